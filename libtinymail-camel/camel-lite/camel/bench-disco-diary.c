@@ -0,0 +1,138 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* Times reading and coalescing a disconnected operation log.
+
+   bench-disco-diary [ACTIONS [FOLDERS [SEED]]]
+
+   Writes the log of a made-up offline session of ACTIONS user actions
+   (20000 by default) in the diary's format, then reads it back and
+   coalesces it the way camel_lite_disco_diary_replay() does before it
+   goes to the server. The session moves messages out of INBOX to FOLDERS other folders,
+   mostly in runs to the same one, deletes some, appends to Sent and
+   keeps saving a draft over the previous one. */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* built with the diary itself, for its log reading and coalescing,
+   which are static. No store is involved. */
+#include "camel-disco-diary.c"
+
+#define BENCH_RTT 0.1	/* seconds a command takes to come back */
+
+static void
+log_uids (FILE *out, const char *uid)
+{
+	camel_lite_file_util_encode_uint32 (out, 1);
+	camel_lite_file_util_encode_string (out, uid);
+}
+
+static void
+log_expunge (FILE *out, const char *folder, const char *uid)
+{
+	camel_lite_file_util_encode_uint32 (out, CAMEL_DISCO_DIARY_FOLDER_EXPUNGE);
+	camel_lite_file_util_encode_string (out, folder);
+	log_uids (out, uid);
+}
+
+static void
+log_append (FILE *out, const char *folder, const char *uid)
+{
+	camel_lite_file_util_encode_uint32 (out, CAMEL_DISCO_DIARY_FOLDER_APPEND);
+	camel_lite_file_util_encode_string (out, folder);
+	camel_lite_file_util_encode_string (out, uid);
+}
+
+static void
+log_transfer (FILE *out, const char *source, const char *dest, const char *uid)
+{
+	camel_lite_file_util_encode_uint32 (out, CAMEL_DISCO_DIARY_FOLDER_TRANSFER);
+	camel_lite_file_util_encode_string (out, source);
+	camel_lite_file_util_encode_string (out, dest);
+	log_uids (out, uid);
+	camel_lite_file_util_encode_uint32 (out, TRUE);
+}
+
+static void
+write_session (FILE *out, int actions, int folders, guint32 seed)
+{
+	GRand *rand = g_rand_new_with_seed (seed);
+	char dest[32], uid[32], draft[32];
+	int i, inbox = 100000, drafts = 0, sent = 0, r;
+
+	dest[0] = draft[0] = '\0';
+
+	for (i = 0; i < actions; i++) {
+		r = g_rand_int_range (rand, 0, 100);
+		if (r < 40) {
+			/* moved to a folder, likely the same as the last move */
+			if (!dest[0] || g_rand_int_range (rand, 0, 100) < 30)
+				sprintf (dest, "Folder %d", g_rand_int_range (rand, 0, folders));
+			sprintf (uid, "%d", inbox--);
+			log_transfer (out, "INBOX", dest, uid);
+		} else if (r < 65) {
+			sprintf (uid, "%d", inbox--);
+			log_expunge (out, "INBOX", uid);
+		} else if (r < 85) {
+			/* a draft saved again replaces the last one */
+			sprintf (uid, "draft-%d", drafts++);
+			log_append (out, "Drafts", uid);
+			if (draft[0])
+				log_expunge (out, "Drafts", draft);
+			strcpy (draft, uid);
+		} else {
+			sprintf (uid, "sent-%d", sent++);
+			log_append (out, "Sent", uid);
+		}
+	}
+
+	camel_lite_file_util_encode_uint32 (out, CAMEL_DISCO_DIARY_END);
+	fflush (out);
+
+	g_rand_free (rand);
+}
+
+int
+main (int argc, char *argv[])
+{
+	int actions = argc > 1 ? atoi (argv[1]) : 20000;
+	int folders = argc > 2 ? MAX (atoi (argv[2]), 1) : 10;
+	guint32 seed = argc > 3 ? atoi (argv[3]) : 1;
+	CamelDiscoDiary diary;
+	GTimer *timer;
+	GPtrArray *ops;
+	double read, coalesce;
+	int i, left;
+	long size;
+
+	memset (&diary, 0, sizeof (diary));
+	if (!(diary.file = tmpfile ())) {
+		perror ("tmpfile");
+		return 1;
+	}
+
+	write_session (diary.file, actions, folders, seed);
+	size = ftell (diary.file);
+
+	timer = g_timer_new ();
+	ops = diary_read_ops (&diary);
+	read = g_timer_elapsed (timer, NULL);
+
+	g_timer_start (timer);
+	left = diary_coalesce (ops);
+	coalesce = g_timer_elapsed (timer, NULL);
+
+	printf ("%ld bytes, %u logged operations, read in %.3fs\n",
+		size, ops->len, read);
+	printf ("%d operations left after coalescing, in %.3fs\n", left, coalesce);
+	printf ("at %.0f ms a command, replay waits %.1fs instead of %.1fs\n",
+		BENCH_RTT * 1000, left * BENCH_RTT, ops->len * BENCH_RTT);
+
+	for (i = 0; i < ops->len; i++)
+		diary_op_free (ops->pdata[i]);
+	g_ptr_array_free (ops, TRUE);
+
+	g_timer_destroy (timer);
+	fclose (diary.file);
+
+	return 0;
+}
@@ -27,12 +27,14 @@
 
 #define __USE_LARGEFILE 1
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <glib/gi18n-lib.h>
 
+#include "camel-debug.h"
 #include "camel-disco-diary.h"
 #include "camel-disco-folder.h"
 #include "camel-disco-store.h"
@@ -44,6 +46,7 @@
 #include "camel-store.h"
 
 #define d(x)
+#define dd(x) (camel_lite_debug("diary")?(x):0)
 
 static void
 camel_lite_disco_diary_class_init (CamelDiscoDiaryClass *camel_lite_disco_diary_class)
@@ -241,13 +244,10 @@ diary_decode_uids (CamelDiscoDiary *diary)
 }
 
 static CamelFolder *
-diary_decode_folder (CamelDiscoDiary *diary)
+diary_get_folder (CamelDiscoDiary *diary, const char *name)
 {
 	CamelFolder *folder;
-	char *name;
 
-	if (camel_lite_file_util_decode_string (diary->file, &name) == -1)
-		return NULL;
 	folder = g_hash_table_lookup (diary->folders, name);
 	if (!folder) {
 		CamelException ex;
@@ -257,7 +257,7 @@ diary_decode_folder (CamelDiscoDiary *diary)
 		folder = camel_lite_store_get_folder (CAMEL_STORE (diary->store),
 						 name, 0, &ex);
 		if (folder)
-			g_hash_table_insert (diary->folders, name, folder);
+			g_hash_table_insert (diary->folders, g_strdup (name), folder);
 		else {
 			msg = g_strdup_printf (_("Could not open `%s':\n%s\nChanges made to this folder will not be resynchronized."),
 					       name, camel_lite_exception_get_description (&ex));
@@ -266,10 +266,8 @@ diary_decode_folder (CamelDiscoDiary *diary)
 						  CAMEL_SESSION_ALERT_WARNING,
 						  msg, FALSE, CAMEL_SERVICE (diary->store));
 			g_free (msg);
-			g_free (name);
 		}
-	} else
-		g_free (name);
+	}
 	return folder;
 }
 
@@ -281,127 +279,310 @@ close_folder (gpointer name, gpointer folder, gpointer data)
 	camel_lite_object_unref (folder);
 }
 
-void
-camel_lite_disco_diary_replay (CamelDiscoDiary *diary, CamelException *ex)
+/* an entry of the log, read back for replaying */
+struct _diary_op {
+	CamelDiscoDiaryAction action;
+	gboolean dropped;
+
+	char *folder;		/* folder, or source of a transfer */
+	char *dest;		/* destination of a transfer */
+	char *uid;		/* appended uid */
+	GPtrArray *uids;	/* expunged or transferred uids */
+	guint32 delete_originals;
+};
+
+static void
+diary_op_free (struct _diary_op *op)
 {
-	guint32 action;
-	off_t size;
+	g_free (op->folder);
+	g_free (op->dest);
+	g_free (op->uid);
+	if (op->uids)
+		free_uids (op->uids);
+	g_free (op);
+}
 
-	d(printf("disco diary replay\n"));
+static struct _diary_op *
+diary_decode_op (CamelDiscoDiary *diary, guint32 action)
+{
+	struct _diary_op *op = g_malloc0 (sizeof (*op));
+
+	op->action = action;
+
+	if (camel_lite_file_util_decode_string (diary->file, &op->folder) == -1)
+		goto lose;
+
+	switch (action) {
+	case CAMEL_DISCO_DIARY_FOLDER_EXPUNGE:
+		if (!(op->uids = diary_decode_uids (diary)))
+			goto lose;
+		break;
+	case CAMEL_DISCO_DIARY_FOLDER_APPEND:
+		if (camel_lite_file_util_decode_string (diary->file, &op->uid) == -1)
+			goto lose;
+		break;
+	case CAMEL_DISCO_DIARY_FOLDER_TRANSFER:
+		if (camel_lite_file_util_decode_string (diary->file, &op->dest) == -1)
+			goto lose;
+		if (!(op->uids = diary_decode_uids (diary)))
+			goto lose;
+		if (camel_lite_file_util_decode_uint32 (diary->file, &op->delete_originals) == -1)
+			goto lose;
+		break;
+	default:
+		goto lose;
+	}
+
+	return op;
+
+ lose:
+	diary_op_free (op);
+	return NULL;
+}
+
+/* Read the whole log, up to the first entry that can't be decoded */
+static GPtrArray *
+diary_read_ops (CamelDiscoDiary *diary)
+{
+	GPtrArray *ops = g_ptr_array_new ();
+	struct _diary_op *op;
+	guint32 action;
 
-	fseek (diary->file, 0, SEEK_END);
-	size = ftell (diary->file);
-	if (size == 0)
-		return;
 	rewind (diary->file);
+	while (camel_lite_file_util_decode_uint32 (diary->file, &action) != -1
+	       && action != CAMEL_DISCO_DIARY_END
+	       && (op = diary_decode_op (diary, action)))
+		g_ptr_array_add (ops, op);
 
-	camel_lite_operation_start (NULL, _("Resynchronizing with server"));
-	while (!camel_lite_exception_is_set (ex)) {
-		camel_lite_operation_progress (NULL, ftell (diary->file) , size);
+	return ops;
+}
 
-		if (camel_lite_file_util_decode_uint32 (diary->file, &action) == -1)
-			break;
-		if (action == CAMEL_DISCO_DIARY_END)
-			break;
+static void
+diary_last_op_set (GHashTable *last, const char *folder, int index)
+{
+	g_hash_table_insert (last, (char *) folder, GINT_TO_POINTER (index + 1));
+}
 
-		switch (action) {
-		case CAMEL_DISCO_DIARY_FOLDER_EXPUNGE:
-		{
-			CamelFolder *folder;
-			GPtrArray *uids;
+static int
+diary_last_op_get (GHashTable *last, const char *folder)
+{
+	return GPOINTER_TO_INT (g_hash_table_lookup (last, folder)) - 1;
+}
+
+/* After a long time offline the log holds a lot of redundant work.
+ * Merge the expunges of a folder and the transfers between the same
+ * two folders when nothing else happened to those folders in between,
+ * so that they go to the server as one command over a uid set.  Drop
+ * appends of messages that were expunged again before reconnecting,
+ * unless a transfer copied them somewhere first.
+ *
+ * Returns the number of operations that are left. */
+static int
+diary_coalesce (GPtrArray *ops)
+{
+	GHashTable *last, *appends;
+	struct _diary_op *op, *prev;
+	int i, j, k, left = 0;
+	char *key;
 
-			folder = diary_decode_folder (diary);
-			uids = diary_decode_uids (diary);
-			if (!uids)
-				goto lose;
+	last = g_hash_table_new (g_str_hash, g_str_equal);		/* folder name -> last op touching it */
+	appends = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);	/* folder\nuid -> append op */
 
-			if (folder)
-				camel_lite_disco_folder_expunge_uids (folder, uids, ex);
-			free_uids (uids);
-			break;
-		}
+	for (i = 0; i < ops->len; i++) {
+		op = ops->pdata[i];
 
+		switch (op->action) {
 		case CAMEL_DISCO_DIARY_FOLDER_APPEND:
-		{
-			CamelFolder *folder;
-			char *uid, *ret_uid = NULL;
-			CamelMimeMessage *message;
-			CamelMessageInfo *info;
-
-			folder = diary_decode_folder (diary);
-			if (camel_lite_file_util_decode_string (diary->file, &uid) == -1)
-				goto lose;
-
-			if (!folder) {
-				g_free (uid);
-				continue;
-			}
+			g_hash_table_insert (appends, g_strconcat (op->folder, "\n", op->uid, NULL), op);
+			diary_last_op_set (last, op->folder, i);
+			break;
 
-			/* TNY TODO Partial message retrieval exception */
-			message = camel_lite_folder_get_message (folder, uid, CAMEL_FOLDER_RECEIVE_FULL, -1, NULL);
-			if (!message) {
-				/* The message was appended and then deleted. */
-				g_free (uid);
-				continue;
+		case CAMEL_DISCO_DIARY_FOLDER_EXPUNGE:
+			for (j = 0; j < op->uids->len; ) {
+				key = g_strconcat (op->folder, "\n", op->uids->pdata[j], NULL);
+				prev = g_hash_table_lookup (appends, key);
+				if (prev)
+					g_hash_table_remove (appends, key);
+				g_free (key);
+
+				if (prev) {
+					/* never needs to reach the server at all */
+					prev->dropped = TRUE;
+					g_free (op->uids->pdata[j]);
+					g_ptr_array_remove_index_fast (op->uids, j);
+				} else
+					j++;
 			}
-			info = camel_lite_folder_get_message_info (folder, uid);
-
-			camel_lite_folder_append_message (folder, message, info, &ret_uid, ex);
-			camel_lite_folder_free_message_info (folder, info);
 
-			if (ret_uid) {
-				camel_lite_disco_diary_uidmap_add (diary, uid, ret_uid);
-				g_free (ret_uid);
+			k = diary_last_op_get (last, op->folder);
+			prev = k >= 0 ? ops->pdata[k] : NULL;
+			if (prev && prev->action == CAMEL_DISCO_DIARY_FOLDER_EXPUNGE && !prev->dropped) {
+				for (j = 0; j < op->uids->len; j++)
+					g_ptr_array_add (prev->uids, op->uids->pdata[j]);
+				g_ptr_array_set_size (op->uids, 0);
 			}
-			g_free (uid);
 
+			if (op->uids->len == 0)
+				op->dropped = TRUE;
+			else
+				diary_last_op_set (last, op->folder, i);
 			break;
-		}
 
 		case CAMEL_DISCO_DIARY_FOLDER_TRANSFER:
-		{
-			CamelFolder *source, *destination;
-			GPtrArray *uids = NULL, *ret_uids = NULL;
-			guint32 delete_originals;
-			int i;
-
-			source = diary_decode_folder (diary);
-			destination = diary_decode_folder (diary);
-			uids = diary_decode_uids (diary);
-
-			if (!uids)
-				goto lose;
-
-			if (camel_lite_file_util_decode_uint32 (diary->file, &delete_originals) == -1) {
-				free_uids (uids);
-				goto lose;
+			/* the copies still need what was appended */
+			for (j = 0; j < op->uids->len; j++) {
+				key = g_strconcat (op->folder, "\n", op->uids->pdata[j], NULL);
+				g_hash_table_remove (appends, key);
+				g_free (key);
 			}
 
-			if (!source || !destination) {
-				free_uids (uids);
-				uids = NULL;
-				continue;
+			k = diary_last_op_get (last, op->folder);
+			prev = k >= 0 ? ops->pdata[k] : NULL;
+			if (prev && k == diary_last_op_get (last, op->dest)
+			    && prev->action == CAMEL_DISCO_DIARY_FOLDER_TRANSFER
+			    && prev->delete_originals == op->delete_originals
+			    && !strcmp (prev->folder, op->folder)
+			    && !strcmp (prev->dest, op->dest)) {
+				for (j = 0; j < op->uids->len; j++)
+					g_ptr_array_add (prev->uids, op->uids->pdata[j]);
+				g_ptr_array_set_size (op->uids, 0);
+				op->dropped = TRUE;
+			} else {
+				diary_last_op_set (last, op->folder, i);
+				diary_last_op_set (last, op->dest, i);
 			}
+			break;
 
-			camel_lite_folder_transfer_messages_to (source, uids, destination, &ret_uids, delete_originals, ex);
+		default:
+			break;
+		}
+	}
 
-			if (ret_uids) {
-				for (i = 0; i < uids->len; i++) {
-					if (!ret_uids->pdata[i])
-						continue;
-					camel_lite_disco_diary_uidmap_add (diary, uids->pdata[i], ret_uids->pdata[i]);
-					g_free (ret_uids->pdata[i]);
-				}
-				g_ptr_array_free (ret_uids, TRUE);
-			}
-			free_uids (uids);
+	g_hash_table_destroy (appends);
+	g_hash_table_destroy (last);
+
+	for (i = 0; i < ops->len; i++)
+		if (!((struct _diary_op *) ops->pdata[i])->dropped)
+			left++;
+
+	return left;
+}
+
+static void
+diary_replay_op (CamelDiscoDiary *diary, struct _diary_op *op, CamelException *ex)
+{
+	switch (op->action) {
+	case CAMEL_DISCO_DIARY_FOLDER_EXPUNGE:
+	{
+		CamelFolder *folder;
+
+		folder = diary_get_folder (diary, op->folder);
+		if (folder)
+			camel_lite_disco_folder_expunge_uids (folder, op->uids, ex);
+		break;
+	}
+
+	case CAMEL_DISCO_DIARY_FOLDER_APPEND:
+	{
+		CamelFolder *folder;
+		char *ret_uid = NULL;
+		CamelMimeMessage *message;
+		CamelMessageInfo *info;
+
+		folder = diary_get_folder (diary, op->folder);
+		if (!folder)
+			break;
+
+		/* TNY TODO Partial message retrieval exception */
+		message = camel_lite_folder_get_message (folder, op->uid, CAMEL_FOLDER_RECEIVE_FULL, -1, NULL);
+		if (!message) {
+			/* The message was appended and then deleted. */
 			break;
 		}
+		info = camel_lite_folder_get_message_info (folder, op->uid);
 
+		camel_lite_folder_append_message (folder, message, info, &ret_uid, ex);
+		camel_lite_folder_free_message_info (folder, info);
+		camel_lite_object_unref (message);
+
+		if (ret_uid) {
+			camel_lite_disco_diary_uidmap_add (diary, op->uid, ret_uid);
+			g_free (ret_uid);
 		}
+		break;
 	}
 
- lose:
+	case CAMEL_DISCO_DIARY_FOLDER_TRANSFER:
+	{
+		CamelFolder *source, *destination;
+		GPtrArray *ret_uids = NULL;
+		int i;
+
+		source = diary_get_folder (diary, op->folder);
+		destination = diary_get_folder (diary, op->dest);
+		if (!source || !destination)
+			break;
+
+		camel_lite_folder_transfer_messages_to (source, op->uids, destination, &ret_uids, op->delete_originals, ex);
+
+		if (ret_uids) {
+			for (i = 0; i < op->uids->len; i++) {
+				if (!ret_uids->pdata[i])
+					continue;
+				camel_lite_disco_diary_uidmap_add (diary, op->uids->pdata[i], ret_uids->pdata[i]);
+				g_free (ret_uids->pdata[i]);
+			}
+			g_ptr_array_free (ret_uids, TRUE);
+		}
+		break;
+	}
+
+	default:
+		break;
+	}
+}
+
+void
+camel_lite_disco_diary_replay (CamelDiscoDiary *diary, CamelException *ex)
+{
+	struct _diary_op *op;
+	GPtrArray *ops;
+	GTimer *timer;
+	int i, done, left;
+	off_t size;
+
+	d(printf("disco diary replay\n"));
+
+	fseek (diary->file, 0, SEEK_END);
+	size = ftell (diary->file);
+	if (size == 0)
+		return;
+
+	camel_lite_operation_start (NULL, _("Resynchronizing with server"));
+
+	timer = g_timer_new ();
+	ops = diary_read_ops (diary);
+	left = diary_coalesce (ops);
+
+	dd(printf("diary replay: %ld bytes, %d operations, %d left after coalescing, read in %.3fs\n",
+		  (long) size, ops->len, left, g_timer_elapsed (timer, NULL)));
+
+	for (i = 0, done = 0; i < ops->len && !camel_lite_exception_is_set (ex); i++) {
+		op = ops->pdata[i];
+		if (op->dropped)
+			continue;
+
+		camel_lite_operation_progress (NULL, done++, left);
+		diary_replay_op (diary, op, ex);
+	}
+
+	dd(printf("diary replay: %d operations replayed in %.3fs\n", done, g_timer_elapsed (timer, NULL)));
+	g_timer_destroy (timer);
+
+	for (i = 0; i < ops->len; i++)
+		diary_op_free (ops->pdata[i]);
+	g_ptr_array_free (ops, TRUE);
+
 	camel_lite_operation_end (NULL);
 
 	/* Close folders */
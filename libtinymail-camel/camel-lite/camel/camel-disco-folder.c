@@ -150,7 +150,7 @@ cdf_folder_changed(CamelFolder *folder, CamelFolderChangeInfo *changes, void *du
 		camel_lite_folder_change_info_cat(m->changes, changes);
 		m->folder = folder;
 		camel_lite_object_ref(folder);
-		camel_lite_session_thread_queue(session, &m->msg, 0);
+		camel_lite_session_thread_queue_keyed(session, &m->msg, folder, CAMEL_SESSION_THREAD_PRIORITY_LOW);
 	}
 }
 
@@ -76,6 +76,20 @@ struct _filter_rule {
 	char *name;
 };
 
+/* batched transfers to one folder */
+struct _batch_dest {
+	CamelFolder *folder;
+	GPtrArray *copy;	/* uids to copy to folder */
+	GPtrArray *move;	/* uids to move to folder */
+};
+
+/* batched flag changes of one kind */
+struct _batch_flags {
+	guint32 flags;
+	guint32 set;
+	GPtrArray *uids;
+};
+
 struct _CamelFilterDriverPrivate {
 	GHashTable *globals;       /* global variables */
 
@@ -124,6 +138,15 @@ struct _CamelFilterDriverPrivate {
 
 	/* evaluator */
 	ESExp *eval;
+
+	/* batched actions, see camel_lite_filter_driver_set_batch() */
+	gboolean batch;
+	CamelFolder *batch_source;  /* folder the batched uids are in, frozen */
+	GPtrArray *batch_dests;     /* struct _batch_dest */
+	GPtrArray *batch_flags;     /* struct _batch_flags */
+	GPtrArray *batch_deleted;   /* uids to mark deleted once transferred */
+	gboolean batch_transferred; /* the current message has batched transfers */
+	GHashTable *batch_failed;   /* uids whose transfer failed, for filter_folder */
 };
 
 #define _PRIVATE(o) (((CamelFilterDriver *)(o))->priv)
@@ -137,6 +160,8 @@ static void camel_lite_filter_driver_log (CamelFilterDriver *driver, enum filter
 static CamelFolder *open_folder (CamelFilterDriver *d, const char *folder_url);
 static int close_folders (CamelFilterDriver *d);
 
+static int batch_flush (CamelFilterDriver *driver, CamelException *ex);
+
 static ESExpResult *do_delete (struct _ESExp *f, int argc, struct _ESExpResult **argv, CamelFilterDriver *);
 static ESExpResult *mark_forward (struct _ESExp *f, int argc, struct _ESExpResult **argv, CamelFilterDriver *);
 static ESExpResult *do_copy (struct _ESExp *f, int argc, struct _ESExpResult **argv, CamelFilterDriver *);
@@ -249,6 +274,9 @@ camel_lite_filter_driver_finalise (CamelObject *obj)
 	struct _CamelFilterDriverPrivate *p = _PRIVATE (driver);
 	struct _filter_rule *node;
 
+	/* anything still batched goes to folders that are about to close */
+	batch_flush (driver, NULL);
+
 	/* close all folders that were opened for appending */
 	close_folders (driver);
 	g_hash_table_destroy (p->folders);
@@ -352,6 +380,9 @@ camel_lite_filter_driver_set_default_folder (CamelFilterDriver *d, CamelFolder *
 {
 	struct _CamelFilterDriverPrivate *p = _PRIVATE (d);
 
+	/* batched copies may still be waiting for the old one */
+	batch_flush (d, NULL);
+
 	if (p->defaultfolder) {
 		camel_lite_folder_thaw (p->defaultfolder);
 		camel_lite_object_unref (p->defaultfolder);
@@ -365,6 +396,36 @@ camel_lite_filter_driver_set_default_folder (CamelFilterDriver *d, CamelFolder *
 	}
 }
 
+/**
+ * camel_lite_filter_driver_set_batch:
+ * @d: a #CamelFilterDriver
+ * @batch: whether actions should be batched
+ *
+ * In batch mode the copy, move, flag and delete actions on messages
+ * which are filtered by uid out of a folder with a summary aren't
+ * carried out straight away.  They are collected per destination
+ * folder and applied by camel_lite_filter_driver_flush(), one transfer
+ * per destination instead of one per message.  Flag changes a message
+ * gets before its transfers are applied ahead of all the transfers,
+ * one that comes after a transfer of the same message flushes the
+ * batch first, so copies see the flags they would have seen when
+ * filtered one by one.  Messages are marked deleted after the
+ * transfers, and not at all if their transfer failed.
+ *
+ * camel_lite_filter_driver_filter_folder() flushes by itself.  Turning
+ * batch mode off applies whatever is still pending.
+ **/
+void
+camel_lite_filter_driver_set_batch (CamelFilterDriver *d, gboolean batch)
+{
+	struct _CamelFilterDriverPrivate *p = _PRIVATE (d);
+
+	if (!batch)
+		batch_flush (d, NULL);
+
+	p->batch = batch;
+}
+
 void
 camel_lite_filter_driver_add_rule(CamelFilterDriver *d, const char *name, const char *match, const char *action)
 {
@@ -436,6 +497,235 @@ camel_lite_filter_driver_set_global (CamelFilterDriver *d, const char *name, con
 }
 #endif
 
+/* whether the actions on the current message can wait for the flush */
+static gboolean
+batch_applies (struct _CamelFilterDriverPrivate *p)
+{
+	return p->batch && !p->modified && p->uid && p->source
+		&& camel_lite_folder_has_summary_capability (p->source);
+}
+
+/* batches are per source folder, a message from another one flushes
+   what was collected so far */
+static void
+batch_begin (CamelFilterDriver *driver)
+{
+	struct _CamelFilterDriverPrivate *p = _PRIVATE (driver);
+
+	if (p->batch_source == p->source)
+		return;
+
+	batch_flush (driver, p->ex);
+
+	p->batch_source = p->source;
+	camel_lite_object_ref (p->batch_source);
+	camel_lite_folder_freeze (p->batch_source);
+
+	p->batch_dests = g_ptr_array_new ();
+	p->batch_flags = g_ptr_array_new ();
+	p->batch_deleted = g_ptr_array_new ();
+}
+
+static void
+batch_transfer (CamelFilterDriver *driver, CamelFolder *folder, gboolean move)
+{
+	struct _CamelFilterDriverPrivate *p = _PRIVATE (driver);
+	struct _batch_dest *dest = NULL;
+	int i;
+
+	batch_begin (driver);
+
+	/* rules only ever name a handful of folders */
+	for (i = 0; i < p->batch_dests->len; i++) {
+		dest = p->batch_dests->pdata[i];
+		if (dest->folder == folder)
+			break;
+	}
+
+	if (i == p->batch_dests->len) {
+		dest = g_malloc (sizeof (*dest));
+		dest->folder = folder;
+		camel_lite_object_ref (folder);
+		dest->copy = g_ptr_array_new ();
+		dest->move = g_ptr_array_new ();
+		g_ptr_array_add (p->batch_dests, dest);
+	}
+
+	g_ptr_array_add (move ? dest->move : dest->copy, g_strdup (p->uid));
+	p->batch_transferred = TRUE;
+}
+
+static void
+batch_set_flags (CamelFilterDriver *driver, guint32 flags, guint32 set)
+{
+	struct _CamelFilterDriverPrivate *p = _PRIVATE (driver);
+	struct _batch_flags *change = NULL;
+	int i;
+
+	/* batched flags are applied before the transfers, a copy made
+	   earlier in this message's actions mustn't get them */
+	if (p->batch_transferred)
+		batch_flush (driver, p->ex);
+
+	batch_begin (driver);
+
+	for (i = 0; i < p->batch_flags->len; i++) {
+		change = p->batch_flags->pdata[i];
+		if (change->flags == flags && change->set == set)
+			break;
+	}
+
+	if (i == p->batch_flags->len) {
+		change = g_malloc (sizeof (*change));
+		change->flags = flags;
+		change->set = set;
+		change->uids = g_ptr_array_new ();
+		g_ptr_array_add (p->batch_flags, change);
+	}
+
+	g_ptr_array_add (change->uids, g_strdup (p->uid));
+}
+
+static void
+batch_delete (CamelFilterDriver *driver, const char *uid)
+{
+	struct _CamelFilterDriverPrivate *p = _PRIVATE (driver);
+
+	batch_begin (driver);
+	g_ptr_array_add (p->batch_deleted, g_strdup (uid));
+}
+
+static void
+batch_free_uids (GPtrArray *uids)
+{
+	int i;
+
+	for (i = 0; i < uids->len; i++)
+		g_free (uids->pdata[i]);
+	g_ptr_array_free (uids, TRUE);
+}
+
+static void
+batch_set_flags_on (CamelFolder *source, GPtrArray *uids, guint32 flags, guint32 set)
+{
+	int i;
+
+	for (i = 0; i < uids->len; i++)
+		camel_lite_folder_set_message_flags (source, uids->pdata[i], flags, set);
+}
+
+/* uids from a failed transfer, none of the later actions touch them */
+static void
+batch_mark_failed (struct _CamelFilterDriverPrivate *p, GHashTable *failed, GPtrArray *uids)
+{
+	int i;
+
+	for (i = 0; i < uids->len; i++) {
+		g_hash_table_insert (failed, uids->pdata[i], uids->pdata[i]);
+		if (p->batch_failed && !g_hash_table_lookup (p->batch_failed, uids->pdata[i]))
+			g_hash_table_insert (p->batch_failed, g_strdup (uids->pdata[i]), GINT_TO_POINTER (1));
+	}
+}
+
+static void
+batch_remove_failed (GHashTable *failed, GPtrArray *uids)
+{
+	int i;
+
+	for (i = 0; i < uids->len; ) {
+		if (g_hash_table_lookup (failed, uids->pdata[i])) {
+			g_free (uids->pdata[i]);
+			g_ptr_array_remove_index (uids, i);
+		} else
+			i++;
+	}
+}
+
+/* Apply the batched actions, the first error ends up in ex.  A message
+   whose transfer failed is neither moved nor marked deleted afterwards,
+   it stays where it was as it would have when filtered on its own.
+   Returns -1 if any transfer failed. */
+static int
+batch_flush (CamelFilterDriver *driver, CamelException *ex)
+{
+	struct _CamelFilterDriverPrivate *p = _PRIVATE (driver);
+	CamelFolder *source = p->batch_source;
+	struct _batch_flags *change;
+	struct _batch_dest *dest;
+	GHashTable *failed;
+	CamelException lex;
+	int i, pass, status = 0;
+
+	if (source == NULL)
+		return 0;
+
+	p->batch_source = NULL;
+	p->batch_transferred = FALSE;
+
+	report_status (driver, CAMEL_FILTER_STATUS_PROGRESS, 100, _("Applying filter actions"));
+
+	camel_lite_exception_init (&lex);
+	failed = g_hash_table_new (g_str_hash, g_str_equal);
+
+	/* no message has a flag action after one of its transfers in
+	   the same batch, see batch_set_flags() */
+	for (i = 0; i < p->batch_flags->len; i++) {
+		change = p->batch_flags->pdata[i];
+		batch_set_flags_on (source, change->uids, change->flags, change->set);
+		batch_free_uids (change->uids);
+		g_free (change);
+	}
+	g_ptr_array_free (p->batch_flags, TRUE);
+	p->batch_flags = NULL;
+
+	/* all the copies first, a move can delete the originals */
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < p->batch_dests->len; i++) {
+			GPtrArray *uids;
+
+			dest = p->batch_dests->pdata[i];
+			uids = pass ? dest->move : dest->copy;
+			if (pass)
+				batch_remove_failed (failed, uids);
+			if (uids->len == 0)
+				continue;
+
+			d(printf ("%s %d messages in one go\n", pass ? "moving" : "copying", uids->len));
+			camel_lite_folder_transfer_messages_to (source, uids, dest->folder, NULL, pass, &lex);
+			if (camel_lite_exception_is_set (&lex)) {
+				batch_mark_failed (p, failed, uids);
+				status = -1;
+				if (ex && !camel_lite_exception_is_set (ex))
+					camel_lite_exception_xfer (ex, &lex);
+				else
+					camel_lite_exception_clear (&lex);
+			}
+		}
+	}
+
+	batch_remove_failed (failed, p->batch_deleted);
+	batch_set_flags_on (source, p->batch_deleted, CAMEL_MESSAGE_DELETED|CAMEL_MESSAGE_SEEN, ~0);
+	batch_free_uids (p->batch_deleted);
+	p->batch_deleted = NULL;
+
+	/* the failed table points into these */
+	g_hash_table_destroy (failed);
+	for (i = 0; i < p->batch_dests->len; i++) {
+		dest = p->batch_dests->pdata[i];
+		batch_free_uids (dest->copy);
+		batch_free_uids (dest->move);
+		camel_lite_object_unref (dest->folder);
+		g_free (dest);
+	}
+	g_ptr_array_free (p->batch_dests, TRUE);
+	p->batch_dests = NULL;
+
+	camel_lite_folder_thaw (source);
+	camel_lite_object_unref (source);
+
+	return status;
+}
+
 static ESExpResult *
 do_delete (struct _ESExp *f, int argc, struct _ESExpResult **argv, CamelFilterDriver *driver)
 {
@@ -481,7 +771,9 @@ do_copy (struct _ESExp *f, int argc, struct _ESExpResult **argv, CamelFilterDriv
 			if (outbox == p->source)
 				break;
 
-			if (!p->modified && p->uid && p->source && camel_lite_folder_has_summary_capability (p->source)) {
+			if (batch_applies (p)) {
+				batch_transfer (driver, outbox, FALSE);
+			} else if (!p->modified && p->uid && p->source && camel_lite_folder_has_summary_capability (p->source)) {
 				GPtrArray *uids;
 
 				uids = g_ptr_array_new ();
@@ -535,7 +827,9 @@ do_move (struct _ESExp *f, int argc, struct _ESExpResult **argv, CamelFilterDriv
 			/* only delete on last folder (only 1 can ever be supplied by ui currently) */
 			last = (i == argc-1);
 
-			if (!p->modified && p->uid && p->source && camel_lite_folder_has_summary_capability (p->source)) {
+			if (batch_applies (p)) {
+				batch_transfer (driver, outbox, last);
+			} else if (!p->modified && p->uid && p->source && camel_lite_folder_has_summary_capability (p->source)) {
 				GPtrArray *uids;
 
 				uids = g_ptr_array_new ();
@@ -668,7 +962,9 @@ set_flag (struct _ESExp *f, int argc, struct _ESExpResult **argv, CamelFilterDri
 	d(fprintf (stderr, "setting flag\n"));
 	if (argc == 1 && argv[0]->type == ESEXP_RES_STRING) {
 		flags = camel_lite_system_flag (argv[0]->value.string);
-		if (p->source && p->uid && camel_lite_folder_has_summary_capability (p->source))
+		if (batch_applies (p))
+			batch_set_flags (driver, flags, ~0);
+		else if (p->source && p->uid && camel_lite_folder_has_summary_capability (p->source))
 			camel_lite_folder_set_message_flags (p->source, p->uid, flags, ~0);
 		else
 			camel_lite_message_info_set_flags(p->info, flags | CAMEL_MESSAGE_FOLDER_FLAGGED, ~0);
@@ -687,7 +983,9 @@ unset_flag (struct _ESExp *f, int argc, struct _ESExpResult **argv, CamelFilterD
 	d(fprintf (stderr, "unsetting flag\n"));
 	if (argc == 1 && argv[0]->type == ESEXP_RES_STRING) {
 		flags = camel_lite_system_flag (argv[0]->value.string);
-		if (p->source && p->uid && camel_lite_folder_has_summary_capability (p->source))
+		if (batch_applies (p))
+			batch_set_flags (driver, flags, 0);
+		else if (p->source && p->uid && camel_lite_folder_has_summary_capability (p->source))
 			camel_lite_folder_set_message_flags (p->source, p->uid, flags, 0);
 		else
 			camel_lite_message_info_set_flags(p->info, flags | CAMEL_MESSAGE_FOLDER_FLAGGED, 0);
@@ -1132,7 +1430,8 @@ run_only_once (gpointer key, char *action, struct _run_only_once *data)
  * @driver:
  * @ex:
  *
- * Flush all of the only-once filter actions.
+ * Flush all of the only-once filter actions, and apply the actions
+ * collected in batch mode.
  **/
 void
 camel_lite_filter_driver_flush (CamelFilterDriver *driver, CamelException *ex)
@@ -1140,6 +1439,8 @@ camel_lite_filter_driver_flush (CamelFilterDriver *driver, CamelException *ex)
 	struct _CamelFilterDriverPrivate *p = _PRIVATE (driver);
 	struct _run_only_once data;
 
+	batch_flush (driver, ex);
+
 	if (!p->only_once)
 		return;
 
@@ -1279,7 +1580,7 @@ camel_lite_filter_driver_filter_folder (CamelFilterDriver *driver, CamelFolder *
 	char *source_url, *service_url;
 	int status = 0;
 	CamelURL *url;
-	int i;
+	int i, j;
 
 	service_url = camel_lite_service_get_url (CAMEL_SERVICE (camel_lite_folder_get_parent_store (folder)));
 	url = camel_lite_url_new (service_url, NULL);
@@ -1293,6 +1594,10 @@ camel_lite_filter_driver_filter_folder (CamelFilterDriver *driver, CamelFolder *
 		freeuids = TRUE;
 	}
 
+	/* remember the failed transfers of all the flushes to come */
+	if (p->batch)
+		p->batch_failed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
 	for (i = 0; i < uids->len; i++) {
 		int pc = (100 * i)/uids->len;
 
@@ -1317,14 +1622,32 @@ camel_lite_filter_driver_filter_folder (CamelFilterDriver *driver, CamelFolder *
 			break;
 		}
 
-		if (remove)
-			camel_lite_folder_set_message_flags (folder, uids->pdata[i],
-							CAMEL_MESSAGE_DELETED | CAMEL_MESSAGE_SEEN, ~0);
+		if (remove) {
+			if (p->batch && p->batch_source == folder)
+				batch_delete (driver, uids->pdata[i]);
+			else
+				camel_lite_folder_set_message_flags (folder, uids->pdata[i],
+								CAMEL_MESSAGE_DELETED | CAMEL_MESSAGE_SEEN, ~0);
+		}
 
-		if (cache)
+		/* a batched message is only done once its actions are */
+		if (cache && !p->batch_failed)
 			camel_lite_uid_cache_save_uid (cache, uids->pdata[i]);
 	}
 
+	if (p->batch_failed) {
+		if (batch_flush (driver, ex) == -1)
+			status = -1;
+
+		for (j = 0; cache && j < i; j++) {
+			if (!g_hash_table_lookup (p->batch_failed, uids->pdata[j]))
+				camel_lite_uid_cache_save_uid (cache, uids->pdata[j]);
+		}
+
+		g_hash_table_destroy (p->batch_failed);
+		p->batch_failed = NULL;
+	}
+
 	if (p->defaultfolder) {
 		report_status (driver, CAMEL_FILTER_STATUS_PROGRESS, 100, _("Syncing folder"));
 		camel_lite_folder_sync (p->defaultfolder, FALSE, camel_lite_exception_is_set (ex) ? NULL : ex);
@@ -1448,6 +1771,7 @@ camel_lite_filter_driver_filter_message (CamelFilterDriver *driver, CamelMimeMes
 	p->deleted = FALSE;
 	p->copied = FALSE;
 	p->moved = FALSE;
+	p->batch_transferred = FALSE;
 	p->message = message;
 	p->info = info;
 	p->uid = uid;
@@ -1507,7 +1831,9 @@ camel_lite_filter_driver_filter_message (CamelFilterDriver *driver, CamelMimeMes
 
 	/* *Now* we can set the DELETED flag... */
 	if (p->deleted) {
-		if (p->source && p->uid && camel_lite_folder_has_summary_capability (p->source))
+		if (batch_applies (p))
+			batch_delete (driver, p->uid);
+		else if (p->source && p->uid && camel_lite_folder_has_summary_capability (p->source))
 			camel_lite_folder_set_message_flags(p->source, p->uid, CAMEL_MESSAGE_DELETED|CAMEL_MESSAGE_SEEN, ~0);
 		else
 			camel_lite_message_info_set_flags(info, CAMEL_MESSAGE_DELETED|CAMEL_MESSAGE_SEEN|CAMEL_MESSAGE_FOLDER_FLAGGED, ~0);
@@ -1524,7 +1850,9 @@ camel_lite_filter_driver_filter_message (CamelFilterDriver *driver, CamelMimeMes
 			       camel_lite_message_info_subject(info)?camel_lite_message_info_subject(info):"?no subject?",
 			       p->modified?"modified message":"");
 
-		if (!p->modified && p->uid && p->source && camel_lite_folder_has_summary_capability (p->source)) {
+		if (batch_applies (p)) {
+			batch_transfer (driver, p->defaultfolder, FALSE);
+		} else if (!p->modified && p->uid && p->source && camel_lite_folder_has_summary_capability (p->source)) {
 			GPtrArray *uids;
 
 			uids = g_ptr_array_new ();
@@ -80,6 +80,7 @@ void camel_lite_filter_driver_set_system_beep_func (CamelFilterDriver *d, CamelF
 void camel_lite_filter_driver_set_folder_func      (CamelFilterDriver *d, CamelFilterGetFolderFunc fetcher, void *data);
 
 void camel_lite_filter_driver_set_default_folder   (CamelFilterDriver *d, CamelFolder *def);
+void camel_lite_filter_driver_set_batch            (CamelFilterDriver *d, gboolean batch);
 
 void camel_lite_filter_driver_add_rule             (CamelFilterDriver *d, const char *name, const char *match,
 					       const char *action);
@@ -34,6 +34,7 @@
 #include <regex.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <glib.h>
 #include <glib/gi18n-lib.h>
@@ -46,16 +47,24 @@
 #include "camel-medium.h"
 #include "camel-mime-message.h"
 #include "camel-multipart.h"
+#include "camel-operation.h"
 #include "camel-search-private.h"
 #include "camel-stream-mem.h"
 
 #define d(x)
 #define r(x)
 
+/* most threads a single match-all is spread over */
+#define CAMEL_FOLDER_SEARCH_MAX_WORKERS (8)
+/* fewest messages worth handing to another thread */
+#define CAMEL_FOLDER_SEARCH_SLICE_MIN (4096)
+
 struct _CamelFolderSearchPrivate {
 	GHashTable *mempool_hash;
 	CamelException *ex;
 
+	int workers;
+
 	CamelFolderThread *threads;
 	GHashTable *threads_hash;
 };
@@ -283,6 +292,21 @@ camel_lite_folder_search_set_folder(CamelFolderSearch *search, CamelFolder *fold
 	search->folder = folder;
 }
 
+/**
+ * camel_lite_folder_search_set_workers:
+ * @search:
+ * @workers: number of threads, or 0 for one per processor
+ *
+ * Set how many threads a match-all over a large summary may be
+ * spread over.  Only expressions which can be compiled are run in
+ * parallel, the rest are always evaluated on the calling thread.
+ **/
+void
+camel_lite_folder_search_set_workers(CamelFolderSearch *search, int workers)
+{
+	_PRIVATE(search)->workers = MIN(workers, CAMEL_FOLDER_SEARCH_MAX_WORKERS);
+}
+
 /**
  * camel_lite_folder_search_set_summary:
  * @search:
@@ -655,6 +679,766 @@ search_not(struct _ESExp *f, int argc, struct _ESExpResult **argv, CamelFolderSe
 	return r;
 }
 
+/* Compiled match-all evaluation.
+
+   The common match-all expressions (flag, date, size, uid and simple
+   header tests glued together with and/or/not) are compiled into a
+   small predicate tree which is run over the whole summary at once,
+   a bitmap of candidates at a time, rather than walking the term tree
+   once per message.  Flag, date and size tests are mask and range
+   compares over a flat copy of those summary fields, and string tests
+   only look at the messages still in question.  Anything the compiler
+   doesn't understand, or a subclass overriding one of the methods
+   involved, falls back to the interpreter. */
+
+enum _search_op {
+	SEARCH_OP_TRUE,
+	SEARCH_OP_FALSE,
+	SEARCH_OP_AND,
+	SEARCH_OP_OR,
+	SEARCH_OP_NOT,
+	SEARCH_OP_FLAG,
+	SEARCH_OP_RANGE,
+	SEARCH_OP_UID,
+	SEARCH_OP_USER_FLAG,
+	SEARCH_OP_HEADER,
+};
+
+enum _search_column {
+	SEARCH_COLUMN_FLAGS,
+	SEARCH_COLUMN_SENT,
+	SEARCH_COLUMN_RECEIVED,
+	SEARCH_COLUMN_SIZE,
+	SEARCH_COLUMN_LAST
+};
+
+enum _search_header {
+	SEARCH_HEADER_SUBJECT,
+	SEARCH_HEADER_FROM,
+	SEARCH_HEADER_TO,
+	SEARCH_HEADER_CC,
+};
+
+struct _search_node {
+	enum _search_op op;
+	int cost;		/* rough per-message cost, cheap tests run first */
+
+	GPtrArray *kids;	/* and, or, not */
+
+	guint32 mask;		/* flag */
+
+	int column;		/* range, lo <= column <= hi */
+	gint64 lo, hi;
+
+	enum _search_header header;	/* header */
+	camel_lite_search_match_t how;
+	camel_lite_search_t type;
+	GPtrArray *words;	/* header-contains, split words of each argument */
+
+	GPtrArray *strings;	/* other header tests and user-flag names, borrowed from the terms */
+	GHashTable *uids;	/* uid, borrowed from the terms */
+};
+
+struct _search_prog {
+	CamelFolderSearch *search;
+	CamelFolderSearchClass *klass;
+
+	GPtrArray *nodes;	/* every node, for freeing */
+	struct _search_node *root;
+	guint columns_used;
+
+	CamelOperation *cc;
+	volatile int cancelled;
+};
+
+/* A run of the summary evaluated by one thread, on its own copy of
+   the columns and bitmaps */
+struct _search_slice {
+	struct _search_prog *prog;
+
+	CamelMessageInfo **infos;
+	guint count, nwords;
+	gint32 *columns[SEARCH_COLUMN_LAST];
+	guint32 *matches;
+
+	struct _search_job *job;
+};
+
+/* Completion of the slices handed to the worker pool */
+struct _search_job {
+	GMutex *lock;
+	GCond *cond;
+	int pending;
+};
+
+#define SEARCH_BITS_SIZE(s) ((s)->nwords * sizeof(guint32))
+
+static struct _search_node *
+search_node_new(struct _search_prog *p, enum _search_op op, int cost)
+{
+	struct _search_node *node = g_malloc0(sizeof(*node));
+
+	node->op = op;
+	node->cost = cost;
+	g_ptr_array_add(p->nodes, node);
+
+	return node;
+}
+
+static void
+search_node_free(struct _search_node *node)
+{
+	int i;
+
+	if (node->kids)
+		g_ptr_array_free(node->kids, TRUE);
+	if (node->words) {
+		for (i=0;i<node->words->len;i++)
+			camel_lite_search_words_free(node->words->pdata[i]);
+		g_ptr_array_free(node->words, TRUE);
+	}
+	if (node->strings)
+		g_ptr_array_free(node->strings, TRUE);
+	if (node->uids)
+		g_hash_table_destroy(node->uids);
+	g_free(node);
+}
+
+static int
+search_node_cmp(const void *ap, const void *bp)
+{
+	const struct _search_node *a = *((struct _search_node **)ap);
+	const struct _search_node *b = *((struct _search_node **)bp);
+
+	return a->cost - b->cost;
+}
+
+static gboolean
+search_term_is(ESExpTerm *t, const char *name)
+{
+	return (t->type == ESEXP_TERM_FUNC || t->type == ESEXP_TERM_IFUNC)
+		&& !strcmp(t->value.func.sym->name, name);
+}
+
+/* only compile calls which will land in our own implementation */
+static gboolean
+search_term_is_func(ESExpTerm *t, const char *name, ESExpFunc *func)
+{
+	return t->type == ESEXP_TERM_FUNC
+		&& !strcmp(t->value.func.sym->name, name)
+		&& t->value.func.sym->f.func == func;
+}
+
+static gboolean
+search_terms_are_strings(ESExpTerm **terms, int count)
+{
+	int i;
+
+	for (i=0;i<count;i++)
+		if (terms[i]->type != ESEXP_TERM_STRING)
+			return FALSE;
+
+	return TRUE;
+}
+
+/* an integer constant, or one of the summary columns; column is -1 for a constant */
+static gboolean
+search_compile_value(struct _search_prog *p, ESExpTerm *t, int *column, gint64 *value)
+{
+	ESExpTerm **terms = t->value.func.terms;
+	int i, count, sub;
+	gint64 v;
+
+	*column = -1;
+
+	if (t->type == ESEXP_TERM_INT) {
+		*value = t->value.number;
+		return TRUE;
+	}
+
+	if (t->type != ESEXP_TERM_FUNC)
+		return FALSE;
+
+	count = t->value.func.termcount;
+	if (count == 0) {
+		if (search_term_is_func(t, "get-sent-date", (ESExpFunc *)search_get_sent_date)) {
+			*column = SEARCH_COLUMN_SENT;
+			return TRUE;
+		} else if (search_term_is_func(t, "get-received-date", (ESExpFunc *)search_get_received_date)) {
+			*column = SEARCH_COLUMN_RECEIVED;
+			return TRUE;
+		} else if (search_term_is_func(t, "get-size", (ESExpFunc *)search_get_size)) {
+			*column = SEARCH_COLUMN_SIZE;
+			return TRUE;
+		} else if (search_term_is_func(t, "get-current-date", (ESExpFunc *)search_get_current_date)) {
+			/* evaluated once per search, not once per message */
+			*value = (int)time(NULL);
+			return TRUE;
+		}
+		return FALSE;
+	}
+
+	/* constant arithmetic, e.g. (- (get-current-date) 86400) */
+	sub = search_term_is(t, "-");
+	if (!sub && !search_term_is(t, "+"))
+		return FALSE;
+
+	*value = 0;
+	for (i=0;i<count;i++) {
+		if (!search_compile_value(p, terms[i], column, &v) || *column != -1) {
+			*column = -1;
+			return FALSE;
+		}
+		if (i == 0 || !sub)
+			*value = (int)(*value + v);
+		else
+			*value = (int)(*value - v);
+	}
+
+	return TRUE;
+}
+
+static struct _search_node *
+search_compile_compare(struct _search_prog *p, ESExpTerm *t, int op)
+{
+	struct _search_node *node;
+	int lcol, rcol, tmp;
+	gint64 lval, rval;
+
+	if (t->value.func.termcount != 2
+	    || !search_compile_value(p, t->value.func.terms[0], &lcol, &lval)
+	    || !search_compile_value(p, t->value.func.terms[1], &rcol, &rval))
+		return NULL;
+
+	if (lcol == -1 && rcol == -1) {
+		gboolean truth = op == '<' ? lval < rval : op == '>' ? lval > rval : lval == rval;
+
+		return search_node_new(p, truth ? SEARCH_OP_TRUE : SEARCH_OP_FALSE, 0);
+	}
+
+	if (lcol != -1 && rcol != -1)
+		return NULL;
+
+	/* always column <op> constant */
+	if (lcol == -1) {
+		tmp = rcol; rcol = lcol; lcol = tmp;
+		rval = lval;
+		if (op == '<')
+			op = '>';
+		else if (op == '>')
+			op = '<';
+	}
+
+	node = search_node_new(p, SEARCH_OP_RANGE, 1);
+	node->column = lcol;
+	node->lo = G_MININT64;
+	node->hi = G_MAXINT64;
+	if (op == '<')
+		node->hi = rval - 1;
+	else if (op == '>')
+		node->lo = rval + 1;
+	else
+		node->lo = node->hi = rval;
+	p->columns_used |= 1 << lcol;
+
+	return node;
+}
+
+static struct _search_node *
+search_compile_header(struct _search_prog *p, ESExpTerm *t, camel_lite_search_match_t how)
+{
+	ESExpTerm **terms = t->value.func.terms;
+	int i, count = t->value.func.termcount;
+	struct _search_node *node;
+	const char *name;
+
+	if (count < 2 || !search_terms_are_strings(terms, count))
+		return NULL;
+
+	/* an empty word matches everything */
+	for (i=1;i<count;i++)
+		if (terms[i]->value.string[0] == 0)
+			return search_node_new(p, SEARCH_OP_TRUE, 0);
+
+	node = search_node_new(p, SEARCH_OP_HEADER, 4);
+	node->how = how;
+	node->type = CAMEL_SEARCH_TYPE_ADDRESS;
+
+	name = terms[0]->value.string;
+	if (!g_ascii_strcasecmp(name, "subject")) {
+		node->header = SEARCH_HEADER_SUBJECT;
+		node->type = CAMEL_SEARCH_TYPE_ASIS;
+	} else if (!g_ascii_strcasecmp(name, "from")) {
+		node->header = SEARCH_HEADER_FROM;
+	} else if (!g_ascii_strcasecmp(name, "to")) {
+		node->header = SEARCH_HEADER_TO;
+	} else if (!g_ascii_strcasecmp(name, "cc")) {
+		node->header = SEARCH_HEADER_CC;
+	} else {
+		/* let the interpreter deal with the rest, and report unknown headers */
+		return NULL;
+	}
+
+	if (how == CAMEL_SEARCH_MATCH_CONTAINS) {
+		node->words = g_ptr_array_new();
+		for (i=1;i<count;i++)
+			g_ptr_array_add(node->words, camel_lite_search_words_split((const unsigned char *)terms[i]->value.string));
+	} else {
+		node->strings = g_ptr_array_new();
+		for (i=1;i<count;i++)
+			g_ptr_array_add(node->strings, terms[i]->value.string);
+	}
+
+	return node;
+}
+
+static struct _search_node *
+search_compile_term(struct _search_prog *p, ESExpTerm *t)
+{
+	CamelFolderSearchClass *klass = p->klass;
+	ESExpTerm **terms = t->value.func.terms;
+	int i, count;
+	struct _search_node *node, *kid;
+	guint32 mask;
+
+	if (t->type == ESEXP_TERM_BOOL)
+		return search_node_new(p, t->value.bool ? SEARCH_OP_TRUE : SEARCH_OP_FALSE, 0);
+
+	if (t->type != ESEXP_TERM_FUNC && t->type != ESEXP_TERM_IFUNC)
+		return NULL;
+
+	count = t->value.func.termcount;
+
+	if ((search_term_is(t, "and") && klass->and == NULL)
+	    || (search_term_is(t, "or") && klass->or == NULL)) {
+		if (count == 0)
+			return NULL;
+
+		node = search_node_new(p, search_term_is(t, "and") ? SEARCH_OP_AND : SEARCH_OP_OR, 0);
+		node->kids = g_ptr_array_new();
+		for (i=0;i<count;i++) {
+			if ((kid = search_compile_term(p, terms[i])) == NULL)
+				return NULL;
+			g_ptr_array_add(node->kids, kid);
+			node->cost = MAX(node->cost, kid->cost);
+		}
+		g_ptr_array_sort(node->kids, search_node_cmp);
+
+		return node;
+	} else if (search_term_is_func(t, "not", (ESExpFunc *)search_not)) {
+		if (count != 1 || (kid = search_compile_term(p, terms[0])) == NULL)
+			return NULL;
+
+		node = search_node_new(p, SEARCH_OP_NOT, kid->cost);
+		node->kids = g_ptr_array_new();
+		g_ptr_array_add(node->kids, kid);
+
+		return node;
+	} else if (search_term_is(t, "<") && klass->lt == NULL) {
+		return search_compile_compare(p, t, '<');
+	} else if (search_term_is(t, ">") && klass->gt == NULL) {
+		return search_compile_compare(p, t, '>');
+	} else if (search_term_is(t, "=") && klass->eq == NULL) {
+		return search_compile_compare(p, t, '=');
+	} else if (search_term_is_func(t, "system-flag", (ESExpFunc *)search_system_flag)) {
+		if (count != 1 || terms[0]->type != ESEXP_TERM_STRING)
+			return NULL;
+
+		mask = camel_lite_system_flag(terms[0]->value.string);
+		if (mask == 0)
+			return search_node_new(p, SEARCH_OP_FALSE, 0);
+
+		node = search_node_new(p, SEARCH_OP_FLAG, 1);
+		node->mask = mask;
+		p->columns_used |= 1 << SEARCH_COLUMN_FLAGS;
+
+		return node;
+	} else if (search_term_is_func(t, "user-flag", (ESExpFunc *)search_user_flag)) {
+		if (!search_terms_are_strings(terms, count))
+			return NULL;
+
+		node = search_node_new(p, SEARCH_OP_USER_FLAG, 3);
+		node->strings = g_ptr_array_new();
+		for (i=0;i<count;i++)
+			g_ptr_array_add(node->strings, terms[i]->value.string);
+
+		return node;
+	} else if (search_term_is_func(t, "uid", (ESExpFunc *)search_uid)) {
+		if (!search_terms_are_strings(terms, count))
+			return NULL;
+
+		node = search_node_new(p, SEARCH_OP_UID, 2);
+		node->uids = g_hash_table_new(g_str_hash, g_str_equal);
+		for (i=0;i<count;i++)
+			g_hash_table_insert(node->uids, terms[i]->value.string, terms[i]->value.string);
+
+		return node;
+	} else if (search_term_is_func(t, "header-contains", (ESExpFunc *)search_header_contains)) {
+		return search_compile_header(p, t, CAMEL_SEARCH_MATCH_CONTAINS);
+	} else if (search_term_is_func(t, "header-matches", (ESExpFunc *)search_header_matches)) {
+		return search_compile_header(p, t, CAMEL_SEARCH_MATCH_EXACT);
+	} else if (search_term_is_func(t, "header-starts-with", (ESExpFunc *)search_header_starts_with)) {
+		return search_compile_header(p, t, CAMEL_SEARCH_MATCH_STARTS);
+	} else if (search_term_is_func(t, "header-ends-with", (ESExpFunc *)search_header_ends_with)) {
+		return search_compile_header(p, t, CAMEL_SEARCH_MATCH_ENDS);
+	}
+
+	return NULL;
+}
+
+static gboolean
+search_bits_empty(struct _search_slice *s, const guint32 *bits)
+{
+	int w;
+
+	for (w=0;w<s->nwords;w++)
+		if (bits[w])
+			return FALSE;
+
+	return TRUE;
+}
+
+static gboolean
+search_node_match(struct _search_node *node, CamelMessageInfo *mi)
+{
+	const char *header = NULL;
+	struct _camel_lite_search_words *words;
+	int i, j, truth = FALSE;
+
+	switch (node->op) {
+	case SEARCH_OP_UID:
+		return g_hash_table_lookup(node->uids, camel_lite_message_info_uid(mi)) != NULL;
+	case SEARCH_OP_USER_FLAG:
+		for (i=0;i<node->strings->len;i++)
+			if (camel_lite_message_info_user_flag(mi, node->strings->pdata[i]))
+				return TRUE;
+		return FALSE;
+	case SEARCH_OP_HEADER:
+		switch (node->header) {
+		case SEARCH_HEADER_SUBJECT:
+			header = camel_lite_message_info_subject(mi);
+			break;
+		case SEARCH_HEADER_FROM:
+			header = camel_lite_message_info_from(mi);
+			break;
+		case SEARCH_HEADER_TO:
+			header = camel_lite_message_info_to(mi);
+			break;
+		case SEARCH_HEADER_CC:
+			header = camel_lite_message_info_cc(mi);
+			break;
+		}
+		if (header == NULL)
+			header = "";
+
+		/* same as check_header, an OR of the arguments */
+		if (node->words) {
+			for (i=0;i<node->words->len && !truth;i++) {
+				words = node->words->pdata[i];
+				truth = TRUE;
+				for (j=0;j<words->len && truth;j++)
+					truth = camel_lite_search_header_match(header, words->words[j]->word, node->how, node->type, NULL);
+			}
+		} else {
+			for (i=0;i<node->strings->len && !truth;i++)
+				truth = camel_lite_search_header_match(header, node->strings->pdata[i], node->how, node->type, NULL);
+		}
+		return truth;
+	default:
+		g_assert_not_reached();
+		return FALSE;
+	}
+}
+
+static gboolean
+search_slice_cancelled(struct _search_slice *s)
+{
+	struct _search_prog *p = s->prog;
+
+	if (!g_atomic_int_get(&p->cancelled)
+	    && p->cc != NULL
+	    && camel_lite_operation_cancel_check(p->cc))
+		g_atomic_int_set(&p->cancelled, TRUE);
+
+	return g_atomic_int_get(&p->cancelled);
+}
+
+/* sets in out the messages of cand which match node */
+static void
+search_node_eval(struct _search_slice *s, struct _search_node *node, const guint32 *cand, guint32 *out)
+{
+	guint32 *rest, *tmp, bits;
+	const gint32 *col;
+	gint64 lo, hi;
+	guint32 mask;
+	int i, w, b, last;
+
+	switch (node->op) {
+	case SEARCH_OP_TRUE:
+		memcpy(out, cand, SEARCH_BITS_SIZE(s));
+		break;
+	case SEARCH_OP_FALSE:
+		memset(out, 0, SEARCH_BITS_SIZE(s));
+		break;
+	case SEARCH_OP_AND:
+		/* each test only looks at what the cheaper ones before it left */
+		rest = g_malloc(SEARCH_BITS_SIZE(s));
+		memcpy(out, cand, SEARCH_BITS_SIZE(s));
+		for (i=0;i<node->kids->len && !search_bits_empty(s, out) && !search_slice_cancelled(s);i++) {
+			memcpy(rest, out, SEARCH_BITS_SIZE(s));
+			search_node_eval(s, node->kids->pdata[i], rest, out);
+		}
+		g_free(rest);
+		break;
+	case SEARCH_OP_OR:
+		/* and only at what hasn't matched yet */
+		rest = g_malloc(SEARCH_BITS_SIZE(s));
+		tmp = g_malloc(SEARCH_BITS_SIZE(s));
+		memcpy(rest, cand, SEARCH_BITS_SIZE(s));
+		memset(out, 0, SEARCH_BITS_SIZE(s));
+		for (i=0;i<node->kids->len && !search_bits_empty(s, rest) && !search_slice_cancelled(s);i++) {
+			search_node_eval(s, node->kids->pdata[i], rest, tmp);
+			for (w=0;w<s->nwords;w++) {
+				out[w] |= tmp[w];
+				rest[w] &= ~tmp[w];
+			}
+		}
+		g_free(tmp);
+		g_free(rest);
+		break;
+	case SEARCH_OP_NOT:
+		tmp = g_malloc(SEARCH_BITS_SIZE(s));
+		search_node_eval(s, node->kids->pdata[0], cand, tmp);
+		for (w=0;w<s->nwords;w++)
+			out[w] = cand[w] & ~tmp[w];
+		g_free(tmp);
+		break;
+	case SEARCH_OP_FLAG:
+		col = s->columns[SEARCH_COLUMN_FLAGS];
+		mask = node->mask;
+		for (w=0;w<s->nwords;w++) {
+			bits = 0;
+			if (cand[w]) {
+				last = MIN(32, s->count - w*32);
+				for (b=0;b<last;b++)
+					bits |= (guint32)((((guint32)col[w*32+b]) & mask) != 0) << b;
+			}
+			out[w] = bits & cand[w];
+		}
+		break;
+	case SEARCH_OP_RANGE:
+		col = s->columns[node->column];
+		lo = node->lo;
+		hi = node->hi;
+		for (w=0;w<s->nwords;w++) {
+			bits = 0;
+			if (cand[w]) {
+				last = MIN(32, s->count - w*32);
+				for (b=0;b<last;b++)
+					bits |= (guint32)((col[w*32+b] >= lo) & (col[w*32+b] <= hi)) << b;
+			}
+			out[w] = bits & cand[w];
+		}
+		break;
+	default:
+		/* string tests, only on the remaining candidates */
+		for (w=0;w<s->nwords;w++) {
+			bits = cand[w];
+			out[w] = 0;
+			if (bits && (w % 32) == 0 && search_slice_cancelled(s))
+				bits = 0;
+			while (bits) {
+				b = g_bit_nth_lsf(bits, -1);
+				bits &= ~(1U << b);
+				if (search_node_match(node, s->infos[w*32+b]))
+					out[w] |= 1U << b;
+			}
+		}
+		break;
+	}
+}
+
+static void
+search_prog_free(struct _search_prog *p)
+{
+	int i;
+
+	for (i=0;i<p->nodes->len;i++)
+		search_node_free(p->nodes->pdata[i]);
+	g_ptr_array_free(p->nodes, TRUE);
+	if (p->cc)
+		camel_lite_operation_unref(p->cc);
+	g_free(p);
+}
+
+static void
+search_slice_run(struct _search_slice *s)
+{
+	struct _search_prog *p = s->prog;
+	CamelMessageInfo *mi;
+	guint32 *cand;
+	int i;
+
+	/* flat copies of the fields the range and flag tests use */
+	for (i=0;i<SEARCH_COLUMN_LAST;i++)
+		if (p->columns_used & (1 << i))
+			s->columns[i] = g_malloc(s->count * sizeof(gint32));
+
+	for (i=0;i<s->count;i++) {
+		mi = s->infos[i];
+		if (s->columns[SEARCH_COLUMN_FLAGS])
+			s->columns[SEARCH_COLUMN_FLAGS][i] = camel_lite_message_info_flags(mi);
+		/* same truncation as the get-*-date and get-size results */
+		if (s->columns[SEARCH_COLUMN_SENT])
+			s->columns[SEARCH_COLUMN_SENT][i] = (int)camel_lite_message_info_date_sent(mi);
+		if (s->columns[SEARCH_COLUMN_RECEIVED])
+			s->columns[SEARCH_COLUMN_RECEIVED][i] = (int)camel_lite_message_info_date_received(mi);
+		if (s->columns[SEARCH_COLUMN_SIZE])
+			s->columns[SEARCH_COLUMN_SIZE][i] = camel_lite_message_info_size(mi) / 1024;
+	}
+
+	cand = g_malloc(SEARCH_BITS_SIZE(s));
+	memset(cand, 0xff, SEARCH_BITS_SIZE(s));
+	if (s->count % 32)
+		cand[s->nwords-1] = (1U << (s->count % 32)) - 1;
+
+	search_node_eval(s, p->root, cand, s->matches);
+
+	g_free(cand);
+	for (i=0;i<SEARCH_COLUMN_LAST;i++) {
+		g_free(s->columns[i]);
+		s->columns[i] = NULL;
+	}
+}
+
+static void
+search_slice_thread(void *data, void *user_data)
+{
+	struct _search_slice *s = data;
+
+	search_slice_run(s);
+
+	g_mutex_lock(s->job->lock);
+	if (--s->job->pending == 0)
+		g_cond_broadcast(s->job->cond);
+	g_mutex_unlock(s->job->lock);
+}
+
+static GStaticMutex search_pool_lock = G_STATIC_MUTEX_INIT;
+static GThreadPool *search_pool;
+
+static GThreadPool *
+search_get_pool(void)
+{
+	g_static_mutex_lock(&search_pool_lock);
+	if (search_pool == NULL)
+		search_pool = g_thread_pool_new(search_slice_thread, NULL, CAMEL_FOLDER_SEARCH_MAX_WORKERS, FALSE, NULL);
+	g_static_mutex_unlock(&search_pool_lock);
+
+	return search_pool;
+}
+
+static int
+search_default_workers(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (n > 0)
+		return MIN(n, CAMEL_FOLDER_SEARCH_MAX_WORKERS);
+#endif
+	return 1;
+}
+
+/* Try to run match-all over summary as a compiled program, returns
+   FALSE if term can't be compiled, in which case nothing was added
+   to matches.  Big summaries are cut into slices of whole bitmap
+   words which run on the worker pool, the results are merged back
+   in summary order. */
+static gboolean
+search_match_compiled(CamelFolderSearch *search, ESExpTerm *term, GPtrArray *summary, GPtrArray *matches)
+{
+	struct _CamelFolderSearchPrivate *priv = _PRIVATE(search);
+	struct _search_prog *p;
+	struct _search_slice *slices, *s;
+	struct _search_job job;
+	GThreadPool *pool;
+	int i, w, b, nslices, workers, nwords, per;
+
+	p = g_malloc0(sizeof(*p));
+	p->search = search;
+	p->klass = (CamelFolderSearchClass *)CAMEL_OBJECT_GET_CLASS(search);
+	p->nodes = g_ptr_array_new();
+
+	p->root = search_compile_term(p, term);
+	if (p->root == NULL) {
+		r(printf("match-all expression not compiled, interpreting\n"));
+		search_prog_free(p);
+		return FALSE;
+	}
+
+	/* the workers check the caller's operation, not their own */
+	p->cc = camel_lite_operation_registered();
+
+	workers = priv->workers > 0 ? priv->workers : search_default_workers();
+	nslices = MAX(1, MIN(workers, summary->len / CAMEL_FOLDER_SEARCH_SLICE_MIN));
+	nwords = (summary->len + 31) / 32;
+	per = (nwords + nslices - 1) / nslices;
+	nslices = per ? (nwords + per - 1) / per : 1;
+
+	slices = g_malloc0(nslices * sizeof(*slices));
+	for (i=0;i<nslices;i++) {
+		s = &slices[i];
+		s->prog = p;
+		s->job = &job;
+		s->infos = (CamelMessageInfo **)summary->pdata + i * per * 32;
+		s->count = MIN(per * 32, summary->len - i * per * 32);
+		s->nwords = (s->count + 31) / 32;
+		s->matches = g_malloc0(SEARCH_BITS_SIZE(s));
+	}
+
+	d(printf("match-all over %d messages in %d slices\n", summary->len, nslices));
+
+	if (nslices > 1) {
+		job.lock = g_mutex_new();
+		job.cond = g_cond_new();
+		job.pending = nslices - 1;
+
+		pool = search_get_pool();
+		for (i=1;i<nslices;i++)
+			g_thread_pool_push(pool, &slices[i], NULL);
+		search_slice_run(&slices[0]);
+
+		g_mutex_lock(job.lock);
+		while (job.pending > 0)
+			g_cond_wait(job.cond, job.lock);
+		g_mutex_unlock(job.lock);
+
+		g_cond_free(job.cond);
+		g_mutex_free(job.lock);
+	} else {
+		search_slice_run(&slices[0]);
+	}
+
+	for (i=0;i<nslices;i++) {
+		s = &slices[i];
+		for (w=0;w<s->nwords && !p->cancelled;w++) {
+			if (s->matches[w] == 0)
+				continue;
+			for (b=0;b<32;b++) {
+				if (s->matches[w] & (1U << b))
+					g_ptr_array_add(matches, (char *)camel_lite_message_info_uid(s->infos[w*32+b]));
+			}
+		}
+		g_free(s->matches);
+	}
+	g_free(slices);
+
+	search_prog_free(p);
+
+	return TRUE;
+}
+
 static ESExpResult *
 search_match_all(struct _ESExp *f, int argc, struct _ESExpTerm **argv, CamelFolderSearch *search)
 {
@@ -702,9 +1486,15 @@ search_match_all(struct _ESExp *f, int argc, struct _ESExpTerm **argv, CamelFold
 	}
 
 	v = search->summary_set?search->summary_set:search->summary;
+	if (argc>0 && search_match_compiled(search, argv[0], v, r->value.ptrarray))
+		goto done;
+
 	for (i=0;i<v->len;i++) {
 		const char *uid;
 
+		if ((i % CAMEL_FOLDER_SEARCH_SLICE_MIN) == 0 && camel_lite_operation_cancel_check(NULL))
+			break;
+
 		search->current = g_ptr_array_index(v, i);
 		uid = camel_lite_message_info_uid(search->current);
 
@@ -725,6 +1515,12 @@ search_match_all(struct _ESExp *f, int argc, struct _ESExpTerm **argv, CamelFold
 		}
 	}
 	search->current = NULL;
+done:
+	if (camel_lite_operation_cancel_check(NULL)) {
+		e_sexp_result_free(f, r);
+		camel_lite_exception_set(_PRIVATE(search)->ex, CAMEL_EXCEPTION_USER_CANCEL, _("Cancelled"));
+		e_sexp_fatal_error(f, _("Cancelled"));
+	}
 
 	return r;
 }
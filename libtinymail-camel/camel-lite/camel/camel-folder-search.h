@@ -123,6 +123,7 @@ void camel_lite_folder_search_construct (CamelFolderSearch *search);
 void camel_lite_folder_search_set_folder(CamelFolderSearch *search, CamelFolder *folder);
 void camel_lite_folder_search_set_summary(CamelFolderSearch *search, GPtrArray *summary);
 void camel_lite_folder_search_set_body_index(CamelFolderSearch *search, CamelIndex *index);
+void camel_lite_folder_search_set_workers(CamelFolderSearch *search, int workers);
 /* this interface is deprecated */
 GPtrArray *camel_lite_folder_search_execute_expression(CamelFolderSearch *search, const char *expr, CamelException *ex);
 
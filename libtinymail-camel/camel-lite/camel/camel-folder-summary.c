@@ -104,6 +104,183 @@ extern int strdup_count, malloc_count, free_count;
 static GStaticRecMutex global_lock = G_STATIC_REC_MUTEX_INIT;
 static GStaticMutex global_lock2 = G_STATIC_MUTEX_INIT;
 
+/* The subject, from, to and cc of a CamelMessageInfoBase are 32 bit
+   handles rather than pointers.  A string in the mmap'd summary file is
+   referred to by its offset in the file, plus one so that 0 can stay
+   NULL.  Any other string (the pooled strings of messages which arrived
+   after the summary got loaded, and the placeholders used across a
+   reload or after an expunge) gets a slot in a global table, which is
+   marked by the high bit.  Like the pstring pool the table is split into
+   STR_SHARDS parts, each with its own lock, and the low bits of a handle
+   say which part it is in.  The parts grow in chunks which never move,
+   so a slot can be read without taking any lock. */
+
+#define STR_HANDLE_TABLE	(1U << 31)
+#define STR_SHARD_BITS		(4)
+#define STR_SHARDS		(1 << STR_SHARD_BITS)
+#define STR_CHUNK_BITS		(14)
+#define STR_CHUNK_SIZE		(1 << STR_CHUNK_BITS)
+#define STR_MAX_CHUNKS		((STR_HANDLE_TABLE >> STR_SHARD_BITS) >> STR_CHUNK_BITS)
+
+#define STR_HANDLE(shard, idx)	(STR_HANDLE_TABLE | ((idx) << STR_SHARD_BITS) | (shard))
+#define STR_HANDLE_SHARD(h)	((h) & (STR_SHARDS - 1))
+#define STR_HANDLE_INDEX(h)	(((h) & ~STR_HANDLE_TABLE) >> STR_SHARD_BITS)
+
+/* slots of the first shard which are never released */
+#define STR_HANDLE_EXPUNGED	STR_HANDLE (0, 1)
+#define STR_HANDLE_FLUSHED	STR_HANDLE (0, 2)
+#define STR_RESERVED		(3)
+
+struct _str_shard {
+	pthread_mutex_t lock;
+	const char **chunks[STR_MAX_CHUNKS];
+	guint32 next;
+	guint32 used;
+	GArray *free_slots;
+};
+
+static struct _str_shard str_shards[STR_SHARDS];
+static pthread_once_t str_once = PTHREAD_ONCE_INIT;
+
+#define STR_SLOT(shard, idx) ((shard)->chunks[(idx) >> STR_CHUNK_BITS][(idx) & (STR_CHUNK_SIZE - 1)])
+
+/* must be called with the shard's lock held */
+static void
+str_chunk_alloc (struct _str_shard *shard, guint32 idx)
+{
+	if (shard->chunks[idx >> STR_CHUNK_BITS] == NULL)
+		shard->chunks[idx >> STR_CHUNK_BITS] = g_new0 (const char *, STR_CHUNK_SIZE);
+}
+
+static void
+str_init (void)
+{
+	struct _str_shard *shard;
+	int i;
+
+	for (i = 0; i < STR_SHARDS; i++) {
+		shard = &str_shards[i];
+		pthread_mutex_init (&shard->lock, NULL);
+		shard->next = STR_RESERVED;
+		shard->free_slots = g_array_new (FALSE, FALSE, sizeof (guint32));
+	}
+
+	shard = &str_shards[0];
+	str_chunk_alloc (shard, 0);
+	STR_SLOT (shard, STR_HANDLE_INDEX (STR_HANDLE_EXPUNGED)) = "Expunged";
+	STR_SLOT (shard, STR_HANDLE_INDEX (STR_HANDLE_FLUSHED)) = "...";
+}
+
+static guint32
+str_slot_new (const char *str)
+{
+	struct _str_shard *shard;
+	guint32 i, idx;
+
+	pthread_once (&str_once, str_init);
+
+	/* pooled strings are separate allocations, so their addresses
+	   spread the threads over the shards */
+	i = (GPOINTER_TO_UINT (str) >> 4) & (STR_SHARDS - 1);
+	shard = &str_shards[i];
+
+	pthread_mutex_lock (&shard->lock);
+
+	if (shard->free_slots->len > 0) {
+		idx = g_array_index (shard->free_slots, guint32, shard->free_slots->len - 1);
+		g_array_set_size (shard->free_slots, shard->free_slots->len - 1);
+	} else {
+		idx = shard->next++;
+		str_chunk_alloc (shard, idx);
+	}
+	STR_SLOT (shard, idx) = str;
+	shard->used++;
+
+	pthread_mutex_unlock (&shard->lock);
+
+	return STR_HANDLE (i, idx);
+}
+
+static void
+str_slot_release (guint32 handle)
+{
+	struct _str_shard *shard;
+	guint32 idx = STR_HANDLE_INDEX (handle);
+
+	if (!(handle & STR_HANDLE_TABLE) || idx < STR_RESERVED)
+		return;
+
+	shard = &str_shards[STR_HANDLE_SHARD (handle)];
+
+	pthread_mutex_lock (&shard->lock);
+	STR_SLOT (shard, idx) = NULL;
+	if (--shard->used == 0) {
+		guint32 c;
+
+		/* no handle into the shard is left, so nobody can be reading
+		   it either: give back all but the first chunk, which holds
+		   the reserved slots */
+		for (c = 1; c < STR_MAX_CHUNKS && shard->chunks[c]; c++) {
+			g_free (shard->chunks[c]);
+			shard->chunks[c] = NULL;
+		}
+		shard->next = STR_RESERVED;
+		g_array_free (shard->free_slots, TRUE);
+		shard->free_slots = g_array_new (FALSE, FALSE, sizeof (guint32));
+	} else
+		g_array_append_val (shard->free_slots, idx);
+	pthread_mutex_unlock (&shard->lock);
+}
+
+static const char *
+str_get (const CamelMessageInfoBase *mi, guint32 handle)
+{
+	if (handle == 0)
+		return NULL;
+
+	if (handle & STR_HANDLE_TABLE)
+		return STR_SLOT (&str_shards[STR_HANDLE_SHARD (handle)], STR_HANDLE_INDEX (handle));
+
+	if (mi->summary && mi->summary->file)
+		return (const char *) g_mapped_file_get_contents (mi->summary->file) + handle - 1;
+
+	return NULL;
+}
+
+/* @str is either in mi's summary file or owned by the caller, like a
+   pooled string, until the handle is replaced */
+static void
+str_set (CamelMessageInfoBase *mi, guint32 *handle, const char *str)
+{
+	guint32 old = *handle;
+	const char *base;
+
+	if (str == NULL) {
+		*handle = 0;
+	} else if (mi->summary && mi->summary->file
+		   && (base = g_mapped_file_get_contents (mi->summary->file))
+		   && str >= base && (const unsigned char *) str < mi->summary->eof
+		   && str - base < STR_HANDLE_TABLE - 1) {
+		*handle = (guint32) (str - base) + 1;
+	} else
+		*handle = str_slot_new (str);
+
+	str_slot_release (old);
+}
+
+static void
+str_set_reserved (CamelMessageInfoBase *mi, guint32 handle)
+{
+	/* sets up the reserved slots on first use */
+	pthread_once (&str_once, str_init);
+
+	str_slot_release (mi->subject_id);
+	str_slot_release (mi->from_id);
+	str_slot_release (mi->to_id);
+	str_slot_release (mi->cc_id);
+	mi->subject_id = mi->from_id = mi->to_id = mi->cc_id = handle;
+}
+
 /* trivial lists, just because ... */
 struct _node {
 	struct _node *next;
@@ -880,12 +1057,8 @@ perform_content_info_save(CamelFolderSummary *s, FILE *out, CamelMessageContentI
 static void 
 flush_for_reload (CamelFolderSummary *s, CamelMessageInfoBase *mi)
 {
-	if (!(mi->flags & CAMEL_MESSAGE_INFO_NEEDS_FREE)) {
-		mi->subject = "...";
-		mi->to = "...";
-		mi->from = "...";
-		mi->cc = "...";
-	}
+	if (!(mi->flags & CAMEL_MESSAGE_INFO_NEEDS_FREE))
+		str_set_reserved (mi, STR_HANDLE_FLUSHED);
 } 
 
 /**
@@ -1649,10 +1822,7 @@ camel_lite_folder_summary_dispose_all (CamelFolderSummary *s)
 			mi->flags |= CAMEL_MESSAGE_EXPUNGED;
 			mi->flags |= CAMEL_MESSAGE_FREED;
 			destroy_possible_pstring_stuff (s, info, FALSE);
-			mi->subject = "Expunged";
-			mi->to = "Expunged";
-			mi->from = "Expunged";
-			mi->cc = "Expunged";
+			str_set_reserved (mi, STR_HANDLE_EXPUNGED);
 
 			g_ptr_array_add (items, info);
 		}
@@ -1696,10 +1866,7 @@ camel_lite_folder_summary_remove(CamelFolderSummary *s, CamelMessageInfo *info)
 		g_ptr_array_add (s->expunged, info);
 		/* NOTE! XUI */
 		destroy_possible_pstring_stuff (s, info, FALSE);
-		mi->subject = "Expunged";
-		mi->to = "Expunged";
-		mi->from = "Expunged";
-		mi->cc = "Expunged";
+		str_set_reserved (mi, STR_HANDLE_EXPUNGED);
 		s->had_expunges = TRUE;
 		s->flags |= CAMEL_SUMMARY_DIRTY;
 		g_static_rec_mutex_unlock (&global_lock);
@@ -2338,24 +2505,24 @@ message_info_new_from_header(CamelFolderSummary *s, struct _camel_lite_header_ra
 		camel_lite_content_type_unref(ct);
 
 	if (subject)
-		mi->subject = camel_lite_pstring_add (subject, TRUE);
+		str_set (mi, &mi->subject_id, camel_lite_pstring_add (subject, TRUE));
 	else
-		mi->subject = camel_lite_pstring_add (g_strdup (""), TRUE);
+		str_set (mi, &mi->subject_id, camel_lite_pstring_add (g_strdup (""), TRUE));
 
 	if (from)
-		mi->from = camel_lite_pstring_add (from, TRUE);
+		str_set (mi, &mi->from_id, camel_lite_pstring_add (from, TRUE));
 	else
-		mi->from = camel_lite_pstring_add (g_strdup (""), TRUE);
+		str_set (mi, &mi->from_id, camel_lite_pstring_add (g_strdup (""), TRUE));
 
 	if (to)
-		mi->to = camel_lite_pstring_add (to, TRUE);
+		str_set (mi, &mi->to_id, camel_lite_pstring_add (to, TRUE));
 	else
-		mi->to = camel_lite_pstring_add (g_strdup (""), TRUE);
+		str_set (mi, &mi->to_id, camel_lite_pstring_add (g_strdup (""), TRUE));
 
 	if (cc)
-		mi->cc = camel_lite_pstring_add (cc, TRUE);
+		str_set (mi, &mi->cc_id, camel_lite_pstring_add (cc, TRUE));
 	else
-		mi->cc = camel_lite_pstring_add (g_strdup (""), TRUE);
+		str_set (mi, &mi->cc_id, camel_lite_pstring_add (g_strdup (""), TRUE));
 
 	mi->date_sent = camel_lite_header_decode_date(camel_lite_header_raw_find(&h, "date", NULL), NULL);
 	received = camel_lite_header_raw_find(&h, "received", NULL);
@@ -2490,7 +2657,7 @@ message_info_load(CamelFolderSummary *s, gboolean *must_add)
 
 	if (len) {
 		CHECK_MMAP_ACCESS (s->eof, ptrchr, len, mi);
-		mi->subject = (const char*)ptrchr;
+		str_set (mi, &mi->subject_id, (const char*)ptrchr);
 	}
 	ptrchr += len;
 
@@ -2499,7 +2666,7 @@ message_info_load(CamelFolderSummary *s, gboolean *must_add)
 
 	if (len) {
 		CHECK_MMAP_ACCESS (s->eof, ptrchr, len, mi);
-		mi->from = (const char*)ptrchr;
+		str_set (mi, &mi->from_id, (const char*)ptrchr);
 	}
 	ptrchr += len;
 
@@ -2508,7 +2675,7 @@ message_info_load(CamelFolderSummary *s, gboolean *must_add)
 
 	if (len) {
 		CHECK_MMAP_ACCESS (s->eof, ptrchr, len, mi);
-		mi->to = (const char*)ptrchr;
+		str_set (mi, &mi->to_id, (const char*)ptrchr);
 	}
 	ptrchr += len;
 
@@ -2517,7 +2684,7 @@ message_info_load(CamelFolderSummary *s, gboolean *must_add)
 
 	if (len) {
 		CHECK_MMAP_ACCESS (s->eof, ptrchr, len, mi);
-		mi->cc = (const char*)ptrchr;
+		str_set (mi, &mi->cc_id, (const char*)ptrchr);
 	}
 	ptrchr += len;
 
@@ -2712,14 +2879,14 @@ destroy_possible_pstring_stuff(CamelFolderSummary *s, CamelMessageInfo *info, gb
 		if (freeuid && mi->uid)
 			g_free(mi->uid);
 
-		if (mi->subject)
-			camel_lite_pstring_free(mi->subject);
-		if (mi->from)
-			camel_lite_pstring_free(mi->from);
-		if (mi->to)
-			camel_lite_pstring_free(mi->to);
-		if (mi->cc)
-			camel_lite_pstring_free(mi->cc);
+		camel_lite_pstring_free(str_get(mi, mi->subject_id));
+		camel_lite_pstring_free(str_get(mi, mi->from_id));
+		camel_lite_pstring_free(str_get(mi, mi->to_id));
+		camel_lite_pstring_free(str_get(mi, mi->cc_id));
+		str_set(mi, &mi->subject_id, NULL);
+		str_set(mi, &mi->from_id, NULL);
+		str_set(mi, &mi->to_id, NULL);
+		str_set(mi, &mi->cc_id, NULL);
 
 #ifdef NON_TINYMAIL_FEATURES
 		if (mi->mlist)
@@ -2754,6 +2921,13 @@ message_info_free(CamelFolderSummary *s, CamelMessageInfo *info)
 		if (mi->uid)
 			g_free (mi->uid);
 
+	/* strings of infos that never needed freeing can still hold slots,
+	   set with camel_lite_message_info_set_string() */
+	str_set (mi, &mi->subject_id, NULL);
+	str_set (mi, &mi->from_id, NULL);
+	str_set (mi, &mi->to_id, NULL);
+	str_set (mi, &mi->cc_id, NULL);
+
 	/* memset: Trash it, makes debugging more easy */
 
 	if (s) {
@@ -3615,10 +3789,10 @@ message_info_clone(CamelFolderSummary *s, const CamelMessageInfo *mi)
 
 	to->flags |= CAMEL_MESSAGE_INFO_NEEDS_FREE;
 
-	to->subject = camel_lite_pstring_strdup(from->subject);
-	to->from = camel_lite_pstring_strdup(from->from);
-	to->to = camel_lite_pstring_strdup(from->to);
-	to->cc = camel_lite_pstring_strdup(from->cc);
+	str_set(to, &to->subject_id, camel_lite_pstring_strdup(str_get(from, from->subject_id)));
+	str_set(to, &to->from_id, camel_lite_pstring_strdup(str_get(from, from->from_id)));
+	str_set(to, &to->to_id, camel_lite_pstring_strdup(str_get(from, from->to_id)));
+	str_set(to, &to->cc_id, camel_lite_pstring_strdup(str_get(from, from->cc_id)));
 
 #ifdef NON_TINYMAIL_FEATURES
 	to->mlist = camel_lite_pstring_strdup(from->mlist);
@@ -3688,16 +3862,16 @@ info_ptr(const CamelMessageInfo *mi, int id)
 	else switch (id)
 	{
 		case CAMEL_MESSAGE_INFO_SUBJECT:
-			retval = ((const CamelMessageInfoBase *)mi)->subject;
+			retval = str_get ((const CamelMessageInfoBase *)mi, ((const CamelMessageInfoBase *)mi)->subject_id);
 		break;
 		case CAMEL_MESSAGE_INFO_FROM:
-			retval = ((const CamelMessageInfoBase *)mi)->from;
+			retval = str_get ((const CamelMessageInfoBase *)mi, ((const CamelMessageInfoBase *)mi)->from_id);
 		break;
 		case CAMEL_MESSAGE_INFO_TO:
-			retval = ((const CamelMessageInfoBase *)mi)->to;
+			retval = str_get ((const CamelMessageInfoBase *)mi, ((const CamelMessageInfoBase *)mi)->to_id);
 		break;
 		case CAMEL_MESSAGE_INFO_CC:
-			retval = ((const CamelMessageInfoBase *)mi)->cc;
+			retval = str_get ((const CamelMessageInfoBase *)mi, ((const CamelMessageInfoBase *)mi)->cc_id);
 		break;
 		case CAMEL_MESSAGE_INFO_MESSAGE_ID:
 			retval = &((const CamelMessageInfoBase *)mi)->message_id;
@@ -3815,6 +3989,43 @@ camel_lite_message_info_ptr(const CamelMessageInfo *mi, int id)
 	return retval;
 }
 
+/**
+ * camel_lite_message_info_set_string:
+ * @mi: a #CamelMessageInfo with a #CamelMessageInfoBase layout
+ * @id: %CAMEL_MESSAGE_INFO_SUBJECT, %CAMEL_MESSAGE_INFO_FROM, %CAMEL_MESSAGE_INFO_TO or %CAMEL_MESSAGE_INFO_CC
+ * @str: a pooled string or %NULL
+ *
+ * Set one of the string fields of an info which is being filled in.
+ * The previous value isn't freed, @str is released along with @mi if
+ * it has %CAMEL_MESSAGE_INFO_NEEDS_FREE set.
+ **/
+void
+camel_lite_message_info_set_string (CamelMessageInfo *mi, int id, const char *str)
+{
+	CamelMessageInfoBase *base = (CamelMessageInfoBase *) mi;
+
+	g_static_rec_mutex_lock (&global_lock);
+
+	switch (id) {
+	case CAMEL_MESSAGE_INFO_SUBJECT:
+		str_set (base, &base->subject_id, str);
+		break;
+	case CAMEL_MESSAGE_INFO_FROM:
+		str_set (base, &base->from_id, str);
+		break;
+	case CAMEL_MESSAGE_INFO_TO:
+		str_set (base, &base->to_id, str);
+		break;
+	case CAMEL_MESSAGE_INFO_CC:
+		str_set (base, &base->cc_id, str);
+		break;
+	default:
+		g_warning ("%s: invalid id %d", __FUNCTION__, id);
+	}
+
+	g_static_rec_mutex_unlock (&global_lock);
+}
+
 
 /**
  * camel_lite_message_info_uint32:
@@ -162,30 +162,33 @@ struct _CamelMessageInfo {
  * they must subclass or use this messageinfo structure */
 /* Otherwise they can do their own thing entirely */
 
-/*                                          on x86_32 */
+/* The strings are handles which only the summary can resolve, use
+ * camel_lite_message_info_subject() and friends to read them and
+ * camel_lite_message_info_set_string() to set them.
+ *                                          x86_32   LP64 */
 struct _CamelMessageInfoBase {
-	CamelFolderSummary *summary;       /* 4 bytes */
-	guint32 refcount;                  /* 4 bytes */
-	char *uid;                         /* 4 bytes */
-	const char *subject;               /* 4 bytes */
-	const char *from;                  /* 4 bytes */
-	const char *to;                    /* 4 bytes */
-	const char *cc;                    /* 4 bytes */
+	CamelFolderSummary *summary;       /* 4 bytes  8 bytes */
+	guint32 refcount;                  /* 4 bytes  4 bytes (+4 padding) */
+	char *uid;                         /* 4 bytes  8 bytes */
+	guint32 subject_id;                /* 4 bytes  4 bytes */
+	guint32 from_id;                   /* 4 bytes  4 bytes */
+	guint32 to_id;                     /* 4 bytes  4 bytes */
+	guint32 cc_id;                     /* 4 bytes  4 bytes */
 
 	/* tree of content description - NULL if it is not available */
-	CamelMessageContentInfo *content;  /* 4 bytes */
+	CamelMessageContentInfo *content;  /* 4 bytes  8 bytes */
 #ifdef NON_TINYMAIL_FEATURES
 	struct _camel_lite_header_param *headers;
 #endif
-	CamelSummaryMessageID message_id;  /* 8 bytes */
+	CamelSummaryMessageID message_id;  /* 8 bytes  8 bytes */
 
-	guint32 flags;                     /* 4 bytes */
-	guint32 size;                      /* 4 bytes */
+	guint32 flags;                     /* 4 bytes  4 bytes */
+	guint32 size;                      /* 4 bytes  4 bytes */
 
-	time_t date_sent;                  /* 4 bytes */
-	time_t date_received;              /* 4 bytes */
+	time_t date_sent;                  /* 4 bytes  8 bytes */
+	time_t date_received;              /* 4 bytes  8 bytes */
 
-                                          /* 56 bytes */
+                                          /* 56 bytes 80 bytes */
 };
 
 
@@ -396,6 +399,7 @@ time_t camel_lite_message_info_time(const CamelMessageInfo *mi, int id);
 gboolean camel_lite_message_info_user_flag(const CamelMessageInfo *mi, const char *id);
 const char *camel_lite_message_info_user_tag(const CamelMessageInfo *mi, const char *id);
 
+void camel_lite_message_info_set_string(CamelMessageInfo *mi, int id, const char *str);
 gboolean camel_lite_message_info_set_flags(CamelMessageInfo *mi, guint32 mask, guint32 set);
 gboolean camel_lite_message_info_set_user_flag(CamelMessageInfo *mi, const char *id, gboolean state);
 gboolean camel_lite_message_info_set_user_tag(CamelMessageInfo *mi, const char *id, const char *val);
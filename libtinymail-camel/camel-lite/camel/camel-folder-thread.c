@@ -34,14 +34,18 @@
 #include <sys/types.h>
 
 #include <glib.h>
+#include <glib/gstdio.h>
 
 #include <libedataserver/e-lite-memory.h>
 
+#include "camel-file-utils.h"
 #include "camel-folder-thread.h"
 
 #define d(x)
 #define m(x)
 
+#define CAMEL_FOLDER_THREAD_VERSION (2)
+
 /*#define TIMEIT*/
 
 #ifdef TIMEIT
@@ -576,6 +580,33 @@ thread_summary(CamelFolderThread *thread, GPtrArray *summary)
 #endif
 }
 
+static CamelFolderThread *
+thread_new(CamelFolder *folder, gboolean thread_subject)
+{
+	CamelFolderThread *thread;
+
+	thread = g_malloc0(sizeof(*thread));
+	thread->refcount = 1;
+	thread->subject = thread_subject;
+	thread->folder = folder;
+	camel_lite_object_ref((CamelObject *)folder);
+	thread->summary = g_ptr_array_new();
+
+	return thread;
+}
+
+static void
+thread_index_free(CamelFolderThread *thread)
+{
+	if (thread->uids) {
+		g_hash_table_destroy(thread->uids);
+		g_hash_table_destroy(thread->subjects);
+		thread->uids = NULL;
+		thread->subjects = NULL;
+	}
+	thread->tail = NULL;
+}
+
 /**
  * camel_lite_folder_thread_messages_new:
  * @folder:
@@ -604,13 +635,7 @@ camel_lite_folder_thread_messages_new (CamelFolder *folder, GPtrArray *uids, gbo
 	GPtrArray *fsummary;
 	int i;
 
-	thread = g_malloc(sizeof(*thread));
-	thread->refcount = 1;
-	thread->subject = thread_subject;
-	thread->tree = NULL;
-	thread->mem_chain = NULL;
-	thread->folder = folder;
-	camel_lite_object_ref((CamelObject *)folder);
+	thread = thread_new(folder, thread_subject);
 
 	/* get all of the summary items of interest in summary order */
 	if (uids) {
@@ -620,7 +645,7 @@ camel_lite_folder_thread_messages_new (CamelFolder *folder, GPtrArray *uids, gbo
 	}
 
 	fsummary = camel_lite_folder_get_summary(folder);
-	thread->summary = summary = g_ptr_array_new();
+	summary = thread->summary;
 
 	for (i=0;i<fsummary->len;i++) {
 		CamelMessageInfo *info = fsummary->pdata[i];
@@ -685,8 +710,10 @@ camel_lite_folder_thread_messages_apply(CamelFolderThread *thread, GPtrArray *ui
 
 	g_slice_free_chain(CamelFolderThreadNode, thread->mem_chain, mem_chain);
 
+	thread_index_free(thread);
 	thread->tree = NULL;
 	thread->mem_chain = NULL;
+	thread->last_order = 0;
 	thread_summary(thread, all);
 
 	g_ptr_array_free(thread->summary, TRUE);
@@ -721,6 +748,7 @@ camel_lite_folder_thread_messages_unref(CamelFolderThread *thread)
 		g_ptr_array_free(thread->summary, TRUE);
 		camel_lite_object_unref((CamelObject *)thread->folder);
 	}
+	thread_index_free(thread);
 	g_slice_free_chain(CamelFolderThreadNode, thread->mem_chain, mem_chain);
 	g_free(thread);
 }
@@ -760,125 +788,454 @@ camel_lite_folder_thread_messages_new_summary(GPtrArray *summary)
 
 	return thread;
 }
+#endif
+
+/* Incremental updates.  Without references threading comes down to
+   grouping by subject, so a message arriving later can be placed
+   directly: it joins the thread its root subject maps to, or starts a
+   new one.  The lookup tables are only built once a thread gets
+   updated. */
 
-/* scan the list in depth-first fashion */
 static void
-build_summary_rec(GHashTable *have, GPtrArray *summary, CamelFolderThreadNode *node)
+thread_index_rec(CamelFolderThread *thread, CamelFolderThreadNode *node)
 {
+	char *subject;
+
 	while (node) {
-		if (node->message)
-			g_hash_table_insert(have, (char *)camel_lite_message_info_uid(node->message), node->message);
-		g_ptr_array_add(summary, node);
+		if (node->message) {
+			g_hash_table_insert(thread->uids, g_strdup(camel_lite_message_info_uid(node->message)), node);
+			if (node->order > thread->last_order)
+				thread->last_order = node->order;
+		}
+
+		if (node->parent == NULL) {
+			thread->tail = node;
+			if (thread->subject
+			    && (subject = get_root_subject(node))
+			    && g_hash_table_lookup(thread->subjects, subject) == NULL)
+				g_hash_table_insert(thread->subjects, g_strdup(subject), node);
+		}
+
 		if (node->child)
-			build_summary_rec(have, summary, node->child);
+			thread_index_rec(thread, node->child);
 		node = node->next;
 	}
 }
 
+static void
+thread_index(CamelFolderThread *thread)
+{
+	if (thread->uids)
+		return;
+
+	thread->uids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	thread->subjects = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	thread->tail = NULL;
+	thread_index_rec(thread, thread->tree);
+}
+
+static void
+thread_append_root(CamelFolderThread *thread, CamelFolderThreadNode *node)
+{
+	node->parent = NULL;
+	node->next = NULL;
+	if (thread->tail)
+		thread->tail->next = node;
+	else
+		thread->tree = node;
+	thread->tail = node;
+}
+
+static void
+thread_append_child(CamelFolderThreadNode *parent, CamelFolderThreadNode *node)
+{
+	CamelFolderThreadNode *c;
+
+	/* yes, this is intentional */
+	c = (CamelFolderThreadNode *)&parent->child;
+	while (c->next)
+		c = c->next;
+	c->next = node;
+	node->next = NULL;
+	node->parent = parent;
+}
+
+static void
+thread_add_info(CamelFolderThread *thread, CamelMessageInfo *info)
+{
+	CamelFolderThreadNode *node, *root = NULL, *c;
+	char *subject = NULL;
+
+	node = camel_lite_folder_thread_node_new(thread);
+	node->message = info;
+	node->order = ++thread->last_order;
+	g_hash_table_insert(thread->uids, g_strdup(camel_lite_message_info_uid(info)), node);
+
+	if (thread->subject && (subject = get_root_subject(node)))
+		root = g_hash_table_lookup(thread->subjects, subject);
+
+	if (root == NULL) {
+		thread_append_root(thread, node);
+		if (subject)
+			g_hash_table_insert(thread->subjects, g_strdup(subject), node);
+	} else if (node->re || !root->re) {
+		thread_append_child(root, node);
+	} else {
+		/* the original turned up after its replies, it takes over the thread */
+		c = (CamelFolderThreadNode *)&thread->tree;
+		while (c->next != root)
+			c = c->next;
+		c->next = node;
+		node->next = root->next;
+		node->parent = NULL;
+		if (thread->tail == root)
+			thread->tail = node;
+		root->next = NULL;
+		container_add_child(node, root);
+		g_hash_table_insert(thread->subjects, g_strdup(subject), node);
+	}
+
+	g_ptr_array_add(thread->summary, info);
+}
+
+static void
+thread_remove_node(CamelFolderThread *thread, CamelFolderThreadNode *node)
+{
+	CamelFolderThreadNode *c, *newtop, *scan;
+	char *subject = NULL;
+
+	if (node->parent == NULL && thread->subject)
+		subject = get_root_subject(node);
+
+	/* the first reply takes the place of the removed message, the
+	   other replies become its children */
+	newtop = node->child;
+	if (newtop) {
+		newtop->parent = node->parent;
+		scan = (CamelFolderThreadNode *)&newtop->child;
+		while (scan->next)
+			scan = scan->next;
+		scan->next = newtop->next;
+		while (scan->next) {
+			scan = scan->next;
+			scan->parent = newtop;
+		}
+		newtop->next = node->next;
+	}
+
+	if (node->parent)
+		c = (CamelFolderThreadNode *)&node->parent->child;
+	else
+		c = (CamelFolderThreadNode *)&thread->tree;
+	while (c->next && c->next != node)
+		c = c->next;
+	if (c->next == NULL) {
+		g_warning("removing thread node %p failed", (void *) node);
+		return;
+	}
+	c->next = newtop ? newtop : node->next;
+
+	if (node->parent == NULL) {
+		if (thread->tail == node) {
+			thread->tail = newtop;
+			if (thread->tail == NULL && c != (CamelFolderThreadNode *)&thread->tree)
+				thread->tail = c;
+		}
+		if (subject && g_hash_table_lookup(thread->subjects, subject) == node) {
+			if (newtop)
+				g_hash_table_insert(thread->subjects, g_strdup(subject), newtop);
+			else
+				g_hash_table_remove(thread->subjects, subject);
+		}
+	}
+
+	g_ptr_array_remove_fast(thread->summary, (void *) node->message);
+	camel_lite_folder_free_message_info(thread->folder, (CamelMessageInfo *)node->message);
+
+	/* the node stays on the mem_chain until the thread is freed */
+	node->message = NULL;
+	node->parent = node->child = node->next = NULL;
+}
+
+/**
+ * camel_lite_folder_thread_messages_add:
+ * @thread: a #CamelFolderThread made for a folder
+ * @summary: #CamelMessageInfo's of messages new to @thread
+ *
+ * Place messages which were added to the folder into @thread without
+ * threading the whole folder again.  They are taken as the newest
+ * messages of their thread.  @thread takes a reference on each
+ * message info it adds.
+ **/
 void
 camel_lite_folder_thread_messages_add(CamelFolderThread *thread, GPtrArray *summary)
 {
-	GPtrArray *all;
+	CamelMessageInfo *info;
 	int i;
-	GHashTable *table;
 
-	/* Instead of working out all the complex in's and out's of
-	   trying to do an incremental summary generation, just redo the whole
-	   thing with the summary in the current order - so it comes out
-	   in the same order */
+	g_return_if_fail(thread->folder != NULL);
+
+	thread_index(thread);
 
-	all = g_ptr_array_new();
-	table = g_hash_table_new(g_str_hash, g_str_equal);
-	build_summary_rec(table, all, thread->tree);
 	for (i=0;i<summary->len;i++) {
-		CamelMessageInfo *info = summary->pdata[i];
+		info = summary->pdata[i];
 
-		/* check its not already there, we dont want duplicates */
-		if (g_hash_table_lookup(table, camel_lite_message_info_uid(info)) == NULL)
-			g_ptr_array_add(all, info);
+		/* we dont want duplicates */
+		if (g_hash_table_lookup(thread->uids, camel_lite_message_info_uid(info)) == NULL) {
+			camel_lite_folder_ref_message_info(thread->folder, info);
+			thread_add_info(thread, info);
+		}
 	}
-	g_hash_table_destroy(table);
+}
 
-	/* reset the tree, and rebuild fully */
-	g_slice_free_chain(CamelFolderThreadNode, thread->mem_chain, mem_chain);
-	thread->tree = NULL;
-	thread->mem_chain = NULL;
-	thread_summary(thread, all);
+/**
+ * camel_lite_folder_thread_messages_remove:
+ * @thread: a #CamelFolderThread made for a folder
+ * @uids: uids of messages which are gone from the folder
+ *
+ * Take messages out of @thread.  If a removed message had replies the
+ * first of them takes its place.
+ **/
+void
+camel_lite_folder_thread_messages_remove(CamelFolderThread *thread, GPtrArray *uids)
+{
+	CamelFolderThreadNode *node;
+	int i;
+
+	g_return_if_fail(thread->folder != NULL);
+
+	thread_index(thread);
+
+	for (i=0;i<uids->len;i++) {
+		if ((node = g_hash_table_lookup(thread->uids, uids->pdata[i]))) {
+			g_hash_table_remove(thread->uids, uids->pdata[i]);
+			thread_remove_node(thread, node);
+		}
+	}
 }
 
+/**
+ * camel_lite_folder_thread_messages_find:
+ * @thread: a #CamelFolderThread made for a folder
+ * @uid: uid of a message
+ *
+ * Find the node of a message in @thread.
+ *
+ * Return value: The #CamelFolderThreadNode of @uid, or %NULL.
+ **/
+CamelFolderThreadNode *
+camel_lite_folder_thread_messages_find(CamelFolderThread *thread, const char *uid)
+{
+	thread_index(thread);
+
+	return g_hash_table_lookup(thread->uids, uid);
+}
+
+static int
+thread_count_rec(CamelFolderThreadNode *node)
+{
+	int count = 0;
+
+	while (node) {
+		count++;
+		if (node->child)
+			count += thread_count_rec(node->child);
+		node = node->next;
+	}
+
+	return count;
+}
+
+/* Empty containers, the missing message replies were grouped under, are
+   stored with an empty uid so that loading keeps those replies together */
 static void
-remove_uid_node_rec(CamelFolderThread *thread, GHashTable *table, CamelFolderThreadNode **list, CamelFolderThreadNode *parent)
-{
-	CamelFolderThreadNode *prev = NULL;
-	CamelFolderThreadNode *node, *next, *child, *rest;
-
-	node = (CamelFolderThreadNode *)list;
-	next = node->next;
-	while (next) {
-
-		if (next->child)
-			remove_uid_node_rec(thread, table, &next->child, next);
-
-		/* do we have a node to remove? */
-		if (next->message && g_hash_table_lookup(table, (char *)camel_lite_message_info_uid(node->message))) {
-			child = next->child;
-			if (child) {
-				/*
-				  node
-				  next
-				   child
-				   lchild
-				  rest
-
-				  becomes:
-				  node
-				  child
-				  lchild
-				  rest
-				*/
-
-				rest = next->next;
-				node->next = child;
-				next = child;
-				do {
-					lchild = child;
-					child->parent = parent;
-					child = child->next;
-				} while (child);
-				lchild->next = rest;
-			} else {
-				/*
-				  node
-				  next
-				  rest
-				  becomes:
-				  node
-				  rest */
-				node->next = next->next;
-				next = node->next;
-			}
+thread_save_rec(FILE *out, CamelFolderThreadNode *node, guint32 depth)
+{
+	while (node) {
+		camel_lite_file_util_encode_string(out, node->message ? camel_lite_message_info_uid(node->message) : "");
+		camel_lite_file_util_encode_uint32(out, depth);
+		if (node->child)
+			thread_save_rec(out, node->child, depth + 1);
+		node = node->next;
+	}
+}
+
+/**
+ * camel_lite_folder_thread_messages_save:
+ * @thread: a #CamelFolderThread made for a folder
+ * @path: file to store the thread tree in
+ *
+ * Store the shape of @thread so camel_lite_folder_thread_messages_load()
+ * can restore it without threading the folder again.
+ *
+ * Return value: 0 on success, -1 on failure.
+ **/
+int
+camel_lite_folder_thread_messages_save(CamelFolderThread *thread, const char *path)
+{
+	char *savename;
+	FILE *out;
+	int ret = -1;
+
+	savename = camel_lite_file_util_savename(path);
+	out = g_fopen(savename, "wb");
+	if (out != NULL) {
+		camel_lite_file_util_encode_uint32(out, CAMEL_FOLDER_THREAD_VERSION);
+		camel_lite_file_util_encode_uint32(out, thread->subject);
+		camel_lite_file_util_encode_uint32(out, thread_count_rec(thread->tree));
+		thread_save_rec(out, thread->tree, 0);
+
+		if (ferror(out) == 0 && fclose(out) == 0) {
+			if (g_rename(savename, path) == 0)
+				ret = 0;
 		} else {
-			node = next;
-			next = node->next;
+			fclose(out);
+			g_unlink(savename);
 		}
 	}
+
+	g_free(savename);
+
+	return ret;
 }
 
-void
-camel_lite_folder_thread_messages_remove(CamelFolderThread *thread, GPtrArray *uids)
+/* drop the empty containers which lost all their replies meanwhile */
+static void
+thread_load_prune(CamelFolderThreadNode **cp)
 {
-	GHashTable *table;
-	int i;
+	CamelFolderThreadNode *c, *lastc;
 
-	table = g_hash_table_new(g_str_hash, g_str_equal);
-	for (i=0;i<uids->len;i++)
-		g_hash_table_insert(table, uids->pdata[i], uids->pdata[i]);
+	/* yes, this is intentional */
+	lastc = (CamelFolderThreadNode *)cp;
+	while (lastc->next) {
+		c = lastc->next;
+		if (c->child)
+			thread_load_prune(&c->child);
+		if (c->message == NULL && c->child == NULL) {
+			/* the node stays on the mem_chain until the thread is freed */
+			lastc->next = c->next;
+			continue;
+		}
+		lastc = c;
+	}
+}
 
-	remove_uid_node_rec(thread, table, &thread->tree, NULL);
-	g_hash_table_destroy(table);
+static gboolean
+thread_load(CamelFolderThread *thread, FILE *in)
+{
+	CamelFolderThreadNode *node, **parents;
+	CamelMessageInfo *info;
+	guint32 version, subject, count, depth, top = 0, i;
+	char *uid;
+
+	if (camel_lite_file_util_decode_uint32(in, &version) == -1
+	    || version != CAMEL_FOLDER_THREAD_VERSION
+	    || camel_lite_file_util_decode_uint32(in, &subject) == -1
+	    || subject != thread->subject
+	    || camel_lite_file_util_decode_uint32(in, &count) == -1)
+		return FALSE;
+
+	thread_index(thread);
+
+	/* parents[d] is the node messages at depth d+1 hang off, messages
+	   which are gone meanwhile leave their replies to their parent */
+	parents = g_malloc0((count + 1) * sizeof(*parents));
+
+	for (i=0;i<count;i++) {
+		if (camel_lite_file_util_decode_string(in, &uid) == -1
+		    || camel_lite_file_util_decode_uint32(in, &depth) == -1
+		    || depth > top) {
+			g_free(parents);
+			return FALSE;
+		}
+
+		info = NULL;
+		if (uid[0] && g_hash_table_lookup(thread->uids, uid) == NULL)
+			info = camel_lite_folder_get_message_info(thread->folder, uid);
+
+		if (info == NULL && uid[0]) {
+			g_free(uid);
+			parents[depth] = depth ? parents[depth-1] : NULL;
+			top = depth + 1;
+			continue;
+		}
+		g_free(uid);
+
+		node = camel_lite_folder_thread_node_new(thread);
+		if (info) {
+			node->message = info;
+			node->order = ++thread->last_order;
+			g_hash_table_insert(thread->uids, g_strdup(camel_lite_message_info_uid(info)), node);
+			g_ptr_array_add(thread->summary, info);
+		}
+
+		if (depth && parents[depth-1])
+			thread_append_child(parents[depth-1], node);
+		else
+			thread_append_root(thread, node);
+		parents[depth] = node;
+		top = depth + 1;
+	}
+
+	g_free(parents);
+
+	thread_load_prune(&thread->tree);
+
+	/* only now do the empty containers have the replies their subject
+	   comes from */
+	thread->tail = NULL;
+	for (node = thread->tree; node; node = node->next) {
+		char *rs;
+
+		thread->tail = node;
+		if (thread->subject
+		    && (rs = get_root_subject(node))
+		    && g_hash_table_lookup(thread->subjects, rs) == NULL)
+			g_hash_table_insert(thread->subjects, g_strdup(rs), node);
+	}
+
+	return TRUE;
 }
 
-#endif
+/**
+ * camel_lite_folder_thread_messages_load:
+ * @folder: folder to thread
+ * @path: file stored by camel_lite_folder_thread_messages_save()
+ * @thread_subject: thread based on subject also
+ *
+ * Restore the threads of @folder as they were stored in @path.
+ * Messages which arrived since are added like
+ * camel_lite_folder_thread_messages_add() does.  If @path can't be
+ * used the folder gets threaded from scratch as by
+ * camel_lite_folder_thread_messages_new().
+ *
+ * Return value: A CamelFolderThread for all messages in @folder.
+ **/
+CamelFolderThread *
+camel_lite_folder_thread_messages_load(CamelFolder *folder, const char *path, gboolean thread_subject)
+{
+	CamelFolderThread *thread;
+	GPtrArray *fsummary;
+	FILE *in;
+	int i;
+
+	if ((in = g_fopen(path, "rb")) == NULL)
+		return camel_lite_folder_thread_messages_new(folder, NULL, thread_subject);
+
+	thread = thread_new(folder, thread_subject);
+	if (!thread_load(thread, in)) {
+		fclose(in);
+		camel_lite_folder_thread_messages_unref(thread);
+		return camel_lite_folder_thread_messages_new(folder, NULL, thread_subject);
+	}
+	fclose(in);
+
+	fsummary = camel_lite_folder_get_summary(folder);
+	camel_lite_folder_thread_messages_add(thread, fsummary);
+	camel_lite_folder_free_summary(folder, fsummary);
+
+	return thread;
+}
 
 CamelFolderThreadNode *
 camel_lite_folder_thread_node_new(CamelFolderThread *thread)
@@ -28,8 +28,10 @@
 G_BEGIN_DECLS
 
 typedef struct _CamelFolderThreadNode {
-	struct _CamelFolderThreadNode *mem_chain;
+	/* next comes first, the list walking code takes the address of
+	   a child or tree pointer as a node */
 	struct _CamelFolderThreadNode *next, *parent, *child;
+	struct _CamelFolderThreadNode *mem_chain;
 	const CamelMessageInfo *message;
 	char *root_subject;	/* cached root equivalent subject */
 	guint32 order:31;
@@ -44,18 +46,31 @@ typedef struct _CamelFolderThread {
 	struct _CamelFolderThreadNode *mem_chain;
 	CamelFolder *folder;
 	GPtrArray *summary;
+
+	/* lookup tables for incremental updates, built on demand */
+	GHashTable *uids;		/* uid -> node */
+	GHashTable *subjects;		/* root subject -> thread root */
+	struct _CamelFolderThreadNode *tail;
+	guint32 last_order;
 } CamelFolderThread;
 
 /* interface 1: using uid's */
 CamelFolderThread *camel_lite_folder_thread_messages_new(CamelFolder *folder, GPtrArray *uids, gboolean thread_subject);
 void camel_lite_folder_thread_messages_apply(CamelFolderThread *thread, GPtrArray *uids);
 
+/* incremental updates of a thread made for a folder */
+void camel_lite_folder_thread_messages_add(CamelFolderThread *thread, GPtrArray *summary);
+void camel_lite_folder_thread_messages_remove(CamelFolderThread *thread, GPtrArray *uids);
+CamelFolderThreadNode *camel_lite_folder_thread_messages_find(CamelFolderThread *thread, const char *uid);
+
+/* persisting the tree of a folder */
+CamelFolderThread *camel_lite_folder_thread_messages_load(CamelFolder *folder, const char *path, gboolean thread_subject);
+int camel_lite_folder_thread_messages_save(CamelFolderThread *thread, const char *path);
+
 /* interface 2: using messageinfo's.  Currently disabled. */
 #if 0
 /* new improved interface */
 CamelFolderThread *camel_lite_folder_thread_messages_new_summary(GPtrArray *summary);
-void camel_lite_folder_thread_messages_add(CamelFolderThread *thread, GPtrArray *summary);
-void camel_lite_folder_thread_messages_remove(CamelFolderThread *thread, GPtrArray *uids);
 #endif
 
 void camel_lite_folder_thread_messages_ref(CamelFolderThread *threads);
@@ -173,6 +173,34 @@ camel_lite_folder_fetch (CamelFolder *folder, const char *uid, const char *spec,
 	return CF_CLASS (folder)->fetch (folder, uid, spec, binary, ex);
 }
 
+static GPtrArray *
+sort_uids (CamelFolder *folder, const char *criteria, CamelException *ex)
+{
+	return NULL;
+}
+
+/**
+ * camel_lite_folder_sort_uids:
+ * @folder: a #CamelFolder object
+ * @criteria: RFC 5256 sort criteria, for example "REVERSE ARRIVAL"
+ * @ex: a #CamelException
+ *
+ * Get the uids of all the messages in @folder in the order given by
+ * @criteria, as sorted by the server.  This includes messages which
+ * aren't in the summary yet.
+ *
+ * Return value: the sorted uids, which should be freed with
+ * camel_lite_folder_free_deep(), or %NULL if @folder can't be sorted
+ * remotely or on error.
+ **/
+GPtrArray *
+camel_lite_folder_sort_uids (CamelFolder *folder, const char *criteria, CamelException *ex)
+{
+	g_return_val_if_fail (CAMEL_IS_FOLDER (folder), NULL);
+
+	return CF_CLASS (folder)->sort_uids (folder, criteria, ex);
+}
+
 static void
 delete_attachments (CamelFolder *folder, const char *uid)
 {
@@ -221,6 +249,7 @@ camel_lite_folder_class_init (CamelFolderClass *camel_lite_folder_class)
 	camel_lite_folder_class->get_cache_filename = get_cache_filename;
 	camel_lite_folder_class->fetch_structure = fetch_structure;
 	camel_lite_folder_class->fetch = fetch;
+	camel_lite_folder_class->sort_uids = sort_uids;
 	camel_lite_folder_class->get_local_size = get_local_size;
 	camel_lite_folder_class->set_push_email = folder_set_push_email;
 	camel_lite_folder_class->sync = folder_sync;
@@ -279,6 +308,10 @@ camel_lite_folder_init (gpointer object, gpointer klass)
 	folder->priv = g_malloc0(sizeof(*folder->priv));
 	folder->priv->frozen = 0;
 	folder->priv->changed_frozen = camel_lite_folder_change_info_new();
+	folder->priv->change_window = 0;
+	folder->priv->change_window_id = 0;
+	folder->priv->changed_window = camel_lite_folder_change_info_new();
+	folder->priv->changed_flushing = NULL;
 	g_static_rec_mutex_init(&folder->priv->lock);
 	g_static_mutex_init(&folder->priv->change_lock);
 }
@@ -303,6 +336,7 @@ camel_lite_folder_finalize (CamelObject *object)
 	}
 
 	camel_lite_folder_change_info_free(p->changed_frozen);
+	camel_lite_folder_change_info_free(p->changed_window);
 
 	g_static_rec_mutex_free(&p->lock);
 	g_static_mutex_free(&p->change_lock);
@@ -1783,6 +1817,115 @@ camel_lite_folder_is_frozen (CamelFolder *folder)
 	return CF_CLASS (folder)->is_frozen (folder);
 }
 
+/* Close the pending batch window, must be called with change_lock
+   held.  Whoever clears change_window_id does the flush, so the timeout
+   and camel_lite_folder_set_change_window() never both do it.  Returns
+   the changes to emit with change_window_emit(), or NULL */
+static CamelFolderChangeInfo *
+change_window_take (CamelFolder *folder)
+{
+	CamelFolderChangeInfo *info = NULL;
+
+	if (folder->priv->change_window_id == 0)
+		return NULL;
+
+	folder->priv->change_window_id = 0;
+	if (camel_lite_folder_change_info_changed(folder->priv->changed_window)) {
+		info = folder->priv->changed_window;
+		folder->priv->changed_window = camel_lite_folder_change_info_new();
+		folder->priv->changed_flushing = info;
+	}
+
+	return info;
+}
+
+static void
+change_window_emit (CamelFolder *folder, CamelFolderChangeInfo *info)
+{
+	if (info) {
+		camel_lite_object_trigger_event (folder, "folder_changed", info);
+
+		CAMEL_FOLDER_LOCK(folder, change_lock);
+		if (folder->priv->changed_flushing == info)
+			folder->priv->changed_flushing = NULL;
+		CAMEL_FOLDER_UNLOCK(folder, change_lock);
+
+		camel_lite_folder_change_info_free(info);
+	}
+}
+
+/* the timeout holds its own reference on the folder, which is dropped
+   when the source is destroyed, also after a g_source_remove() while
+   it is being dispatched */
+static gboolean
+change_window_flush (gpointer user_data)
+{
+	CamelFolder *folder = user_data;
+	CamelFolderChangeInfo *info;
+
+	CAMEL_FOLDER_LOCK(folder, change_lock);
+	info = change_window_take (folder);
+	CAMEL_FOLDER_UNLOCK(folder, change_lock);
+
+	change_window_emit (folder, info);
+
+	return FALSE;
+}
+
+/**
+ * camel_lite_folder_set_change_window:
+ * @folder: a #CamelFolder object
+ * @msecs: length of the batch window in milliseconds, or 0 to disable
+ *
+ * Makes the folder coalesce its "folder_changed" events. The first change
+ * that arrives starts a batch window of @msecs milliseconds; all changes
+ * that arrive during that window are merged and emitted as one single
+ * "folder_changed" event from the main loop when the window closes.
+ *
+ * Disabling the window emits any changes that are still pending.
+ **/
+void
+camel_lite_folder_set_change_window (CamelFolder *folder, guint msecs)
+{
+	CamelFolderChangeInfo *info = NULL;
+
+	g_return_if_fail (CAMEL_IS_FOLDER (folder));
+
+	CAMEL_FOLDER_LOCK(folder, change_lock);
+	folder->priv->change_window = msecs;
+	if (msecs == 0 && folder->priv->change_window_id != 0) {
+		/* if the timeout is being dispatched right now, it finds
+		   the id cleared and leaves the flush to us */
+		g_source_remove (folder->priv->change_window_id);
+		info = change_window_take (folder);
+	}
+	CAMEL_FOLDER_UNLOCK(folder, change_lock);
+
+	change_window_emit (folder, info);
+}
+
+/**
+ * camel_lite_folder_get_change_window:
+ * @folder: a #CamelFolder object
+ *
+ * Return value: the batch window set with
+ * camel_lite_folder_set_change_window(), or 0 if changes are emitted
+ * as they come.
+ **/
+guint
+camel_lite_folder_get_change_window (CamelFolder *folder)
+{
+	guint msecs;
+
+	g_return_val_if_fail (CAMEL_IS_FOLDER (folder), 0);
+
+	CAMEL_FOLDER_LOCK(folder, change_lock);
+	msecs = folder->priv->change_window;
+	CAMEL_FOLDER_UNLOCK(folder, change_lock);
+
+	return msecs;
+}
+
 struct _folder_filter_msg {
 	CamelSessionThreadMsg msg;
 
@@ -1943,6 +2086,22 @@ folder_changed (CamelObject *obj, gpointer event_data)
 
 		return FALSE;
 	}
+
+	/* merge into the current batch window, unless this is the batch itself */
+	if (folder->priv->change_window > 0
+	    && changed != folder->priv->changed_flushing) {
+		camel_lite_folder_change_info_cat(folder->priv->changed_window, changed);
+		if (folder->priv->change_window_id == 0) {
+			camel_lite_object_ref (folder);
+			folder->priv->change_window_id = g_timeout_add_full (
+				G_PRIORITY_DEFAULT, folder->priv->change_window,
+				change_window_flush, folder,
+				(GDestroyNotify) camel_lite_object_unref);
+		}
+		CAMEL_FOLDER_UNLOCK(folder, change_lock);
+
+		return FALSE;
+	}
 	CAMEL_FOLDER_UNLOCK(folder, change_lock);
 
 
@@ -224,6 +224,8 @@ typedef struct {
 	char* (*fetch_structure) (CamelFolder *folder, const char *uid, CamelException *ex);
 	char* (*convert) (CamelFolder *folder, const char *uid, const char *spec, const char *convert_to, CamelException *ex);
 
+	GPtrArray * (*sort_uids) (CamelFolder *folder, const char *criteria, CamelException *ex);
+
 } CamelFolderClass;
 
 /* Standard Camel function */
@@ -350,6 +352,9 @@ void               camel_lite_folder_rename                 (CamelFolder *folder
 void               camel_lite_folder_freeze                (CamelFolder *folder);
 void               camel_lite_folder_thaw                  (CamelFolder *folder);
 gboolean           camel_lite_folder_is_frozen             (CamelFolder *folder);
+void               camel_lite_folder_set_change_window     (CamelFolder *folder,
+							    guint msecs);
+guint              camel_lite_folder_get_change_window     (CamelFolder *folder);
 
 /* For use by subclasses (for free_{uids,summary,subfolder_names}) */
 void camel_lite_folder_free_nop     (CamelFolder *folder, GPtrArray *array);
@@ -391,6 +396,8 @@ char* camel_lite_folder_fetch_structure (CamelFolder *folder, const char *uid, C
 char* camel_lite_folder_get_cache_filename (CamelFolder *folder, const char *uid, const char *spec, CamelFolderPartState *state);
 char* camel_lite_folder_convert (CamelFolder *folder, const char *uid, const char *spec, const char *convert_to, CamelException *ex);
 
+GPtrArray * camel_lite_folder_sort_uids (CamelFolder *folder, const char *criteria, CamelException *ex);
+
 G_END_DECLS
 
 #endif /* CAMEL_FOLDER_H */
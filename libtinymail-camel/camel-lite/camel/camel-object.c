@@ -51,15 +51,30 @@
 
 /* ** Quickie type system ************************************************* */
 
+/* A read-only copy of the event pairs on a hooklist.  Event emission
+   walks the currently published snapshot without taking any lock; writers
+   build a new one under the hooklist lock and swap it in.  Snapshots (and
+   the pairs removed along with them) that may still be in use by an
+   emitter are kept on the retired lists until no emitter is running */
+typedef struct _CamelHookSnapshot {
+	struct _CamelHookSnapshot *next; /* retired list */
+
+	unsigned int len;
+	struct _CamelHookPair *pairs[1];
+} CamelHookSnapshot;
+
 /* A 'locked' hooklist, that is only allocated on demand */
 typedef struct _CamelHookList {
 	GStaticRecMutex lock;
 
-	unsigned int depth:30;	/* recursive event depth */
-	unsigned int flags:2;	/* flags, see below */
+	volatile int emitters;	/* number of lock-less event emissions in progress */
 
 	unsigned int list_length;
 	struct _CamelHookPair *list;
+
+	CamelHookSnapshot *snapshot;	/* published, read atomically */
+	CamelHookSnapshot *retired;	/* replaced snapshots, not yet freed */
+	struct _CamelHookPair *retired_pairs; /* removed pairs, not yet freed */
 } CamelHookList;
 
 #define CAMEL_HOOK_PAIR_REMOVED (1<<0)
@@ -189,6 +204,96 @@ hooks_free(CamelHookList *hooks)
 	g_slice_free (CamelHookList, hooks);
 }
 
+static void
+snapshot_free(CamelHookSnapshot *snap)
+{
+	g_free(snap);
+}
+
+/* free retired snapshots and pairs, if no emitter can still see them.
+   Must be called with the hooklist locked */
+static void
+hooks_reclaim(CamelHookList *hooks)
+{
+	CamelHookSnapshot *snap, *snext;
+	CamelHookPair *pair, *pnext;
+
+	if (g_atomic_int_get(&hooks->emitters) != 0)
+		return;
+
+	snap = hooks->retired;
+	while (snap) {
+		snext = snap->next;
+		snapshot_free(snap);
+		snap = snext;
+	}
+	hooks->retired = NULL;
+
+	pair = hooks->retired_pairs;
+	while (pair) {
+		pnext = pair->next;
+		pair_free(pair);
+		pair = pnext;
+	}
+	hooks->retired_pairs = NULL;
+}
+
+/* rebuild and publish the event snapshot of a hooklist, after its event
+   pairs changed.  Must be called with the hooklist locked */
+static void
+hooks_publish(CamelHookList *hooks)
+{
+	CamelHookSnapshot *snap, *old;
+	CamelHookPair *pair;
+
+	snap = g_malloc(sizeof(*snap) + sizeof(snap->pairs[0]) * hooks->list_length);
+	snap->next = NULL;
+	snap->len = 0;
+
+	/* the list is kept newest first, the snapshot oldest first, which is the
+	   order the hooks get called in */
+	pair = hooks->list;
+	while (pair) {
+		if (pair->func.event != NULL
+		    && pair->name != meta_name
+		    && pair->name != bag_name)
+			snap->pairs[snap->len++] = pair;
+		pair = pair->next;
+	}
+
+	if (snap->len > 1) {
+		unsigned int i;
+
+		for (i=0;i<snap->len/2;i++) {
+			pair = snap->pairs[i];
+			snap->pairs[i] = snap->pairs[snap->len-i-1];
+			snap->pairs[snap->len-i-1] = pair;
+		}
+	}
+
+	old = hooks->snapshot;
+	g_atomic_pointer_set((volatile gpointer *)&hooks->snapshot, snap);
+
+	if (old) {
+		old->next = hooks->retired;
+		hooks->retired = old;
+	}
+
+	hooks_reclaim(hooks);
+}
+
+/* unlink-time removal of an event pair, emitters may still be calling it */
+static void
+hooks_retire_pair(CamelHookList *hooks, CamelHookPair *pair)
+{
+	pair->flags |= CAMEL_HOOK_PAIR_REMOVED;
+	pair->next = hooks->retired_pairs;
+	hooks->retired_pairs = pair;
+	hooks->list_length--;
+
+	hooks_publish(hooks);
+}
+
 /* not checked locked, who cares, only required for people that want to redefine root objects */
 void
 camel_lite_type_init(void)
@@ -1165,8 +1270,11 @@ camel_lite_object_free_hooks(CamelObject *o)
 	g_static_rec_mutex_lock (&hooks_lock);
 
 	if (o->hooks) {
-		g_assert(o->hooks->depth == 0);
-		g_assert((o->hooks->flags & CAMEL_HOOK_PAIR_REMOVED) == 0);
+		g_assert(g_atomic_int_get(&o->hooks->emitters) == 0);
+
+		hooks_reclaim(o->hooks);
+		if (o->hooks->snapshot)
+			snapshot_free(o->hooks->snapshot);
 
 		pair = o->hooks->list;
 		while (pair) {
@@ -1205,10 +1313,12 @@ camel_lite_object_get_hooks(CamelObject *o)
 		if (o->hooks == NULL) {
 			hooks = hooks_alloc();
 			g_static_rec_mutex_init(&hooks->lock);
-			hooks->flags = 0;
-			hooks->depth = 0;
+			hooks->emitters = 0;
 			hooks->list_length = 0;
 			hooks->list = NULL;
+			hooks->snapshot = NULL;
+			hooks->retired = NULL;
+			hooks->retired_pairs = NULL;
 			o->hooks = hooks;
 		}
 		pthread_mutex_unlock(&lock);
@@ -1272,6 +1382,7 @@ setup:
 	pair->next = hooks->list;
 	hooks->list = pair;
 	hooks->list_length++;
+	hooks_publish(hooks);
 	camel_lite_object_unget_hooks(obj);
 
 	h(printf("%p hook event '%s' %p %p = %d\n", vo, name, func, data, id));
@@ -1311,14 +1422,8 @@ camel_lite_object_remove_event(void *vo, unsigned int id)
 	while (pair) {
 		if (pair->id == id
 		    && (pair->flags & CAMEL_HOOK_PAIR_REMOVED) == 0) {
-			if (hooks->depth > 0) {
-				pair->flags |= CAMEL_HOOK_PAIR_REMOVED;
-				hooks->flags |= CAMEL_HOOK_PAIR_REMOVED;
-			} else {
-				parent->next = pair->next;
-				pair_free(pair);
-				hooks->list_length--;
-			}
+			parent->next = pair->next;
+			hooks_retire_pair(hooks, pair);
 			camel_lite_object_unget_hooks(obj);
 			g_static_rec_mutex_unlock (&hooks_lock);
 			return;
@@ -1364,14 +1469,8 @@ camel_lite_object_unhook_event(void *vo, const char * name, CamelObjectEventHook
 		    && pair->data == data
 		    && strcmp(pair->name, name) == 0
 		    && (pair->flags & CAMEL_HOOK_PAIR_REMOVED) == 0) {
-			if (hooks->depth > 0) {
-				pair->flags |= CAMEL_HOOK_PAIR_REMOVED;
-				hooks->flags |= CAMEL_HOOK_PAIR_REMOVED;
-			} else {
-				parent->next = pair->next;
-				pair_free(pair);
-				hooks->list_length--;
-			}
+			parent->next = pair->next;
+			hooks_retire_pair(hooks, pair);
 			camel_lite_object_unget_hooks(obj);
 			g_static_rec_mutex_unlock (&hooks_lock);
 			return;
@@ -1391,8 +1490,9 @@ camel_lite_object_trigger_event(void *vo, const char * name, void *event_data)
 {
 	CamelObject *obj = vo;
 	CamelHookList *hooks;
-	CamelHookPair *pair, **pairs, *parent, *hook;
-	int i, size;
+	CamelHookSnapshot *snap;
+	CamelHookPair *pair, *hook;
+	int i;
 	const char *prepname;
 
 	if (obj->ref_count > 0)
@@ -1443,50 +1543,32 @@ trigger:
 	}
 
 trigger_interface:
-	/* lock the object for hook emission */
+	/* walk the published snapshot, no locking, hooks added or removed
+	   meanwhile only take effect for the next emission; removed ones are
+	   skipped but stay allocated until we're done */
 	camel_lite_object_ref(obj);
-	hooks = camel_lite_object_get_hooks(obj);
+	hooks = obj->hooks;
 
-	if (hooks->list) {
-		/* first, copy the items in the list, and say we're in an event */
-		hooks->depth++;
-		pair = hooks->list;
-		size = 0;
-		pairs = alloca(sizeof(pairs[0]) * hooks->list_length);
+	g_atomic_int_inc(&hooks->emitters);
+	snap = g_atomic_pointer_get((volatile gpointer *)&hooks->snapshot);
+	if (snap) {
 		prepname = hook->name;
-		while (pair) {
-			if (pair->name == prepname)
-				pairs[size++] = pair;
-			pair = pair->next;
-		}
-
-		/* now execute the events we have, if they haven't been removed during our calls */
-		for (i=size-1;i>=0;i--) {
-			pair = pairs[i];
-			if ((pair->flags & CAMEL_HOOK_PAIR_REMOVED) == 0)
+		for (i=0;i<snap->len;i++) {
+			pair = snap->pairs[i];
+			if (pair->name == prepname
+			    && (pair->flags & CAMEL_HOOK_PAIR_REMOVED) == 0)
 				(pair->func.event) (obj, event_data, pair->data);
 		}
-		hooks->depth--;
-
-		/* and if we're out of any events, then clean up any pending removes */
-		if (hooks->depth == 0 && (hooks->flags & CAMEL_HOOK_PAIR_REMOVED)) {
-			parent = (CamelHookPair *)&hooks->list;
-			pair = parent->next;
-			while (pair) {
-				if (pair->flags & CAMEL_HOOK_PAIR_REMOVED) {
-					parent->next = pair->next;
-					pair_free(pair);
-					hooks->list_length--;
-				} else {
-					parent = pair;
-				}
-				pair = parent->next;
-			}
-			hooks->flags &= ~CAMEL_HOOK_PAIR_REMOVED;
-		}
+	}
+	/* the last emitter out frees what was retired while it ran, the
+	   retired lists are only a hint until we hold the lock */
+	if (g_atomic_int_dec_and_test(&hooks->emitters)
+	    && (hooks->retired != NULL || hooks->retired_pairs != NULL)) {
+		g_static_rec_mutex_lock(&hooks->lock);
+		hooks_reclaim(hooks);
+		g_static_rec_mutex_unlock(&hooks->lock);
 	}
 
-	camel_lite_object_unget_hooks(obj);
 	camel_lite_object_unref(obj);
 	/* g_static_rec_mutex_unlock (&hooks_lock); */
 }
@@ -158,7 +158,7 @@ offline_folder_changed (CamelFolder *folder, CamelFolderChangeInfo *changes, voi
 		camel_lite_object_ref (folder);
 		m->folder = folder;
 
-		camel_lite_session_thread_queue (session, &m->msg, 0);
+		camel_lite_session_thread_queue_keyed (session, &m->msg, folder, CAMEL_SESSION_THREAD_PRIORITY_LOW);
 	}
 }
 
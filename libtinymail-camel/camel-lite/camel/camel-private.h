@@ -44,6 +44,11 @@ struct _CamelFolderPrivate {
 	/* must require the 'change_lock' to access this */
 	int frozen;
 	struct _CamelFolderChangeInfo *changed_frozen; /* queues changed events */
+	/* coalescing of changed events, also under 'change_lock' */
+	guint change_window;	/* msecs, 0 = disabled */
+	guint change_window_id;	/* pending flush timeout */
+	struct _CamelFolderChangeInfo *changed_window; /* queues changed events */
+	struct _CamelFolderChangeInfo *changed_flushing; /* being emitted by the flush */
 };
 
 #define CAMEL_FOLDER_LOCK(f, l) \
@@ -100,6 +105,14 @@ struct _CamelSessionPrivate {
 	int thread_id;
 	GHashTable *thread_active;
 	GThreadPool *thread_pool;
+	int thread_pool_size;
+
+	/* work scheduling, all under 'thread_lock' */
+	GHashTable *thread_lanes;	/* struct _CamelSessionThreadLane by key */
+	struct _CamelSessionThreadLane *thread_default_lane;	/* unkeyed messages */
+	GQueue *thread_ready[3];	/* runnable lanes, by priority */
+	guint thread_queued, thread_running;
+	guint64 thread_completed, thread_wait_total, thread_wait_max;
 
 	GHashTable *thread_msg_op;
 	GHashTable *junk_headers;
@@ -161,6 +174,9 @@ struct _CamelVeeFolderPrivate {
 	GMutex *summary_lock;		/* for locking vfolder summary */
 	GMutex *subfolder_lock;		/* for locking the subfolder list */
 	GMutex *changed_lock;		/* for locking the folders-changed list */
+	GMutex *match_lock;		/* for locking the match caches */
+
+	GHashTable *match_caches;	/* source folder -> match cache, see camel-vee-folder.c */
 };
 
 #define CAMEL_VEE_FOLDER_LOCK(f, l) \
@@ -51,6 +51,9 @@
 
 #define d(x)
 
+/* default maximum number of threads processing session thread messages */
+#define CAMEL_SESSION_THREAD_POOL_SIZE 4
+
 #define CS_CLASS(so) ((CamelSessionClass *)((CamelObject *)so)->klass)
 
 static CamelService *get_service (CamelSession *session,
@@ -66,6 +69,30 @@ static void session_thread_msg_free(CamelSession *session, CamelSessionThreadMsg
 static int session_thread_queue(CamelSession *session, CamelSessionThreadMsg *msg, int flags);
 static void session_thread_wait(CamelSession *session, int id);
 static void session_thread_status(CamelSession *session, CamelSessionThreadMsg *msg, const char *text, int pc);
+static int session_thread_queue_keyed(CamelSession *session, CamelSessionThreadMsg *msg, const void *key, int flags);
+static struct _CamelSessionThreadLane *thread_lane_new(const void *key);
+static void thread_lane_free(struct _CamelSessionThreadLane *lane);
+
+/* Thread messages are queued on a 'lane' per serialisation key. A lane
+   runs at most one message at a time, in queueing order, while messages
+   on different lanes run in parallel on the thread pool. Lanes that have
+   work and aren't running sit on the ready queue of the priority of their
+   first message, and for every one of those the pool got one push. Idle
+   lanes are freed, except for the default lane which all unkeyed messages
+   share, so that those run one after another as they did when the pool
+   had a single thread. The default lane is a lane like the others though:
+   its messages do run in parallel with keyed ones */
+struct _CamelSessionThreadLane {
+	const void *key;
+	GQueue *jobs;
+	int running;
+};
+
+struct _CamelSessionThreadJob {
+	CamelSessionThreadMsg *msg;
+	int priority;
+	GTimeVal queued;
+};
 
 static void
 camel_lite_session_init (CamelSession *session)
@@ -79,6 +106,12 @@ camel_lite_session_init (CamelSession *session)
 	session->priv->thread_id = 1;
 	session->priv->thread_active = g_hash_table_new(NULL, NULL);
 	session->priv->thread_pool = NULL;
+	session->priv->thread_pool_size = CAMEL_SESSION_THREAD_POOL_SIZE;
+	session->priv->thread_lanes = g_hash_table_new(NULL, NULL);
+	session->priv->thread_default_lane = thread_lane_new(NULL);
+	session->priv->thread_ready[0] = g_queue_new();
+	session->priv->thread_ready[1] = g_queue_new();
+	session->priv->thread_ready[2] = g_queue_new();
 	session->priv->junk_headers = NULL;
 }
 
@@ -87,6 +120,7 @@ camel_lite_session_finalise (CamelObject *o)
 {
 	CamelSession *session = (CamelSession *)o;
 	GThreadPool *thread_pool = session->priv->thread_pool;
+	int i;
 
 	g_hash_table_destroy(session->priv->thread_active);
 
@@ -96,6 +130,13 @@ camel_lite_session_finalise (CamelObject *o)
 		g_thread_pool_free(thread_pool, FALSE, FALSE);
 	}
 
+	g_assert(g_hash_table_size(session->priv->thread_lanes) == 0);
+	g_hash_table_destroy(session->priv->thread_lanes);
+	g_assert(g_queue_is_empty(session->priv->thread_default_lane->jobs));
+	thread_lane_free(session->priv->thread_default_lane);
+	for (i = 0; i < 3; i++)
+		g_queue_free(session->priv->thread_ready[i]);
+
 	g_free(session->storage_path);
 
 	g_mutex_free(session->priv->lock);
@@ -117,6 +158,7 @@ camel_lite_session_class_init (CamelSessionClass *camel_session_class)
 	camel_session_class->thread_msg_new = session_thread_msg_new;
 	camel_session_class->thread_msg_free = session_thread_msg_free;
 	camel_session_class->thread_queue = session_thread_queue;
+	camel_session_class->thread_queue_keyed = session_thread_queue_keyed;
 	camel_session_class->thread_wait = session_thread_wait;
 	camel_session_class->thread_status = session_thread_status;
 
@@ -620,9 +662,82 @@ static void session_thread_msg_free(CamelSession *session, CamelSessionThreadMsg
 	g_free(msg);
 }
 
+static struct _CamelSessionThreadLane *
+thread_lane_new (const void *key)
+{
+	struct _CamelSessionThreadLane *lane;
+
+	lane = g_slice_new (struct _CamelSessionThreadLane);
+	lane->key = key;
+	lane->jobs = g_queue_new ();
+	lane->running = FALSE;
+
+	return lane;
+}
+
+static void
+thread_lane_free (struct _CamelSessionThreadLane *lane)
+{
+	g_queue_free (lane->jobs);
+	g_slice_free (struct _CamelSessionThreadLane, lane);
+}
+
+static int
+thread_priority (int flags)
+{
+	if (flags & CAMEL_SESSION_THREAD_PRIORITY_HIGH)
+		return 0;
+	if (flags & CAMEL_SESSION_THREAD_PRIORITY_LOW)
+		return 2;
+	return 1;
+}
+
+/* must be called with thread_lock held */
+static void
+thread_lane_ready (CamelSession *session, struct _CamelSessionThreadLane *lane)
+{
+	struct _CamelSessionThreadJob *job = g_queue_peek_head (lane->jobs);
+
+	g_queue_push_tail (session->priv->thread_ready[job->priority], lane);
+
+	/* the pool only wants non-NULL data, the ready queues do the scheduling */
+	g_thread_pool_push (session->priv->thread_pool, GINT_TO_POINTER (1), NULL);
+}
+
 static void
-session_thread_proxy(CamelSessionThreadMsg *msg, CamelSession *session)
+session_thread_proxy(gpointer data, CamelSession *session)
 {
+	struct _CamelSessionThreadLane *lane = NULL;
+	struct _CamelSessionThreadJob *job;
+	CamelSessionThreadMsg *msg;
+	GTimeVal now;
+	guint64 wait;
+	int i;
+
+	CAMEL_SESSION_LOCK(session, thread_lock);
+
+	/* whichever push woke us up, run the most urgent ready lane */
+	for (i = 0; i < 3 && lane == NULL; i++)
+		lane = g_queue_pop_head (session->priv->thread_ready[i]);
+	g_assert (lane != NULL);
+
+	job = g_queue_pop_head (lane->jobs);
+	lane->running = TRUE;
+
+	g_get_current_time (&now);
+	wait = (guint64) (now.tv_sec - job->queued.tv_sec) * G_USEC_PER_SEC
+		+ (now.tv_usec - job->queued.tv_usec);
+	session->priv->thread_queued--;
+	session->priv->thread_running++;
+	session->priv->thread_wait_total += wait;
+	if (wait > session->priv->thread_wait_max)
+		session->priv->thread_wait_max = wait;
+
+	CAMEL_SESSION_UNLOCK(session, thread_lock);
+
+	msg = job->msg;
+	g_slice_free (struct _CamelSessionThreadJob, job);
+
 	if (msg->ops->receive) {
 		CamelOperation *oldop;
 
@@ -631,30 +746,80 @@ session_thread_proxy(CamelSessionThreadMsg *msg, CamelSession *session)
 		camel_lite_operation_register(oldop);
 	}
 
+	CAMEL_SESSION_LOCK(session, thread_lock);
+
+	session->priv->thread_running--;
+	session->priv->thread_completed++;
+	lane->running = FALSE;
+	if (!g_queue_is_empty (lane->jobs))
+		thread_lane_ready (session, lane);
+	else if (lane != session->priv->thread_default_lane) {
+		g_hash_table_remove (session->priv->thread_lanes, lane->key);
+		thread_lane_free (lane);
+	}
+
+	CAMEL_SESSION_UNLOCK(session, thread_lock);
+
+	/* this might drop the last reference on the session */
 	camel_lite_session_thread_msg_free(session, msg);
 }
 
-static int session_thread_queue(CamelSession *session, CamelSessionThreadMsg *msg, int flags)
+static int
+session_thread_push(CamelSession *session, CamelSessionThreadMsg *msg, const void *key, int flags)
 {
-	GThreadPool *thread_pool;
+	struct _CamelSessionThreadLane *lane;
+	struct _CamelSessionThreadJob *job;
 	int id;
 
+	job = g_slice_new (struct _CamelSessionThreadJob);
+	job->msg = msg;
+	job->priority = thread_priority (flags);
+	g_get_current_time (&job->queued);
+
+	id = msg->id;
+
 	CAMEL_SESSION_LOCK(session, thread_lock);
-	thread_pool = session->priv->thread_pool;
-	if (thread_pool == NULL) {
-		thread_pool = g_thread_pool_new (
+	if (session->priv->thread_pool == NULL)
+		session->priv->thread_pool = g_thread_pool_new (
 			(GFunc) session_thread_proxy,
-			session, 1, FALSE, NULL);
-		session->priv->thread_pool = thread_pool;
+			session, session->priv->thread_pool_size, FALSE, NULL);
+
+	if (key == NULL)
+		lane = session->priv->thread_default_lane;
+	else if ((lane = g_hash_table_lookup (session->priv->thread_lanes, key)) == NULL) {
+		lane = thread_lane_new (key);
+		g_hash_table_insert (session->priv->thread_lanes, (gpointer) key, lane);
 	}
-	CAMEL_SESSION_UNLOCK(session, thread_lock);
 
-	id = msg->id;
-	g_thread_pool_push(thread_pool, msg, NULL);
+	g_queue_push_tail (lane->jobs, job);
+	session->priv->thread_queued++;
+
+	/* a running lane gets readied again once its current message is
+	   done, one that is waiting on a ready queue already keeps its place */
+	if (!lane->running && g_queue_get_length (lane->jobs) == 1)
+		thread_lane_ready (session, lane);
+
+	CAMEL_SESSION_UNLOCK(session, thread_lock);
 
 	return id;
 }
 
+static int session_thread_queue(CamelSession *session, CamelSessionThreadMsg *msg, int flags)
+{
+	/* all messages without a key share the default lane, and thus stay serialised */
+	return session_thread_push (session, msg, NULL, flags);
+}
+
+static int session_thread_queue_keyed(CamelSession *session, CamelSessionThreadMsg *msg, const void *key, int flags)
+{
+	/* a subclass that queues messages its own way but knows nothing
+	   about keys still gets to see all of them */
+	if (key == NULL || CS_CLASS (session)->thread_queue != session_thread_queue)
+		return CS_CLASS (session)->thread_queue (session, msg, flags);
+
+	return session_thread_push (session, msg, key, flags);
+}
+
 static void session_thread_wait(CamelSession *session, int id)
 {
 	int wait;
@@ -737,6 +902,84 @@ camel_lite_session_thread_queue(CamelSession *session, CamelSessionThreadMsg *ms
 	return CS_CLASS (session)->thread_queue(session, msg, flags);
 }
 
+/**
+ * camel_lite_session_thread_queue_keyed:
+ * @session: a #CamelSession object
+ * @msg: a #CamelSessionThreadMsg
+ * @key: serialisation key, usually the folder the message works on
+ * @flags: CAMEL_SESSION_THREAD_PRIORITY_HIGH or _LOW, or 0
+ *
+ * Queue a thread message in another thread for processing. Messages
+ * queued with the same @key are processed one after another, in the order
+ * they were queued. Messages with different keys may run in parallel.
+ * Messages queued with #camel_lite_session_thread_queue, or with a %NULL
+ * @key, all share one default lane and never run in parallel with each
+ * other, but they do run in parallel with keyed messages. A message that
+ * must not overlap with those of a key has to be queued with that key.
+ *
+ * Sessions which override the thread_queue method but not thread_queue_keyed
+ * get keyed messages passed to thread_queue, without their key.
+ *
+ * Returns the id of the operation queued
+ **/
+int
+camel_lite_session_thread_queue_keyed(CamelSession *session, CamelSessionThreadMsg *msg, const void *key, int flags)
+{
+	g_assert(CAMEL_IS_SESSION(session));
+	g_assert(msg != NULL);
+
+	return CS_CLASS (session)->thread_queue_keyed(session, msg, key, flags);
+}
+
+/**
+ * camel_lite_session_thread_get_stats:
+ * @session: a #CamelSession object
+ * @stats: a #CamelSessionThreadStats to fill in
+ *
+ * Get a snapshot of the queue depth, activity and queueing latency of
+ * the session's thread messages.
+ **/
+void
+camel_lite_session_thread_get_stats(CamelSession *session, CamelSessionThreadStats *stats)
+{
+	g_assert(CAMEL_IS_SESSION(session));
+	g_assert(stats != NULL);
+
+	CAMEL_SESSION_LOCK(session, thread_lock);
+	stats->threads = session->priv->thread_pool_size;
+	stats->queued = session->priv->thread_queued;
+	stats->running = session->priv->thread_running;
+	stats->lanes = g_hash_table_size(session->priv->thread_lanes);
+	if (session->priv->thread_default_lane->running
+	    || !g_queue_is_empty(session->priv->thread_default_lane->jobs))
+		stats->lanes++;
+	stats->completed = session->priv->thread_completed;
+	stats->wait_total = session->priv->thread_wait_total;
+	stats->wait_max = session->priv->thread_wait_max;
+	CAMEL_SESSION_UNLOCK(session, thread_lock);
+}
+
+/**
+ * camel_lite_session_set_thread_pool_size:
+ * @session: a #CamelSession object
+ * @max_threads: maximum number of threads processing thread messages
+ *
+ * Set how many thread messages with different keys may run at the same
+ * time.
+ **/
+void
+camel_lite_session_set_thread_pool_size(CamelSession *session, int max_threads)
+{
+	g_assert(CAMEL_IS_SESSION(session));
+	g_return_if_fail(max_threads > 0);
+
+	CAMEL_SESSION_LOCK(session, thread_lock);
+	session->priv->thread_pool_size = max_threads;
+	if (session->priv->thread_pool)
+		g_thread_pool_set_max_threads(session->priv->thread_pool, max_threads, NULL);
+	CAMEL_SESSION_UNLOCK(session, thread_lock);
+}
+
 /**
  * camel_lite_session_thread_wait:
  * @session: a #CamelSession object
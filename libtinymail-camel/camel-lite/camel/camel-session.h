@@ -110,6 +110,7 @@ typedef struct {
 	void (*thread_wait)(CamelSession *session, int id);
 	void (*thread_status)(CamelSession *session, CamelSessionThreadMsg *msg, const char *text, int pc);
 	gboolean (*lookup_addressbook) (CamelSession *session, const char *name);
+	int (*thread_queue_keyed)(CamelSession *session, CamelSessionThreadMsg *msg, const void *key, int flags);
 } CamelSessionClass;
 
 
@@ -205,10 +206,29 @@ struct _CamelSessionThreadMsg {
 	/* user fields follow */
 };
 
+/* flags for camel_lite_session_thread_queue */
+enum {
+	CAMEL_SESSION_THREAD_PRIORITY_HIGH = 1<<0,
+	CAMEL_SESSION_THREAD_PRIORITY_LOW = 1<<1
+};
+
+typedef struct _CamelSessionThreadStats {
+	guint threads;		/* maximum number of worker threads */
+	guint queued;		/* messages waiting to run */
+	guint running;		/* messages being processed */
+	guint lanes;		/* serialisation keys with queued or running work */
+	guint64 completed;	/* messages processed so far */
+	guint64 wait_total;	/* usecs spent queued, summed over completed messages */
+	guint64 wait_max;	/* longest time a message spent queued, in usecs */
+} CamelSessionThreadStats;
+
 void *camel_lite_session_thread_msg_new(CamelSession *session, CamelSessionThreadOps *ops, unsigned int size);
 void camel_lite_session_thread_msg_free(CamelSession *session, CamelSessionThreadMsg *msg);
 int camel_lite_session_thread_queue(CamelSession *session, CamelSessionThreadMsg *msg, int flags);
+int camel_lite_session_thread_queue_keyed(CamelSession *session, CamelSessionThreadMsg *msg, const void *key, int flags);
 void camel_lite_session_thread_wait(CamelSession *session, int id);
+void camel_lite_session_thread_get_stats(CamelSession *session, CamelSessionThreadStats *stats);
+void camel_lite_session_set_thread_pool_size(CamelSession *session, int max_threads);
 gboolean camel_lite_session_get_network_state (CamelSession *session);
 void camel_lite_session_set_network_state (CamelSession *session, gboolean network_state);
 const GHashTable * camel_lite_session_get_junk_headers (CamelSession *session);
@@ -98,6 +98,22 @@ restore (CamelStore *store)
 	return;
 }
 
+static void
+set_push_folders (CamelStore *store, GPtrArray *folder_names)
+{
+	return;
+}
+
+static void
+get_folder_status_many (CamelStore *store, CamelStoreFolderStatus *statuses, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		CS_CLASS (store)->get_folder_status (store, statuses[i].folder_name,
+			&statuses[i].unseen, &statuses[i].messages, &statuses[i].uidnext);
+}
+
 void
 camel_lite_store_restore (CamelStore *store)
 {
@@ -134,6 +150,8 @@ camel_lite_store_class_init (CamelStoreClass *camel_lite_store_class)
 	camel_lite_store_class->get_folder_status = get_folder_status_impl;
 	camel_lite_store_class->delete_cache = delete_cache;
 	camel_lite_store_class->restore = restore;
+	camel_lite_store_class->set_push_folders = set_push_folders;
+	camel_lite_store_class->get_folder_status_many = get_folder_status_many;
 
 	/* virtual method overload */
 	camel_lite_service_class->construct = construct;
@@ -147,6 +165,7 @@ camel_lite_store_class_init (CamelStoreClass *camel_lite_store_class)
 	camel_lite_object_class_add_event(camel_lite_object_class, "folder_renamed", NULL);
 	camel_lite_object_class_add_event(camel_lite_object_class, "folder_subscribed", NULL);
 	camel_lite_object_class_add_event(camel_lite_object_class, "folder_unsubscribed", NULL);
+	camel_lite_object_class_add_event(camel_lite_object_class, "folder_status", NULL);
 }
 
 static void
@@ -234,6 +253,45 @@ get_folder_status_impl (CamelStore *store, const char *folder_name, int *unseen,
 	return;
 }
 
+/**
+ * camel_lite_store_set_push_folders:
+ * @store: a #CamelStore object
+ * @folder_names: full names of the folders to watch, or %NULL for none
+ *
+ * Ask @store to watch @folder_names for new and removed messages while
+ * it is online, whether or not they are open.  Changes are signalled
+ * with the "folder_status" event, whose data is a
+ * #CamelStoreFolderStatus, from a thread of the store's own.  Stores
+ * that can't push ignore this.
+ **/
+void
+camel_lite_store_set_push_folders (CamelStore *store, GPtrArray *folder_names)
+{
+	g_return_if_fail (CAMEL_IS_STORE (store));
+
+	CS_CLASS (store)->set_push_folders (store, folder_names);
+}
+
+/**
+ * camel_lite_store_get_folder_status_many:
+ * @store: a #CamelStore object
+ * @statuses: the folders to get the counts of
+ * @count: number of elements in @statuses
+ *
+ * Like camel_lite_store_get_folder_status() for each of @statuses,
+ * filling in their counts, but stores that can ask about several
+ * folders at once do so.  The caller sets the counts to -1, those
+ * which can't be found out are left alone.
+ **/
+void
+camel_lite_store_get_folder_status_many (CamelStore *store, CamelStoreFolderStatus *statuses, int count)
+{
+	g_return_if_fail (CAMEL_IS_STORE (store));
+
+	if (count > 0)
+		CS_CLASS (store)->get_folder_status_many (store, statuses, count);
+}
+
 
 static int
 store_setv (CamelObject *object, CamelException *ex, CamelArgV *args)
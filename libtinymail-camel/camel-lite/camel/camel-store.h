@@ -55,6 +55,16 @@ typedef struct _CamelFolderInfo {
 
 } CamelFolderInfo;
 
+/* Data of the "folder_status" event and of
+   camel_lite_store_get_folder_status_many(), counts which aren't known
+   are -1 */
+typedef struct _CamelStoreFolderStatus {
+	const char *folder_name;
+	int unseen;
+	int messages;
+	int uidnext;
+} CamelStoreFolderStatus;
+
 /* Note: these are abstractions (duh), its upto the provider to make them make sense */
 
 /* a folder which can't contain messages */
@@ -201,6 +211,13 @@ typedef struct {
 
 	void             (*restore)                 (CamelStore *store);
 
+	void             (*set_push_folders)        (CamelStore *store,
+						     GPtrArray *folder_names);
+
+	void             (*get_folder_status_many)  (CamelStore *store,
+						     CamelStoreFolderStatus *statuses,
+						     int count);
+
 } CamelStoreClass;
 
 /* Standard Camel function */
@@ -281,6 +298,13 @@ int              camel_lite_store_get_local_size          (CamelStore *store, co
 
 void             camel_lite_store_restore                 (CamelStore *store);
 
+void             camel_lite_store_set_push_folders        (CamelStore *store,
+						      GPtrArray *folder_names);
+
+void             camel_lite_store_get_folder_status_many  (CamelStore *store,
+						      CamelStoreFolderStatus *statuses,
+						      int count);
+
 typedef struct _CamelISubscribe CamelISubscribe;
 struct _CamelISubscribe {
 	CamelInterface iface;
@@ -345,6 +345,54 @@ camel_lite_stream_buffer_read_opp (CamelStream *stream, char *buffer, size_t n,
 	return (ssize_t)(bptr - buffer);
 }
 
+/**
+ * camel_lite_stream_buffer_peek:
+ * @sbf: a #CamelStreamBuffer object
+ * @data: where to return a pointer to the buffered data
+ *
+ * Points *@data at the data that is buffered in @sbf, reading more
+ * from the underlying stream only if the buffer is empty. Nothing is
+ * consumed, use camel_lite_stream_buffer_consume() for that. The data
+ * stays valid until the next read from @sbf.
+ *
+ * Returns the number of bytes available at *@data, %0 for end of file
+ * and %-1 on error.
+ **/
+ssize_t
+camel_lite_stream_buffer_peek (CamelStreamBuffer *sbf, const char **data)
+{
+	ssize_t bytes_read;
+
+	g_return_val_if_fail ((sbf->mode & CAMEL_STREAM_BUFFER_MODE) == CAMEL_STREAM_BUFFER_READ, -1);
+
+	if (sbf->ptr >= sbf->end) {
+		bytes_read = camel_lite_stream_read (sbf->stream, (char *) sbf->buf, sbf->size);
+		if (bytes_read <= 0)
+			return bytes_read;
+		sbf->ptr = sbf->buf;
+		sbf->end = sbf->buf + bytes_read;
+	}
+
+	*data = (const char *) sbf->ptr;
+
+	return (ssize_t) (sbf->end - sbf->ptr);
+}
+
+/**
+ * camel_lite_stream_buffer_consume:
+ * @sbf: a #CamelStreamBuffer object
+ * @n: number of bytes
+ *
+ * Skips @n bytes of the data returned by camel_lite_stream_buffer_peek().
+ **/
+void
+camel_lite_stream_buffer_consume (CamelStreamBuffer *sbf, size_t n)
+{
+	g_return_if_fail (n <= sbf->end - sbf->ptr);
+
+	sbf->ptr += n;
+}
+
 /* only returns the number passed in, or -1 on an error */
 static ssize_t
 stream_write_all(CamelStream *stream, const char *buffer, size_t n)
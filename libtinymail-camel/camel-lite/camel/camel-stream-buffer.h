@@ -98,6 +98,10 @@ int camel_lite_tcp_stream_buffer_gets_nb (CamelStreamBuffer *sbf, char *buf, uns
 
 ssize_t camel_lite_stream_buffer_read_opp (CamelStream *stream, char *buffer, size_t n, int len);
 
+/* look at the buffered data without copying it out */
+ssize_t camel_lite_stream_buffer_peek (CamelStreamBuffer *sbf, const char **data);
+void camel_lite_stream_buffer_consume (CamelStreamBuffer *sbf, size_t n);
+
 G_END_DECLS
 
 #endif /* CAMEL_STREAM_BUFFER_H */
@@ -28,6 +28,8 @@
 #include <string.h>
 #include <pthread.h>
 
+#include <libedataserver/e-lite-memory.h>
+
 #include "camel-string-utils.h"
 
 #include <sys/types.h>
@@ -242,9 +244,61 @@ char camel_lite_toupper(char c)
 static int cnt=0;
 #endif
 
-/* working stuff for pstrings */
-static pthread_mutex_t pstring_lock = PTHREAD_MUTEX_INITIALIZER;
-static GHashTable *pstring_table = NULL;
+/* working stuff for pstrings
+
+   The pool is split into PSTRING_SHARDS tables, each with its own
+   lock, picked by the string's hash, so that summaries being loaded
+   on different threads mostly don't meet on the same lock.  The
+   refcount is kept as the value in the table, so the pooled string
+   is a plain allocation and a string which is handed over to the pool
+   is kept as it is, rather than copied. */
+
+#define PSTRING_SHARDS (32)	/* must be a power of 2 */
+
+struct _pstring_shard {
+	pthread_mutex_t lock;
+	GHashTable *table;	/* str -> refcount */
+
+	/* statistics, updated under lock apart from contended */
+	guint strings;
+	guint refs;
+	guint bytes;
+	guint lookups;
+	volatile int contended;
+};
+
+static struct _pstring_shard pstring_shards[PSTRING_SHARDS];
+static pthread_once_t pstring_once = PTHREAD_ONCE_INIT;
+
+static void
+pstring_init (void)
+{
+	int i;
+
+	for (i = 0; i < PSTRING_SHARDS; i++) {
+		pthread_mutex_init (&pstring_shards[i].lock, NULL);
+		pstring_shards[i].table = g_hash_table_new (g_str_hash, g_str_equal);
+	}
+}
+
+static struct _pstring_shard *
+pstring_shard_lock (const char *str)
+{
+	struct _pstring_shard *shard;
+	guint hash;
+
+	pthread_once (&pstring_once, pstring_init);
+
+	hash = g_str_hash (str);
+	shard = &pstring_shards[(hash ^ (hash >> 16)) & (PSTRING_SHARDS - 1)];
+
+	if (pthread_mutex_trylock (&shard->lock) != 0) {
+		g_atomic_int_inc (&shard->contended);
+		pthread_mutex_lock (&shard->lock);
+	}
+
+	return shard;
+}
 
 /**
  * camel_lite_pstring_add:
@@ -261,8 +315,9 @@ static GHashTable *pstring_table = NULL;
 const char *
 camel_lite_pstring_add (char *str, gboolean own)
 {
-	void *pcount;
-	char *pstr;
+	struct _pstring_shard *shard;
+	gpointer pstr, pcount;
+	char *pooled;
 	int count;
 
 	if (str == NULL)
@@ -274,28 +329,32 @@ camel_lite_pstring_add (char *str, gboolean own)
 		return "";
 	}
 
-	pthread_mutex_lock (&pstring_lock);
-	if (pstring_table == NULL)
-		pstring_table = g_hash_table_new (g_str_hash, g_str_equal);
+	shard = pstring_shard_lock (str);
+	shard->lookups++;
 
-	if (g_hash_table_lookup_extended (pstring_table, str, (void **) &pstr, &pcount)) {
+	if (g_hash_table_lookup_extended (shard->table, str, &pstr, &pcount)) {
+		pooled = pstr;
 		count = GPOINTER_TO_INT (pcount) + 1;
-		g_hash_table_insert (pstring_table, pstr, GINT_TO_POINTER (count));
+		g_hash_table_insert (shard->table, pooled, GINT_TO_POINTER (count));
 		if (own)
 			g_free (str);
 	} else {
-		pstr = own ? str : g_strdup (str);
+		/* an owned string becomes the pooled one as it is */
+		pooled = own ? str : g_strdup (str);
 
 #ifdef MEMDEBUG
 		cnt++;
 		printf ("%d\n", cnt);
 #endif
-		g_hash_table_insert (pstring_table, pstr, GINT_TO_POINTER (1));
+		g_hash_table_insert (shard->table, pooled, GINT_TO_POINTER (1));
+		shard->strings++;
+		shard->bytes += strlen (pooled) + 1;
 	}
+	shard->refs++;
 
-	pthread_mutex_unlock (&pstring_lock);
+	pthread_mutex_unlock (&shard->lock);
 
-	return pstr;
+	return pooled;
 }
 
 
@@ -331,30 +390,152 @@ camel_lite_pstring_strdup (const char *s)
 void
 camel_lite_pstring_free(const char *s)
 {
-	char *p;
-	void *pcount;
+	struct _pstring_shard *shard;
+	gpointer pstr, pcount;
 	int count;
 
-	if (pstring_table == NULL)
-		return;
 	if (s == NULL || s[0] == 0)
 		return;
 
-	pthread_mutex_lock(&pstring_lock);
-	if (g_hash_table_lookup_extended(pstring_table, s, (void **)&p, &pcount)) {
-		count = GPOINTER_TO_INT(pcount)-1;
-		if (count == 0) {
-			g_hash_table_remove(pstring_table, p);
-			g_free(p);
+	shard = pstring_shard_lock (s);
+
+	/* look it up rather than trusting the pointer, so strings which
+	   didn't come from the pool are only warned about */
+	if (g_hash_table_lookup_extended (shard->table, s, &pstr, &pcount)) {
+		shard->refs--;
+		count = GPOINTER_TO_INT (pcount) - 1;
+		if (count > 0) {
+			g_hash_table_insert (shard->table, pstr, GINT_TO_POINTER (count));
+		} else {
+			g_hash_table_remove (shard->table, pstr);
+			shard->strings--;
+			shard->bytes -= strlen (pstr) + 1;
+			g_free (pstr);
 #ifdef MEMDEBUG
 			cnt--;
 			printf ("%d\n", cnt);
 #endif
-		} else {
-			g_hash_table_insert(pstring_table, p, GINT_TO_POINTER(count));
 		}
 	} else {
 		g_warning("Trying to free string not allocated from the pool '%s'", s);
 	}
-	pthread_mutex_unlock(&pstring_lock);
+
+	pthread_mutex_unlock (&shard->lock);
+}
+
+
+/**
+ * camel_lite_pstring_get_stats:
+ * @stats: statistics to fill in
+ *
+ * Fill in @stats with the current occupancy of the string pool, and
+ * how often adding or freeing a string had to wait for another thread
+ * holding the same shard.
+ **/
+void
+camel_lite_pstring_get_stats (CamelPStringStats *stats)
+{
+	struct _pstring_shard *shard;
+	int i;
+
+	pthread_once (&pstring_once, pstring_init);
+
+	memset (stats, 0, sizeof (*stats));
+	stats->shards = PSTRING_SHARDS;
+
+	for (i = 0; i < PSTRING_SHARDS; i++) {
+		shard = &pstring_shards[i];
+
+		pthread_mutex_lock (&shard->lock);
+		stats->strings += shard->strings;
+		stats->refs += shard->refs;
+		stats->bytes += shard->bytes;
+		stats->lookups += shard->lookups;
+		stats->shard_max = MAX (stats->shard_max, shard->strings);
+		pthread_mutex_unlock (&shard->lock);
+
+		stats->contended += g_atomic_int_get (&shard->contended);
+	}
+}
+
+
+/* Arenas hold the strings of something which is thrown away as a
+   whole, they aren't refcounted and are only freed with the arena. */
+struct _CamelPStringArena {
+	pthread_mutex_t lock;
+	GHashTable *table;
+	EMemPool *pool;
+};
+
+/**
+ * camel_lite_pstring_arena_new:
+ *
+ * Create a new string arena.  Strings added to an arena are
+ * uniquified within it like pooled strings, but aren't refcounted,
+ * they are all released at once by camel_lite_pstring_arena_free().
+ *
+ * Return value: A new #CamelPStringArena.
+ **/
+CamelPStringArena *
+camel_lite_pstring_arena_new (void)
+{
+	CamelPStringArena *arena = g_malloc (sizeof (*arena));
+
+	pthread_mutex_init (&arena->lock, NULL);
+	arena->table = g_hash_table_new (g_str_hash, g_str_equal);
+	arena->pool = e_mempool_new (4096, 1024, E_MEMPOOL_ALIGN_BYTE);
+
+	return arena;
+}
+
+/**
+ * camel_lite_pstring_arena_add:
+ * @arena: a #CamelPStringArena
+ * @str: string to add to the arena
+ * @own: whether @str should be freed once it is copied into the arena
+ *
+ * Add the string to @arena.
+ *
+ * The NULL and empty strings are special cased to constant values.
+ *
+ * Return value: A pointer to an equivalent string of @str, valid
+ * until @arena is freed.
+ **/
+const char *
+camel_lite_pstring_arena_add (CamelPStringArena *arena, char *str, gboolean own)
+{
+	char *astr;
+
+	if (str == NULL)
+		return NULL;
+
+	if (str[0] != '\0') {
+		pthread_mutex_lock (&arena->lock);
+		if ((astr = g_hash_table_lookup (arena->table, str)) == NULL) {
+			astr = e_mempool_strdup (arena->pool, str);
+			g_hash_table_insert (arena->table, astr, astr);
+		}
+		pthread_mutex_unlock (&arena->lock);
+	} else
+		astr = "";
+
+	if (own)
+		g_free (str);
+
+	return astr;
+}
+
+/**
+ * camel_lite_pstring_arena_free:
+ * @arena: a #CamelPStringArena
+ *
+ * Free @arena and every string that was added to it.
+ **/
+void
+camel_lite_pstring_arena_free (CamelPStringArena *arena)
+{
+	g_hash_table_destroy (arena->table);
+	e_mempool_destroy (arena->pool);
+	pthread_mutex_destroy (&arena->lock);
+	g_free (arena);
 }
@@ -42,9 +42,27 @@ const char *camel_lite_strdown (char *str);
 char camel_lite_tolower(char c);
 char camel_lite_toupper(char c);
 
+typedef struct _CamelPStringStats CamelPStringStats;
+typedef struct _CamelPStringArena CamelPStringArena;
+
+struct _CamelPStringStats {
+	guint shards;		/* number of lock stripes */
+	guint strings;		/* distinct strings in the pool */
+	guint refs;		/* outstanding references */
+	guint bytes;		/* string bytes held */
+	guint shard_max;	/* strings in the fullest shard */
+	guint lookups;		/* adds since startup */
+	guint contended;	/* adds and frees which had to wait on a shard lock */
+};
+
 const char *camel_lite_pstring_add (char *str, gboolean own);
 const char *camel_lite_pstring_strdup(const char *s);
 void camel_lite_pstring_free(const char *s);
+void camel_lite_pstring_get_stats (CamelPStringStats *stats);
+
+CamelPStringArena *camel_lite_pstring_arena_new (void);
+const char *camel_lite_pstring_arena_add (CamelPStringArena *arena, char *str, gboolean own);
+void camel_lite_pstring_arena_free (CamelPStringArena *arena);
 
 G_END_DECLS
 
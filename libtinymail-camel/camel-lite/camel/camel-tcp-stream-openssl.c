@@ -72,6 +72,7 @@ static int stream_setsockopt (CamelTcpStream *stream, const CamelSockOptData *da
 static struct sockaddr *stream_get_local_address (CamelTcpStream *stream, socklen_t *len);
 static struct sockaddr *stream_get_remote_address (CamelTcpStream *stream, socklen_t *len);
 static int stream_gettimeout (CamelTcpStream *stream);
+static int stream_get_fd (CamelTcpStream *stream);
 
 static SSL *open_ssl_connection (CamelSession *session, int sockfd, CamelTcpStreamSSL *openssl);
 
@@ -214,6 +215,7 @@ camel_lite_tcp_stream_ssl_class_init (CamelTcpStreamSSLClass *camel_lite_tcp_str
 
 	camel_lite_tcp_stream_class->enable_compress = openssl_enable_compress;
 	camel_lite_tcp_stream_class->gettimeout = stream_gettimeout;
+	camel_lite_tcp_stream_class->get_fd = stream_get_fd;
 	camel_lite_tcp_stream_class->read_nb = stream_read_nb;
 	camel_lite_tcp_stream_class->connect = stream_connect;
 	camel_lite_tcp_stream_class->getsockopt = stream_getsockopt;
@@ -404,6 +406,12 @@ stream_gettimeout (CamelTcpStream *stream)
 	return SSL_get_default_timeout ((const SSL*) ssl);
 }
 
+static int
+stream_get_fd (CamelTcpStream *stream)
+{
+	return CAMEL_TCP_STREAM_SSL (stream)->priv->sockfd;
+}
+
 static ssize_t
 stream_read_nb (CamelTcpStream *stream, char *buffer, size_t n)
 {
@@ -67,6 +67,7 @@ static struct sockaddr *stream_get_local_address (CamelTcpStream *stream, sockle
 static struct sockaddr *stream_get_remote_address (CamelTcpStream *stream, socklen_t *len);
 static ssize_t stream_read_nb (CamelTcpStream *stream, char *buffer, size_t n);
 static int stream_gettimeout (CamelTcpStream *stream);
+static int stream_get_fd (CamelTcpStream *stream);
 
 
 static void 
@@ -94,6 +95,7 @@ camel_lite_tcp_stream_raw_class_init (CamelTcpStreamRawClass *camel_lite_tcp_str
 
 	camel_lite_tcp_stream_class->enable_compress = raw_enable_compress;
 	camel_lite_tcp_stream_class->gettimeout = stream_gettimeout;
+	camel_lite_tcp_stream_class->get_fd = stream_get_fd;
 	camel_lite_tcp_stream_class->read_nb = stream_read_nb;
 	camel_lite_tcp_stream_class->connect = stream_connect;
 	camel_lite_tcp_stream_class->getsockopt = stream_getsockopt;
@@ -108,6 +110,12 @@ stream_gettimeout (CamelTcpStream *stream)
 	return 600;
 }
 
+static int
+stream_get_fd (CamelTcpStream *stream)
+{
+	return CAMEL_TCP_STREAM_RAW (stream)->sockfd;
+}
+
 static void
 camel_lite_tcp_stream_raw_init (gpointer object, gpointer klass)
 {
@@ -85,6 +85,7 @@ static struct sockaddr *stream_get_local_address (CamelTcpStream *stream, sockle
 static struct sockaddr *stream_get_remote_address (CamelTcpStream *stream, socklen_t *len);
 static ssize_t stream_read_nb (CamelTcpStream *stream, char *buffer, size_t n);
 static int stream_gettimeout (CamelTcpStream *stream);
+static int stream_get_fd (CamelTcpStream *stream);
 
 static gboolean begin_read (CamelTcpStreamSSL *stream);
 static void end_read (CamelTcpStreamSSL *stream);
@@ -202,6 +203,7 @@ camel_lite_tcp_stream_ssl_class_init (CamelTcpStreamSSLClass *camel_lite_tcp_str
 
 	camel_lite_tcp_stream_class->enable_compress = ssl_enable_compress;
 	camel_lite_tcp_stream_class->gettimeout = stream_gettimeout;
+	camel_lite_tcp_stream_class->get_fd = stream_get_fd;
 	camel_lite_tcp_stream_class->read_nb = stream_read_nb;
 	camel_lite_tcp_stream_class->connect = stream_connect;
 	camel_lite_tcp_stream_class->getsockopt = stream_getsockopt;
@@ -216,6 +218,18 @@ stream_gettimeout (CamelTcpStream *stream)
 	return 330;
 }
 
+static int
+stream_get_fd (CamelTcpStream *stream)
+{
+	CamelTcpStreamSSL *ssl = CAMEL_TCP_STREAM_SSL (stream);
+
+	/* the native socket is at the bottom of the SSL layer */
+	if (ssl->priv->sockfd == NULL)
+		return -1;
+
+	return PR_FileDesc2NativeHandle (ssl->priv->sockfd);
+}
+
 static void
 camel_lite_tcp_stream_ssl_init (gpointer object, gpointer klass)
 {
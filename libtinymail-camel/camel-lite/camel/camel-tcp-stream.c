@@ -42,6 +42,7 @@ static struct sockaddr *tcp_get_local_address (CamelTcpStream *stream, socklen_t
 static struct sockaddr *tcp_get_remote_address (CamelTcpStream *stream, socklen_t *len);
 static ssize_t tcp_read_nb (CamelTcpStream *stream, char *buffer, size_t n);
 static int tcp_gettimeout (CamelTcpStream *stream);
+static int tcp_get_fd (CamelTcpStream *stream);
 
 static void 
 tcp_enable_compress (CamelTcpStream *stream)
@@ -61,6 +62,7 @@ camel_lite_tcp_stream_class_init (CamelTcpStreamClass *camel_lite_tcp_stream_cla
 	/* tcp stream methods */
 	camel_lite_tcp_stream_class->enable_compress     = tcp_enable_compress;
 	camel_lite_tcp_stream_class->gettimeout         = tcp_gettimeout;
+	camel_lite_tcp_stream_class->get_fd             = tcp_get_fd;
 	camel_lite_tcp_stream_class->read_nb            = tcp_read_nb;
 	camel_lite_tcp_stream_class->connect            = tcp_connect;
 	camel_lite_tcp_stream_class->getsockopt         = tcp_getsockopt;
@@ -174,6 +176,31 @@ camel_lite_tcp_stream_gettimeout (CamelTcpStream *stream)
 	return CTS_CLASS (stream)->gettimeout (stream);
 }
 
+static int
+tcp_get_fd (CamelTcpStream *stream)
+{
+	return -1;
+}
+
+/**
+ * camel_lite_tcp_stream_get_fd:
+ * @stream: a #CamelTcpStream object
+ *
+ * Get the socket underneath @stream, for waiting on it with poll().
+ * Data which the stream has read from the socket but not handed out
+ * yet doesn't show up there, read everything with
+ * camel_lite_tcp_stream_read_nb() before waiting.
+ *
+ * Returns the file descriptor or %-1 if the stream has none
+ **/
+int
+camel_lite_tcp_stream_get_fd (CamelTcpStream *stream)
+{
+	g_return_val_if_fail (CAMEL_IS_TCP_STREAM (stream), -1);
+
+	return CTS_CLASS (stream)->get_fd (stream);
+}
+
 static int
 tcp_setsockopt (CamelTcpStream *stream, const CamelSockOptData *data)
 {
@@ -109,6 +109,7 @@ typedef struct {
 	ssize_t (*read_nb)   (CamelTcpStream *stream, char *buffer, size_t n);
 	int (*gettimeout) (CamelTcpStream *stream);
 	void (*enable_compress) (CamelTcpStream *stream);
+	int (*get_fd) (CamelTcpStream *stream);
 
 } CamelTcpStreamClass;
 
@@ -129,6 +130,8 @@ int         camel_lite_tcp_stream_gettimeout (CamelTcpStream *stream);
 
 void        camel_lite_tcp_stream_enable_compress (CamelTcpStream *stream);
 
+int         camel_lite_tcp_stream_get_fd (CamelTcpStream *stream);
+
 G_END_DECLS
 
 #endif /* CAMEL_TCP_STREAM_H */
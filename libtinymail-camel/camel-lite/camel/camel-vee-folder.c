@@ -28,6 +28,7 @@
 
 #include <glib.h>
 #include <glib/gi18n-lib.h>
+#include <glib/gstdio.h>
 
 #include <libedataserver/md5-utils.h>
 
@@ -37,6 +38,7 @@
 
 #include "camel-debug.h"
 #include "camel-exception.h"
+#include "camel-file-utils.h"
 #include "camel-folder-search.h"
 #include "camel-mime-message.h"
 #include "camel-private.h"
@@ -76,6 +78,7 @@ static void camel_lite_vee_folder_finalise   (CamelObject *obj);
 
 static int vee_rebuild_folder(CamelVeeFolder *vf, CamelFolder *source, CamelException *ex);
 static void vee_folder_remove_folder(CamelVeeFolder *vf, CamelFolder *source);
+static void vee_match_caches_save(CamelVeeFolder *vf);
 
 static void folder_changed(CamelFolder *sub, CamelFolderChangeInfo *changes, CamelVeeFolder *vf);
 static void subfolder_deleted(CamelFolder *f, void *event_data, CamelVeeFolder *vf);
@@ -500,6 +503,8 @@ vee_sync(CamelFolder *folder, gboolean expunge, CamelException *ex)
 
 	CAMEL_VEE_FOLDER_UNLOCK(vf, subfolder_lock);
 
+	vee_match_caches_save(vf);
+
 	/* camel_lite_object_state_write(vf); */
 }
 
@@ -840,6 +845,437 @@ vee_folder_remove_folder(CamelVeeFolder *vf, CamelFolder *source)
 	}
 }
 
+/* ********************************************************************** *
+   Match cache
+
+   For every source folder we remember what the expression gave for each
+   of its messages, together with the message flags at that time. A
+   rebuild then only has to search the messages that are new or whose
+   flags changed since, instead of running the expression over the whole
+   source folder. Changes coming from the source folders keep the cache
+   current, and it is stored next to the vfolder's state file so it also
+   survives a restart. */
+
+#define CAMEL_VEE_MATCH_CACHE_VERSION (1)
+
+struct _vee_match {
+	guint32 flags;		/* message flags when the expression was evaluated */
+	guint32 matched:1;
+	guint32 seen:1;		/* scratch, used while validating */
+};
+
+struct _vee_match_cache {
+	char *expression;	/* the expression the matches are for */
+	GHashTable *uids;	/* uid -> struct _vee_match */
+	int dirty;
+};
+
+static void
+vee_match_free(struct _vee_match *m)
+{
+	g_slice_free(struct _vee_match, m);
+}
+
+static struct _vee_match_cache *
+vee_match_cache_new(void)
+{
+	struct _vee_match_cache *cache = g_new0(struct _vee_match_cache, 1);
+
+	cache->uids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)vee_match_free);
+
+	return cache;
+}
+
+static void
+vee_match_cache_free(struct _vee_match_cache *cache)
+{
+	g_free(cache->expression);
+	g_hash_table_destroy(cache->uids);
+	g_free(cache);
+}
+
+static void
+vee_match_cache_set(struct _vee_match_cache *cache, const char *uid, guint32 flags, int matched)
+{
+	struct _vee_match *m;
+
+	m = g_hash_table_lookup(cache->uids, uid);
+	if (m == NULL) {
+		m = g_slice_new0(struct _vee_match);
+		g_hash_table_insert(cache->uids, g_strdup(uid), m);
+	}
+	m->flags = flags;
+	m->matched = matched != 0;
+	cache->dirty = TRUE;
+}
+
+/* Only the message flags are remembered with a match, so an expression
+   may only depend on those and on what never changes. The current date
+   gives a different answer every time, user flags and tags (which
+   labels are made of) can change without the flags changing, and
+   threads depend on the other messages */
+static gboolean
+vee_match_expression_cacheable(const char *expression)
+{
+	return expression != NULL
+		&& strstr(expression, "get-current-date") == NULL
+		&& strstr(expression, "user-flag") == NULL
+		&& strstr(expression, "user-tag") == NULL
+		&& strstr(expression, "match-threads") == NULL;
+}
+
+static gboolean
+vee_match_cache_valid(struct _vee_match_cache *cache, const char *expression)
+{
+	return vee_match_expression_cacheable(expression)
+		&& cache->expression != NULL
+		&& strcmp(cache->expression, expression) == 0;
+}
+
+static char *
+vee_match_cache_path(CamelVeeFolder *vf, CamelFolder *source)
+{
+	CamelFolder *folder = (CamelFolder *)vf;
+	CamelURL *url = ((CamelService *)folder->parent_store)->url;
+	char hash[9];
+
+	if (url == NULL || url->path == NULL)
+		return NULL;
+
+	camel_lite_vee_folder_hash_folder(source, hash);
+	hash[8] = 0;
+
+	return g_strdup_printf("%s/%s.%s.vmatch", url->path, folder->full_name, hash);
+}
+
+static struct _vee_match_cache *
+vee_match_cache_load(CamelVeeFolder *vf, CamelFolder *source)
+{
+	struct _vee_match_cache *cache = vee_match_cache_new();
+	guint32 version, count, flags, matched, i;
+	char *path, *uid;
+	FILE *in;
+
+	path = vee_match_cache_path(vf, source);
+	if (path == NULL)
+		return cache;
+
+	in = g_fopen(path, "rb");
+	g_free(path);
+	if (in == NULL)
+		return cache;
+
+	if (camel_lite_file_util_decode_uint32(in, &version) == -1
+	    || version != CAMEL_VEE_MATCH_CACHE_VERSION
+	    || camel_lite_file_util_decode_string(in, &cache->expression) == -1
+	    || camel_lite_file_util_decode_uint32(in, &count) == -1)
+		goto fail;
+
+	for (i = 0; i < count; i++) {
+		if (camel_lite_file_util_decode_string(in, &uid) == -1)
+			goto fail;
+		if (camel_lite_file_util_decode_uint32(in, &flags) == -1
+		    || camel_lite_file_util_decode_uint32(in, &matched) == -1) {
+			g_free(uid);
+			goto fail;
+		}
+		vee_match_cache_set(cache, uid, flags, matched);
+		g_free(uid);
+	}
+
+	fclose(in);
+	cache->dirty = FALSE;
+
+	return cache;
+fail:
+	fclose(in);
+	vee_match_cache_free(cache);
+
+	return vee_match_cache_new();
+}
+
+static void
+vee_match_cache_save_uid(char *uid, struct _vee_match *m, FILE *out)
+{
+	camel_lite_file_util_encode_string(out, uid);
+	camel_lite_file_util_encode_uint32(out, m->flags);
+	camel_lite_file_util_encode_uint32(out, m->matched);
+}
+
+static void
+vee_match_cache_save(CamelVeeFolder *vf, CamelFolder *source, struct _vee_match_cache *cache)
+{
+	char *path, *savename;
+	FILE *out;
+
+	if (!cache->dirty || cache->expression == NULL)
+		return;
+
+	path = vee_match_cache_path(vf, source);
+	if (path == NULL)
+		return;
+
+	savename = camel_lite_file_util_savename(path);
+	out = g_fopen(savename, "wb");
+	if (out != NULL) {
+		camel_lite_file_util_encode_uint32(out, CAMEL_VEE_MATCH_CACHE_VERSION);
+		camel_lite_file_util_encode_string(out, cache->expression);
+		camel_lite_file_util_encode_uint32(out, g_hash_table_size(cache->uids));
+		g_hash_table_foreach(cache->uids, (GHFunc)vee_match_cache_save_uid, out);
+
+		if (ferror(out) == 0 && fclose(out) == 0) {
+			g_rename(savename, path);
+			cache->dirty = FALSE;
+		} else {
+			fclose(out);
+			g_unlink(savename);
+		}
+	}
+
+	g_free(savename);
+	g_free(path);
+}
+
+/* must hold match_lock */
+static struct _vee_match_cache *
+vee_match_cache_get(CamelVeeFolder *vf, CamelFolder *source)
+{
+	struct _CamelVeeFolderPrivate *p = _PRIVATE(vf);
+	struct _vee_match_cache *cache;
+
+	cache = g_hash_table_lookup(p->match_caches, source);
+	if (cache == NULL) {
+		cache = vee_match_cache_load(vf, source);
+		g_hash_table_insert(p->match_caches, source, cache);
+	}
+
+	return cache;
+}
+
+static void
+vee_match_cache_save_folder(CamelFolder *source, struct _vee_match_cache *cache, CamelVeeFolder *vf)
+{
+	vee_match_cache_save(vf, source, cache);
+}
+
+/* store the caches of all source folders, if they changed */
+static void
+vee_match_caches_save(CamelVeeFolder *vf)
+{
+	struct _CamelVeeFolderPrivate *p = _PRIVATE(vf);
+
+	CAMEL_VEE_FOLDER_LOCK(vf, match_lock);
+	g_hash_table_foreach(p->match_caches, (GHFunc)vee_match_cache_save_folder, vf);
+	CAMEL_VEE_FOLDER_UNLOCK(vf, match_lock);
+}
+
+/* store and drop the cache of a source folder that is going away */
+static void
+vee_match_cache_remove(CamelVeeFolder *vf, CamelFolder *source)
+{
+	struct _CamelVeeFolderPrivate *p = _PRIVATE(vf);
+	struct _vee_match_cache *cache;
+
+	CAMEL_VEE_FOLDER_LOCK(vf, match_lock);
+	cache = g_hash_table_lookup(p->match_caches, source);
+	if (cache) {
+		g_hash_table_steal(p->match_caches, source);
+		if ((source->folder_flags & CAMEL_FOLDER_HAS_BEEN_DELETED) == 0) {
+			vee_match_cache_save(vf, source, cache);
+		} else {
+			char *path = vee_match_cache_path(vf, source);
+
+			if (path) {
+				g_unlink(path);
+				g_free(path);
+			}
+		}
+		vee_match_cache_free(cache);
+	}
+	CAMEL_VEE_FOLDER_UNLOCK(vf, match_lock);
+}
+
+static gboolean
+vee_match_unseen(char *uid, struct _vee_match *m, void *data)
+{
+	if (m->seen) {
+		m->seen = FALSE;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Update the cache with the result of a search of @expression over @uids,
+   @matches is the search result, or NULL if the uids need to be searched
+   again next time. @flags holds the flags of @uids from before the search,
+   if it is NULL the current flags are taken */
+static void
+vee_match_cache_update(CamelVeeFolder *vf, CamelFolder *source, const char *expression,
+		       GPtrArray *uids, GArray *flags, GPtrArray *matches)
+{
+	struct _vee_match_cache *cache;
+	GHashTable *matchhash = NULL;
+	CamelMessageInfo *info;
+	int i;
+
+	CAMEL_VEE_FOLDER_LOCK(vf, match_lock);
+
+	cache = g_hash_table_lookup(_PRIVATE(vf)->match_caches, source);
+	if (cache == NULL || !vee_match_cache_valid(cache, expression)) {
+		CAMEL_VEE_FOLDER_UNLOCK(vf, match_lock);
+		return;
+	}
+
+	if (matches) {
+		matchhash = g_hash_table_new(g_str_hash, g_str_equal);
+		for (i = 0; i < matches->len; i++)
+			g_hash_table_insert(matchhash, matches->pdata[i], GINT_TO_POINTER (1));
+	}
+
+	for (i = 0; i < uids->len; i++) {
+		if (matchhash && flags) {
+			vee_match_cache_set(cache, uids->pdata[i], g_array_index(flags, guint32, i),
+					    g_hash_table_lookup(matchhash, uids->pdata[i]) != NULL);
+		} else if (matchhash
+			   && (info = camel_lite_folder_summary_uid(source->summary, uids->pdata[i]))) {
+			vee_match_cache_set(cache, uids->pdata[i], camel_lite_message_info_flags(info),
+					    g_hash_table_lookup(matchhash, uids->pdata[i]) != NULL);
+			camel_lite_message_info_free(info);
+		} else if (g_hash_table_remove(cache->uids, uids->pdata[i]))
+			cache->dirty = TRUE;
+	}
+
+	if (matchhash)
+		g_hash_table_destroy(matchhash);
+
+	CAMEL_VEE_FOLDER_UNLOCK(vf, match_lock);
+}
+
+static void
+free_uid_array(GPtrArray *uids)
+{
+	int i;
+
+	for (i = 0; i < uids->len; i++)
+		g_free(uids->pdata[i]);
+	g_ptr_array_free(uids, TRUE);
+}
+
+/* Get the uids of @source that match the vfolder expression, as a newly
+   allocated array of newly allocated strings. Uses and refreshes the match
+   cache of @source, only messages that are new or have changed flags since
+   they were last matched get searched. match_lock is only held to read
+   and update the cache, not while searching.
+
+   The flags are taken before searching, a message that changes while the
+   search runs is remembered with its old flags and so gets searched again
+   next time */
+static GPtrArray *
+vee_match_folder(CamelVeeFolder *vf, CamelFolder *source, CamelException *ex)
+{
+	struct _vee_match_cache *cache;
+	CamelFolderSummary *ssummary = source->summary;
+	GPtrArray *match, *search, *stale;
+	GArray *flags;
+	struct _vee_match *m;
+	CamelMessageInfo *info;
+	char *expression;
+	gboolean all = FALSE;
+	guint32 f;
+	int i, count;
+
+	match = g_ptr_array_new();
+	expression = g_strdup(vf->expression);
+
+	if (!vee_match_expression_cacheable(expression)) {
+		search = camel_lite_folder_search_by_expression(source, expression, ex);
+		g_free(expression);
+		if (search == NULL) {
+			g_ptr_array_free(match, TRUE);
+			return NULL;
+		}
+
+		for (i = 0; i < search->len; i++)
+			g_ptr_array_add(match, g_strdup(search->pdata[i]));
+		camel_lite_folder_search_free(source, search);
+
+		return match;
+	}
+
+	stale = g_ptr_array_new();
+	flags = g_array_new(FALSE, FALSE, sizeof(guint32));
+
+	CAMEL_VEE_FOLDER_LOCK(vf, match_lock);
+
+	cache = vee_match_cache_get(vf, source);
+	if (!vee_match_cache_valid(cache, expression)) {
+		/* start over, the whole folder gets searched */
+		g_free(cache->expression);
+		cache->expression = g_strdup(expression);
+		g_hash_table_remove_all(cache->uids);
+		cache->dirty = TRUE;
+		all = TRUE;
+	}
+
+	/* take what we know, collect what we need to search again */
+	count = camel_lite_folder_summary_count(ssummary);
+	for (i = 0; i < count; i++) {
+		info = camel_lite_folder_summary_index(ssummary, i);
+		if (info == NULL)
+			continue;
+
+		f = camel_lite_message_info_flags(info);
+		m = g_hash_table_lookup(cache->uids, camel_lite_message_info_uid(info));
+		if (m && m->flags == f) {
+			m->seen = TRUE;
+			if (m->matched)
+				g_ptr_array_add(match, g_strdup(camel_lite_message_info_uid(info)));
+		} else {
+			g_ptr_array_add(stale, g_strdup(camel_lite_message_info_uid(info)));
+			g_array_append_val(flags, f);
+		}
+
+		camel_lite_message_info_free(info);
+	}
+
+	/* forget what vanished from the source */
+	if (g_hash_table_foreach_remove(cache->uids, (GHRFunc)vee_match_unseen, NULL) > 0)
+		cache->dirty = TRUE;
+
+	CAMEL_VEE_FOLDER_UNLOCK(vf, match_lock);
+
+	if (stale->len > 0 || all) {
+		d(printf("vfolder '%s': searching %d of %d uids in '%s'\n",
+			 ((CamelFolder *)vf)->full_name, stale->len, count, source->full_name));
+
+		if (all)
+			search = camel_lite_folder_search_by_expression(source, expression, ex);
+		else
+			search = camel_lite_folder_search_by_uids(source, expression, stale, ex);
+
+		if (search == NULL) {
+			free_uid_array(stale);
+			free_uid_array(match);
+			g_array_free(flags, TRUE);
+			g_free(expression);
+			return NULL;
+		}
+
+		for (i = 0; i < search->len; i++)
+			g_ptr_array_add(match, g_strdup(search->pdata[i]));
+
+		vee_match_cache_update(vf, source, expression, stale, flags, search);
+		camel_lite_folder_search_free(source, search);
+	}
+
+	free_uid_array(stale);
+	g_array_free(flags, TRUE);
+	g_free(expression);
+
+	return match;
+}
+
 struct _update_data {
 	CamelFolder *source;
 	CamelVeeFolder *vf;
@@ -915,7 +1351,7 @@ vee_rebuild_folder(CamelVeeFolder *vf, CamelFolder *source, CamelException *ex)
 	if (vf->expression == NULL) {
 		match = g_ptr_array_new();
 	} else {
-		match = camel_lite_folder_search_by_expression(f, vf->expression, ex);
+		match = vee_match_folder(vf, f, ex);
 		if (match == NULL)
 			return -1;
 	}
@@ -1035,11 +1471,9 @@ vee_rebuild_folder(CamelVeeFolder *vf, CamelFolder *source, CamelException *ex)
 
 	g_hash_table_destroy(matchhash);
 	g_hash_table_destroy(allhash);
-	/* if expression not set, we only had a null list */
-	if (vf->expression == NULL)
-		g_ptr_array_free(match, TRUE);
-	else
-		camel_lite_folder_search_free(f, match);
+	for (i=0;i<match->len;i++)
+		g_free(match->pdata[i]);
+	g_ptr_array_free(match, TRUE);
 	camel_lite_folder_free_uids(f, all);
 
 	if (unmatched_changes) {
@@ -1273,6 +1707,16 @@ folder_changed_change(CamelSession *session, CamelSessionThreadMsg *msg)
 			matches_changed = camel_lite_folder_search_by_uids(sub, vf->expression, changed, NULL);
 	}
 
+	/* keep the match cache of the source current */
+	if (changes->uid_removed->len > 0)
+		vee_match_cache_update(vf, sub, vf->expression, changes->uid_removed, NULL, NULL);
+	if (changes->uid_added->len > 0)
+		vee_match_cache_update(vf, sub, vf->expression, changes->uid_added, NULL, matches_added);
+	if (changed->len > 0)
+		vee_match_cache_update(vf, sub, vf->expression, changed, NULL, matches_changed);
+	if (always_changed)
+		vee_match_cache_update(vf, sub, vf->expression, always_changed, NULL, NULL);
+
 	CAMEL_VEE_FOLDER_LOCK(vf, summary_lock);
 	if (folder_unmatched != NULL)
 		CAMEL_VEE_FOLDER_LOCK(folder_unmatched, summary_lock);
@@ -1460,7 +1904,8 @@ folder_changed_base(CamelVeeFolder *vf, CamelFolder *sub, CamelFolderChangeInfo
 	camel_lite_object_ref((CamelObject *)sub);
 	m->vf = vf;
 	camel_lite_object_ref((CamelObject *)vf);
-	camel_lite_session_thread_queue(session, &m->msg, 0);
+	/* keep the changes of one vee folder in order */
+	camel_lite_session_thread_queue_keyed(session, &m->msg, vf, 0);
 }
 
 static void
@@ -1618,6 +2063,7 @@ static void
 vee_remove_folder(CamelVeeFolder *vf, CamelFolder *sub)
 {
 	vee_folder_remove_folder(vf, sub);
+	vee_match_cache_remove(vf, sub);
 }
 
 static void
@@ -1713,6 +2159,9 @@ camel_lite_vee_folder_init (CamelVeeFolder *obj)
 	p->summary_lock = g_mutex_new();
 	p->subfolder_lock = g_mutex_new();
 	p->changed_lock = g_mutex_new();
+	p->match_lock = g_mutex_new();
+
+	p->match_caches = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)vee_match_cache_free);
 }
 
 static void
@@ -1749,6 +2198,9 @@ camel_lite_vee_folder_finalise (CamelObject *obj)
 	g_mutex_free(p->summary_lock);
 	g_mutex_free(p->subfolder_lock);
 	g_mutex_free(p->changed_lock);
+	g_mutex_free(p->match_lock);
+
+	g_hash_table_destroy(p->match_caches);
 
 	g_free(p);
 }
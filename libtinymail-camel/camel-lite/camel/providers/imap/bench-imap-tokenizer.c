@@ -0,0 +1,189 @@
+/* Times the FETCH response tokenizer on recorded server output.
+
+   bench-imap-tokenizer [-n ROUNDS] [TRACE...]
+
+   A trace is the raw output of a server for one command, untagged
+   responses up to the tagged completion, as a proxy or a socket log
+   records it. Without a trace, one is made up that looks like the
+   headers fetch of a folder summary update. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "camel-exception.h"
+#include "camel-stream-buffer.h"
+#include "camel-stream-mem.h"
+
+#include "camel-imap-command.h"
+
+#define BENCH_MESSAGES 10000
+
+static const char *headers =
+	"Date: Tue, 17 Jul 2007 02:44:25 -0700\r\n"
+	"From: Someone Else <someone.else@example.org>\r\n"
+	"To: tinymail-devel@example.org\r\n"
+	"Cc: somebody@example.com\r\n"
+	"Subject: Re: [PATCH] Don't copy FETCH responses around\r\n"
+	"Message-ID: <20070717094425.GA1234@mail.example.org>\r\n"
+	"Content-Type: text/plain; charset=us-ascii\r\n"
+	"\r\n";
+
+/* what the summary update of a folder of @messages gets back */
+static GByteArray *
+make_trace (int messages)
+{
+	GString *trace = g_string_new ("");
+	GByteArray *ba;
+	int i;
+
+	for (i = 1; i <= messages; i++)
+		g_string_append_printf (trace,
+			"* %d FETCH (UID %d FLAGS (\\Seen%s) RFC822.SIZE %d "
+			"INTERNALDATE \"17-Jul-2007 02:44:25 -0700\" "
+			"BODY[HEADER.FIELDS (DATE FROM TO CC SUBJECT MESSAGE-ID X-PRIORITY "
+			"X-MSMAIL-PRIORITY IMPORTANCE X-MS-HAS-ATTACH CONTENT-TYPE)] {%d}\r\n%s)\r\n",
+			i, 1000 + i, i % 3 ? "" : " \\Answered", 2000 + i % 5000,
+			(int) strlen (headers), headers);
+	g_string_append (trace, "A00042 OK FETCH completed\r\n");
+
+	ba = g_byte_array_new ();
+	g_byte_array_append (ba, (const guint8 *) trace->str, trace->len);
+	g_string_free (trace, TRUE);
+
+	return ba;
+}
+
+static GByteArray *
+load_trace (const char *filename)
+{
+	GByteArray *ba;
+	gchar *contents;
+	gsize length;
+	GError *err = NULL;
+
+	if (!g_file_get_contents (filename, &contents, &length, &err)) {
+		fprintf (stderr, "%s\n", err->message);
+		g_error_free (err);
+		return NULL;
+	}
+
+	ba = g_byte_array_new ();
+	g_byte_array_append (ba, (const guint8 *) contents, length);
+	g_free (contents);
+
+	return ba;
+}
+
+/* Reads every untagged response of @stream token by token, literals
+   included, and stops at the first line that isn't one */
+static int
+replay (CamelStreamBuffer *stream, guint *responses, guint *tokens, CamelException *ex)
+{
+	CamelImapTokenizer *tok;
+	GByteArray *literal;
+	const char *data;
+	int type;
+
+	tok = camel_lite_imap_tokenizer_new_for_stream (stream);
+	literal = g_byte_array_new ();
+
+	while (camel_lite_stream_buffer_peek (stream, &data) > 0 && *data == '*') {
+		camel_lite_stream_buffer_consume (stream, 1);
+		while ((type = camel_lite_imap_tokenizer_next (tok, NULL, NULL, ex)) != CAMEL_IMAP_TOKEN_EOL) {
+			if (type == CAMEL_IMAP_TOKEN_ERROR)
+				goto fail;
+			if (type == CAMEL_IMAP_TOKEN_LITERAL) {
+				g_byte_array_set_size (literal, 0);
+				if (camel_lite_imap_tokenizer_literal (tok, literal, ex) == -1)
+					goto fail;
+			}
+			(*tokens)++;
+		}
+		(*responses)++;
+	}
+
+	g_byte_array_free (literal, TRUE);
+	camel_lite_imap_tokenizer_free (tok);
+
+	return 0;
+
+ fail:
+	g_byte_array_free (literal, TRUE);
+	camel_lite_imap_tokenizer_free (tok);
+
+	return -1;
+}
+
+static void
+bench (const char *name, GByteArray *trace, int rounds)
+{
+	CamelException ex = CAMEL_EXCEPTION_INITIALISER;
+	guint responses = 0, tokens = 0;
+	CamelStream *mem, *stream;
+	GTimer *timer;
+	double elapsed;
+	int i;
+
+	/* frees @trace when it goes */
+	mem = camel_lite_stream_mem_new_with_byte_array (trace);
+	timer = g_timer_new ();
+	g_timer_stop (timer);
+
+	for (i = 0; i < rounds; i++) {
+		camel_lite_stream_reset (mem);
+		stream = camel_lite_stream_buffer_new (mem, CAMEL_STREAM_BUFFER_READ);
+		responses = tokens = 0;
+
+		g_timer_continue (timer);
+		if (replay (CAMEL_STREAM_BUFFER (stream), &responses, &tokens, &ex) == -1) {
+			printf ("%s: %s after %u responses\n", name,
+				camel_lite_exception_get_description (&ex), responses);
+			camel_lite_exception_clear (&ex);
+			camel_lite_object_unref (stream);
+			break;
+		}
+		g_timer_stop (timer);
+
+		camel_lite_object_unref (stream);
+	}
+
+	elapsed = g_timer_elapsed (timer, NULL);
+	if (i == rounds && elapsed > 0)
+		printf ("%s: %u responses, %u tokens, %u bytes, %d rounds in %.3fs, "
+			"%.1f MB/s, %.0f responses/s\n",
+			name, responses, tokens, trace->len, rounds, elapsed,
+			trace->len * (double) rounds / elapsed / (1024 * 1024),
+			responses * (double) rounds / elapsed);
+
+	g_timer_destroy (timer);
+	camel_lite_object_unref (mem);
+}
+
+int
+main (int argc, char *argv[])
+{
+	GByteArray *trace;
+	int i = 1, rounds = 10;
+
+	g_thread_init (NULL);
+
+	if (argc > 2 && !strcmp (argv[1], "-n")) {
+		rounds = MAX (atoi (argv[2]), 1);
+		i = 3;
+	}
+
+	if (i == argc) {
+		trace = make_trace (BENCH_MESSAGES);
+		bench ("synthetic", trace, rounds);
+		return 0;
+	}
+
+	for (; i < argc; i++) {
+		if ((trace = load_trace (argv[i])))
+			bench (argv[i], trace, rounds);
+	}
+
+	return 0;
+}
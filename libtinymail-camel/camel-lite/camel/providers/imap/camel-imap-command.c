@@ -37,6 +37,7 @@
 
 #include "camel-debug.h"
 #include "camel-exception.h"
+#include "camel-operation.h"
 #include "camel-private.h"
 #include "camel-session.h"
 #include "camel-utf8.h"
@@ -56,6 +57,8 @@ extern int camel_lite_verbose_debug;
 
 static gboolean imap_command_start (CamelImapStore *store, CamelFolder *folder,
 				    const char *cmd, CamelException *ex);
+static gboolean imap_command_send (CamelImapStore *store, const char *cmd,
+				   CamelException *ex);
 static CamelImapResponse *imap_read_response (CamelImapStore *store,
 					      CamelException *ex);
 static char *imap_read_untagged (CamelImapStore *store, char *line,
@@ -249,12 +252,9 @@ static gboolean
 imap_command_start (CamelImapStore *store, CamelFolder *folder,
 		    const char *cmd, CamelException *ex)
 {
-	ssize_t nwritten;
 	ssize_t nread;
 	gchar *resp = NULL;
 	CamelException myex = CAMEL_EXCEPTION_INITIALISER;
-	gchar *full_cmd = NULL;
-	guint len = 0;
 	gboolean fetching_message = (folder && (folder->parent_store != (CamelStore *) store));
 
 	if (store->ostream == NULL || ((CamelObject *)store->ostream)->ref_count <= 0)
@@ -375,6 +375,28 @@ imap_command_start (CamelImapStore *store, CamelFolder *folder,
 	if (resp)
 		g_free (resp);
 
+	if (!imap_command_send (store, cmd, ex))
+	{
+		CamelException mex = CAMEL_EXCEPTION_INITIALISER;
+
+		camel_lite_imap_recon (store, &mex, FALSE);
+		imap_debug ("Recon in start: %s\n", camel_lite_exception_get_description (&mex));
+
+		camel_lite_exception_clear (&mex);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Tag and write @cmd, without looking at what the server sent */
+static gboolean
+imap_command_send (CamelImapStore *store, const char *cmd, CamelException *ex)
+{
+	ssize_t nwritten;
+	gchar *full_cmd;
+	guint len;
+
 	full_cmd = g_strdup_printf ("%c%.5u %s\r\n", store->tag_prefix,
 		store->command++, cmd);
 	len = strlen (full_cmd);
@@ -385,28 +407,89 @@ imap_command_start (CamelImapStore *store, CamelFolder *folder,
 
 	g_free (full_cmd);
 
-	/* g_mutex_unlock (store->stream_lock); */
-
 	if (nwritten != len)
 	{
-		CamelException mex = CAMEL_EXCEPTION_INITIALISER;
-
 		if (errno == EINTR) {
 			camel_lite_exception_set (ex, CAMEL_EXCEPTION_USER_CANCEL,
 					     _("Operation cancelled"));
 		} else
 			camel_lite_exception_set (ex, CAMEL_EXCEPTION_SERVICE_LOST_CONNECTION,
 					     g_strerror (errno));
+		return FALSE;
+	}
 
+	return TRUE;
+}
 
-		camel_lite_imap_recon (store, &mex, FALSE);
-		imap_debug ("Recon in start: %s\n", camel_lite_exception_get_description (&mex));
+/**
+ * camel_lite_imap_command_pipeline:
+ * @store: the IMAP store
+ * @folder: The folder to perform the operations in (or %NULL if not
+ * relevant).
+ * @cmds: the commands to send, already formatted
+ * @ex: a CamelException
+ *
+ * Send all of @cmds before reading any of the responses, which saves a
+ * round trip per command. Keep @cmds short enough for their responses
+ * to fit in the socket's buffers, as nothing is read while sending.
+ *
+ * Unlike camel_lite_imap_command(), @cmds are sent as they are, no
+ * %-escapes are processed.
+ *
+ * Return value: An array as long as @cmds with the response to each
+ * command, or %NULL for commands that failed. @ex is set to the first
+ * failure. The caller must free the responses, in order, with
+ * camel_lite_imap_response_free() and the array with g_ptr_array_free().
+ **/
+GPtrArray *
+camel_lite_imap_command_pipeline (CamelImapStore *store, CamelFolder *folder,
+			     GPtrArray *cmds, CamelException *ex)
+{
+	CamelException local_ex = CAMEL_EXCEPTION_INITIALISER;
+	GPtrArray *responses;
+	int i, sent = 0;
 
-		camel_lite_exception_clear (&mex);
-		return FALSE;
+	responses = g_ptr_array_sized_new (cmds->len);
+
+	/* One lock per command, each is released by its tagged response */
+	for (i = 0; i < cmds->len; i++) {
+		camel_lite_imap_store_stop_idle_connect_lock (store);
+
+		if (i == 0 ? imap_command_start (store, folder, cmds->pdata[i], ex)
+			   : imap_command_send (store, cmds->pdata[i], ex)) {
+			sent++;
+			continue;
+		}
+
+		camel_lite_imap_store_connect_unlock_start_idle (store);
+
+		/* The responses to what got sent can't be trusted anymore */
+		if (sent > 0) {
+			CamelException mex = CAMEL_EXCEPTION_INITIALISER;
+
+			for (; sent > 0; sent--)
+				camel_lite_imap_store_connect_unlock_start_idle (store);
+			camel_lite_imap_recon (store, &mex, FALSE);
+			camel_lite_exception_clear (&mex);
+		}
+		break;
 	}
 
-	return TRUE;
+	for (i = 0; i < sent; i++) {
+		CamelImapResponse *response = imap_read_response (store, &local_ex);
+
+		if (camel_lite_exception_is_set (&local_ex)) {
+			if (!camel_lite_exception_is_set (ex))
+				camel_lite_exception_xfer (ex, &local_ex);
+			camel_lite_exception_clear (&local_ex);
+		}
+		g_ptr_array_add (responses, response);
+	}
+
+	while (responses->len < cmds->len)
+		g_ptr_array_add (responses, NULL);
+
+	return responses;
 }
 
 /**
@@ -459,6 +542,37 @@ camel_lite_imap_command_continuation (CamelImapStore *store, const char *cmd,
 }
 
 
+/* The server is going away, no more data to fetch */
+static void
+imap_server_bye (CamelImapStore *store, CamelException *ex)
+{
+	camel_lite_service_disconnect (CAMEL_SERVICE (store), FALSE, NULL);
+	camel_lite_exception_setv (ex, CAMEL_EXCEPTION_SERVICE_LOST_CONNECTION,
+			      _("Server unexpectedly disconnected: %s"),
+			      _("Unknown error")); /* g_strerror (104));  FIXME after 1.0 is released */
+	store->connected = FALSE;
+}
+
+/* Shows imap ALERT codes in an untagged response to the user */
+static void
+imap_server_alert (CamelImapStore *store, const char *respbuf)
+{
+	char *msg;
+
+	if (g_ascii_strncasecmp (respbuf, "* OK [ALERT]", 12)
+	    && g_ascii_strncasecmp (respbuf, "* NO [ALERT]", 12)
+	    && g_ascii_strncasecmp (respbuf, "* BAD [ALERT]", 13))
+		return;
+
+	/* for imap ALERT codes, account user@host */
+	/* we might get a ']' from a BAD response since we +12, but who cares? */
+	msg = g_strdup_printf(_("Alert from IMAP server %s@%s:\n%s"),
+			      ((CamelService *)store)->url->user, ((CamelService *)store)->url->host, respbuf+12);
+	camel_lite_session_alert_user_generic(((CamelService *)store)->session,
+		CAMEL_SESSION_ALERT_WARNING, msg, FALSE, ((CamelService *)store));
+	g_free(msg);
+}
+
 /**
  * camel_lite_imap_command_response:
  * @store: the IMAP store
@@ -498,12 +612,7 @@ camel_lite_imap_command_response (CamelImapStore *store, char **response,
 	switch (*respbuf) {
 	case '*':
 		if (!g_ascii_strncasecmp (respbuf, "* BYE", 5)) {
-			/* Connection was lost, no more data to fetch */
-			camel_lite_service_disconnect (CAMEL_SERVICE (store), FALSE, NULL);
-			camel_lite_exception_setv (ex, CAMEL_EXCEPTION_SERVICE_LOST_CONNECTION,
-					      _("Server unexpectedly disconnected: %s"),
-					      _("Unknown error")); /* g_strerror (104));  FIXME after 1.0 is released */
-			store->connected = FALSE;
+			imap_server_bye (store, ex);
 			g_free (respbuf);
 			respbuf = NULL;
 			type = CAMEL_IMAP_RESPONSE_ERROR;
@@ -520,19 +629,8 @@ camel_lite_imap_command_response (CamelImapStore *store, char **response,
 
 		if (!respbuf)
 			type = CAMEL_IMAP_RESPONSE_ERROR;
-		else if (!g_ascii_strncasecmp (respbuf, "* OK [ALERT]", 12)
-			 || !g_ascii_strncasecmp (respbuf, "* NO [ALERT]", 12)
-			 || !g_ascii_strncasecmp (respbuf, "* BAD [ALERT]", 13)) {
-			char *msg;
-
-			/* for imap ALERT codes, account user@host */
-			/* we might get a ']' from a BAD response since we +12, but who cares? */
-			msg = g_strdup_printf(_("Alert from IMAP server %s@%s:\n%s"),
-					      ((CamelService *)store)->url->user, ((CamelService *)store)->url->host, respbuf+12);
-			camel_lite_session_alert_user_generic(((CamelService *)store)->session,
-				CAMEL_SESSION_ALERT_WARNING, msg, FALSE, ((CamelService *)store));
-			g_free(msg);
-		}
+		else
+			imap_server_alert (store, respbuf);
 
 		break;
 	case '+':
@@ -567,12 +665,7 @@ camel_lite_imap_command_response_idle (CamelImapStore *store, char **response,
 	switch (*respbuf) {
 	case '*':
 		if (!g_ascii_strncasecmp (respbuf, "* BYE", 5)) {
-			/* Connection was lost, no more data to fetch */
-			camel_lite_service_disconnect (CAMEL_SERVICE (store), FALSE, NULL);
-			camel_lite_exception_setv (ex, CAMEL_EXCEPTION_SERVICE_LOST_CONNECTION,
-					      _("Server unexpectedly disconnected: %s"),
-					      _("Unknown error")); /* g_strerror (104));  FIXME after 1.0 is released */
-			store->connected = FALSE;
+			imap_server_bye (store, ex);
 			g_free (respbuf);
 			respbuf = NULL;
 			type = CAMEL_IMAP_RESPONSE_ERROR;
@@ -584,20 +677,10 @@ camel_lite_imap_command_response_idle (CamelImapStore *store, char **response,
 		respbuf = imap_read_untagged (store, respbuf, ex);
 		if (!respbuf)
 			type = CAMEL_IMAP_RESPONSE_ERROR;
-		else if (!g_ascii_strncasecmp (respbuf, "* OK [ALERT]", 12)
-			 || !g_ascii_strncasecmp (respbuf, "* NO [ALERT]", 12)
-			 || !g_ascii_strncasecmp (respbuf, "* BAD [ALERT]", 13)) {
-			char *msg;
-
-			/* for imap ALERT codes, account user@host */
-			/* we might get a ']' from a BAD response since we +12, but who cares? */
-			msg = g_strdup_printf(_("Alert from IMAP server %s@%s:\n%s"),
-					      ((CamelService *)store)->url->user, ((CamelService *)store)->url->host, respbuf+12);
-			camel_lite_session_alert_user_generic(((CamelService *)store)->session,
-				CAMEL_SESSION_ALERT_WARNING, msg, FALSE, ((CamelService *)store));
-			g_free(msg);
-		} else if (!g_ascii_strncasecmp (respbuf, "* BAD Invalid tag",17))
+		else if (!g_ascii_strncasecmp (respbuf, "* BAD Invalid tag",17))
 			type = CAMEL_IMAP_RESPONSE_ERROR;
+		else
+			imap_server_alert (store, respbuf);
 		break;
 	case '+':
 		type = CAMEL_IMAP_RESPONSE_CONTINUATION;
@@ -691,14 +774,19 @@ imap_read_response (CamelImapStore *store, CamelException *ex)
 
 /* Given a line that is the start of an untagged response, read and
  * return the complete response, which may include an arbitrary number
- * of literals.
+ * of literals.  @len is passed on to camel_lite_stream_buffer_read_opp(),
+ * or -1 to read the literals with a plain camel_lite_stream_read().
+ *
+ * The lines and literals are read straight into the one buffer that is
+ * returned, the literals are fixed up in place.
  */
 static char *
 imap_read_untagged_opp (CamelImapStore *store, char *line, CamelException *ex, int len)
 {
-	int fulllen, ldigits, nread, n, i, sexp = 0;
+	int ldigits, nread, n, sexp = 0;
 	unsigned int length;
-	GPtrArray *data;
+	size_t start, brace, lit;
+	char digits[16];
 	GString *str;
 	char *end, *p, *s, *d;
 
@@ -706,16 +794,14 @@ imap_read_untagged_opp (CamelImapStore *store, char *line, CamelException *ex, i
 	if (!p)
 		return line;
 
-	data = g_ptr_array_new ();
-	fulllen = 0;
+	str = g_string_new (NULL);
 
 	while (1) {
-		str = g_string_new (line);
+		start = str->len;
+		g_string_append (str, line);
 		g_free (line);
-		fulllen += str->len;
-		g_ptr_array_add (data, str);
 
-		if (!(p = strrchr (str->str, '{')) || p[1] == '-')
+		if (!(p = strrchr (str->str + start, '{')) || p[1] == '-')
 			break;
 
 		/* HACK ALERT: We scan the non-literal part of the string, looking for possible s expression braces.
@@ -723,7 +809,7 @@ imap_read_untagged_opp (CamelImapStore *store, char *line, CamelException *ex, i
 		   This is so if we get a blank line after a literal, in an s-expression, we can keep going, since
 		   we do no other parsing at this level.
 		   TODO: handle quoted strings? */
-		for (s=str->str; s<p; s++) {
+		for (s = str->str + start; s < p; s++) {
 			if (*s == '(')
 				sexp++;
 			else if (*s == ')')
@@ -735,14 +821,22 @@ imap_read_untagged_opp (CamelImapStore *store, char *line, CamelException *ex, i
 			break;
 		ldigits = end - (p + 1);
 
+		/* the buffer can move while the literal is read into it */
+		brace = p - str->str;
+
 		/* Read the literal */
-		str = g_string_sized_new (length + 2);
-		str->str[0] = '\n';
+		lit = str->len;
+		g_string_set_size (str, lit + length + 1);
+		str->str[lit] = '\n';
 		nread = 0;
 
 		do {
-			if ((n = camel_lite_stream_buffer_read_opp (store->istream, str->str + nread + 1, length - nread, len)) == -1) {
+			if (len != -1)
+				n = camel_lite_stream_buffer_read_opp (store->istream, str->str + lit + nread + 1, length - nread, len);
+			else
+				n = camel_lite_stream_read (store->istream, str->str + lit + nread + 1, length - nread);
 
+			if (n == -1) {
 				if (errno == EINTR)
 				{
 					CamelException mex = CAMEL_EXCEPTION_INITIALISER;
@@ -756,7 +850,6 @@ imap_read_untagged_opp (CamelImapStore *store, char *line, CamelException *ex, i
 							     g_strerror (errno));
 					camel_lite_service_disconnect (CAMEL_SERVICE (store), FALSE, NULL);
 				}
-				g_string_free (str, TRUE);
 				goto lose;
 			}
 
@@ -776,14 +869,12 @@ imap_read_untagged_opp (CamelImapStore *store, char *line, CamelException *ex, i
 					     _("Server response ended too soon."));
 				camel_lite_service_disconnect (CAMEL_SERVICE (store), FALSE, NULL);
 			}
-			g_string_free (str, TRUE);
 			goto lose;
 		}
-		str->str[length + 1] = '\0';
 
 		if (camel_lite_debug("imap")) {
 			printf("Literal: -->");
-			fwrite(str->str+1, 1, length, stdout);
+			fwrite(str->str + lit + 1, 1, length, stdout);
 			printf("<--\n");
 		}
 
@@ -797,34 +888,30 @@ imap_read_untagged_opp (CamelImapStore *store, char *line, CamelException *ex, i
 		 *     NULs along if they are embedded in the message
 		 */
 
-		s = d = str->str + 1;
-		end = str->str + 1 + length;
+		s = d = str->str + lit + 1;
+		end = s + length;
 		while (s < end) {
 			while (s < end && *s == '\0') {
 				s++;
 				length--;
 			}
-			if (*s == '\r' && *(s + 1) == '\n') {
+			if (s == end)
+				break;
+			if (*s == '\r' && s + 1 < end && *(s + 1) == '\n') {
 				s++;
 				length--;
 			}
 			*d++ = *s++;
 		}
-		*d = '\0';
-		str->len = length + 1;
-
-		/* p points to the "{" in the line that starts the
-		 * literal. The length of the CR-less response must be
-		 * less than or equal to the length of the response
-		 * with CRs, therefore overwriting the old value with
-		 * the new value cannot cause an overrun. However, we
-		 * don't want it to be shorter either, because then the
-		 * GString's length would be off...
-		 */
-		sprintf (p, "{%0*u}", ldigits, length);
+		g_string_truncate (str, lit + 1 + length);
 
-		fulllen += str->len;
-		g_ptr_array_add (data, str);
+		/* The CR-less length never has more digits than the
+		 * length the server sent, pad it to the same width so
+		 * the line it is on keeps its length. The line is
+		 * followed by the literal now, so no NUL goes in.
+		 */
+		g_snprintf (digits, sizeof (digits), "%0*u", ldigits, length);
+		memcpy (str->str + brace + 1, digits, ldigits);
 
 		/* Read the next line. */
 		do {
@@ -833,193 +920,30 @@ imap_read_untagged_opp (CamelImapStore *store, char *line, CamelException *ex, i
 
 			/* MAJOR HACK ALERT, gropuwise sometimes sends an extra blank line after literals, check that here
 			   But only do it if we're inside an sexpression */
-			if (line[0] == 0 && sexp > 0)
+			if (line[0] == 0 && sexp > 0) {
 				g_warning("Server sent empty line after a literal, assuming in error");
-		} while (line[0] == 0 && sexp > 0);
+				g_free (line);
+				line = NULL;
+			}
+		} while (line == NULL);
 	}
 
-	/* Now reassemble the data. */
-	p = line = g_malloc (fulllen + 1);
-	for (i = 0; i < data->len; i++) {
-		str = data->pdata[i];
-		memcpy (p, str->str, str->len);
-		p += str->len;
-		g_string_free (str, TRUE);
-	}
-	*p = '\0';
-	g_ptr_array_free (data, TRUE);
-	return line;
+	/* hand back no more than the response needs, these can pile
+	   up by the thousands in a CamelImapResponse */
+	length = str->len;
+	line = g_string_free (str, FALSE);
+
+	return g_realloc (line, length + 1);
 
  lose:
-	for (i = 0; i < data->len; i++)
-		g_string_free (data->pdata[i], TRUE);
-	g_ptr_array_free (data, TRUE);
+	g_string_free (str, TRUE);
 	return NULL;
 }
 
-
-
 static char *
 imap_read_untagged (CamelImapStore *store, char *line, CamelException *ex)
 {
-	int fulllen, ldigits, nread, n, i, sexp = 0;
-	unsigned int length;
-	GPtrArray *data;
-	GString *str;
-	char *end, *p, *s, *d;
-
-	p = strrchr (line, '{');
-	if (!p)
-		return line;
-
-	data = g_ptr_array_new ();
-	fulllen = 0;
-
-	while (1) {
-		str = g_string_new (line);
-		g_free (line);
-		fulllen += str->len;
-		g_ptr_array_add (data, str);
-
-		if (!(p = strrchr (str->str, '{')) || p[1] == '-')
-			break;
-
-		/* HACK ALERT: We scan the non-literal part of the string, looking for possible s expression braces.
-		   This assumes we're getting s-expressions, which we should be.
-		   This is so if we get a blank line after a literal, in an s-expression, we can keep going, since
-		   we do no other parsing at this level.
-		   TODO: handle quoted strings? */
-		for (s=str->str; s<p; s++) {
-			if (*s == '(')
-				sexp++;
-			else if (*s == ')')
-				sexp--;
-		}
-
-		length = strtoul (p + 1, &end, 10);
-		if (*end != '}' || *(end + 1) || end == p + 1 || length >= UINT_MAX - 2)
-			break;
-		ldigits = end - (p + 1);
-
-		/* Read the literal */
-		str = g_string_sized_new (length + 2);
-		str->str[0] = '\n';
-		nread = 0;
-
-		do {
-			if ((n = camel_lite_stream_read (store->istream, str->str + nread + 1, length - nread)) == -1) {
-				if (errno == EINTR)
-				{
-					CamelException mex = CAMEL_EXCEPTION_INITIALISER;
-					camel_lite_exception_set (ex, CAMEL_EXCEPTION_USER_CANCEL,
-							     _("Operation cancelled"));
-					camel_lite_imap_recon (store, &mex, TRUE);
-					imap_debug ("Recon in untagged: %s\n", camel_lite_exception_get_description (&mex));
-					camel_lite_exception_clear (&mex);
-				} else {
-					camel_lite_exception_set (ex, CAMEL_EXCEPTION_SERVICE_LOST_CONNECTION,
-							     g_strerror (errno));
-					camel_lite_service_disconnect (CAMEL_SERVICE (store), FALSE, NULL);
-				}
-				g_string_free (str, TRUE);
-				goto lose;
-			}
-
-			nread += n;
-		} while (n > 0 && nread < length);
-
-		if (nread < length) {
-			if (errno == EINTR) {
-				CamelException mex = CAMEL_EXCEPTION_INITIALISER;
-				camel_lite_exception_set (ex, CAMEL_EXCEPTION_USER_CANCEL,
-						     _("Operation cancelled"));
-				camel_lite_imap_recon (store, &mex, TRUE);
-				imap_debug ("Recon in untagged idle: %s\n", camel_lite_exception_get_description (&mex));
-				camel_lite_exception_clear (&mex);
-			} else {
-				camel_lite_exception_set (ex, CAMEL_EXCEPTION_SERVICE_LOST_CONNECTION,
-					     _("Server response ended too soon."));
-				camel_lite_service_disconnect (CAMEL_SERVICE (store), FALSE, NULL);
-			}
-			g_string_free (str, TRUE);
-			goto lose;
-		}
-		str->str[length + 1] = '\0';
-
-		if (camel_lite_debug("imap")) {
-			printf("Literal: -->");
-			fwrite(str->str+1, 1, length, stdout);
-			printf("<--\n");
-		}
-
-		/* Fix up the literal, turning CRLFs into LF. Also, if
-		 * we find any embedded NULs, strip them. This is
-		 * dubious, but:
-		 *   - The IMAP grammar says you can't have NULs here
-		 *     anyway, so this will not affect our behavior
-		 *     against any completely correct server.
-		 *   - WU-imapd 12.264 (at least) will cheerily pass
-		 *     NULs along if they are embedded in the message
-		 */
-
-		s = d = str->str + 1;
-		end = str->str + 1 + length;
-		while (s < end) {
-			while (s < end && *s == '\0') {
-				s++;
-				length--;
-			}
-			if (*s == '\r' && *(s + 1) == '\n') {
-				s++;
-				length--;
-			}
-			*d++ = *s++;
-		}
-		*d = '\0';
-		str->len = length + 1;
-
-		/* p points to the "{" in the line that starts the
-		 * literal. The length of the CR-less response must be
-		 * less than or equal to the length of the response
-		 * with CRs, therefore overwriting the old value with
-		 * the new value cannot cause an overrun. However, we
-		 * don't want it to be shorter either, because then the
-		 * GString's length would be off...
-		 */
-		sprintf (p, "{%0*u}", ldigits, length);
-
-		fulllen += str->len;
-		g_ptr_array_add (data, str);
-
-		/* Read the next line. */
-		do {
-			if (camel_lite_imap_store_readline (store, &line, ex) < 0)
-				goto lose;
-
-			/* MAJOR HACK ALERT, gropuwise sometimes sends an extra blank line after literals, check that here
-			   But only do it if we're inside an sexpression */
-			if (line[0] == 0 && sexp > 0)
-				g_warning("Server sent empty line after a literal, assuming in error");
-		} while (line[0] == 0 && sexp > 0);
-	}
-
-	/* Now reassemble the data. */
-	p = line = g_malloc (fulllen + 1);
-	for (i = 0; i < data->len; i++) {
-		str = data->pdata[i];
-		memcpy (p, str->str, str->len);
-		p += str->len;
-		g_string_free (str, TRUE);
-	}
-	*p = '\0';
-	g_ptr_array_free (data, TRUE);
-	return line;
-
- lose:
-	for (i = 0; i < data->len; i++)
-		g_string_free (data->pdata[i], TRUE);
-	g_ptr_array_free (data, TRUE);
-	return NULL;
+	return imap_read_untagged_opp (store, line, ex, -1);
 }
 
 /**
@@ -1353,3 +1277,652 @@ imap_command_strdup_printf (CamelImapStore *store, const char *fmt, ...)
 	
 	return result;
 }
+
+
+/* The tokenizer reads the store's CamelStreamBuffer in place. A token
+ * points into that buffer, unless it straddles a refill or is a quoted
+ * string with escapes, then it's gathered in @scratch. Either way it
+ * is only valid until the next call. */
+struct _CamelImapTokenizer {
+	CamelImapStore *store;
+	CamelStreamBuffer *stream;
+	GByteArray *scratch;
+
+	int last, unget;
+	const char *token;
+	guint32 len;
+
+	guint32 literal;	/* bytes of the last literal not read yet */
+	gboolean failed;
+};
+
+/* Releases the command lock, once, like camel_lite_imap_command_response()
+ * does on an error */
+static int
+tokenizer_fail (CamelImapTokenizer *tok)
+{
+	if (!tok->failed) {
+		tok->failed = TRUE;
+		if (tok->store)
+			camel_lite_imap_store_connect_unlock_start_idle (tok->store);
+	}
+
+	return CAMEL_IMAP_TOKEN_ERROR;
+}
+
+static int
+tokenizer_protocol_error (CamelImapTokenizer *tok, CamelException *ex)
+{
+	camel_lite_exception_setv (ex, CAMEL_EXCEPTION_SERVICE_PROTOCOL,
+			      _("Unexpected response from IMAP server: %s"),
+			      _("Unknown error"));
+
+	/* there's no telling where the next response starts */
+	if (tok->store)
+		camel_lite_service_disconnect (CAMEL_SERVICE (tok->store), FALSE, NULL);
+
+	return tokenizer_fail (tok);
+}
+
+static ssize_t
+tokenizer_peek (CamelImapTokenizer *tok, const char **data, CamelException *ex)
+{
+	ssize_t n;
+
+	if (tok->failed)
+		return -1;
+
+	n = camel_lite_stream_buffer_peek (tok->stream, data);
+	if (n > 0)
+		return n;
+
+	if (!tok->store) {
+		/* replaying a recorded trace, nothing to reconnect */
+		if (n == 0)
+			camel_lite_exception_set (ex, CAMEL_EXCEPTION_SERVICE_LOST_CONNECTION,
+					     _("Server response ended too soon."));
+		else
+			camel_lite_exception_setv (ex, CAMEL_EXCEPTION_SYSTEM_IO_READ,
+					      _("Read failed: %s"), g_strerror (errno));
+	} else if (n == -1 && errno == EINTR) {
+		CamelException mex = CAMEL_EXCEPTION_INITIALISER;
+		camel_lite_exception_set (ex, CAMEL_EXCEPTION_USER_CANCEL,
+				     _("Operation cancelled"));
+		camel_lite_imap_recon (tok->store, &mex, TRUE);
+		imap_debug ("Recon in tokenizer: %s\n", camel_lite_exception_get_description (&mex));
+		camel_lite_exception_clear (&mex);
+	} else {
+		if (n == 0)
+			camel_lite_exception_set (ex, CAMEL_EXCEPTION_SERVICE_LOST_CONNECTION,
+					     _("Server response ended too soon."));
+		else
+			camel_lite_exception_setv (ex, CAMEL_EXCEPTION_SERVICE_LOST_CONNECTION,
+					      _("Server unexpectedly disconnected: %s"),
+					      g_strerror (errno));
+		camel_lite_service_disconnect (CAMEL_SERVICE (tok->store), FALSE, NULL);
+	}
+
+	tokenizer_fail (tok);
+
+	return -1;
+}
+
+/* atom_specials, less the resp_specials and list_wildcards that show
+ * up in the atoms we care about (\Seen, \*, ...), and less '[' and ']'
+ * which we hand out as tokens of their own */
+static gboolean
+tokenizer_is_atom (unsigned char c)
+{
+	return c > 0x20 && c != 0x7f && !strchr ("(){\"[]", c);
+}
+
+static int
+tokenizer_atom (CamelImapTokenizer *tok, CamelException *ex)
+{
+	gboolean number = TRUE;
+	const char *data;
+	ssize_t n, i;
+
+	g_byte_array_set_size (tok->scratch, 0);
+
+	while (1) {
+		if ((n = tokenizer_peek (tok, &data, ex)) == -1)
+			return CAMEL_IMAP_TOKEN_ERROR;
+
+		for (i = 0; i < n && tokenizer_is_atom (data[i]); i++) {
+			if (data[i] < '0' || data[i] > '9')
+				number = FALSE;
+		}
+
+		if (i < n) {
+			if (tok->scratch->len == 0) {
+				tok->token = data;
+				tok->len = i;
+			} else {
+				g_byte_array_append (tok->scratch, (const guint8 *) data, i);
+				tok->token = (const char *) tok->scratch->data;
+				tok->len = tok->scratch->len;
+			}
+			camel_lite_stream_buffer_consume (tok->stream, i);
+			break;
+		}
+
+		g_byte_array_append (tok->scratch, (const guint8 *) data, n);
+		camel_lite_stream_buffer_consume (tok->stream, n);
+	}
+
+	return number ? CAMEL_IMAP_TOKEN_NUMBER : CAMEL_IMAP_TOKEN_ATOM;
+}
+
+/* the opening quote was consumed already */
+static int
+tokenizer_string (CamelImapTokenizer *tok, CamelException *ex)
+{
+	gboolean escaped = FALSE, gathered = FALSE;
+	const char *data;
+	ssize_t n, i, start;
+
+	g_byte_array_set_size (tok->scratch, 0);
+
+	while (1) {
+		if ((n = tokenizer_peek (tok, &data, ex)) == -1)
+			return CAMEL_IMAP_TOKEN_ERROR;
+
+		for (i = 0, start = 0; i < n; i++) {
+			if (data[i] == '\r' || data[i] == '\n')
+				return tokenizer_protocol_error (tok, ex);
+			if (escaped)
+				escaped = FALSE;
+			else if (data[i] == '\\') {
+				/* drop the backslash, keep what it quotes */
+				g_byte_array_append (tok->scratch, (const guint8 *) data + start, i - start);
+				gathered = TRUE;
+				start = i + 1;
+				escaped = TRUE;
+			} else if (data[i] == '"')
+				break;
+		}
+
+		if (i < n) {
+			if (!gathered) {
+				tok->token = data;
+				tok->len = i;
+			} else {
+				g_byte_array_append (tok->scratch, (const guint8 *) data + start, i - start);
+				tok->token = (const char *) tok->scratch->data;
+				tok->len = tok->scratch->len;
+			}
+			camel_lite_stream_buffer_consume (tok->stream, i + 1);
+			break;
+		}
+
+		g_byte_array_append (tok->scratch, (const guint8 *) data + start, n - start);
+		gathered = TRUE;
+		camel_lite_stream_buffer_consume (tok->stream, n);
+	}
+
+	return CAMEL_IMAP_TOKEN_STRING;
+}
+
+/* CRLF, or a bare LF */
+static int
+tokenizer_eol (CamelImapTokenizer *tok, CamelException *ex)
+{
+	const char *data;
+
+	if (tokenizer_peek (tok, &data, ex) == -1)
+		return CAMEL_IMAP_TOKEN_ERROR;
+
+	if (*data == '\r') {
+		camel_lite_stream_buffer_consume (tok->stream, 1);
+		if (tokenizer_peek (tok, &data, ex) == -1)
+			return CAMEL_IMAP_TOKEN_ERROR;
+	}
+
+	if (*data != '\n')
+		return tokenizer_protocol_error (tok, ex);
+	camel_lite_stream_buffer_consume (tok->stream, 1);
+
+	tok->token = NULL;
+	tok->len = 0;
+
+	return CAMEL_IMAP_TOKEN_EOL;
+}
+
+/* "{<size>}" CRLF, the opening brace was consumed already. The data
+ * itself is left for the caller. */
+static int
+tokenizer_literal (CamelImapTokenizer *tok, CamelException *ex)
+{
+	guint32 size = 0, i;
+
+	if (tokenizer_atom (tok, ex) == CAMEL_IMAP_TOKEN_ERROR)
+		return CAMEL_IMAP_TOKEN_ERROR;
+
+	for (i = 0; i < tok->len && tok->token[i] >= '0' && tok->token[i] <= '9'; i++) {
+		if (size > (G_MAXUINT32 - 9) / 10)
+			return tokenizer_protocol_error (tok, ex);
+		size = size * 10 + (tok->token[i] - '0');
+	}
+
+	if (i == 0 || i + 1 != tok->len || tok->token[i] != '}')
+		return tokenizer_protocol_error (tok, ex);
+
+	if (tokenizer_eol (tok, ex) == CAMEL_IMAP_TOKEN_ERROR)
+		return CAMEL_IMAP_TOKEN_ERROR;
+
+	tok->token = NULL;
+	tok->len = size;
+	tok->literal = size;
+
+	return CAMEL_IMAP_TOKEN_LITERAL;
+}
+
+static int
+tokenizer_skip_literal (CamelImapTokenizer *tok, CamelException *ex)
+{
+	const char *data;
+	ssize_t n;
+
+	while (tok->literal > 0) {
+		if ((n = tokenizer_peek (tok, &data, ex)) == -1)
+			return -1;
+		if (n > tok->literal)
+			n = tok->literal;
+		camel_lite_stream_buffer_consume (tok->stream, n);
+		tok->literal -= n;
+	}
+
+	return 0;
+}
+
+/* Reads the literal _next() just returned into @buffer or @stream,
+ * turning CRLFs into LFs and dropping NULs like imap_read_untagged()
+ * does. A failing write doesn't stop the read, the connection has to
+ * stay in step with the server. */
+static int
+tokenizer_read_literal (CamelImapTokenizer *tok, GByteArray *buffer, CamelStream *stream, CamelException *ex)
+{
+	guint32 total = tok->literal;
+	gboolean cr = FALSE, werr = FALSE;
+	char chunk[4096], *d;
+	const char *data, *s, *end;
+	guint offset = 0;
+	ssize_t n;
+
+	if (tok->unget == CAMEL_IMAP_TOKEN_LITERAL)
+		tok->unget = 0;
+
+	if (buffer)
+		offset = buffer->len;
+
+	while (tok->literal > 0) {
+		if ((n = tokenizer_peek (tok, &data, ex)) == -1)
+			return -1;
+		if (n > tok->literal)
+			n = tok->literal;
+
+		if (buffer) {
+			/* one more for a CR that was held back */
+			g_byte_array_set_size (buffer, offset + n + 1);
+			d = (char *) buffer->data + offset;
+		} else {
+			if (n > (ssize_t) sizeof (chunk) - 1)
+				n = sizeof (chunk) - 1;
+			d = chunk;
+		}
+
+		camel_lite_stream_buffer_consume (tok->stream, n);
+		tok->literal -= n;
+
+		for (s = data, end = data + n; s < end; s++) {
+			if (cr) {
+				cr = FALSE;
+				if (*s != '\n')
+					*d++ = '\r';
+			}
+			if (*s == '\r')
+				cr = TRUE;
+			else if (*s != '\0')
+				*d++ = *s;
+		}
+
+		if (cr && tok->literal == 0)
+			*d++ = '\r';
+
+		if (buffer) {
+			offset = d - (char *) buffer->data;
+			g_byte_array_set_size (buffer, offset);
+		} else {
+			if (!werr && camel_lite_stream_write (stream, chunk, d - chunk) != d - chunk) {
+				camel_lite_exception_setv (ex, CAMEL_EXCEPTION_SYSTEM_IO_WRITE,
+						      _("Write to cache failed: %s"), g_strerror (errno));
+				werr = TRUE;
+			}
+			camel_lite_operation_progress (NULL, total - tok->literal, total);
+		}
+	}
+
+	return werr ? -1 : 0;
+}
+
+/**
+ * camel_lite_imap_tokenizer_new:
+ * @store: the IMAP store
+ *
+ * Return value: a tokenizer for the responses @store reads, to be
+ * freed with camel_lite_imap_tokenizer_free().
+ **/
+CamelImapTokenizer *
+camel_lite_imap_tokenizer_new (CamelImapStore *store)
+{
+	CamelImapTokenizer *tok;
+
+	tok = g_new0 (CamelImapTokenizer, 1);
+	tok->store = store;
+	tok->scratch = g_byte_array_new ();
+
+	return tok;
+}
+
+/**
+ * camel_lite_imap_tokenizer_new_for_stream:
+ * @stream: a buffered stream of server responses
+ *
+ * Like camel_lite_imap_tokenizer_new(), but reading @stream instead of
+ * a store's connection, to replay recorded server output as the
+ * tokenizer benchmark does. Responses are read with
+ * camel_lite_imap_tokenizer_next() and the functions built on it, not
+ * with camel_lite_imap_tokenizer_response(). @stream is kept alive by
+ * the caller.
+ *
+ * Return value: a tokenizer, to be freed with
+ * camel_lite_imap_tokenizer_free().
+ **/
+CamelImapTokenizer *
+camel_lite_imap_tokenizer_new_for_stream (CamelStreamBuffer *stream)
+{
+	CamelImapTokenizer *tok;
+
+	tok = camel_lite_imap_tokenizer_new (NULL);
+	tok->stream = stream;
+
+	return tok;
+}
+
+void
+camel_lite_imap_tokenizer_free (CamelImapTokenizer *tok)
+{
+	g_byte_array_free (tok->scratch, TRUE);
+	g_free (tok);
+}
+
+/**
+ * camel_lite_imap_tokenizer_response:
+ * @tok: the tokenizer
+ * @response: a pointer to pass back the response data in
+ * @ex: a CamelException
+ *
+ * The streaming counterpart of camel_lite_imap_command_response(),
+ * to be called at the start of each response. A numbered untagged
+ * response ("* 12 FETCH ...") is left in the stream for the caller to
+ * read with camel_lite_imap_tokenizer_next(), up to its
+ * %CAMEL_IMAP_TOKEN_EOL, and *@response is set to %NULL. Any other
+ * response is read whole into *@response, which the caller must free,
+ * and for an untagged one the next token is its %CAMEL_IMAP_TOKEN_EOL.
+ *
+ * Return value: as for camel_lite_imap_command_response(). @store's
+ * command lock is unlocked on %CAMEL_IMAP_RESPONSE_TAGGED, on
+ * %CAMEL_IMAP_RESPONSE_ERROR, and when any read from @tok fails.
+ **/
+CamelImapResponseType
+camel_lite_imap_tokenizer_response (CamelImapTokenizer *tok, char **response,
+				    CamelException *ex)
+{
+	CamelImapStore *store = tok->store;
+	const char *data, *token;
+	char *atom, *rest, *respbuf;
+	guint32 len;
+	int type;
+
+	*response = NULL;
+	tok->unget = 0;
+
+	g_return_val_if_fail (store != NULL, CAMEL_IMAP_RESPONSE_ERROR);
+
+	if (tok->failed)
+		return CAMEL_IMAP_RESPONSE_ERROR;
+
+	if (!camel_lite_disco_store_check_online ((CamelDiscoStore *) store, ex)) {
+		tokenizer_fail (tok);
+		return CAMEL_IMAP_RESPONSE_ERROR;
+	}
+
+	camel_lite_imap_store_restore_stream_buffer (store);
+	if (!store->istream) {
+		camel_lite_exception_set (ex, CAMEL_EXCEPTION_SERVICE_UNAVAILABLE,
+				     _("Read from service failed: Service unavailable"));
+		tokenizer_fail (tok);
+		return CAMEL_IMAP_RESPONSE_ERROR;
+	}
+	tok->stream = CAMEL_STREAM_BUFFER (store->istream);
+
+	if (tokenizer_peek (tok, &data, ex) == -1)
+		return CAMEL_IMAP_RESPONSE_ERROR;
+
+	/* tagged and continuation responses are short, read them whole */
+	if (*data != '*')
+		return camel_lite_imap_command_response (store, response, ex);
+
+	camel_lite_stream_buffer_consume (tok->stream, 1);
+
+	type = camel_lite_imap_tokenizer_next (tok, &token, &len, ex);
+	if (type == CAMEL_IMAP_TOKEN_NUMBER) {
+		camel_lite_imap_tokenizer_unget (tok);
+		return CAMEL_IMAP_RESPONSE_UNTAGGED;
+	} else if (type == CAMEL_IMAP_TOKEN_ERROR)
+		return CAMEL_IMAP_RESPONSE_ERROR;
+	else if (type != CAMEL_IMAP_TOKEN_ATOM) {
+		tokenizer_protocol_error (tok, ex);
+		return CAMEL_IMAP_RESPONSE_ERROR;
+	}
+
+	/* OK, BYE, FLAGS, ... read the rest as camel_lite_imap_command_response()
+	 * would, the token goes when the buffer is refilled */
+	atom = g_strndup (token, len);
+	if (camel_lite_imap_store_readline (store, &rest, ex) < 0) {
+		g_free (atom);
+		tokenizer_fail (tok);
+		return CAMEL_IMAP_RESPONSE_ERROR;
+	}
+	respbuf = g_strconcat ("* ", atom, rest, NULL);
+	g_free (atom);
+	g_free (rest);
+
+	imap_debug ("(.., ..) <- %s\n", respbuf);
+
+	if (!g_ascii_strncasecmp (respbuf, "* BYE", 5)) {
+		imap_server_bye (store, ex);
+		g_free (respbuf);
+		tokenizer_fail (tok);
+		return CAMEL_IMAP_RESPONSE_ERROR;
+	}
+
+	if (strchr (respbuf, '{') && !(respbuf = imap_read_untagged (store, respbuf, ex))) {
+		tokenizer_fail (tok);
+		return CAMEL_IMAP_RESPONSE_ERROR;
+	}
+
+	imap_server_alert (store, respbuf);
+
+	*response = respbuf;
+	tok->token = NULL;
+	tok->len = 0;
+	tok->last = tok->unget = CAMEL_IMAP_TOKEN_EOL;
+
+	return CAMEL_IMAP_RESPONSE_UNTAGGED;
+}
+
+/**
+ * camel_lite_imap_tokenizer_next:
+ * @tok: the tokenizer
+ * @token: where to return the token, or %NULL
+ * @len: where to return its length, or %NULL
+ * @ex: a CamelException
+ *
+ * Reads the next token of the response. *@token points at the atom,
+ * number or (unquoted) string and is not NUL terminated, it's valid
+ * until the next call on @tok. '(', ')', '[' and ']' come back as
+ * themselves. For a %CAMEL_IMAP_TOKEN_LITERAL *@len is its size, its
+ * data can be read with camel_lite_imap_tokenizer_literal() or
+ * camel_lite_imap_tokenizer_literal_to_stream(), it is skipped otherwise.
+ *
+ * Return value: the type of the token, or %CAMEL_IMAP_TOKEN_ERROR
+ **/
+int
+camel_lite_imap_tokenizer_next (CamelImapTokenizer *tok, const char **token,
+				guint32 *len, CamelException *ex)
+{
+	const char *data;
+	ssize_t n, i;
+	int type;
+
+	if (tok->failed)
+		return CAMEL_IMAP_TOKEN_ERROR;
+
+	if (tok->unget) {
+		type = tok->unget;
+		tok->unget = 0;
+		goto done;
+	}
+
+	if (tok->literal && tokenizer_skip_literal (tok, ex) == -1)
+		return CAMEL_IMAP_TOKEN_ERROR;
+
+	while (1) {
+		if ((n = tokenizer_peek (tok, &data, ex)) == -1)
+			return CAMEL_IMAP_TOKEN_ERROR;
+		for (i = 0; i < n && data[i] == ' '; i++)
+			;
+		camel_lite_stream_buffer_consume (tok->stream, i);
+		if (i < n)
+			break;
+	}
+	data += i;
+
+	switch (*data) {
+	case '\r':
+	case '\n':
+		type = tokenizer_eol (tok, ex);
+		break;
+	case '"':
+		camel_lite_stream_buffer_consume (tok->stream, 1);
+		type = tokenizer_string (tok, ex);
+		break;
+	case '{':
+		camel_lite_stream_buffer_consume (tok->stream, 1);
+		type = tokenizer_literal (tok, ex);
+		break;
+	case '(':
+	case ')':
+	case '[':
+	case ']':
+		camel_lite_stream_buffer_consume (tok->stream, 1);
+		tok->token = data;
+		tok->len = 1;
+		type = *data;
+		break;
+	default:
+		if (tokenizer_is_atom (*data))
+			type = tokenizer_atom (tok, ex);
+		else
+			type = tokenizer_protocol_error (tok, ex);
+		break;
+	}
+
+	if (type == CAMEL_IMAP_TOKEN_ERROR)
+		return type;
+
+	tok->last = type;
+ done:
+	if (token)
+		*token = tok->token;
+	if (len)
+		*len = tok->len;
+
+	return type;
+}
+
+/**
+ * camel_lite_imap_tokenizer_unget:
+ * @tok: the tokenizer
+ *
+ * Hands the last token back, the next call to
+ * camel_lite_imap_tokenizer_next() returns it again.
+ **/
+void
+camel_lite_imap_tokenizer_unget (CamelImapTokenizer *tok)
+{
+	tok->unget = tok->last;
+}
+
+/**
+ * camel_lite_imap_tokenizer_skip_line:
+ * @tok: the tokenizer
+ * @ex: a CamelException
+ *
+ * Skips the rest of the response, literals included.
+ *
+ * Return value: 0 on success, -1 on error
+ **/
+int
+camel_lite_imap_tokenizer_skip_line (CamelImapTokenizer *tok, CamelException *ex)
+{
+	int type;
+
+	while ((type = camel_lite_imap_tokenizer_next (tok, NULL, NULL, ex)) != CAMEL_IMAP_TOKEN_EOL) {
+		if (type == CAMEL_IMAP_TOKEN_ERROR)
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * camel_lite_imap_tokenizer_literal:
+ * @tok: the tokenizer
+ * @buffer: the array to append the literal to
+ * @ex: a CamelException
+ *
+ * Appends the data of the literal that camel_lite_imap_tokenizer_next()
+ * just returned to @buffer, with LF line endings.
+ *
+ * Return value: 0 on success, -1 on error
+ **/
+int
+camel_lite_imap_tokenizer_literal (CamelImapTokenizer *tok, GByteArray *buffer,
+				   CamelException *ex)
+{
+	return tokenizer_read_literal (tok, buffer, NULL, ex);
+}
+
+/**
+ * camel_lite_imap_tokenizer_literal_to_stream:
+ * @tok: the tokenizer
+ * @stream: the stream to write the literal to
+ * @ex: a CamelException
+ *
+ * Like camel_lite_imap_tokenizer_literal(), but copies the literal
+ * to @stream a buffer at a time, so that a large message never has
+ * to be held in memory. Progress is reported to the current
+ * CamelOperation.
+ *
+ * Return value: 0 on success, -1 on a read or write error. After a
+ * write error the literal has been read all the same.
+ **/
+int
+camel_lite_imap_tokenizer_literal_to_stream (CamelImapTokenizer *tok, CamelStream *stream,
+					     CamelException *ex)
+{
+	return tokenizer_read_literal (tok, NULL, stream, ex);
+}
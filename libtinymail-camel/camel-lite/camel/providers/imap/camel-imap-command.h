@@ -74,9 +74,46 @@ CamelImapResponseType camel_lite_imap_command_response  (CamelImapStore *store,
 						    char **respbuf,
 						    CamelException *ex);
 
+GPtrArray         *camel_lite_imap_command_pipeline     (CamelImapStore *store,
+						    CamelFolder *folder,
+						    GPtrArray *cmds,
+						    CamelException *ex);
+
 CamelImapResponseType camel_lite_imap_command_response_idle (CamelImapStore *store, char **response,
 						        CamelException *ex);
 
+/* Reading a response one token at a time, straight from the
+ * store's input buffer. Special characters come back as themselves. */
+typedef enum {
+	CAMEL_IMAP_TOKEN_ERROR = -1,
+	CAMEL_IMAP_TOKEN_EOL = 256,
+	CAMEL_IMAP_TOKEN_ATOM,
+	CAMEL_IMAP_TOKEN_NUMBER,
+	CAMEL_IMAP_TOKEN_STRING,
+	CAMEL_IMAP_TOKEN_LITERAL
+} CamelImapTokenType;
+
+CamelImapTokenizer *camel_lite_imap_tokenizer_new      (CamelImapStore *store);
+CamelImapTokenizer *camel_lite_imap_tokenizer_new_for_stream (CamelStreamBuffer *stream);
+void                camel_lite_imap_tokenizer_free     (CamelImapTokenizer *tok);
+
+CamelImapResponseType camel_lite_imap_tokenizer_response (CamelImapTokenizer *tok,
+						      char **response,
+						      CamelException *ex);
+int   camel_lite_imap_tokenizer_next             (CamelImapTokenizer *tok,
+						    const char **token,
+						    guint32 *len,
+						    CamelException *ex);
+void  camel_lite_imap_tokenizer_unget            (CamelImapTokenizer *tok);
+int   camel_lite_imap_tokenizer_skip_line        (CamelImapTokenizer *tok,
+						    CamelException *ex);
+int   camel_lite_imap_tokenizer_literal          (CamelImapTokenizer *tok,
+						    GByteArray *buffer,
+						    CamelException *ex);
+int   camel_lite_imap_tokenizer_literal_to_stream (CamelImapTokenizer *tok,
+						    CamelStream *stream,
+						    CamelException *ex);
+
 G_END_DECLS
 
 #endif /* CAMEL_IMAP_COMMAND_H */
@@ -53,6 +53,9 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#ifndef G_OS_WIN32
+#include <sys/poll.h>
+#endif
 
 #include <glib/gi18n-lib.h>
 
@@ -69,6 +72,7 @@
 #include "camel-mime-filter-crlf.h"
 #include "camel-mime-filter-from.h"
 #include "camel-mime-message.h"
+#include "camel-mime-parser.h"
 #include "camel-mime-utils.h"
 #include "camel-multipart-encrypted.h"
 #include "camel-multipart-signed.h"
@@ -105,9 +109,17 @@
  * octets) */
 #define UID_SET_LIMIT  (768)
 
+/* batch window for the changes a refresh reports, in milliseconds */
+#define REFRESH_CHANGE_WINDOW 250
+
 #define CF_CLASS(o) (CAMEL_FOLDER_CLASS (CAMEL_OBJECT_GET_CLASS(o)))
 static CamelDiscoFolderClass *disco_folder_class = NULL;
 
+/* keys of the GData filled in by parse_fetch_response, looked up once
+   rather than for every item of every FETCH response */
+static GQuark fetch_sequence, fetch_flags, fetch_size, fetch_uid, fetch_internaldate;
+static GQuark fetch_body, fetch_part_spec, fetch_part_data, fetch_part_len, fetch_part_stream;
+
 static void imap_finalize (CamelObject *object);
 static int imap_getv(CamelObject *object, CamelException *ex, CamelArgGetV *args);
 
@@ -161,6 +173,7 @@ static void imap_transfer_resyncing (CamelFolder *source, GPtrArray *uids,
 static GPtrArray *imap_search_by_expression (CamelFolder *folder, const char *expression, CamelException *ex);
 static GPtrArray *imap_search_by_uids	    (CamelFolder *folder, const char *expression, GPtrArray *uids, CamelException *ex);
 static void       imap_search_free          (CamelFolder *folder, GPtrArray *uids);
+static GPtrArray *imap_sort_uids            (CamelFolder *folder, const char *criteria, CamelException *ex);
 static int imap_get_local_size (CamelFolder *folder);
 static void imap_thaw (CamelFolder *folder);
 
@@ -201,6 +214,17 @@ camel_lite_imap_folder_class_init (CamelImapFolderClass *camel_lite_imap_folder_
 
 	disco_folder_class = CAMEL_DISCO_FOLDER_CLASS (camel_lite_type_get_global_classfuncs (camel_lite_disco_folder_get_type ()));
 
+	fetch_sequence = g_quark_from_static_string ("SEQUENCE");
+	fetch_flags = g_quark_from_static_string ("FLAGS");
+	fetch_size = g_quark_from_static_string ("RFC822.SIZE");
+	fetch_uid = g_quark_from_static_string ("UID");
+	fetch_internaldate = g_quark_from_static_string ("INTERNALDATE");
+	fetch_body = g_quark_from_static_string ("BODY");
+	fetch_part_spec = g_quark_from_static_string ("BODY_PART_SPEC");
+	fetch_part_data = g_quark_from_static_string ("BODY_PART_DATA");
+	fetch_part_len = g_quark_from_static_string ("BODY_PART_LEN");
+	fetch_part_stream = g_quark_from_static_string ("BODY_PART_STREAM");
+
 	/* virtual method overload */
 	((CamelObjectClass *)camel_lite_imap_folder_class)->getv = imap_getv;
 
@@ -215,6 +239,7 @@ camel_lite_imap_folder_class_init (CamelImapFolderClass *camel_lite_imap_folder_
 	camel_lite_folder_class->search_by_expression = imap_search_by_expression;
 	camel_lite_folder_class->search_by_uids = imap_search_by_uids;
 	camel_lite_folder_class->search_free = imap_search_free;
+	camel_lite_folder_class->sort_uids = imap_sort_uids;
 	camel_lite_folder_class->thaw = imap_thaw;
 	camel_lite_folder_class->delete_attachments = imap_delete_attachments;
 	camel_lite_folder_class->rewrite_cache = imap_rewrite_cache;
@@ -256,8 +281,6 @@ camel_lite_imap_folder_init (gpointer object, gpointer klass)
 	imap_folder->in_idle = FALSE;
 	imap_folder->cancel_occurred = FALSE;
 
-	imap_folder->gmsgstore = NULL;
-	imap_folder->gmsgstore_ticks = 0;
 
 	imap_folder->do_push_email = TRUE;
 	folder->permanent_flags = CAMEL_MESSAGE_ANSWERED | CAMEL_MESSAGE_DELETED |
@@ -516,6 +539,7 @@ camel_lite_imap_folder_selected (CamelFolder *folder, CamelImapResponse *respons
 	CamelFolderChangeInfo *changes = NULL;
 
 	count = camel_lite_folder_summary_count (folder->summary);
+	imap_folder->modseq = 0;
 
 	/* With CONDSTORE this is the typical output.
 	 * C: A142 SELECT INBOX (CONDSTORE)
@@ -569,6 +593,7 @@ camel_lite_imap_folder_selected (CamelFolder *folder, CamelImapResponse *respons
 
 				highestmodseq = g_strndup (resp, len);
 				phighestmodseq = get_highestmodseq (imap_folder);
+				imap_folder->modseq = g_ascii_strtoull (highestmodseq, NULL, 10);
 
 				if (phighestmodseq !=NULL && !strcmp (phighestmodseq, highestmodseq))
 				{
@@ -747,7 +772,7 @@ camel_lite_imap_folder_selected (CamelFolder *folder, CamelImapResponse *respons
 							continue;
 
 						fetch_data = parse_fetch_response (imap_folder, resp + 7);
-						uid = strtoul (g_datalist_get_data (&fetch_data, "UID"), NULL, 10);
+						uid = strtoul (g_datalist_id_get_data (&fetch_data, fetch_uid), NULL, 10);
 						g_datalist_clear (&fetch_data);
 					}
 					camel_lite_imap_response_free_without_processing (store, response);
@@ -920,6 +945,7 @@ imap_refresh_info (CamelFolder *folder, CamelException *ex)
 	CamelImapFolder *imap_folder = CAMEL_IMAP_FOLDER (folder);
 	CamelImapResponse *response;
 	CamelStoreInfo *si;
+	guint window;
 
 	if (camel_lite_disco_store_status (CAMEL_DISCO_STORE (imap_store)) == CAMEL_DISCO_STORE_OFFLINE)
 		return;
@@ -929,6 +955,12 @@ imap_refresh_info (CamelFolder *folder, CamelException *ex)
 		return;
 	}
 
+	/* a rescan reports its changes a few at a time, coalesce them
+	   unless the caller already has a window of its own */
+	window = camel_lite_folder_get_change_window (folder);
+	if (window == 0)
+		camel_lite_folder_set_change_window (folder, REFRESH_CHANGE_WINDOW);
+
 	/* If the folder isn't selected, select it (which will force
 	 * a rescan if one is needed).
 	 * Also, if this is the INBOX, some servers (cryus) wont tell
@@ -986,6 +1018,9 @@ done:
 	camel_lite_imap_store_connect_unlock_start_idle (imap_store);
 	CAMEL_FOLDER_REC_UNLOCK(folder, lock);
 
+	/* emits what is still pending */
+	if (window == 0)
+		camel_lite_folder_set_change_window (folder, 0);
 }
 
 #if 0
@@ -1044,9 +1079,9 @@ process_condstore_line (CamelImapFolder *imap_folder, char *resp, CamelFolderCha
 	if (!data)
 		return -1;
 
-	uid = g_datalist_get_data (&data, "UID");
-	flags = GPOINTER_TO_UINT (g_datalist_get_data (&data, "FLAGS"));
-	seq = GPOINTER_TO_UINT (g_datalist_get_data (&data, "SEQUENCE"));
+	uid = g_datalist_id_get_data (&data, fetch_uid);
+	flags = GPOINTER_TO_UINT (g_datalist_id_get_data (&data, fetch_flags));
+	seq = GPOINTER_TO_UINT (g_datalist_id_get_data (&data, fetch_sequence));
 
 	/* So basically: if the UID is not found locally, we have flags
 	 * for a new message. That's cool, but not an error as the
@@ -1287,9 +1322,9 @@ imap_rescan (CamelFolder *folder, int exists, CamelException *ex)
 		if (!data)
 			continue;
 
-		seq = GPOINTER_TO_INT (g_datalist_get_data (&data, "SEQUENCE"));
-		uid = g_datalist_get_data (&data, "UID");
-		flags = GPOINTER_TO_UINT (g_datalist_get_data (&data, "FLAGS"));
+		seq = GPOINTER_TO_INT (g_datalist_id_get_data (&data, fetch_sequence));
+		uid = g_datalist_id_get_data (&data, fetch_uid);
+		flags = GPOINTER_TO_UINT (g_datalist_id_get_data (&data, fetch_flags));
 
 		if (!uid || !seq || seq > summary_len || seq < 0)
 		{
@@ -1416,62 +1451,164 @@ imap_rescan (CamelFolder *folder, int exists, CamelException *ex)
 /* the max number of chars that an unsigned 32-bit int can be is 10 chars plus 1 for a possible : */
 #define UID_SET_FULL(setlen, maxlen) (maxlen > 0 ? setlen + 11 >= maxlen : FALSE)
 
-/* Find all messages in @folder with flags matching @flags and @mask.
- * If no messages match, returns %NULL. Otherwise, returns an array of
- * CamelMessageInfo and sets *@set to a message set corresponding the
- * UIDs of the matched messages (up to @UID_SET_LIMIT bytes). The
- * caller must free the infos, the array, and the set string. */
-static GPtrArray *
-get_matching (CamelFolder *folder, guint32 flags, guint32 mask, char **set)
+/* Most UID STOREs sent before reading their responses.  With CONDSTORE
+ * a STORE can be answered with a FETCH per message, these must fit in
+ * the socket's buffers while we are still writing. */
+#define STORE_PIPELINE_DEPTH 8
+
+/* Messages with the same change, sorted by uid */
+struct _sync_group {
+	guint32 added, removed;
+	GPtrArray *entries;
+};
+
+struct _sync_entry {
+	const char *uid;		/* key in the stolen journal */
+	CamelImapFlagDelta *delta;
+	struct _sync_group *group;
+	guint32 nuid;
+	gboolean failed;
+};
+
+struct _sync_collect {
+	CamelFolder *folder;
+	GPtrArray *entries;
+	GPtrArray *groups;
+};
+
+struct _sync_store {
+	struct _sync_group *group;
+	guint first, last;
+	char *cmd;
+};
+
+/* Group what is left of a change once the server's own changes and
+ * the non permanent flags are taken out */
+static void
+sync_collect (gpointer key, gpointer value, gpointer user_data)
 {
-	GPtrArray *matches;
+	struct _sync_collect *c = user_data;
+	CamelFolder *folder = c->folder;
+	CamelImapFlagDelta *delta = value;
 	CamelImapMessageInfo *info;
-	int i, max, range;
+	struct _sync_group *group = NULL;
+	struct _sync_entry *entry;
+	guint32 added, removed;
+	int i;
+
+	if (!(info = (CamelImapMessageInfo *)camel_lite_folder_summary_uid (folder->summary, key)))
+		return;
+
+	added = delta->added & info->info.flags & folder->permanent_flags;
+	removed = delta->removed & ~info->info.flags & folder->permanent_flags;
+
+	if (added == 0 && removed == 0) {
+		if (!camel_lite_imap_summary_journal_has (folder->summary, key))
+			info->info.flags &= ~CAMEL_MESSAGE_FOLDER_FLAGGED;
+		camel_lite_message_info_free (info);
+		return;
+	}
+	camel_lite_message_info_free (info);
+
+	for (i = 0; i < c->groups->len; i++) {
+		group = c->groups->pdata[i];
+		if (group->added == added && group->removed == removed)
+			break;
+		group = NULL;
+	}
+	if (!group) {
+		group = g_new0 (struct _sync_group, 1);
+		group->added = added;
+		group->removed = removed;
+		group->entries = g_ptr_array_new ();
+		g_ptr_array_add (c->groups, group);
+	}
+
+	entry = g_new0 (struct _sync_entry, 1);
+	entry->uid = key;
+	entry->delta = delta;
+	entry->group = group;
+	entry->nuid = strtoul (key, NULL, 10);
+	g_ptr_array_add (c->entries, entry);
+	g_ptr_array_add (group->entries, entry);
+}
+
+static int
+sync_entry_compar (const void *va, const void *vb)
+{
+	const struct _sync_entry *a = *(struct _sync_entry **)va, *b = *(struct _sync_entry **)vb;
+
+	return a->nuid < b->nuid ? -1 : a->nuid > b->nuid;
+}
+
+/* Only uids which follow each other are merged into a range, so that
+ * a STORE never touches a message it wasn't meant for */
+static char *
+sync_entries_to_set (GPtrArray *entries, guint first, guint *last)
+{
+	struct _sync_entry *entry;
+	guint32 start, prev;
 	GString *gset;
+	guint i = first;
 
-	matches = g_ptr_array_new ();
 	gset = g_string_new ("");
-	max = camel_lite_folder_summary_count (folder->summary);
-	range = -1;
-	for (i = 0; i < max && !UID_SET_FULL (gset->len, UID_SET_LIMIT); i++) {
-		info = (CamelImapMessageInfo *)camel_lite_folder_summary_index (folder->summary, i);
-		if (!info)
-			continue;
-		if ((info->info.flags & mask) != flags) {
-			camel_lite_message_info_free((CamelMessageInfo *)info);
-			if (range != -1) {
-				if (range != i - 1) {
-					info = matches->pdata[matches->len - 1];
-					g_string_append_printf (gset, ":%s", camel_lite_message_info_uid (info));
-				}
-				range = -1;
-			}
-			continue;
+	while (i < entries->len && !UID_SET_FULL (gset->len, UID_SET_LIMIT)) {
+		entry = entries->pdata[i++];
+		start = prev = entry->nuid;
+		while (i < entries->len && ((struct _sync_entry *)entries->pdata[i])->nuid == prev + 1) {
+			prev++;
+			i++;
 		}
-
-		g_ptr_array_add (matches, info);
-		if (range != -1)
-			continue;
-		range = i;
 		if (gset->len)
 			g_string_append_c (gset, ',');
-		g_string_append_printf (gset, "%s", camel_lite_message_info_uid (info));
+		if (start == prev)
+			g_string_append_printf (gset, "%u", start);
+		else
+			g_string_append_printf (gset, "%u:%u", start, prev);
 	}
+	*last = i;
+
+	return g_string_free (gset, FALSE);
+}
+
+/* Whether @uid is in the set of a [MODIFIED set] response code */
+static gboolean
+uid_set_contains (const char *set, guint32 uid)
+{
+	unsigned long a, b;
+	char *end;
 
-	if (range != -1 && range != max - 1) {
-		info = matches->pdata[matches->len - 1];
-		g_string_append_printf (gset, ":%s", camel_lite_message_info_uid (info));
+	for (;;) {
+		a = b = strtoul (set, &end, 10);
+		if (end == set)
+			return FALSE;
+		if (*end == ':')
+			b = strtoul (end + 1, &end, 10);
+		if ((uid >= a && uid <= b) || (uid >= b && uid <= a))
+			return TRUE;
+		if (*end != ',')
+			return FALSE;
+		set = end + 1;
 	}
+}
 
-	if (matches->len) {
-		*set = gset->str;
-		g_string_free (gset, FALSE);
-		return matches;
-	} else {
-		*set = NULL;
-		g_string_free (gset, TRUE);
-		g_ptr_array_free (matches, TRUE);
-		return NULL;
+/* Our own STOREs raise the modseq of the messages they change, the
+ * value from SELECT would make the next STORE to them fail.  Keep up
+ * with the MODSEQ items of the FETCH responses instead. */
+static void
+imap_folder_note_modseq (CamelImapFolder *imap_folder, CamelImapResponse *response)
+{
+	guint64 modseq;
+	char *resp;
+	int i;
+
+	for (i = 0; i < response->untagged->len; i++) {
+		resp = response->untagged->pdata[i];
+		if (!camel_lite_strstrcase (resp, " FETCH ") || !(resp = camel_lite_strstrcase (resp, "MODSEQ (")))
+			continue;
+		modseq = g_ascii_strtoull (resp + 8, NULL, 10);
+		if (modseq > imap_folder->modseq)
+			imap_folder->modseq = modseq;
 	}
 }
 
@@ -1506,106 +1643,219 @@ imap_sync_offline (CamelFolder *folder, CamelException *ex)
 	camel_lite_store_summary_save((CamelStoreSummary *)((CamelImapStore *)folder->parent_store)->summary, ex);
 }
 
+/* Flag changes are taken from the summary's journal rather than found
+ * by walking the summary.  Messages with the same change are grouped
+ * and stored with +FLAGS and -FLAGS, which leaves alone what other
+ * clients changed on the same messages meanwhile. */
 static void
 imap_sync_online (CamelFolder *folder, CamelException *ex)
 {
 	CamelImapStore *store = CAMEL_IMAP_STORE (folder->parent_store);
-	CamelImapResponse *response = NULL;
+	CamelImapFolder *imap_folder = CAMEL_IMAP_FOLDER (folder);
 	CamelImapMessageInfo *info;
 	CamelException local_ex;
-	GPtrArray *matches;
-	char *set, *flaglist;
-	gboolean unset;
-	int i, j, max;
+	GHashTable *journal;
+	GPtrArray *entries, *groups, *stores, *cmds, *responses, *modified_entries;
+	struct _sync_collect collect;
+	struct _sync_entry *entry;
+	struct _sync_group *group;
+	struct _sync_store *sstore;
+	char *set, *flaglist, *modseq = NULL, *unchanged = NULL;
+	guint64 unchangedsince;
+	int i, j, k, done;
 
 	if (folder->permanent_flags == 0) {
 		imap_sync_offline (folder, ex);
 		return;
 	}
 
+	journal = camel_lite_imap_summary_journal_steal (folder->summary);
+	if (g_hash_table_size (journal) == 0) {
+		g_hash_table_destroy (journal);
+		imap_sync_offline (folder, ex);
+		return;
+	}
+
 	camel_lite_exception_init (&local_ex);
 	camel_lite_imap_store_stop_idle_connect_lock (store);
 
-	/* Find a message with changed flags, find all of the other
-	 * messages like it, sync them as a group, mark them as
-	 * updated, and continue.*/
-	max = camel_lite_folder_summary_count (folder->summary);
-	for (i = 0; i < max; i++) {
-		if (!(info = (CamelImapMessageInfo *)camel_lite_folder_summary_index (folder->summary, i)))
-			continue;
+	collect.folder = folder;
+	collect.entries = entries = g_ptr_array_new ();
+	collect.groups = groups = g_ptr_array_new ();
+	g_hash_table_foreach (journal, sync_collect, &collect);
+
+	if ((store->capabilities & IMAP_CAPABILITY_CONDSTORE)) {
+		modseq = camel_lite_imap_folder_get_highestmodseq (imap_folder);
+		unchangedsince = MAX (modseq ? g_ascii_strtoull (modseq, NULL, 10) : 0, imap_folder->modseq);
+		if (unchangedsince > 0)
+			unchanged = g_strdup_printf (" (UNCHANGEDSINCE %" G_GUINT64_FORMAT ")", unchangedsince);
+	}
+	if (!unchanged)
+		unchanged = g_strdup ("");
+
+	/* One +FLAGS and one -FLAGS per uid set.  The second STORE to a
+	 * message would see the modseq raised by the first, so only the
+	 * first is conditional. */
+	stores = g_ptr_array_new ();
+	for (i = 0; i < groups->len; i++) {
+		guint first, last;
+
+		group = groups->pdata[i];
+		qsort (group->entries->pdata, group->entries->len, sizeof (void *), sync_entry_compar);
+
+		for (first = 0; first < group->entries->len; first = last) {
+			set = sync_entries_to_set (group->entries, first, &last);
+
+			if (group->added) {
+				flaglist = imap_create_flag_list (group->added);
+				sstore = g_new0 (struct _sync_store, 1);
+				sstore->group = group;
+				sstore->first = first;
+				sstore->last = last;
+				sstore->cmd = g_strdup_printf ("UID STORE %s%s +FLAGS.SILENT %s",
+							       set, unchanged, flaglist);
+				g_ptr_array_add (stores, sstore);
+				g_free (flaglist);
+			}
 
-		if (!(info->info.flags & CAMEL_MESSAGE_FOLDER_FLAGGED)) {
-			camel_lite_message_info_free((CamelMessageInfo *)info);
-			continue;
+			if (group->removed) {
+				flaglist = imap_create_flag_list (group->removed);
+				sstore = g_new0 (struct _sync_store, 1);
+				sstore->group = group;
+				sstore->first = first;
+				sstore->last = last;
+				sstore->cmd = g_strdup_printf ("UID STORE %s%s -FLAGS.SILENT %s",
+							       set, group->added ? "" : unchanged, flaglist);
+				g_ptr_array_add (stores, sstore);
+				g_free (flaglist);
+			}
+
+			g_free (set);
 		}
+	}
+	g_free (unchanged);
+	g_free (modseq);
 
-		/* Note: Cyrus is broken and will not accept an
-		   empty-set of flags so... if this is true then we
-		   want to unset the previously set flags.*/
-		unset = !(info->info.flags & folder->permanent_flags);
-
-		/* Note: get_matching() uses UID_SET_LIMIT to limit
-		   the size of the uid-set string. We don't have to
-		   loop here to flush all the matching uids because
-		   they will be scooped up later by our parent loop (I
-		   think?). -- Jeff */
-		matches = get_matching (folder, info->info.flags & (folder->permanent_flags | CAMEL_MESSAGE_FOLDER_FLAGGED),
-					folder->permanent_flags | CAMEL_MESSAGE_FOLDER_FLAGGED, &set);
-		camel_lite_message_info_free(info);
-		if (matches == NULL)
-			continue;
+	/* Make sure we're connected before issuing commands */
+	if (stores->len > 0)
+		camel_lite_disco_store_check_online ((CamelDiscoStore*)store, &local_ex);
 
-		/* Make sure we're connected before issuing commands */
-		if (!camel_lite_disco_store_check_online ((CamelDiscoStore*)store, ex)) {
-			g_free(set);
-			break;
-		}
+	modified_entries = g_ptr_array_new ();
 
-		/* FIXME: since we don't know the previously set flags,
-		   if unset is TRUE then just unset all the flags? */
-		flaglist = imap_create_flag_list (unset ? folder->permanent_flags : info->info.flags & folder->permanent_flags);
+	done = 0;
+	while (done < stores->len && !camel_lite_exception_is_set (&local_ex)) {
+		cmds = g_ptr_array_new ();
+		for (k = 0; k < STORE_PIPELINE_DEPTH && done + k < stores->len; k++)
+			g_ptr_array_add (cmds, ((struct _sync_store *)stores->pdata[done + k])->cmd);
 
-		/* Note: to `unset' flags, use -FLAGS.SILENT (<flag list>) */
-		response = camel_lite_imap_command (store, folder, &local_ex,
-					       "UID STORE %s %sFLAGS.SILENT %s",
-					       set, unset ? "-" : "", flaglist);
-		g_free (set);
-		g_free (flaglist);
+		responses = camel_lite_imap_command_pipeline (store, folder, cmds, &local_ex);
 
-		if (response)
-			camel_lite_imap_response_free (store, response);
+		for (k = 0; k < cmds->len; k++) {
+			CamelImapResponse *response = responses->pdata[k];
+			const char *modified = NULL;
 
-		if (!camel_lite_exception_is_set (&local_ex)) {
-			for (j = 0; j < matches->len; j++) {
-				info = matches->pdata[j];
-				info->info.flags &= ~CAMEL_MESSAGE_FOLDER_FLAGGED;
-				((CamelImapMessageInfo *) info)->server_flags =	info->info.flags & CAMEL_IMAP_SERVER_FLAGS;
+			sstore = stores->pdata[done + k];
+			if (response && response->status)
+				modified = strstr (response->status, "[MODIFIED ");
+
+			for (j = sstore->first; j < sstore->last; j++) {
+				entry = sstore->group->entries->pdata[j];
+				if (!response) {
+					entry->failed = TRUE;
+				} else if (modified && uid_set_contains (modified + 10, entry->nuid)) {
+					if (!entry->failed)
+						g_ptr_array_add (modified_entries, entry);
+					entry->failed = TRUE;
+				}
+			}
+
+			if (response) {
+				imap_folder_note_modseq (imap_folder, response);
+				camel_lite_imap_response_free (store, response);
 			}
-			camel_lite_folder_summary_touch (folder->summary);
 		}
 
-		for (j = 0; j < matches->len; j++) {
-			info = matches->pdata[j];
-			camel_lite_message_info_free(&info->info);
+		done += cmds->len;
+		g_ptr_array_free (responses, TRUE);
+		g_ptr_array_free (cmds, TRUE);
+	}
+
+	/* The server changed these since we last looked.  Get their
+	 * flags and modseqs, which also makes the retry of what stays in
+	 * the journal conditional on the state we have just seen rather
+	 * than on the one from SELECT. */
+	if (modified_entries->len > 0 && !camel_lite_exception_is_set (&local_ex)) {
+		CamelImapResponse *response;
+		guint first, last;
+
+		qsort (modified_entries->pdata, modified_entries->len, sizeof (void *), sync_entry_compar);
+		for (first = 0; first < modified_entries->len; first = last) {
+			set = sync_entries_to_set (modified_entries, first, &last);
+			response = camel_lite_imap_command (store, folder, &local_ex,
+							    "UID FETCH %s (FLAGS MODSEQ)", set);
+			g_free (set);
+			if (!response)
+				break;
+			imap_folder_note_modseq (imap_folder, response);
+			camel_lite_imap_response_free (store, response);
 		}
-		g_ptr_array_free (matches, TRUE);
+	}
+	g_ptr_array_free (modified_entries, TRUE);
 
-		/* check for an exception */
-		if (camel_lite_exception_is_set (&local_ex)) {
+	/* What wasn't sent failed as well */
+	for (i = done; i < stores->len; i++) {
+		sstore = stores->pdata[i];
+		for (j = sstore->first; j < sstore->last; j++)
+			((struct _sync_entry *)sstore->group->entries->pdata[j])->failed = TRUE;
+	}
 
-			camel_lite_imap_store_connect_unlock_start_idle (store);
+	for (i = 0; i < entries->len; i++) {
+		entry = entries->pdata[i];
 
-			camel_lite_exception_xfer (ex, &local_ex);
-			return;
+		if (entry->failed) {
+			camel_lite_imap_summary_journal_restore (folder->summary, entry->uid, entry->delta);
+			continue;
 		}
 
+		info = (CamelImapMessageInfo *)camel_lite_folder_summary_uid (folder->summary, entry->uid);
+		if (!info)
+			continue;
+
+		group = entry->group;
+		info->server_flags = ((info->server_flags | group->added) & ~group->removed) & CAMEL_IMAP_SERVER_FLAGS;
+		if (!camel_lite_imap_summary_journal_has (folder->summary, entry->uid))
+			info->info.flags &= ~CAMEL_MESSAGE_FOLDER_FLAGGED;
+		camel_lite_folder_summary_touch (folder->summary);
+		camel_lite_message_info_free (info);
+	}
+
+	for (i = 0; i < stores->len; i++) {
+		sstore = stores->pdata[i];
+		g_free (sstore->cmd);
+		g_free (sstore);
+	}
+	g_ptr_array_free (stores, TRUE);
+	for (i = 0; i < groups->len; i++) {
+		group = groups->pdata[i];
+		g_ptr_array_free (group->entries, TRUE);
+		g_free (group);
+	}
+	g_ptr_array_free (groups, TRUE);
+	for (i = 0; i < entries->len; i++)
+		g_free (entries->pdata[i]);
+	g_ptr_array_free (entries, TRUE);
+	g_hash_table_destroy (journal);
+
+	if (camel_lite_exception_is_set (&local_ex)) {
+		camel_lite_imap_store_connect_unlock_start_idle (store);
+		camel_lite_exception_xfer (ex, &local_ex);
+		return;
 	}
 
 	/* Save the summary */
 	imap_sync_offline (folder, ex);
 
 	camel_lite_imap_store_connect_unlock_start_idle (store);
-
 }
 
 static int
@@ -2423,6 +2673,288 @@ imap_search_free (CamelFolder *folder, GPtrArray *uids)
 	CAMEL_IMAP_FOLDER_UNLOCK(folder, search_lock);
 }
 
+/* Sorting, threading and searching on the server.  These see every
+   message in the mailbox, not just the part of it that made it into
+   the summary, so the order they give is right even for a folder
+   that is only partly synced. */
+
+static int
+uid_number_compar (const void *a, const void *b)
+{
+	guint32 ua = *(const guint32 *) a, ub = *(const guint32 *) b;
+
+	return ua < ub ? -1 : ua > ub;
+}
+
+static char *
+uid_numbers_to_set (GArray *uids)
+{
+	guint32 first, last, uid;
+	GString *set;
+	char *str;
+	int i;
+
+	if (uids->len == 0)
+		return NULL;
+
+	qsort (uids->data, uids->len, sizeof (guint32), uid_number_compar);
+
+	set = g_string_new ("");
+	first = last = g_array_index (uids, guint32, 0);
+	for (i = 1; i <= uids->len; i++) {
+		uid = i < uids->len ? g_array_index (uids, guint32, i) : 0;
+		if (i < uids->len && (uid == last || uid == last + 1)) {
+			last = uid;
+			continue;
+		}
+		if (set->len)
+			g_string_append_c (set, ',');
+		if (first == last)
+			g_string_append_printf (set, "%u", first);
+		else
+			g_string_append_printf (set, "%u:%u", first, last);
+		first = last = uid;
+	}
+
+	str = set->str;
+	g_string_free (set, FALSE);
+
+	return str;
+}
+
+static CamelImapResponse *
+imap_server_command (CamelFolder *folder, guint32 capability, const char *cmd, CamelException *ex)
+{
+	CamelImapStore *store = CAMEL_IMAP_STORE (folder->parent_store);
+	CamelImapResponse *response = NULL;
+
+	camel_lite_imap_store_stop_idle_connect_lock (store);
+
+	if (camel_lite_disco_store_check_online ((CamelDiscoStore *) store, ex)
+	    && (capability == 0 || (store->capabilities & capability)))
+		response = camel_lite_imap_command (store, folder, ex, "%s", cmd);
+
+	camel_lite_imap_store_connect_unlock_start_idle (store);
+
+	return response;
+}
+
+/**
+ * camel_lite_imap_folder_sort:
+ * @folder: an IMAP folder
+ * @criteria: RFC 5256 sort criteria, for example "REVERSE DATE"
+ * @search: search criteria for the messages to sort, or %NULL for all of them
+ * @ex: a #CamelException
+ *
+ * Have the server sort the messages in @folder with UID SORT.
+ *
+ * Return value: the sorted uids as an array of guint32, or %NULL on
+ * error.  If the server doesn't support SORT, %NULL is returned without
+ * @ex being set and the caller should sort the summary itself.
+ **/
+GArray *
+camel_lite_imap_folder_sort (CamelFolder *folder, const char *criteria, const char *search, CamelException *ex)
+{
+	CamelImapStore *store = CAMEL_IMAP_STORE (folder->parent_store);
+	CamelImapResponse *response;
+	char *cmd, *result, *p, *lasts = NULL;
+	GArray *uids;
+	guint32 uid;
+
+	cmd = g_strdup_printf ("UID SORT (%s) UTF-8 %s", criteria, search ? search : "ALL");
+	response = imap_server_command (folder, IMAP_CAPABILITY_SORT, cmd, ex);
+	g_free (cmd);
+
+	if (!response)
+		return NULL;
+	result = camel_lite_imap_response_extract (store, response, "SORT", ex);
+	if (!result)
+		return NULL;
+
+	uids = g_array_new (FALSE, FALSE, sizeof (guint32));
+	p = (char *) imap_next_word (result + 2);
+	for (p = strtok_r (p, " ", &lasts); p; p = strtok_r (NULL, " ", &lasts)) {
+		uid = strtoul (p, NULL, 10);
+		if (uid)
+			g_array_append_val (uids, uid);
+	}
+	g_free (result);
+
+	return uids;
+}
+
+static GPtrArray *
+imap_sort_uids (CamelFolder *folder, const char *criteria, CamelException *ex)
+{
+	GPtrArray *uids;
+	GArray *sorted;
+	int i;
+
+	sorted = camel_lite_imap_folder_sort (folder, criteria, NULL, ex);
+	if (!sorted)
+		return NULL;
+
+	uids = g_ptr_array_sized_new (sorted->len);
+	for (i = 0; i < sorted->len; i++)
+		g_ptr_array_add (uids, g_strdup_printf ("%u", g_array_index (sorted, guint32, i)));
+	g_array_free (sorted, TRUE);
+
+	return uids;
+}
+
+/**
+ * camel_lite_imap_folder_thread:
+ * @folder: an IMAP folder
+ * @search: search criteria for the messages to thread, or %NULL for all of them
+ * @tree: return location for the threads
+ * @ex: a #CamelException
+ *
+ * Have the server thread the messages in @folder with UID THREAD
+ * REFERENCES.  The roots of the threads are linked by their next
+ * pointers, the replies to a message hang off its child pointer.  A
+ * node with a uid of 0 stands for a parent the server doesn't have.
+ * Free the result with camel_lite_imap_thread_free().
+ *
+ * Return value: %FALSE on error, or if the server can't thread with
+ * the REFERENCES algorithm.  In that case @ex isn't set and the caller
+ * should thread the summary itself.
+ **/
+gboolean
+camel_lite_imap_folder_thread (CamelFolder *folder, const char *search, CamelImapThreadNode **tree, CamelException *ex)
+{
+	CamelImapStore *store = CAMEL_IMAP_STORE (folder->parent_store);
+	CamelImapResponse *response;
+	char *cmd, *result;
+
+	*tree = NULL;
+
+	cmd = g_strdup_printf ("UID THREAD REFERENCES UTF-8 %s", search ? search : "ALL");
+	response = imap_server_command (folder, IMAP_CAPABILITY_THREAD_REFERENCES, cmd, ex);
+	g_free (cmd);
+
+	if (!response)
+		return FALSE;
+	result = camel_lite_imap_response_extract (store, response, "THREAD", ex);
+	if (!result)
+		return FALSE;
+
+	if (!imap_parse_thread_response (result, tree)) {
+		camel_lite_exception_set (ex, CAMEL_EXCEPTION_SERVICE_PROTOCOL,
+				     _("IMAP server returned an invalid THREAD response"));
+		g_free (result);
+		return FALSE;
+	}
+	g_free (result);
+
+	return TRUE;
+}
+
+/**
+ * camel_lite_imap_thread_free:
+ * @tree: threads from camel_lite_imap_folder_thread()
+ *
+ * Free @tree.
+ **/
+void
+camel_lite_imap_thread_free (CamelImapThreadNode *tree)
+{
+	CamelImapThreadNode *next;
+
+	while (tree) {
+		next = tree->next;
+		camel_lite_imap_thread_free (tree->child);
+		g_free (tree);
+		tree = next;
+	}
+}
+
+/**
+ * camel_lite_imap_folder_esearch:
+ * @folder: an IMAP folder
+ * @search: search criteria, or %NULL for all messages
+ * @result: the result to fill in
+ * @ex: a #CamelException
+ *
+ * Search the messages in @folder on the server.  When the server
+ * supports ESEARCH it only sends the lowest and highest matching uid,
+ * the number of matches and the matches as a compact uid set, rather
+ * than one number per message.  Otherwise the same results are worked
+ * out from a plain UID SEARCH.  Free the result with
+ * camel_lite_imap_search_result_clear().
+ *
+ * Return value: %FALSE on error.
+ **/
+gboolean
+camel_lite_imap_folder_esearch (CamelFolder *folder, const char *search, CamelImapSearchResult *result, CamelException *ex)
+{
+	CamelImapStore *store = CAMEL_IMAP_STORE (folder->parent_store);
+	CamelImapResponse *response;
+	char *cmd, *resp, *p, *lasts = NULL;
+	gboolean esearch;
+	GArray *uids;
+	guint32 uid;
+
+	memset (result, 0, sizeof (*result));
+
+	esearch = (store->capabilities & IMAP_CAPABILITY_ESEARCH) != 0;
+	cmd = g_strdup_printf ("UID SEARCH %s%s", esearch ? "RETURN (MIN MAX COUNT ALL) " : "",
+			       search ? search : "ALL");
+	response = imap_server_command (folder, 0, cmd, ex);
+	g_free (cmd);
+
+	if (!response)
+		return FALSE;
+
+	if (esearch) {
+		/* some servers leave the response out if nothing matched */
+		resp = camel_lite_imap_response_extract (store, response, "ESEARCH", NULL);
+		if (!resp)
+			return TRUE;
+		imap_parse_esearch_response (resp, &result->min, &result->max, &result->count, &result->all);
+		g_free (resp);
+
+		return TRUE;
+	}
+
+	resp = camel_lite_imap_response_extract (store, response, "SEARCH", ex);
+	if (!resp)
+		return FALSE;
+
+	uids = g_array_new (FALSE, FALSE, sizeof (guint32));
+	p = (char *) imap_next_word (resp + 2);
+	for (p = strtok_r (p, " ", &lasts); p; p = strtok_r (NULL, " ", &lasts)) {
+		uid = strtoul (p, NULL, 10);
+		if (uid == 0)
+			continue;
+		/* the server may send the matches in any order */
+		if (uids->len == 0 || uid < result->min)
+			result->min = uid;
+		if (uid > result->max)
+			result->max = uid;
+		g_array_append_val (uids, uid);
+	}
+	g_free (resp);
+
+	result->all = uid_numbers_to_set (uids);
+	result->count = uids->len;
+	g_array_free (uids, TRUE);
+
+	return TRUE;
+}
+
+/**
+ * camel_lite_imap_search_result_clear:
+ * @result: a result filled in by camel_lite_imap_folder_esearch()
+ *
+ * Free the data held by @result.
+ **/
+void
+camel_lite_imap_search_result_clear (CamelImapSearchResult *result)
+{
+	g_free (result->all);
+	memset (result, 0, sizeof (*result));
+}
+
 static CamelMimeMessage *get_message (CamelImapFolder *imap_folder,
 				      const char *uid,
 				      CamelMessageContentInfo *ci,
@@ -2841,8 +3373,8 @@ imap_get_message (CamelFolder *folder, const char *uid, CamelFolderReceiveType t
 					for (i = 0, body = NULL; i < response->untagged->len; i++) {
 						fetch_data = parse_fetch_response (imap_folder, response->untagged->pdata[i]);
 						if (fetch_data) {
-							found_uid = g_datalist_get_data (&fetch_data, "UID");
-							body = g_datalist_get_data (&fetch_data, "BODY");
+							found_uid = g_datalist_id_get_data (&fetch_data, fetch_uid);
+							body = g_datalist_id_get_data (&fetch_data, fetch_body);
 							if (found_uid && body && !strcmp (found_uid, uid))
 								break;
 							g_datalist_clear (&fetch_data);
@@ -3021,34 +3553,37 @@ decode_internaldate (const unsigned char *in)
 
 
 static CamelImapMessageInfo*
-message_from_data (CamelFolder *folder, GData *data)
+message_from_stream (CamelFolder *folder, CamelStream *stream, guint32 size, const char *idate)
 {
-	CamelMimeMessage *msg;
-	CamelStream *stream;
+	CamelMimeParser *mp;
 	CamelImapMessageInfo *mi;
-	const char *idate;
-	gint size = 0;
 	struct _camel_lite_header_raw *h;
 
-	stream = g_datalist_get_data (&data, "BODY_PART_STREAM");
-	if (!stream)
+	/* The info only needs the headers, so don't build a whole
+	 * CamelMimeMessage out of them */
+	mp = camel_lite_mime_parser_new ();
+	if (camel_lite_mime_parser_init_with_stream (mp, stream) == -1) {
+		camel_lite_object_unref (mp);
 		return NULL;
+	}
 
-	msg = camel_lite_mime_message_new ();
-	if (camel_lite_data_wrapper_construct_from_stream (CAMEL_DATA_WRAPPER (msg), stream) == -1) {
-		camel_lite_object_unref (CAMEL_OBJECT (msg));
+	switch (camel_lite_mime_parser_step (mp, NULL, NULL)) {
+	case CAMEL_MIME_PARSER_STATE_HEADER:
+	case CAMEL_MIME_PARSER_STATE_MESSAGE:
+	case CAMEL_MIME_PARSER_STATE_MULTIPART:
+		break;
+	default:
+		camel_lite_object_unref (mp);
 		return NULL;
 	}
 
-	mi = (CamelImapMessageInfo *)camel_lite_folder_summary_info_new_from_message (folder->summary, msg);
+	h = camel_lite_mime_parser_headers_raw (mp);
+	mi = (CamelImapMessageInfo *)camel_lite_folder_summary_info_new_from_header (folder->summary, h);
 
-	size = GPOINTER_TO_INT (g_datalist_get_data (&data, "RFC822.SIZE"));
 	if (size)
 		mi->info.size = size;
 
 
-	h = ((CamelMimePart *)msg)->headers;
-
 	if (camel_lite_header_raw_find(&h, "X-MSMail-Priority", NULL) &&
 		!camel_lite_header_raw_find(&h, "X-MS-Has-Attach", NULL)) {
 		/**/
@@ -3063,7 +3598,7 @@ message_from_data (CamelFolder *folder, GData *data)
 
 	}
 
-	camel_lite_object_unref (CAMEL_OBJECT (msg));
+	camel_lite_object_unref (mp);
 	/* This overrides Received: (although it wont be found by the messages
 	 * fed to message_info_new_from_header, as this header is not in the
 	 * query. Leaving them out makes retrieving summary consume a lot less
@@ -3071,12 +3606,255 @@ message_from_data (CamelFolder *folder, GData *data)
 	 * message got written to the store. It's often not the same as the date
 	 * in the "Received" headers. */
 
-	if ((idate = g_datalist_get_data (&data, "INTERNALDATE")))
+	if (idate)
 		mi->info.date_received = decode_internaldate ((const unsigned char *) idate);
 
 	return mi;
 }
 
+/* What we need out of one "* n FETCH (...)", read by fetch_response_read */
+struct _fetch_response {
+	guint32 seq, flags, size;
+	char *uid, *idate;
+	char *part_spec;	/* NULL for HEADER.FIELDS, which isn't cached */
+	GByteArray *body;
+
+	CamelStream *stream;	/* if set, the body goes here in stead */
+	gboolean written;
+};
+
+static void
+fetch_response_clear (struct _fetch_response *fh)
+{
+	g_free (fh->uid);
+	g_free (fh->idate);
+	g_free (fh->part_spec);
+	if (fh->body)
+		g_byte_array_free (fh->body, TRUE);
+	fh->uid = fh->idate = fh->part_spec = NULL;
+	fh->body = NULL;
+	fh->seq = fh->flags = fh->size = 0;
+}
+
+static gboolean
+fetch_token_is (const char *token, guint32 len, const char *name)
+{
+	return len == strlen (name) && !g_ascii_strncasecmp (token, name, len);
+}
+
+static guint32
+fetch_token_uint (const char *token, guint32 len)
+{
+	guint32 n = 0;
+
+	while (len--)
+		n = n * 10 + (*token++ - '0');
+
+	return n;
+}
+
+/* Skips one value of a FETCH item, nested lists and all */
+static int
+fetch_skip_value (CamelImapTokenizer *tok, CamelException *ex)
+{
+	int type, depth = 0;
+
+	do {
+		type = camel_lite_imap_tokenizer_next (tok, NULL, NULL, ex);
+		if (type == '(')
+			depth++;
+		else if (type == ')')
+			depth--;
+		else if (type == CAMEL_IMAP_TOKEN_EOL || type == CAMEL_IMAP_TOKEN_ERROR)
+			return -1;
+	} while (depth > 0);
+
+	return depth < 0 ? -1 : 0;
+}
+
+/* Reads the nstring value of a BODY[...] or RFC822 item into fh->body,
+ * or copies it to fh->stream as it comes in */
+static int
+fetch_read_body (CamelImapTokenizer *tok, struct _fetch_response *fh, CamelException *ex)
+{
+	const char *token;
+	guint32 len;
+	int type;
+
+	if (!fh->stream) {
+		if (!fh->body)
+			fh->body = g_byte_array_new ();
+		g_byte_array_set_size (fh->body, 0);
+	}
+
+	type = camel_lite_imap_tokenizer_next (tok, &token, &len, ex);
+	if (type == CAMEL_IMAP_TOKEN_LITERAL) {
+		if (!fh->stream) {
+			if (camel_lite_imap_tokenizer_literal (tok, fh->body, ex) == -1)
+				return -1;
+		} else if (camel_lite_imap_tokenizer_literal_to_stream (tok, fh->stream, ex) == -1)
+			return -1;
+	} else if (type == CAMEL_IMAP_TOKEN_STRING) {
+		if (!fh->stream)
+			g_byte_array_append (fh->body, (const guint8 *) token, len);
+		else if (camel_lite_stream_write (fh->stream, token, len) != (ssize_t) len) {
+			camel_lite_exception_setv (ex, CAMEL_EXCEPTION_SYSTEM_IO_WRITE,
+					      _("Write to cache failed: %s"), g_strerror (errno));
+			return -1;
+		}
+	} else if (type != CAMEL_IMAP_TOKEN_ATOM || !fetch_token_is (token, len, "NIL"))
+		return -1;
+
+	fh->written = TRUE;
+
+	return 0;
+}
+
+/* "[HEADER.FIELDS (...)]" and the like, after BODY */
+static int
+fetch_read_section (CamelImapTokenizer *tok, struct _fetch_response *fh, CamelException *ex)
+{
+	const char *token;
+	guint32 len;
+	int type;
+
+	g_free (fh->part_spec);
+	fh->part_spec = NULL;
+
+	type = camel_lite_imap_tokenizer_next (tok, &token, &len, ex);
+	if (type == ']') {
+		fh->part_spec = g_strdup ("");
+		return 0;
+	} else if (type != CAMEL_IMAP_TOKEN_ATOM && type != CAMEL_IMAP_TOKEN_NUMBER)
+		return -1;
+
+	if (len < 13 || g_ascii_strncasecmp (token, "HEADER.FIELDS", 13))
+		fh->part_spec = g_strndup (token, len);
+
+	type = camel_lite_imap_tokenizer_next (tok, &token, &len, ex);
+	if (type == '(') {
+		camel_lite_imap_tokenizer_unget (tok);
+		if (fetch_skip_value (tok, ex) == -1)
+			return -1;
+		type = camel_lite_imap_tokenizer_next (tok, &token, &len, ex);
+	}
+	if (type != ']')
+		return -1;
+
+	/* a partial fetch's <origin> */
+	type = camel_lite_imap_tokenizer_next (tok, &token, &len, ex);
+	if (type != CAMEL_IMAP_TOKEN_ATOM || *token != '<')
+		camel_lite_imap_tokenizer_unget (tok);
+
+	return 0;
+}
+
+/* Reads one untagged response off @tok straight into @fh, without
+ * going through a response string and a GData like parse_fetch_response
+ * does. Return value: 1 for a FETCH, 0 for anything else (which is
+ * skipped), -1 if reading failed and the command lock is gone. */
+static int
+fetch_response_read (CamelImapTokenizer *tok, struct _fetch_response *fh, CamelException *ex)
+{
+	const char *token;
+	guint32 len;
+	int type;
+
+	if (camel_lite_imap_tokenizer_next (tok, &token, &len, ex) != CAMEL_IMAP_TOKEN_NUMBER)
+		goto skip;
+	fh->seq = fetch_token_uint (token, len);
+
+	type = camel_lite_imap_tokenizer_next (tok, &token, &len, ex);
+	if (type != CAMEL_IMAP_TOKEN_ATOM || !fetch_token_is (token, len, "FETCH"))
+		goto skip;
+	if (camel_lite_imap_tokenizer_next (tok, NULL, NULL, ex) != '(')
+		goto skip;
+
+	while ((type = camel_lite_imap_tokenizer_next (tok, &token, &len, ex)) == CAMEL_IMAP_TOKEN_ATOM) {
+		if (fetch_token_is (token, len, "FLAGS")) {
+			if (camel_lite_imap_tokenizer_next (tok, NULL, NULL, ex) != '(')
+				goto skip;
+			/* FIXME user flags */
+			while ((type = camel_lite_imap_tokenizer_next (tok, &token, &len, ex)) == CAMEL_IMAP_TOKEN_ATOM)
+				fh->flags |= imap_parse_flag (token, len);
+			if (type != ')')
+				goto skip;
+		} else if (fetch_token_is (token, len, "RFC822.SIZE")) {
+			if (camel_lite_imap_tokenizer_next (tok, &token, &len, ex) != CAMEL_IMAP_TOKEN_NUMBER)
+				goto skip;
+			fh->size = fetch_token_uint (token, len);
+		} else if (fetch_token_is (token, len, "UID")) {
+			if (camel_lite_imap_tokenizer_next (tok, &token, &len, ex) != CAMEL_IMAP_TOKEN_NUMBER)
+				goto skip;
+			g_free (fh->uid);
+			fh->uid = g_strndup (token, len);
+		} else if (fetch_token_is (token, len, "INTERNALDATE")) {
+			if (camel_lite_imap_tokenizer_next (tok, &token, &len, ex) != CAMEL_IMAP_TOKEN_STRING)
+				goto skip;
+			g_free (fh->idate);
+			fh->idate = g_strndup (token, len);
+		} else if (fetch_token_is (token, len, "BODY")) {
+			if (camel_lite_imap_tokenizer_next (tok, NULL, NULL, ex) != '[') {
+				/* BODY without a section is the structure */
+				camel_lite_imap_tokenizer_unget (tok);
+				if (fetch_skip_value (tok, ex) == -1)
+					goto skip;
+			} else if (fetch_read_section (tok, fh, ex) == -1 ||
+				   fetch_read_body (tok, fh, ex) == -1)
+				goto skip;
+		} else if (fetch_token_is (token, len, "RFC822")) {
+			g_free (fh->part_spec);
+			fh->part_spec = g_strdup ("");
+			if (fetch_read_body (tok, fh, ex) == -1)
+				goto skip;
+		} else if (fetch_skip_value (tok, ex) == -1) {
+			/* MODSEQ, BODYSTRUCTURE, ... */
+			goto skip;
+		}
+	}
+
+	if (type != ')' || camel_lite_imap_tokenizer_next (tok, NULL, NULL, ex) != CAMEL_IMAP_TOKEN_EOL)
+		goto skip;
+
+	return 1;
+
+ skip:
+	camel_lite_imap_tokenizer_unget (tok);
+	if (camel_lite_imap_tokenizer_skip_line (tok, ex) == -1)
+		return -1;
+
+	return 0;
+}
+
+static CamelImapMessageInfo*
+message_from_fetch (CamelImapFolder *imap_folder, struct _fetch_response *fh)
+{
+	CamelImapMessageInfo *mi;
+	CamelStream *stream = NULL;
+
+	if (!fh->uid || !fh->body)
+		return NULL;
+
+	if (fh->part_spec) {
+		CAMEL_IMAP_FOLDER_REC_LOCK (imap_folder, cache_lock);
+		stream = camel_lite_imap_message_cache_insert (imap_folder->cache,
+							  fh->uid, fh->part_spec,
+							  (const char *) fh->body->data, fh->body->len, NULL);
+		CAMEL_IMAP_FOLDER_REC_UNLOCK (imap_folder, cache_lock);
+	}
+
+	/* the stream takes the literal over, no copy */
+	if (!stream) {
+		stream = camel_lite_stream_mem_new_with_byte_array (fh->body);
+		fh->body = NULL;
+	}
+
+	mi = message_from_stream ((CamelFolder *) imap_folder, stream, fh->size, fh->idate);
+	camel_lite_object_unref (stream);
+
+	return mi;
+}
+
 #if 0
 static void
 add_message_from_data (CamelFolder *folder, GPtrArray *messages,
@@ -3088,10 +3866,10 @@ add_message_from_data (CamelFolder *folder, GPtrArray *messages,
 	const char *idate;
 	int seq;
 
-	seq = GPOINTER_TO_INT (g_datalist_get_data (&data, "SEQUENCE"));
+	seq = GPOINTER_TO_INT (g_datalist_id_get_data (&data, fetch_sequence));
 	if (seq < first)
 		return;
-	stream = g_datalist_get_data (&data, "BODY_PART_STREAM");
+	stream = g_datalist_id_get_data (&data, fetch_part_stream);
 	if (!stream)
 		return;
 
@@ -3108,7 +3886,7 @@ add_message_from_data (CamelFolder *folder, GPtrArray *messages,
 
 	camel_lite_object_unref (CAMEL_OBJECT (msg));
 
-	if ((idate = g_datalist_get_data (&data, "INTERNALDATE")))
+	if ((idate = g_datalist_id_get_data (&data, fetch_internaldate)))
 		mi->info.date_received = decode_internaldate ((const unsigned char *) idate);
 
 	if (mi->info.date_received == -1)
@@ -3133,7 +3911,7 @@ static void
 construct_junk_headers (char *header, char *value, struct _junk_data *jdata)
 {
 	char *bs, *es, *flag=NULL;
-	char *bdata = g_datalist_get_data (&(jdata->data), "BODY_PART_DATA");
+	char *bdata = g_datalist_id_get_data (&(jdata->data), fetch_part_data);
 	struct _camel_lite_header_param *node;
 
 	/* FIXME: This can be written in a much clever way.
@@ -3210,8 +3988,8 @@ imap_get_uids (CamelFolder *folder, CamelImapStore *store, CamelException *ex, G
 			}
 		} else {
 			GData *data = parse_fetch_response ((CamelImapFolder *)folder, resp);
-			int sequence = GPOINTER_TO_INT (g_datalist_get_data (&data, "SEQUENCE"));
-			char *uid = g_datalist_get_data (&data, "UID");
+			int sequence = GPOINTER_TO_INT (g_datalist_id_get_data (&data, fetch_sequence));
+			char *uid = g_datalist_id_get_data (&data, fetch_uid);
 			if (sequence > greater_than && uid) {
 				g_ptr_array_add (needheaders, g_strdup (uid));
 				cnt++;
@@ -3265,7 +4043,8 @@ imap_update_summary (CamelFolder *folder, int exists,
    const char *header_spec;
    CamelImapMessageInfo *mi;
    char *resp;
-   GData *data;
+   CamelImapTokenizer *tok;
+   struct _fetch_response fh;
    gboolean more = TRUE, oosync = FALSE, oldrescval = imap_folder->need_rescan;
    unsigned int nextn, cnt=0, tcnt=0, ucnt=0, ineed = 0, allhdrs = 0;
    gboolean do_the_save = TRUE;
@@ -3521,23 +4300,36 @@ imap_update_summary (CamelFolder *folder, int exists,
 			g_free (uidset);
 
 			resp = NULL;
-			while ((type = camel_lite_imap_command_response (store, &resp, ex))
+			tok = camel_lite_imap_tokenizer_new (store);
+			memset (&fh, 0, sizeof (fh));
+			while ((type = camel_lite_imap_tokenizer_response (tok, &resp, ex))
 				== CAMEL_IMAP_RESPONSE_UNTAGGED)
 			{
 				gchar *muid;
 				guint32 sequence, curlen;
+				int got;
 
-				data = parse_fetch_response (imap_folder, resp);
-				g_free (resp); resp = NULL;
+				if (resp) {
+					/* not a FETCH, and read already */
+					g_free (resp); resp = NULL;
+					camel_lite_imap_tokenizer_skip_line (tok, ex);
+					continue;
+				}
 
-				if (!data)
+				got = fetch_response_read (tok, &fh, ex);
+				if (got == -1) {
+					type = CAMEL_IMAP_RESPONSE_ERROR;
+					break;
+				} else if (got == 0) {
+					fetch_response_clear (&fh);
 					continue;
+				}
 
-				mi = message_from_data (folder, data);
+				mi = message_from_fetch (imap_folder, &fh);
 
 				if (mi)
 				{
-				  flags = GPOINTER_TO_INT (g_datalist_get_data (&data, "FLAGS"));
+				  flags = fh.flags;
 				  if (flags)
 				  {
 					mi->server_flags = flags;
@@ -3545,7 +4337,7 @@ imap_update_summary (CamelFolder *folder, int exists,
 					/* flags_to_label(folder, mi); */
 				  }
 
-				  muid = g_datalist_get_data (&data, "UID");
+				  muid = fh.uid;
 
 				  if (muid)
 				  {
@@ -3558,7 +4350,7 @@ imap_update_summary (CamelFolder *folder, int exists,
 
 				  allhdrs++;
 				  camel_lite_operation_progress (NULL, allhdrs , ineed);
-				  sequence = GPOINTER_TO_INT (g_datalist_get_data (&data, "SEQUENCE"));
+				  sequence = fh.seq;
 				  curlen = camel_lite_folder_summary_count (folder->summary);
 
 				  if (sequence > 0 && sequence <= exists && sequence != curlen)
@@ -3605,6 +4397,8 @@ imap_update_summary (CamelFolder *folder, int exists,
 					if (hcnt > 1000) {
 						if (camel_lite_folder_summary_save (folder->summary, ex) == -1)
 						{
+							fetch_response_clear (&fh);
+							camel_lite_imap_tokenizer_free (tok);
 							g_ptr_array_foreach (needheaders, (GFunc)g_free, NULL);
 							g_ptr_array_free (needheaders, TRUE);
 							camel_lite_operation_end (NULL);
@@ -3629,9 +4423,12 @@ imap_update_summary (CamelFolder *folder, int exists,
 					}
 				}
 
-				g_datalist_clear (&data);
+				fetch_response_clear (&fh);
 			}
 
+			fetch_response_clear (&fh);
+			camel_lite_imap_tokenizer_free (tok);
+
 			if (resp != NULL)
 				g_free (resp);
 
@@ -4042,6 +4839,9 @@ send_done_in_stop_idle (CamelImapStore *store, CamelFolder *folder)
 	/* Step C) (see idle_thread). We're assuming idle_cont == FALSE, send_done == TRUE*/
 	do_send_done (store, folder, &idle_resp, &ex);
 	camel_lite_exception_clear (&ex);
+
+	/* the idle thread waits for idle_send_done_happened */
+	_camel_lite_imap_store_wake_idle (store);
 	return idle_resp;
 }
 
@@ -4052,6 +4852,20 @@ typedef struct {
 	gboolean had_cond;
 } IdleThreadInfo;
 
+/* Milliseconds left until IDLE has to be re-issued */
+static int
+idle_time_left (CamelImapStore *store, GTimeVal *since)
+{
+	GTimeVal now;
+	gint64 left;
+
+	g_get_current_time (&now);
+	left = (gint64) store->idle_sleep * (IDLE_TICK_TIME / 1000)
+		- ((gint64) (now.tv_sec - since->tv_sec) * 1000 + (now.tv_usec - since->tv_usec) / 1000);
+
+	return (int) CLAMP (left, 0, G_MAXINT);
+}
+
 static gpointer
 idle_thread (gpointer data)
 {
@@ -4060,8 +4874,9 @@ idle_thread (gpointer data)
 	CamelImapFolder *imap_folder;
 	CamelImapStore *store;
 	gboolean tfirst = TRUE, first = TRUE, my_cont, had_cond = FALSE;
-	int cnt = 0;
 	gpointer retval = NULL;
+	GTimeVal since;
+	int sockfd;
 
 	idle_debug ("idle_thread starts\n");
 
@@ -4104,8 +4919,10 @@ idle_thread (gpointer data)
 	}
 
 
-	while (store->idle_thread != g_thread_self ())
-		usleep (100);
+	/* The starting thread holds info->mutex until it has set
+	 * store->idle_thread and waits for us */
+	g_mutex_lock (info->mutex);
+	g_mutex_unlock (info->mutex);
 
 	/* We add our own reference because the calling thread will immediately
 	 * after the GCond broadcast free the info (and its references). We add
@@ -4127,17 +4944,25 @@ idle_thread (gpointer data)
 	}
 
 	store->idle_send_done_happened = FALSE;
-	/* While nothing has stopped us yet ...
-	 * TNY TODO: it would be nicer to use select() here, rather than usleep() */
-	
+	_camel_lite_imap_store_drain_wake (store);
+	g_get_current_time (&since);
+
+	/* While nothing has stopped us yet ... Between the cycles we block
+	 * in poll () on the socket and the store's wake up pipe, so an
+	 * idle account doesn't wake up until it has to re-issue IDLE */
+
 	while (my_cont && !store->idle_kill && 
 	       (store->idle_cont || !store->idle_send_done_happened))
 	{
 		CamelException ex = CAMEL_EXCEPTION_INITIALISER;
 		IdleResponse *idle_resp = NULL;
 		gboolean senddone = FALSE;
-		
+
+		sockfd = -1;
+
 		if (CAMEL_SERVICE_REC_TRYLOCK (store, connect_lock)) {
+			gboolean drained = FALSE;
+
 			/* A) The first time we will start the IDLE by sending IDLE to
 			 * the server and reading away the + continuation (check out the
 			 * idle_real_start function). We don't call this in the other
@@ -4150,6 +4975,7 @@ idle_thread (gpointer data)
 				if (l)
 					g_static_rec_mutex_unlock (store->idle_lock);
 				first = FALSE;
+				g_get_current_time (&since);
 			}
 
 			/* And we also send the broadcast to the caller of this thread:
@@ -4174,6 +5000,7 @@ idle_thread (gpointer data)
 				
 				if (!store->idle_kill) {
 					process_idle_body (store, folder, &idle_resp, &ex);
+					drained = TRUE;
 				}
 				g_static_rec_mutex_unlock (store->idle_lock);
 			}
@@ -4214,7 +5041,7 @@ idle_thread (gpointer data)
 			 * case we'll just exit ASAP (it's let_idle_die in CamelImapStore
 			 * trying to disconnect from the IMAP server). */
 
-			if ((cnt > store->idle_sleep) || senddone) {
+			if (idle_time_left (store, &since) == 0 || senddone) {
 				do_send_done (store, folder, &idle_resp, &ex);
 				if (store->idle_cont) {
 					first = TRUE;
@@ -4223,19 +5050,22 @@ idle_thread (gpointer data)
 					retval = idle_resp;
 					my_cont = FALSE;
 				}
-
-			cnt = 0;
 			}
+
+			/* Only wait on the socket once everything that was on
+			 * it has been read, otherwise poll () returns at once */
+			if (drained && my_cont && store->ostream && CAMEL_IS_TCP_STREAM (store->ostream))
+				sockfd = camel_lite_tcp_stream_get_fd (CAMEL_TCP_STREAM (store->ostream));
+
 			CAMEL_SERVICE_REC_UNLOCK (store, connect_lock);
 		}
 
-		/* TNY TODO: try to use the select() of the non-blocking read
-		 * for this usleep() and cnt stuff. */
-		
+		/* Without the socket we wait a tick and try for the
+		 * connection again */
 		if (my_cont)
-			usleep (IDLE_TICK_TIME);
-
-		cnt++;
+			_camel_lite_imap_store_wait (store, sockfd, sockfd == -1 ?
+				MIN (idle_time_left (store, &since), IDLE_TICK_TIME / 1000) :
+				idle_time_left (store, &since));
 	}
 
 	/* We have an extra bool for this, because it's possible that info
@@ -4265,6 +5095,7 @@ stop_idle (CamelImapStore *store, CamelFolder *folder, gboolean send_done)
 		IdleResponse *idle_resp = NULL;
 
 		store->idle_cont = FALSE;
+		_camel_lite_imap_store_wake_idle (store);
 		if (send_done && !store->idle_send_done_happened) {
 			idle_resp  = send_done_in_stop_idle (store, folder);
 			g_thread_join (store->idle_thread);
@@ -4308,6 +5139,7 @@ camel_lite_imap_folder_stop_idle (CamelFolder *folder)
 	store = CAMEL_IMAP_STORE (folder->parent_store);
 
 	store->idle_cont = FALSE;
+	_camel_lite_imap_store_wake_idle (store);
 
 	if (!camel_lite_disco_store_check_online ((CamelDiscoStore*)store, &ex))
 		return;
@@ -4336,6 +5168,7 @@ camel_lite_imap_folder_stop_idle_in_connect_lock (CamelFolder *folder)
 	store = CAMEL_IMAP_STORE (folder->parent_store);
 
 	store->idle_cont = FALSE;
+	_camel_lite_imap_store_wake_idle (store);
 
 	if (!camel_lite_disco_store_check_online ((CamelDiscoStore*)store, &ex))
 		return;
@@ -4394,6 +5227,7 @@ camel_lite_imap_folder_start_idle (CamelFolder *folder)
 				IdleResponse *idle_resp = NULL;
 
 				store->idle_cont = FALSE;
+				_camel_lite_imap_store_wake_idle (store);
 				idle_resp = g_thread_join (store->idle_thread);
 				store->idle_thread = NULL;
 
@@ -4420,9 +5254,9 @@ camel_lite_imap_folder_start_idle (CamelFolder *folder)
 				info->folder = folder;
 				camel_lite_object_ref (info->folder);
 
+				g_mutex_lock (info->mutex);
 				store->idle_thread = g_thread_create (idle_thread,
 					info, TRUE, NULL);
-				g_mutex_lock (info->mutex);
 				if (!info->had_cond)
 					g_cond_wait (info->condition, info->mutex);
 				g_mutex_unlock (info->mutex);
@@ -4625,6 +5459,68 @@ imap_thaw (CamelFolder *folder)
 	}
 }
 
+/* Fetches for one message can run on several pool connections at once,
+   so a cache file is written under a private temporary name and renamed
+   into place once complete. Readers never see half a file and two
+   writers of the same part don't interleave. */
+static FILE *
+cache_file_open (const char *path, char **tmp_path)
+{
+	FILE *fil;
+	int fd;
+
+	*tmp_path = g_strdup_printf ("%s.XXXXXX", path);
+	fd = g_mkstemp (*tmp_path);
+	if (fd == -1) {
+		g_free (*tmp_path);
+		*tmp_path = NULL;
+		return NULL;
+	}
+
+	fil = fdopen (fd, "w");
+	if (!fil) {
+		close (fd);
+		unlink (*tmp_path);
+		g_free (*tmp_path);
+		*tmp_path = NULL;
+	}
+
+	return fil;
+}
+
+static void
+cache_file_abort (FILE **fil, char **tmp_path)
+{
+	if (*fil) {
+		fclose (*fil);
+		*fil = NULL;
+	}
+	if (*tmp_path) {
+		unlink (*tmp_path);
+		g_free (*tmp_path);
+		*tmp_path = NULL;
+	}
+}
+
+static gboolean
+cache_file_commit (FILE **fil, char **tmp_path, const char *path)
+{
+	gboolean ok = FALSE;
+
+	if (*fil) {
+		ok = fclose (*fil) == 0;
+		*fil = NULL;
+	}
+	if (ok)
+		ok = rename (*tmp_path, path) == 0;
+	if (!ok && *tmp_path)
+		unlink (*tmp_path);
+	g_free (*tmp_path);
+	*tmp_path = NULL;
+
+	return ok;
+}
+
 static void
 handle_freeup (CamelImapStore *store, gint nread, CamelException *ex)
 {
@@ -4639,158 +5535,107 @@ handle_freeup (CamelImapStore *store, gint nread, CamelException *ex)
 	}
 }
 
-static GStaticRecMutex gmsgstore_lock = G_STATIC_REC_MUTEX_INIT;
-
-static gboolean
-check_gmsgstore_die (gpointer user_data)
-{
-	CamelImapFolder *imap_folder = user_data;
-	gboolean retval = TRUE;
-
-	if (g_static_rec_mutex_trylock (&gmsgstore_lock))
-	{
-		imap_folder->gmsgstore_ticks--;
-		if (imap_folder->gmsgstore_ticks <= 0)
-		{
-			if (imap_folder->gmsgstore) {
-				imap_debug ("Get-Message service dies\n");
-				/* camel_lite_imap_store_stop_idle_connect_lock (imap_folder->gmsgstore); */
-				camel_lite_service_disconnect (CAMEL_SERVICE (imap_folder->gmsgstore),
-					imap_folder->gmsgstore->clean_exit, NULL);
-				/* camel_lite_imap_store_connect_unlock_start_idle (imap_folder->gmsgstore); */
-				camel_lite_object_unref (CAMEL_OBJECT (imap_folder->gmsgstore));
-				imap_folder->gmsgstore = NULL;
-				camel_lite_object_unref (imap_folder);
-			}
-			retval = FALSE;
-		}
-		g_static_rec_mutex_unlock (&gmsgstore_lock);
-	} else
-		retval = TRUE;
-
-	return retval;
-}
-
+/* Messages and parts are fetched over connections from the account's
+   pool (see _camel_lite_imap_store_gmsg_acquire), this opens a new one
+   when the pool has room for it. */
 static CamelImapStore * 
-create_gmsgstore (CamelImapFolder *imap_folder, gboolean *ctchecker, CamelException *ex)
+create_gmsgstore (CamelImapFolder *imap_folder, CamelException *ex)
 {
 	CamelImapStore *store;
 	CamelFolder *folder = (CamelFolder *) imap_folder;
-	gboolean amcon = FALSE;
+	CamelImapStore *parent = CAMEL_IMAP_STORE (folder->parent_store);
+	gboolean amcon = FALSE, reserved = FALSE;
 
-
-	g_static_rec_mutex_lock (&gmsgstore_lock); /* A */
-
-	if (imap_folder->gmsgstore) {
+	store = _camel_lite_imap_store_gmsg_acquire (parent, folder, &reserved, ex);
+	if (store) {
 		imap_debug ("Get-Message service reused\n");
-		store = imap_folder->gmsgstore;
-		imap_folder->gmsgstore_ticks = store->getsrv_sleep;
-		*ctchecker=FALSE;
-	} else
-	{
+		return store;
+	}
+	if (!reserved)
+		return NULL;
 
-		if (CAMEL_SERVICE (folder->parent_store)->status == CAMEL_SERVICE_DISCONNECTED) {
-			CamelException tex = CAMEL_EXCEPTION_INITIALISER;
-			camel_lite_service_connect (CAMEL_SERVICE (folder->parent_store), &tex);
-			if (camel_lite_exception_is_set (&tex)) {
-				camel_lite_exception_setv (ex, CAMEL_EXCEPTION_FOLDER_UID_NOT_AVAILABLE,
-						_("This message is not currently available"
-						" and can't go online to fetch it: %s"),
-						camel_lite_exception_get_description (&tex));
-				g_static_rec_mutex_unlock (&gmsgstore_lock);
-				camel_lite_exception_clear (&tex);
-				return NULL;
-			}
+	if (CAMEL_SERVICE (folder->parent_store)->status == CAMEL_SERVICE_DISCONNECTED) {
+		CamelException tex = CAMEL_EXCEPTION_INITIALISER;
+		camel_lite_service_connect (CAMEL_SERVICE (folder->parent_store), &tex);
+		if (camel_lite_exception_is_set (&tex)) {
+			camel_lite_exception_setv (ex, CAMEL_EXCEPTION_FOLDER_UID_NOT_AVAILABLE,
+					_("This message is not currently available"
+					" and can't go online to fetch it: %s"),
+					camel_lite_exception_get_description (&tex));
+			_camel_lite_imap_store_gmsg_attach (parent, NULL);
+			camel_lite_exception_clear (&tex);
+			return NULL;
 		}
+	}
 
-		store = CAMEL_IMAP_STORE (camel_lite_object_new (CAMEL_IMAP_STORE_TYPE));
-		imap_debug ("Get-Message service created\n");
-
-		camel_lite_url_set_param(CAMEL_SERVICE (folder->parent_store)->url, "dont_touch_summary", "yes");
+	store = CAMEL_IMAP_STORE (camel_lite_object_new (CAMEL_IMAP_STORE_TYPE));
+	imap_debug ("Get-Message service created\n");
 
-		camel_lite_service_construct (CAMEL_SERVICE (store),
-			camel_lite_service_get_session (CAMEL_SERVICE (folder->parent_store)),
-			camel_lite_service_get_provider (CAMEL_SERVICE (folder->parent_store)),
-			CAMEL_SERVICE (folder->parent_store)->url, ex);
+	camel_lite_url_set_param(CAMEL_SERVICE (folder->parent_store)->url, "dont_touch_summary", "yes");
 
-		CAMEL_SERVICE (store)->data = CAMEL_SERVICE (folder->parent_store)->data;
+	camel_lite_service_construct (CAMEL_SERVICE (store),
+		camel_lite_service_get_session (CAMEL_SERVICE (folder->parent_store)),
+		camel_lite_service_get_provider (CAMEL_SERVICE (folder->parent_store)),
+		CAMEL_SERVICE (folder->parent_store)->url, ex);
 
-		if (camel_lite_exception_is_set (ex))
-		{
-			g_critical ("Severe interal error while trying to construct a new connection\n");
-			camel_lite_object_unref (store);
-			g_static_rec_mutex_unlock (&gmsgstore_lock);
-			return NULL;
-		}
+	CAMEL_SERVICE (store)->data = CAMEL_SERVICE (folder->parent_store)->data;
 
-		camel_lite_operation_start (NULL, _("Preparing to get message"));
+	if (camel_lite_exception_is_set (ex))
+	{
+		g_critical ("Severe interal error while trying to construct a new connection\n");
+		camel_lite_object_unref (store);
+		_camel_lite_imap_store_gmsg_attach (parent, NULL);
+		return NULL;
+	}
 
-		amcon = camel_lite_service_connect (CAMEL_SERVICE (store), ex);
+	camel_lite_operation_start (NULL, _("Preparing to get message"));
 
-		if (!amcon || camel_lite_exception_is_set (ex) || !camel_lite_disco_store_check_online (CAMEL_DISCO_STORE (store), ex)) {
-			camel_lite_object_unref (store);
-			if (!camel_lite_exception_is_set (ex))
-				camel_lite_exception_set (ex, CAMEL_EXCEPTION_FOLDER_UID_NOT_AVAILABLE,
-						_("This message is not currently available"
-						" and can't go online to fetch it"));
-			else if (camel_lite_strstrcase (camel_lite_exception_get_description (ex), "summary") != NULL)
-				if (camel_lite_exception_is_set (ex))
-					camel_lite_exception_clear (ex);
-			camel_lite_exception_set (ex, CAMEL_EXCEPTION_SYSTEM_IO_WRITE,
-						_("This message can't be retrieved due to insufficient"
-						" storage space resources."));
+	amcon = camel_lite_service_connect (CAMEL_SERVICE (store), ex);
 
-			CAMEL_IMAP_FOLDER_REC_UNLOCK (imap_folder, cache_lock);
-			g_static_rec_mutex_unlock (&gmsgstore_lock);
-			return NULL;
-		}
-		camel_lite_exception_clear (ex);
-		camel_lite_operation_end (NULL);
+	if (!amcon || camel_lite_exception_is_set (ex) || !camel_lite_disco_store_check_online (CAMEL_DISCO_STORE (store), ex)) {
+		camel_lite_object_unref (store);
+		if (!camel_lite_exception_is_set (ex))
+			camel_lite_exception_set (ex, CAMEL_EXCEPTION_FOLDER_UID_NOT_AVAILABLE,
+					_("This message is not currently available"
+					" and can't go online to fetch it"));
+		else if (camel_lite_strstrcase (camel_lite_exception_get_description (ex), "summary") != NULL)
+			if (camel_lite_exception_is_set (ex))
+				camel_lite_exception_clear (ex);
+		camel_lite_exception_set (ex, CAMEL_EXCEPTION_SYSTEM_IO_WRITE,
+					_("This message can't be retrieved due to insufficient"
+					" storage space resources."));
 
-		imap_folder->gmsgstore = store;
-		imap_folder->gmsgstore_ticks = store->getsrv_sleep;;
-		*ctchecker=TRUE;
+		CAMEL_IMAP_FOLDER_REC_UNLOCK (imap_folder, cache_lock);
+		_camel_lite_imap_store_gmsg_attach (parent, NULL);
+		return NULL;
 	}
+	camel_lite_exception_clear (ex);
+	camel_lite_operation_end (NULL);
+
+	_camel_lite_imap_store_gmsg_attach (parent, store);
 
 	return store;
 }
 
 
 static void 
-stop_gmsgstore (CamelImapFolder *imap_folder, gboolean ctchecker, gboolean quick)
+stop_gmsgstore (CamelImapFolder *imap_folder, CamelImapStore *store, gboolean quick)
 {
-	if (quick) {
-		imap_folder->gmsgstore->clean_exit = FALSE;
-		imap_folder->gmsgstore_ticks = 0;
-		if (ctchecker) {
-			camel_lite_object_ref (imap_folder);
-			imap_folder->gmsgstore_signal = g_timeout_add (1,
-				check_gmsgstore_die, imap_folder);
-		}
-	} else {
-		if (ctchecker) {
-			camel_lite_object_ref (imap_folder);
-			imap_folder->gmsgstore_signal = g_timeout_add (1000,
-				check_gmsgstore_die, imap_folder);
-		}
-	}
+	CamelImapStore *parent = CAMEL_IMAP_STORE (((CamelFolder *) imap_folder)->parent_store);
 
-	g_static_rec_mutex_unlock (&gmsgstore_lock); /* A */
+	if (quick)
+		store->clean_exit = FALSE;
+
+	_camel_lite_imap_store_gmsg_release (parent, store, quick);
 }
 
 
 static void 
 stop_gmsgstore_from_idle (CamelImapFolder *imap_folder)
 {
-	g_static_rec_mutex_lock (&gmsgstore_lock); /* A */
-	if (imap_folder->gmsgstore) {
-		imap_folder->gmsgstore->clean_exit = FALSE;
-		imap_folder->gmsgstore_ticks = 0;
-		camel_lite_object_ref (imap_folder);
-		imap_folder->gmsgstore_signal = g_timeout_add (1,
-			check_gmsgstore_die, imap_folder);
-	}
-	g_static_rec_mutex_unlock (&gmsgstore_lock); /* A */
+	CamelImapStore *parent = CAMEL_IMAP_STORE (((CamelFolder *) imap_folder)->parent_store);
+
+	_camel_lite_imap_store_gmsg_drop_idle (parent, (CamelFolder *) imap_folder);
 }
 
 static char *
@@ -4857,7 +5702,7 @@ imap_convert (CamelFolder *folder, const char *uid, const char *spec, const char
   CamelImapStore *store = NULL;
   ssize_t nread = 0;
   FILE *fil = NULL;
-  gboolean ctchecker = FALSE;
+  char *tmp_path = NULL;
 
   found = g_file_test (path, G_FILE_TEST_EXISTS | G_FILE_TEST_IS_REGULAR);
 
@@ -4875,7 +5720,7 @@ imap_convert (CamelFolder *folder, const char *uid, const char *spec, const char
 		int fd;
 		CamelImapResponse *noop_response;
 
-		store = create_gmsgstore (imap_folder, &ctchecker, ex);
+		store = create_gmsgstore (imap_folder, ex);
 		if (!store)
 			return NULL;
 
@@ -4883,13 +5728,13 @@ imap_convert (CamelFolder *folder, const char *uid, const char *spec, const char
 		if (noop_response)
 			camel_lite_imap_response_free (store, noop_response);
 		else {
-			stop_gmsgstore (imap_folder, ctchecker, FALSE);
+			stop_gmsgstore (imap_folder, store, FALSE);
 			return NULL;
 		}
 		
 		camel_lite_operation_start (NULL, _("Retrieving converted message part"));
 
-		fil = fopen (path, "w");
+		fil = cache_file_open (path, &tmp_path);
 
 		if (!fil) {
 			err = TRUE;
@@ -5054,11 +5899,16 @@ convert_berrorhander:
 			goto convert_errorhandler;
 		}
 
+		if (!cache_file_commit (&fil, &tmp_path, path)) {
+			err = TRUE;
+			ex_id = CAMEL_EXCEPTION_SYSTEM_IO_WRITE;
+			err_message = g_strdup_printf (_("Write to cache failed: %s"), g_strerror (errno));
+			goto convert_errorhandler;
+		}
+
 		camel_lite_operation_end (NULL);
 
-		if (fil)
-			fclose (fil);
-		stop_gmsgstore (imap_folder, ctchecker, FALSE);
+		stop_gmsgstore (imap_folder, store, FALSE);
 	}
 	
   }
@@ -5069,8 +5919,7 @@ convert_errorhandler:
 
 	camel_lite_operation_end (NULL);
 
-	if (fil)
-		fclose (fil);
+	cache_file_abort (&fil, &tmp_path);
 
 	if (!err_message)
 		camel_lite_exception_setv (ex, ex_id, _("Could not find message body in response"));
@@ -5081,7 +5930,7 @@ convert_errorhandler:
 
 	if (store) {
 		handle_freeup (store, nread, ex);
-		stop_gmsgstore (imap_folder, ctchecker, FALSE);
+		stop_gmsgstore (imap_folder, store, FALSE);
 	}
 
   return NULL;
@@ -5099,7 +5948,7 @@ imap_fetch (CamelFolder *folder, const char *uid, const char *spec, gboolean *bi
   CamelImapStore *store = NULL;
   ssize_t nread = 0;
   FILE *fil = NULL;
-  gboolean ctchecker = FALSE;
+  char *tmp_path = NULL;
 
   if (binary && *binary) {
 	g_free (path);
@@ -5163,7 +6012,7 @@ imap_fetch (CamelFolder *folder, const char *uid, const char *spec, gboolean *bi
 		int fd;
 		CamelImapResponse *noop_response;
 
-		store = create_gmsgstore (imap_folder, &ctchecker, ex);
+		store = create_gmsgstore (imap_folder, ex);
 		if (!store)
 			return NULL;
 
@@ -5171,7 +6020,7 @@ imap_fetch (CamelFolder *folder, const char *uid, const char *spec, gboolean *bi
 		if (noop_response)
 			camel_lite_imap_response_free (store, noop_response);
 		else {
-			stop_gmsgstore (imap_folder, ctchecker, FALSE);
+			stop_gmsgstore (imap_folder, store, FALSE);
 			return NULL;
 		}
 
@@ -5195,7 +6044,7 @@ imap_fetch (CamelFolder *folder, const char *uid, const char *spec, gboolean *bi
 				else
 					path = g_strdup_printf ("%s/%s_ENCODED", imap_folder->cache->path, uid);
 			}
-			fil = fopen (path, "w");
+			fil = cache_file_open (path, &tmp_path);
 
 			if (!fil) {
 				err = TRUE;
@@ -5269,9 +6118,7 @@ imap_fetch (CamelFolder *folder, const char *uid, const char *spec, gboolean *bi
 							" we use BINARY (%s)\n", line);
 						store->capabilities &= ~IMAP_CAPABILITY_BINARY;
 						retry = TRUE;
-						fclose (fil);
-						fil = NULL;
-						unlink (path);
+						cache_file_abort (&fil, &tmp_path);
 						g_free (path);
 						if (spec && *spec)
 							path = g_strdup_printf ("%s/%s_%s_ENCODED", imap_folder->cache->path, uid, spec);
@@ -5516,11 +6363,16 @@ fetch_retry:
 			retry = retry;
 		}
 
+		if (!cache_file_commit (&fil, &tmp_path, path)) {
+			err = TRUE;
+			ex_id = CAMEL_EXCEPTION_SYSTEM_IO_WRITE;
+			err_message = g_strdup_printf (_("Write to cache failed: %s"), g_strerror (errno));
+			goto fetch_errorhandler;
+		}
+
 		camel_lite_operation_end (NULL);
 
-		if (fil)
-			fclose (fil);
-		stop_gmsgstore (imap_folder, ctchecker, FALSE);
+		stop_gmsgstore (imap_folder, store, FALSE);
 	}
 	
   }
@@ -5531,11 +6383,7 @@ fetch_errorhandler:
 
 	camel_lite_operation_end (NULL);
 
-	if (fil)
-		fclose (fil);
-
-	if (path)
-		unlink (path);
+	cache_file_abort (&fil, &tmp_path);
 
 	if (!err_message)
 		camel_lite_exception_setv (ex, ex_id, _("Could not find message body in response"));
@@ -5546,7 +6394,7 @@ fetch_errorhandler:
 
 	if (store) {
 		handle_freeup (store, nread, ex);
-		stop_gmsgstore (imap_folder, ctchecker, FALSE);
+		stop_gmsgstore (imap_folder, store, FALSE);
 	}
 
   return NULL;
@@ -5604,7 +6452,6 @@ imap_fetch_structure (CamelFolder *folder, const char *uid, CamelException *ex)
 			camel_lite_exception_set (ex, CAMEL_EXCEPTION_FOLDER_UID_NOT_AVAILABLE,
 					     _("This message is not currently available"));
 		} else {
-			gboolean ctchecker = FALSE;
 			CamelImapStore *store;
 			GString *bodyst = g_string_new ("");
 			CamelImapResponse *response, *noop_response;
@@ -5614,7 +6461,7 @@ imap_fetch_structure (CamelFolder *folder, const char *uid, CamelException *ex)
 			gchar *mpstr = camel_lite_folder_fetch (folder, uid, "HEADER", &hdr_bin, ex);
 			g_free (mpstr);
 
-			store = create_gmsgstore (imap_folder, &ctchecker, ex);
+			store = create_gmsgstore (imap_folder, ex);
 
 			if (!store)
 				goto frees;
@@ -5624,7 +6471,7 @@ imap_fetch_structure (CamelFolder *folder, const char *uid, CamelException *ex)
 			if (noop_response)
 				camel_lite_imap_response_free (store, noop_response);
 			else {
-				stop_gmsgstore (imap_folder, ctchecker, FALSE);
+				stop_gmsgstore (imap_folder, store, FALSE);
 				goto frees;
 			}
 
@@ -5650,7 +6497,7 @@ imap_fetch_structure (CamelFolder *folder, const char *uid, CamelException *ex)
 				retval = NULL;
 			}
 
-			stop_gmsgstore (imap_folder, ctchecker, FALSE);
+			stop_gmsgstore (imap_folder, store, FALSE);
 
 			camel_lite_imap_message_cache_set_partial (imap_folder->cache, uid, TRUE);
 
@@ -5658,11 +6505,12 @@ imap_fetch_structure (CamelFolder *folder, const char *uid, CamelException *ex)
 		}
 
 		if (retval) {
-			file = fopen (path, "w");
-			if (file) {
+			char *tmp_path = NULL;
+
+			file = cache_file_open (path, &tmp_path);
+			if (file)
 				fputs (retval, file);
-				fclose (file);
-			} else {
+			if (!cache_file_commit (&file, &tmp_path, path)) {
 				gchar *mss = g_strdup_printf (_("Write to cache failed: %s"), g_strerror (errno));
 				camel_lite_exception_set (ex, CAMEL_EXCEPTION_SYSTEM_IO_WRITE, mss);
 				g_free (mss);
@@ -5683,7 +6531,7 @@ camel_lite_imap_folder_fetch_data (CamelImapFolder *imap_folder, const char *uid
 	CamelFolder *folder = CAMEL_FOLDER (imap_folder);
 	CamelImapStore *store = NULL;
 	CamelStream *stream = NULL;
-	gboolean connected = FALSE, ctchecker=FALSE;
+	gboolean connected = FALSE;
 	CamelException  tex = CAMEL_EXCEPTION_INITIALISER;
 	ssize_t nread = 0;
 	gchar *errmessage = NULL;
@@ -5729,7 +6577,7 @@ camel_lite_imap_folder_fetch_data (CamelImapFolder *imap_folder, const char *uid
 	camel_lite_exception_clear (ex);
 
 	camel_lite_exception_clear (&tex);
-	store = create_gmsgstore (imap_folder, &ctchecker, &tex);
+	store = create_gmsgstore (imap_folder, &tex);
 
 	if (!store) {
 		const char *desc = camel_lite_exception_get_description (&tex);
@@ -5746,7 +6594,7 @@ camel_lite_imap_folder_fetch_data (CamelImapFolder *imap_folder, const char *uid
 	if (noop_response)
 		camel_lite_imap_response_free (store, noop_response);
 	else {
-		stop_gmsgstore (imap_folder, ctchecker, FALSE);
+		stop_gmsgstore (imap_folder, store, FALSE);
 		g_message ("%s: NO NOOP RESPONSE -> EXIT", __FUNCTION__);
 		return NULL;
 	}
@@ -5942,11 +6790,11 @@ berrorhander:
 			}
 		} else
 		{
-			CamelImapResponse *response;
-			gboolean err = FALSE, done=FALSE;
-			char *body = NULL;
-			int body_len = 0;
-			int i;
+			CamelImapTokenizer *tok;
+			CamelImapResponseType rtype = CAMEL_IMAP_RESPONSE_ERROR;
+			struct _fetch_response fr;
+			gboolean err = FALSE;
+			char *resp = NULL, *p;
 /*
 a01 UID FETCH 1:10 BODY.PEEK[0]
 * Bla bla
@@ -5956,74 +6804,56 @@ Received: from nic.funet.fi
 
 			/* Stops idle */
 			if (store->server_level < IMAP_LEVEL_IMAP4REV1 && !*section_text)
-				response = camel_lite_imap_command (store, folder, ex,
+				err = !camel_lite_imap_command_start (store, folder, ex,
 					"UID FETCH %s RFC822.PEEK", uid);
 			else
-				response = camel_lite_imap_command (store, folder, ex,
+				err = !camel_lite_imap_command_start (store, folder, ex,
 					"UID FETCH %s BODY.PEEK[%s]", uid, section_text);
 
-			if (!response)
-				err = TRUE;
+			/* The literal is copied to the cache as it comes in, in
+			 * stead of being read whole into the response first */
+			tok = camel_lite_imap_tokenizer_new (store);
+			memset (&fr, 0, sizeof (fr));
+			fr.stream = stream;
 
-			if (response && response->untagged && response->untagged->len <= 0) {
-				ex_id = CAMEL_EXCEPTION_FOLDER_INVALID_UID;
-				errmessage = g_strdup_printf (_("Message with UID %s does not exists"), uid);
-				err = TRUE;
+			while (!err && (rtype = camel_lite_imap_tokenizer_response (tok, &resp, ex))
+			       == CAMEL_IMAP_RESPONSE_UNTAGGED)
+			{
+				if (resp) {
+					g_free (resp); resp = NULL;
+					camel_lite_imap_tokenizer_skip_line (tok, ex);
+				} else if (fetch_response_read (tok, &fr, ex) == -1) {
+					rtype = CAMEL_IMAP_RESPONSE_ERROR;
+					break;
+				}
+				fetch_response_clear (&fr);
 			}
 
-			if (response) {
-			 if (response->untagged) {
-			  for (i = 0; i < response->untagged->len; i++) {
-				char *line = response->untagged->pdata[i];
-				int br_cnt=0;
-
-				do {
-					if(*line == '(') {
-						br_cnt++;
-					}
-					if(*line == ')') {
-						br_cnt--;
-					}
-
-					line++;
-
-					if (!g_ascii_strncasecmp (line, "BODY[", 5) ||
-					!g_ascii_strncasecmp (line, "RFC822 ", 7)) {
-						if (*line == 'B' || *line == 'b') {
-							char *p;
-							line += 5;
-							p = strchr (line, ']');
-							if (!p || *(p + 1) != ' ') {
-								errmessage = g_strdup (_("Protocol error while retrieving message"));
-								ex_id = CAMEL_EXCEPTION_SYSTEM_IO_WRITE;
-								err = TRUE;
-								break;
-							}
-							line = p + 2;
-						} else
-							line += 7;
-
-						body = imap_parse_nstring ((const char **) &line, (size_t *) &body_len);
-						if (body) {
-							done = TRUE;
-							break;
-						}
+			if (!err) {
+				if (rtype == CAMEL_IMAP_RESPONSE_TAGGED) {
+					p = strchr (resp, ' ');
+					if (!p || g_ascii_strncasecmp (p, " OK", 3)) {
+						camel_lite_exception_setv (ex, CAMEL_EXCEPTION_SERVICE_PROTOCOL,
+								      _("IMAP command failed: %s"),
+								      p ? p + 1 : _("Unknown error"));
+						err = TRUE;
 					}
-
-				} while (!done && line && (*line != ')' || br_cnt > 0));
-			  }
-			 }
-			 camel_lite_imap_response_free (store, response);
-			}
-
-			if (body) {
-				if (camel_lite_stream_write (stream, body, body_len) != body_len) {
-					errmessage = g_strdup_printf (_("Write to cache failed: %s"), g_strerror (errno));
-					ex_id = CAMEL_EXCEPTION_SYSTEM_IO_WRITE;
+				} else {
+					/* a continuation keeps the command lock */
+					if (rtype == CAMEL_IMAP_RESPONSE_CONTINUATION)
+						camel_lite_imap_store_connect_unlock_start_idle (store);
 					err = TRUE;
 				}
-				g_free (body); body = NULL;
-			} else {
+			}
+			g_free (resp);
+
+			fetch_response_clear (&fr);
+			camel_lite_imap_tokenizer_free (tok);
+
+			if (!err && camel_lite_exception_is_set (ex)) {
+				/* writing to the cache failed */
+				err = TRUE;
+			} else if (!err && !fr.written) {
 				errmessage = g_strdup_printf (_("Message with UID %s does not exists"), uid);
 				ex_id = CAMEL_EXCEPTION_FOLDER_INVALID_UID;
 				err = TRUE;
@@ -6256,7 +7086,7 @@ myretry:
 
 	camel_lite_imap_store_connect_unlock_start_idle (store);
 
-	stop_gmsgstore (imap_folder, ctchecker, FALSE);
+	stop_gmsgstore (imap_folder, store, FALSE);
 
 	camel_lite_operation_end (NULL);
 
@@ -6284,7 +7114,7 @@ errorhander:
 	{
 		camel_lite_imap_store_connect_unlock_start_idle (store);
 
-		stop_gmsgstore (imap_folder, ctchecker, TRUE);
+		stop_gmsgstore (imap_folder, store, TRUE);
 	}
 
 	camel_lite_operation_end (NULL);
@@ -6316,7 +7146,7 @@ parse_fetch_response (CamelImapFolder *imap_folder, char *response)
 			return NULL;
 		response += 7;
 
-		g_datalist_set_data (&data, "SEQUENCE", GINT_TO_POINTER (seq));
+		g_datalist_id_set_data (&data, fetch_sequence, GINT_TO_POINTER (seq));
 	}
 
 	do {
@@ -6330,13 +7160,13 @@ parse_fetch_response (CamelImapFolder *imap_folder, char *response)
 			/* FIXME user flags */
 			flags = imap_parse_flag_list (&response);
 
-			g_datalist_set_data (&data, "FLAGS", GUINT_TO_POINTER (flags));
+			g_datalist_id_set_data (&data, fetch_flags, GUINT_TO_POINTER (flags));
 		} else if (!g_ascii_strncasecmp (response, "RFC822.SIZE ", 12)) {
 			unsigned long size;
 
 			response += 12;
 			size = strtoul (response, &response, 10);
-			g_datalist_set_data (&data, "RFC822.SIZE", GUINT_TO_POINTER (size));
+			g_datalist_id_set_data (&data, fetch_size, GUINT_TO_POINTER (size));
 		} else if (!g_ascii_strncasecmp (response, "BODY[", 5) ||
 			   !g_ascii_strncasecmp (response, "RFC822 ", 7)) {
 			char *p;
@@ -6378,21 +7208,21 @@ parse_fetch_response (CamelImapFolder *imap_folder, char *response)
 
 			if (!body)
 				body = g_strdup ("");
-			g_datalist_set_data_full (&data, "BODY_PART_SPEC", part_spec, g_free);
-			g_datalist_set_data_full (&data, "BODY_PART_DATA", body, g_free);
-			g_datalist_set_data (&data, "BODY_PART_LEN", GINT_TO_POINTER (body_len));
+			g_datalist_id_set_data_full (&data, fetch_part_spec, part_spec, g_free);
+			g_datalist_id_set_data_full (&data, fetch_part_data, body, g_free);
+			g_datalist_id_set_data (&data, fetch_part_len, GINT_TO_POINTER (body_len));
 		} else if (!g_ascii_strncasecmp (response, "BODY ", 5) ||
 			   !g_ascii_strncasecmp (response, "BODYSTRUCTURE ", 14)) {
 			response = strchr (response, ' ') + 1;
 			start = response;
 			imap_skip_list ((const char **) &response);
-			g_datalist_set_data_full (&data, "BODY", g_strndup (start, response - start), g_free);
+			g_datalist_id_set_data_full (&data, fetch_body, g_strndup (start, response - start), g_free);
 		} else if (!g_ascii_strncasecmp (response, "UID ", 4)) {
 			int len;
 
 			len = strcspn (response + 4, " )");
 			uid = g_strndup (response + 4, len);
-			g_datalist_set_data_full (&data, "UID", uid, g_free);
+			g_datalist_id_set_data_full (&data, fetch_uid, uid, g_free);
 			response += 4 + len;
 		} else if (!g_ascii_strncasecmp (response, "INTERNALDATE ", 13)) {
 			int len;
@@ -6402,7 +7232,7 @@ parse_fetch_response (CamelImapFolder *imap_folder, char *response)
 				response++;
 				len = strcspn (response, "\"");
 				idate = g_strndup (response, len);
-				g_datalist_set_data_full (&data, "INTERNALDATE", idate, g_free);
+				g_datalist_id_set_data_full (&data, fetch_internaldate, idate, g_free);
 				response += len + 1;
 			}
 		} else if (!g_ascii_strncasecmp (response, "MODSEQ ", 7)) {
@@ -6439,7 +7269,7 @@ parse_fetch_response (CamelImapFolder *imap_folder, char *response)
 		}
 
 		if (stream)
-			g_datalist_set_data_full (&data, "BODY_PART_STREAM", stream,
+			g_datalist_id_set_data_full (&data, fetch_part_stream, stream,
 						  (GDestroyNotify) camel_lite_object_unref);
 	}
 
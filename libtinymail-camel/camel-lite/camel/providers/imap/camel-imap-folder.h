@@ -51,12 +51,11 @@ struct _CamelImapFolder {
 	unsigned int read_only:1;
 	gchar *folder_dir;
 
+	/* highest MODSEQ seen since the last SELECT, or 0 */
+	guint64 modseq;
+
 	gboolean do_push_email, stopping, in_idle, cancel_occurred;
-	guint gmsgstore_signal;
 	GStaticRecMutex *idle_lock;
-
-	CamelImapStore *gmsgstore;
-	gint gmsgstore_ticks;
 };
 
 typedef struct {
@@ -97,6 +96,28 @@ void camel_lite_imap_folder_start_idle (CamelFolder *folder);
 
 char* camel_lite_imap_folder_get_highestmodseq (CamelImapFolder *imap_folder);
 
+typedef struct {
+	guint32 min, max, count;
+	char *all;	/* the matching uids as an IMAP uid set */
+} CamelImapSearchResult;
+
+typedef struct _CamelImapThreadNode CamelImapThreadNode;
+
+struct _CamelImapThreadNode {
+	CamelImapThreadNode *next;
+	CamelImapThreadNode *child;
+	guint32 uid;
+};
+
+GArray *camel_lite_imap_folder_sort (CamelFolder *folder, const char *criteria,
+				     const char *search, CamelException *ex);
+gboolean camel_lite_imap_folder_thread (CamelFolder *folder, const char *search,
+					CamelImapThreadNode **tree, CamelException *ex);
+void camel_lite_imap_thread_free (CamelImapThreadNode *tree);
+gboolean camel_lite_imap_folder_esearch (CamelFolder *folder, const char *search,
+					 CamelImapSearchResult *result, CamelException *ex);
+void camel_lite_imap_search_result_clear (CamelImapSearchResult *result);
+
 
 G_END_DECLS
 
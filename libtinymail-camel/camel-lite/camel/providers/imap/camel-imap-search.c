@@ -319,6 +319,7 @@ sync_match(CamelImapSearch *is, struct _match_record *mr)
 	CamelFolder *folder = ((CamelFolderSearch *)is)->folder;
 	CamelImapStore *store = (CamelImapStore *)folder->parent_store;
 	struct _camel_lite_search_words *words;
+	GPtrArray *uids;
 	GString *search;
 	int i;
 
@@ -344,35 +345,80 @@ sync_match(CamelImapSearch *is, struct _match_record *mr)
 		}
 		g_string_append_c (search, '"');
 	}
-	camel_lite_search_words_free (words);
 
-	/* We only try search using utf8 if its non us-ascii text? */
-	if ((words->type & CAMEL_SEARCH_WORD_8BIT) &&  (store->capabilities & IMAP_CAPABILITY_utf8_search)) {
+	/* With ESEARCH the matches come back as a uid set, rather than
+	   one number per message */
+	if (store->capabilities & IMAP_CAPABILITY_ESEARCH) {
+		CamelException ex = CAMEL_EXCEPTION_INITIALISER;
+		CamelImapSearchResult res;
+		gboolean found = FALSE;
+
+		if ((words->type & CAMEL_SEARCH_WORD_8BIT) && (store->capabilities & IMAP_CAPABILITY_utf8_search)) {
+			char *criteria = g_strdup_printf ("CHARSET UTF-8 %s", search->str);
+
+			found = camel_lite_imap_folder_esearch (folder, criteria, &res, &ex);
+			g_free (criteria);
+			/* We can't actually tell if we got a NO response, so assume always */
+			if (!found) {
+				store->capabilities &= ~IMAP_CAPABILITY_utf8_search;
+				camel_lite_exception_clear (&ex);
+			}
+		}
+		if (!found)
+			found = camel_lite_imap_folder_esearch (folder, search->str, &res, &ex);
+		camel_lite_exception_clear (&ex);
+		g_string_free (search, TRUE);
+		camel_lite_search_words_free (words);
+
+		if (!found)
+			return -1;
+
+		if (res.all) {
+			/* ranges are filled in from the summary, uids we
+			   don't have can't be matched anyway */
+			uids = imap_uid_set_to_array (folder->summary, res.all);
+			if (!uids) {
+				camel_lite_imap_search_result_clear (&res);
+				return -1;
+			}
+			for (i = 0; i < uids->len; i++) {
+				uid = strtoul (uids->pdata[i], NULL, 10);
+				g_array_append_vals (mr->matches, &uid, 1);
+			}
+			imap_uid_array_free (uids);
+		}
+		camel_lite_imap_search_result_clear (&res);
+	} else {
+		/* We only try search using utf8 if its non us-ascii text? */
+		if ((words->type & CAMEL_SEARCH_WORD_8BIT) &&  (store->capabilities & IMAP_CAPABILITY_utf8_search)) {
+
+			response = camel_lite_imap_command (store, folder, NULL,
+						       "UID SEARCH CHARSET UTF-8 %s", search->str);
+			/* We can't actually tell if we got a NO response, so assume always */
+			if (response == NULL)
+				store->capabilities &= ~IMAP_CAPABILITY_utf8_search;
+		}
+		if (response == NULL) {
+			response = camel_lite_imap_command (store, folder, NULL,
+						       "UID SEARCH %s", search->str);
+		}
+		g_string_free(search, TRUE);
+		camel_lite_search_words_free (words);
 
-		response = camel_lite_imap_command (store, folder, NULL,
-					       "UID SEARCH CHARSET UTF-8 %s", search->str);
-		/* We can't actually tell if we got a NO response, so assume always */
-		if (response == NULL)
-			store->capabilities &= ~IMAP_CAPABILITY_utf8_search;
-	}
-	if (response == NULL) {
-		response = camel_lite_imap_command (store, folder, NULL,
-					       "UID SEARCH %s", search->str);
-	}
-	g_string_free(search, TRUE);
+		if (!response)
+			return -1;
 
-	if (!response)
-		return -1;
-	result = camel_lite_imap_response_extract (store, response, "SEARCH", NULL);
-	if (!result)
-		return -1;
+		result = camel_lite_imap_response_extract (store, response, "SEARCH", NULL);
+		if (!result)
+			return -1;
 
-	p = result + sizeof ("* SEARCH");
-	for (p = strtok_r (p, " ", &lasts); p; p = strtok_r (NULL, " ", &lasts)) {
-		uid = strtoul(p, NULL, 10);
-		g_array_append_vals(mr->matches, &uid, 1);
+		p = result + sizeof ("* SEARCH");
+		for (p = strtok_r (p, " ", &lasts); p; p = strtok_r (NULL, " ", &lasts)) {
+			uid = strtoul(p, NULL, 10);
+			g_array_append_vals(mr->matches, &uid, 1);
+		}
+		g_free(result);
 	}
-	g_free(result);
 
 	mr->validity = is->validity;
 	mr->lastuid = is->lastuid;
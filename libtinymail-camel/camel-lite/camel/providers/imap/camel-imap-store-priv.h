@@ -25,9 +25,12 @@
 
 #include <camel/camel-object.h>
 
+#include "camel-imap-types.h"
+
 G_BEGIN_DECLS
 
-/* This is the tick time for IDLE loop, the time we sleep in microseconds */
+/* This is the tick time for IDLE loop, the time we sleep in microseconds
+ * when we can't wait on the socket */
 #define IDLE_TICK_TIME 500000
 
 /* Default sleep time in seconds for IDLE for sending DONE and IDLE again to avoid
@@ -39,6 +42,31 @@ void _camel_lite_imap_store_current_folder_finalize (CamelObject *stream, gpoint
 void _camel_lite_imap_store_old_folder_finalize (CamelObject *stream, gpointer event_data, gpointer user_data);
 void _camel_lite_imap_store_last_folder_finalize (CamelObject *stream, gpointer event_data, gpointer user_data);
 
+void _camel_lite_imap_store_wake_idle (CamelImapStore *store);
+void _camel_lite_imap_store_drain_wake (CamelImapStore *store);
+int _camel_lite_imap_store_wait (CamelImapStore *store, int sockfd, int timeout);
+
+/* Default number of connections which IDLE on a folder each, when the
+ * server can't NOTIFY */
+#define CAMEL_IMAP_PUSH_POOL_SIZE 2
+
+/* Default number of connections messages and parts are fetched over */
+#define CAMEL_IMAP_GMSG_POOL_SIZE 3
+
+/* A pooled get-message connection */
+struct _CamelImapGmsgConn {
+	CamelImapStore *store;	/* NULL while it is being opened */
+	GThread *owner;		/* NULL when unused */
+	gint depth;		/* nested uses by owner */
+	time_t last_used;
+	gboolean dead;		/* close rather than hand out again */
+};
+
+CamelImapStore *_camel_lite_imap_store_gmsg_acquire (CamelImapStore *store, CamelFolder *folder, gboolean *reserved, CamelException *ex);
+void _camel_lite_imap_store_gmsg_attach (CamelImapStore *store, CamelImapStore *conn_store);
+void _camel_lite_imap_store_gmsg_release (CamelImapStore *store, CamelImapStore *conn_store, gboolean drop);
+void _camel_lite_imap_store_gmsg_drop_idle (CamelImapStore *store, CamelFolder *folder);
+
 G_END_DECLS
 
 #endif /* CAMEL_IMAP_STORE_PRIV_H */
@@ -30,11 +30,16 @@
 
 #include <config.h>
 
+#include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#ifndef G_OS_WIN32
+#include <sys/poll.h>
+#endif
 
 #include <glib.h>
 #include <glib/gi18n-lib.h>
@@ -49,6 +54,7 @@
 #include "camel/camel-file-utils.h"
 #include "camel/camel-folder.h"
 #include "camel/camel-net-utils.h"
+#include "camel/camel-operation.h"
 #include "camel/camel-string-utils.h"
 #include "camel/camel-private.h"
 #include "camel/camel-sasl.h"
@@ -83,7 +89,6 @@
 /* Specified in RFC 2060 */
 #define IMAP_PORT "143"
 #define IMAPS_PORT "993"
-#define STOP_IDLE_LOOP_WAIT 100000
 
 #ifdef G_OS_WIN32
 /* The strtok() in Microsoft's C library is MT-safe (but still uses
@@ -146,6 +151,7 @@ static void imap_forget_folder(CamelImapStore *imap_store, const char *folder_na
 static void imap_set_server_level (CamelImapStore *store);
 
 static void imap_get_folder_status (CamelStore *store, const char *folder_name, int *unseen, int *messages, int *uidnext);
+static void imap_get_folder_status_many (CamelStore *store, CamelStoreFolderStatus *statuses, int count);
 
 static int
 imapstore_get_local_size (CamelStore *store, const gchar *folder_name)
@@ -226,6 +232,7 @@ let_idle_die (CamelImapStore *store, gboolean connect_buz)
 
 	store->idle_kill = TRUE;
 	store->idle_cont = FALSE;
+	_camel_lite_imap_store_wake_idle (store);
 
 	if (store->idle_prefix)
 	{
@@ -278,6 +285,7 @@ _camel_lite_imap_store_stop_idle (CamelImapStore *store)
 
 		store->idle_kill = TRUE;
 		store->idle_cont = FALSE;
+		_camel_lite_imap_store_wake_idle (store);
 
 		if (store->idle_prefix) {
 			gchar *resp = NULL;
@@ -367,7 +375,12 @@ _camel_lite_imap_store_stop_idle_connect_lock (CamelImapStore *store)
 		if (!connection_locked) {
 			store->idle_wait_reasons--;
 			idle_debug ("Looping stop_idle_connect_lock\n");
-			usleep (STOP_IDLE_LOOP_WAIT);
+
+			/* Wait for whoever has the connection to let go of
+			 * it rather than polling, then retry with the wait
+			 * reasons lock held */
+			CAMEL_SERVICE_REC_LOCK (store, connect_lock);
+			CAMEL_SERVICE_REC_UNLOCK (store, connect_lock);
 		}
 	}
 	idle_debug ("Idle wait reasons lock depth (%d->%d)\n", depth, depth - 1);
@@ -449,6 +462,1112 @@ _camel_lite_imap_store_start_idle_if_unlocked (CamelImapStore *store)
 	
 }
 
+/* Pool of secondary ("get-message") connections.  Fetching a message
+   or a part runs on one of these rather than on the store's own
+   connection, so that several fetches can run at the same time.  The
+   connections themselves are set up by the folder, the pool only hands
+   them out, keeps count of them and closes the ones left unused for
+   getsrv_sleep seconds. */
+
+/* Logging out takes a round trip per connection, so the reaper only
+   picks the connections and a session thread closes them */
+struct _gmsg_close_msg {
+	CamelSessionThreadMsg msg;
+
+	GList *conns;
+};
+
+static void
+gmsg_close (CamelSession *session, CamelSessionThreadMsg *mm)
+{
+	struct _gmsg_close_msg *m = (struct _gmsg_close_msg *)mm;
+	GList *l;
+
+	for (l = m->conns; l; l = l->next) {
+		CamelImapStore *conn_store = l->data;
+
+		imap_debug ("Get-Message service dies\n");
+		camel_lite_service_disconnect (CAMEL_SERVICE (conn_store), conn_store->clean_exit, NULL);
+	}
+}
+
+static void
+gmsg_close_free (CamelSession *session, CamelSessionThreadMsg *mm)
+{
+	struct _gmsg_close_msg *m = (struct _gmsg_close_msg *)mm;
+	GList *l;
+
+	for (l = m->conns; l; l = l->next)
+		camel_lite_object_unref (l->data);
+	g_list_free (m->conns);
+}
+
+static CamelSessionThreadOps gmsg_close_ops = {
+	gmsg_close,
+	gmsg_close_free,
+};
+
+static gboolean
+gmsg_reap (gpointer user_data)
+{
+	CamelImapStore *store = user_data;
+	struct _CamelImapGmsgConn *conn;
+	GList *l, *next, *dead = NULL;
+	time_t now = time (NULL);
+	gboolean retval = TRUE;
+
+	g_mutex_lock (store->gmsg_lock);
+	for (l = store->gmsg_conns; l; l = next) {
+		next = l->next;
+		conn = l->data;
+		if (conn->owner == NULL && conn->store
+		    && (conn->dead || now - conn->last_used >= store->getsrv_sleep)) {
+			store->gmsg_conns = g_list_delete_link (store->gmsg_conns, l);
+			dead = g_list_prepend (dead, conn->store);
+			g_free (conn);
+		}
+	}
+	if (store->gmsg_conns == NULL) {
+		store->gmsg_reaper = 0;
+		retval = FALSE;
+	}
+	g_mutex_unlock (store->gmsg_lock);
+
+	if (dead) {
+		CamelSession *session = ((CamelService *) store)->session;
+		struct _gmsg_close_msg *m;
+
+		m = camel_lite_session_thread_msg_new (session, &gmsg_close_ops, sizeof (*m));
+		m->conns = dead;
+		camel_lite_session_thread_queue (session, &m->msg, 0);
+	}
+
+	if (!retval)
+		camel_lite_object_unref (store);
+
+	return retval;
+}
+
+/* must be called with gmsg_lock held */
+static void
+gmsg_start_reaper (CamelImapStore *store)
+{
+	if (store->gmsg_reaper == 0) {
+		camel_lite_object_ref (store);
+		store->gmsg_reaper = g_timeout_add (1000, gmsg_reap, store);
+	}
+}
+
+static struct _CamelImapGmsgConn *
+gmsg_find (CamelImapStore *store, CamelImapStore *conn_store, GThread *owner)
+{
+	struct _CamelImapGmsgConn *conn;
+	GList *l;
+
+	for (l = store->gmsg_conns; l; l = l->next) {
+		conn = l->data;
+		if (conn->store == conn_store && (owner == NULL || conn->owner == owner))
+			return conn;
+	}
+
+	return NULL;
+}
+
+/**
+ * _camel_lite_imap_store_gmsg_acquire:
+ * @store: the account's store
+ * @folder: folder the connection will be used for
+ * @reserved: set to %TRUE if the caller has to open a new connection
+ * @ex: a #CamelException
+ *
+ * Get a connection out of @store's pool, preferring one which has
+ * @folder selected already.  If none is free and the pool isn't full
+ * yet %NULL is returned with @reserved set, the caller then has to
+ * open a connection and hand it to _camel_lite_imap_store_gmsg_attach().
+ * If the pool is full this waits for a connection to be released, or
+ * for the current operation to be cancelled.
+ *
+ * A thread which already holds a connection gets the same one back.
+ *
+ * Return value: A connection or %NULL.
+ **/
+CamelImapStore *
+_camel_lite_imap_store_gmsg_acquire (CamelImapStore *store, CamelFolder *folder, gboolean *reserved, CamelException *ex)
+{
+	struct _CamelImapGmsgConn *conn, *idle;
+	GThread *self = g_thread_self ();
+	gboolean waited = FALSE;
+	GTimeVal until;
+	guint count;
+	GList *l;
+
+	*reserved = FALSE;
+
+	g_mutex_lock (store->gmsg_lock);
+	for (;;) {
+		idle = NULL;
+		count = 0;
+		for (l = store->gmsg_conns; l; l = l->next) {
+			conn = l->data;
+			count++;
+
+			/* this used to be a single connection behind a recursive lock,
+			 * nested users stay on the connection they already have */
+			if (conn->owner == self && conn->store) {
+				conn->depth++;
+				g_mutex_unlock (store->gmsg_lock);
+				return conn->store;
+			}
+
+			if (conn->owner == NULL && conn->store && !conn->dead
+			    && (idle == NULL || conn->store->current_folder == folder))
+				idle = conn;
+		}
+
+		if (idle) {
+			idle->owner = self;
+			idle->depth = 1;
+			store->gmsg_acquired++;
+			g_mutex_unlock (store->gmsg_lock);
+			return idle->store;
+		}
+
+		if (count < store->gmsg_size) {
+			conn = g_new0 (struct _CamelImapGmsgConn, 1);
+			conn->owner = self;
+			conn->depth = 1;
+			store->gmsg_conns = g_list_prepend (store->gmsg_conns, conn);
+			store->gmsg_acquired++;
+			*reserved = TRUE;
+			g_mutex_unlock (store->gmsg_lock);
+			return NULL;
+		}
+
+		if (!waited) {
+			store->gmsg_waited++;
+			waited = TRUE;
+		}
+
+		g_get_current_time (&until);
+		g_time_val_add (&until, G_USEC_PER_SEC);
+		g_cond_timed_wait (store->gmsg_cond, store->gmsg_lock, &until);
+
+		if (camel_lite_operation_cancel_check (NULL)) {
+			g_mutex_unlock (store->gmsg_lock);
+			camel_lite_exception_set (ex, CAMEL_EXCEPTION_USER_CANCEL, _("Operation cancelled"));
+			return NULL;
+		}
+	}
+}
+
+/**
+ * _camel_lite_imap_store_gmsg_attach:
+ * @store: the account's store
+ * @conn_store: the new connection, or %NULL if opening it failed
+ *
+ * Fill in the slot reserved by _camel_lite_imap_store_gmsg_acquire().
+ * The connection belongs to the pool from now on.
+ **/
+void
+_camel_lite_imap_store_gmsg_attach (CamelImapStore *store, CamelImapStore *conn_store)
+{
+	struct _CamelImapGmsgConn *conn;
+
+	g_mutex_lock (store->gmsg_lock);
+	conn = gmsg_find (store, NULL, g_thread_self ());
+	if (conn == NULL) {
+		g_mutex_unlock (store->gmsg_lock);
+		g_warning ("Attaching a get-message connection which wasn't reserved");
+		return;
+	}
+
+	if (conn_store) {
+		conn->store = conn_store;
+		store->gmsg_created++;
+	} else {
+		store->gmsg_conns = g_list_remove (store->gmsg_conns, conn);
+		g_free (conn);
+		g_cond_broadcast (store->gmsg_cond);
+	}
+	g_mutex_unlock (store->gmsg_lock);
+}
+
+/**
+ * _camel_lite_imap_store_gmsg_release:
+ * @store: the account's store
+ * @conn_store: a connection from _camel_lite_imap_store_gmsg_acquire()
+ * @drop: whether the connection should be closed rather than reused
+ *
+ * Give a connection back to the pool.
+ **/
+void
+_camel_lite_imap_store_gmsg_release (CamelImapStore *store, CamelImapStore *conn_store, gboolean drop)
+{
+	struct _CamelImapGmsgConn *conn;
+
+	g_mutex_lock (store->gmsg_lock);
+	conn = gmsg_find (store, conn_store, g_thread_self ());
+	if (conn == NULL) {
+		g_mutex_unlock (store->gmsg_lock);
+		g_warning ("Releasing a get-message connection which isn't held");
+		return;
+	}
+
+	if (drop)
+		conn->dead = TRUE;
+
+	if (--conn->depth == 0) {
+		conn->owner = NULL;
+		conn->last_used = time (NULL);
+		gmsg_start_reaper (store);
+		g_cond_broadcast (store->gmsg_cond);
+	}
+	g_mutex_unlock (store->gmsg_lock);
+}
+
+/**
+ * _camel_lite_imap_store_gmsg_drop_idle:
+ * @store: the account's store
+ * @folder: a folder
+ *
+ * Close the unused pooled connections which have @folder selected.
+ **/
+void
+_camel_lite_imap_store_gmsg_drop_idle (CamelImapStore *store, CamelFolder *folder)
+{
+	struct _CamelImapGmsgConn *conn;
+	GList *l;
+
+	g_mutex_lock (store->gmsg_lock);
+	for (l = store->gmsg_conns; l; l = l->next) {
+		conn = l->data;
+		if (conn->owner == NULL && conn->store && conn->store->current_folder == folder) {
+			conn->store->clean_exit = FALSE;
+			conn->dead = TRUE;
+		}
+	}
+	g_mutex_unlock (store->gmsg_lock);
+}
+
+/**
+ * camel_lite_imap_store_set_gmsg_pool:
+ * @store: a #CamelImapStore
+ * @size: most connections to open for fetching messages, at least 1
+ * @idle_timeout: seconds to keep an unused connection open, or 0 to keep the current value
+ *
+ * Configure the pool of connections @store fetches messages and parts
+ * over.  The size can also be set with the getsrv_connections url
+ * parameter, and the timeout with getsrv_delay.
+ **/
+void
+camel_lite_imap_store_set_gmsg_pool (CamelImapStore *store, guint size, guint idle_timeout)
+{
+	g_mutex_lock (store->gmsg_lock);
+	store->gmsg_size = MAX (size, 1);
+	if (idle_timeout > 0)
+		store->getsrv_sleep = idle_timeout;
+	g_cond_broadcast (store->gmsg_cond);
+	g_mutex_unlock (store->gmsg_lock);
+}
+
+/**
+ * camel_lite_imap_store_get_gmsg_stats:
+ * @store: a #CamelImapStore
+ * @stats: statistics to fill in
+ *
+ * Fill in @stats with the state and utilisation of @store's pool of
+ * message fetching connections.
+ **/
+void
+camel_lite_imap_store_get_gmsg_stats (CamelImapStore *store, CamelImapGmsgStats *stats)
+{
+	struct _CamelImapGmsgConn *conn;
+	GList *l;
+
+	memset (stats, 0, sizeof (*stats));
+
+	g_mutex_lock (store->gmsg_lock);
+	stats->size = store->gmsg_size;
+	stats->idle_timeout = store->getsrv_sleep;
+	for (l = store->gmsg_conns; l; l = l->next) {
+		conn = l->data;
+		stats->connections++;
+		if (conn->owner)
+			stats->busy++;
+	}
+	stats->acquired = store->gmsg_acquired;
+	stats->waited = store->gmsg_waited;
+	stats->created = store->gmsg_created;
+	g_mutex_unlock (store->gmsg_lock);
+}
+
+/**
+ * _camel_lite_imap_store_wake_idle:
+ * @store: a #CamelImapStore
+ *
+ * Wake the IDLE thread up so that it notices idle_cont or idle_kill
+ * changed, instead of when its wait on the socket times out.
+ **/
+void
+_camel_lite_imap_store_wake_idle (CamelImapStore *store)
+{
+	char c = 0;
+
+	/* the pipe is non-blocking, a full pipe already wakes it */
+	if (store->idle_wake[1] != -1) {
+		while (write (store->idle_wake[1], &c, 1) == -1 && errno == EINTR)
+			;
+	}
+}
+
+/**
+ * _camel_lite_imap_store_drain_wake:
+ * @store: a #CamelImapStore
+ *
+ * Forget wake ups sent with _camel_lite_imap_store_wake_idle() which
+ * nobody waited for.
+ **/
+void
+_camel_lite_imap_store_drain_wake (CamelImapStore *store)
+{
+	char buf[32];
+
+	if (store->idle_wake[0] != -1) {
+		while (read (store->idle_wake[0], buf, sizeof (buf)) > 0)
+			;
+	}
+}
+
+/**
+ * _camel_lite_imap_store_wait:
+ * @store: a #CamelImapStore
+ * @sockfd: the connection's socket, or -1
+ * @timeout: most milliseconds to wait
+ *
+ * Sleep until the server sends something on @sockfd, another thread
+ * calls _camel_lite_imap_store_wake_idle() or @timeout passes.  What
+ * the stream has buffered already doesn't show up on the socket, it
+ * has to be read before waiting.
+ *
+ * Return value: 1 if there is something to read, -1 if @store was
+ * woken up and 0 if the wait timed out.
+ **/
+int
+_camel_lite_imap_store_wait (CamelImapStore *store, int sockfd, int timeout)
+{
+#ifndef G_OS_WIN32
+	struct pollfd polls[2];
+	int status, nfds = 1;
+
+	store->idle_wakeups++;
+
+	if (store->idle_wake[0] == -1) {
+		usleep (MIN (timeout, IDLE_TICK_TIME / 1000) * 1000);
+		store->idle_wakeups_timeout++;
+		return 0;
+	}
+
+	polls[0].fd = store->idle_wake[0];
+	polls[0].events = POLLIN;
+	polls[1].fd = sockfd;
+	polls[1].events = POLLIN;
+	if (sockfd != -1)
+		nfds = 2;
+
+	do {
+		polls[0].revents = 0;
+		polls[1].revents = 0;
+		status = poll (polls, nfds, timeout);
+	} while (status == -1 && errno == EINTR);
+
+	/* A socket which is closed or in error stays readable, don't
+	 * spin on it but leave it to the next read to notice */
+	if (status > 0 && nfds == 2 && (polls[1].revents & (POLLERR|POLLHUP|POLLNVAL))) {
+		do {
+			polls[0].revents = 0;
+			status = poll (polls, 1, MIN (timeout, IDLE_TICK_TIME / 1000));
+		} while (status == -1 && errno == EINTR);
+		nfds = 1;
+	}
+
+	if (status > 0 && (polls[0].revents & POLLIN)) {
+		_camel_lite_imap_store_drain_wake (store);
+		store->idle_wakeups_stop++;
+		return -1;
+	} else if (status > 0 && nfds == 2) {
+		store->idle_wakeups_io++;
+		return 1;
+	}
+#else
+	store->idle_wakeups++;
+	usleep (MIN (timeout, IDLE_TICK_TIME / 1000) * 1000);
+#endif
+	store->idle_wakeups_timeout++;
+	return 0;
+}
+
+/**
+ * camel_lite_imap_store_get_idle_stats:
+ * @store: a #CamelImapStore
+ * @stats: statistics to fill in
+ *
+ * Fill in @stats with how often @store's IDLE thread woke up, and
+ * why.  An idle account with nothing arriving should only wake up
+ * to re-issue IDLE.
+ **/
+void
+camel_lite_imap_store_get_idle_stats (CamelImapStore *store, CamelImapIdleStats *stats)
+{
+	stats->wakeups = store->idle_wakeups;
+	stats->io = store->idle_wakeups_io;
+	stats->stop = store->idle_wakeups_stop;
+	stats->timeout = store->idle_wakeups_timeout;
+}
+
+/* Parse an untagged "* STATUS mailbox (MESSAGES n UNSEEN n UIDNEXT n)"
+   response, returns the mailbox as the server names it or NULL if
+   @resp isn't one.  Items which aren't in the response are left
+   alone. */
+static char *
+parse_status_response (const char *resp, int *unseen, int *messages, int *uidnext)
+{
+	const char *p, *item;
+	char *mailbox, *end;
+	size_t len;
+	guint32 value;
+
+	if (strncmp (resp, "* ", 2) != 0 || g_ascii_strncasecmp (resp + 2, "STATUS ", 7) != 0)
+		return NULL;
+
+	p = resp + 9;
+	mailbox = imap_parse_astring (&p, &len);
+	if (!mailbox || !p) {
+		g_free (mailbox);
+		return NULL;
+	}
+
+	while (*p == ' ')
+		p++;
+	if (*p == '(')
+		p++;
+
+	while (*p && *p != ')') {
+		item = p;
+		while (*p && *p != ' ')
+			p++;
+		value = strtoul (p, &end, 10);
+		if (end == p)
+			break;
+		p = end;
+
+		if (!g_ascii_strncasecmp (item, "MESSAGES ", 9))
+			*messages = value;
+		else if (!g_ascii_strncasecmp (item, "UNSEEN ", 7))
+			*unseen = value;
+		else if (!g_ascii_strncasecmp (item, "UIDNEXT ", 8))
+			*uidnext = value;
+
+		while (*p == ' ')
+			p++;
+	}
+
+	return mailbox;
+}
+
+/* Push for folders other than the selected one.  If the server can
+   NOTIFY (RFC 5465) one extra connection asks it for STATUS responses
+   about all of them, otherwise up to push_size connections each
+   EXAMINE one folder and IDLE on it.  The folders left over then get
+   polled with STATUS by those connections in turn, each time they
+   leave IDLE to keep alive.  Either way the counts are passed on with
+   the store's "folder_status" event, from the connection's thread. */
+
+#define PUSH_RETRY_TIME (60)	/* seconds before trying a failed connection again */
+
+struct _CamelImapPushConn {
+	CamelImapStore *parent;
+	CamelImapStore *store;
+	GPtrArray *folders;	/* folder names, the first one is examined */
+	GPtrArray *mailboxes;	/* the same, as the server names them */
+	gboolean notify;
+	int messages;		/* EXISTS of the examined folder */
+	time_t polled;		/* last STATUS of the other folders */
+	CamelOperation *op;
+	GThread *thread;
+	volatile gboolean stop;
+};
+
+static void
+push_free_names (GPtrArray *names)
+{
+	guint i;
+
+	if (names == NULL)
+		return;
+
+	for (i = 0; i < names->len; i++)
+		g_free (names->pdata[i]);
+	g_ptr_array_free (names, TRUE);
+}
+
+/* Milliseconds left until the connection has to be kept alive */
+static int
+push_time_left (struct _CamelImapPushConn *conn, time_t since)
+{
+	gint64 left;
+
+	left = (gint64) conn->parent->idle_sleep * (IDLE_TICK_TIME / 1000)
+		- (gint64) (time (NULL) - since) * 1000;
+
+	return (int) CLAMP (left, 0, G_MAXINT);
+}
+
+static void
+push_report (struct _CamelImapPushConn *conn, const char *folder_name, int unseen, int messages, int uidnext)
+{
+	CamelStoreFolderStatus status;
+
+	imap_debug ("Push: %s unseen=%d messages=%d uidnext=%d\n",
+		folder_name, unseen, messages, uidnext);
+
+	status.folder_name = folder_name;
+	status.unseen = unseen;
+	status.messages = messages;
+	status.uidnext = uidnext;
+
+	camel_lite_object_trigger_event (conn->parent, "folder_status", &status);
+}
+
+static gboolean
+push_mailbox_equal (const char *a, const char *b)
+{
+	if (!g_ascii_strcasecmp (a, "INBOX"))
+		return !g_ascii_strcasecmp (b, "INBOX");
+
+	return !strcmp (a, b);
+}
+
+/* An untagged STATUS response on the NOTIFY connection */
+static void
+push_status_line (struct _CamelImapPushConn *conn, const char *resp)
+{
+	int unseen = -1, messages = -1, uidnext = -1;
+	char *mailbox;
+	guint i;
+
+	if (!(mailbox = parse_status_response (resp, &unseen, &messages, &uidnext)))
+		return;
+
+	for (i = 0; i < conn->mailboxes->len; i++) {
+		if (push_mailbox_equal (conn->mailboxes->pdata[i], mailbox)) {
+			push_report (conn, conn->folders->pdata[i], unseen, messages, uidnext);
+			break;
+		}
+	}
+
+	g_free (mailbox);
+}
+
+/* Keep track of the examined folder's size, returns TRUE if @resp is
+   about a change in it */
+static gboolean
+push_idle_line (struct _CamelImapPushConn *conn, const char *resp)
+{
+	guint32 n;
+	char *p;
+
+	if (strncmp (resp, "* ", 2) != 0 || !isdigit ((unsigned char) resp[2]))
+		return FALSE;
+
+	n = strtoul (resp + 2, &p, 10);
+	while (*p == ' ')
+		p++;
+
+	if (!g_ascii_strncasecmp (p, "EXISTS", 6)) {
+		conn->messages = n;
+		return TRUE;
+	} else if (!g_ascii_strncasecmp (p, "EXPUNGE", 7)) {
+		if (conn->messages > 0)
+			conn->messages--;
+		return TRUE;
+	} else if (!g_ascii_strncasecmp (p, "FETCH", 5))
+		return TRUE;
+
+	return FALSE;
+}
+
+/* Number of unseen messages in the examined folder, or -1 */
+static int
+push_count_unseen (struct _CamelImapPushConn *conn, CamelException *ex)
+{
+	CamelImapResponse *response;
+	int unseen = -1;
+	guint i;
+
+	if (conn->store->capabilities & IMAP_CAPABILITY_ESEARCH)
+		response = camel_lite_imap_command (conn->store, NULL, ex, "SEARCH RETURN (COUNT) UNSEEN");
+	else
+		response = camel_lite_imap_command (conn->store, NULL, ex, "SEARCH UNSEEN");
+
+	if (!response)
+		return -1;
+
+	for (i = 0; i < response->untagged->len; i++) {
+		const char *resp = response->untagged->pdata[i];
+
+		if (!g_ascii_strncasecmp (resp, "* ESEARCH", 9)) {
+			guint32 min = 0, max = 0, count = 0;
+			char *all = NULL;
+
+			if (imap_parse_esearch_response (resp, &min, &max, &count, &all))
+				unseen = count;
+			g_free (all);
+		} else if (!g_ascii_strncasecmp (resp, "* SEARCH", 8)) {
+			const char *p = resp + 8;
+
+			unseen = 0;
+			while (*p) {
+				while (*p == ' ')
+					p++;
+				if (!isdigit ((unsigned char) *p))
+					break;
+				while (isdigit ((unsigned char) *p))
+					p++;
+				unseen++;
+			}
+		} else
+			push_idle_line (conn, resp);
+	}
+
+	camel_lite_imap_response_free (conn->store, response);
+
+	return unseen;
+}
+
+/* Connect and ask for the changes */
+static gboolean
+push_setup (struct _CamelImapPushConn *conn, CamelException *ex)
+{
+	CamelImapResponse *response;
+	const char *folder_name;
+	int uidnext = -1, unseen;
+	guint i;
+
+	if (!camel_lite_service_connect (CAMEL_SERVICE (conn->store), ex))
+		return FALSE;
+
+	if (conn->notify) {
+		GString *list = g_string_new ("");
+
+		for (i = 0; i < conn->mailboxes->len; i++) {
+			char *quoted = imap_quote_string (conn->mailboxes->pdata[i]);
+
+			if (i > 0)
+				g_string_append_c (list, ' ');
+			g_string_append (list, quoted);
+			g_free (quoted);
+		}
+
+		/* FlagChange keeps the unseen counts current, not every
+		 * server takes it for mailboxes which aren't selected */
+		response = camel_lite_imap_command (conn->store, NULL, ex,
+			"NOTIFY SET STATUS (mailboxes (%s) (MessageNew MessageExpunge FlagChange))",
+			list->str);
+		if (!response && camel_lite_exception_get_id (ex) == CAMEL_EXCEPTION_SERVICE_PROTOCOL) {
+			camel_lite_exception_clear (ex);
+			response = camel_lite_imap_command (conn->store, NULL, ex,
+				"NOTIFY SET STATUS (mailboxes (%s) (MessageNew MessageExpunge))",
+				list->str);
+			if (!response && camel_lite_exception_get_id (ex) == CAMEL_EXCEPTION_SERVICE_PROTOCOL) {
+				/* leave it to IDLE the next time we go online */
+				conn->parent->push_notify_broken = TRUE;
+				conn->stop = TRUE;
+			}
+		}
+		g_string_free (list, TRUE);
+
+		if (!response)
+			return FALSE;
+
+		for (i = 0; i < response->untagged->len; i++)
+			push_status_line (conn, response->untagged->pdata[i]);
+		camel_lite_imap_response_free (conn->store, response);
+
+		return TRUE;
+	}
+
+	folder_name = conn->folders->pdata[0];
+	conn->messages = -1;
+	conn->polled = 0;
+
+	response = camel_lite_imap_command (conn->store, NULL, ex, "EXAMINE %F", folder_name);
+	if (!response)
+		return FALSE;
+
+	for (i = 0; i < response->untagged->len; i++) {
+		const char *resp = response->untagged->pdata[i], *p;
+
+		if ((p = camel_lite_strstrcase (resp, "[UIDNEXT ")))
+			uidnext = strtoul (p + 9, NULL, 10);
+		else
+			push_idle_line (conn, resp);
+	}
+	camel_lite_imap_response_free (conn->store, response);
+
+	unseen = push_count_unseen (conn, ex);
+	if (camel_lite_exception_is_set (ex))
+		return FALSE;
+
+	push_report (conn, folder_name, unseen, conn->messages, uidnext);
+
+	return TRUE;
+}
+
+/* IDLE: STATUS the folders beyond the examined one, no more often than
+   the connection is kept alive.  Returns TRUE if the examined folder
+   changed meanwhile */
+static gboolean
+push_poll (struct _CamelImapPushConn *conn, CamelException *ex)
+{
+	CamelImapResponse *response;
+	gboolean changed = FALSE;
+	guint i, j;
+
+	if (conn->folders->len < 2 || push_time_left (conn, conn->polled) > 0)
+		return FALSE;
+
+	for (i = 1; i < conn->folders->len && !conn->stop; i++) {
+		response = camel_lite_imap_command (conn->store, NULL, ex,
+			"STATUS %F (MESSAGES UNSEEN UIDNEXT)", conn->folders->pdata[i]);
+		if (!response)
+			return changed;
+
+		for (j = 0; j < response->untagged->len; j++) {
+			const char *resp = response->untagged->pdata[j];
+
+			if (push_idle_line (conn, resp))
+				changed = TRUE;
+			else
+				push_status_line (conn, resp);
+		}
+		camel_lite_imap_response_free (conn->store, response);
+	}
+
+	conn->polled = time (NULL);
+
+	return changed;
+}
+
+/* NOTIFY: wait for STATUS responses, NOOP now and then so the
+   connection isn't dropped */
+static void
+push_notify_loop (struct _CamelImapPushConn *conn, CamelException *ex)
+{
+	CamelImapStore *store = conn->store;
+	CamelImapResponse *response;
+	time_t since = time (NULL);
+	char *resp = NULL;
+	int sockfd = -1, timeout;
+	guint i;
+
+	if (CAMEL_IS_TCP_STREAM (store->ostream))
+		sockfd = camel_lite_tcp_stream_get_fd (CAMEL_TCP_STREAM (store->ostream));
+
+	while (!conn->stop) {
+		while (camel_lite_imap_store_readline_nb (store, &resp, ex) > 0) {
+			push_status_line (conn, resp);
+			g_free (resp);
+			resp = NULL;
+		}
+		if (camel_lite_exception_is_set (ex))
+			return;
+
+		if ((timeout = push_time_left (conn, since)) == 0) {
+			response = camel_lite_imap_command (store, NULL, ex, "NOOP");
+			if (!response)
+				return;
+			for (i = 0; i < response->untagged->len; i++)
+				push_status_line (conn, response->untagged->pdata[i]);
+			camel_lite_imap_response_free (store, response);
+			since = time (NULL);
+			continue;
+		}
+
+		_camel_lite_imap_store_wait (store, sockfd, sockfd == -1 ?
+			MIN (timeout, IDLE_TICK_TIME / 1000) : timeout);
+	}
+}
+
+/* IDLE on the examined folder until something changes in it, we're
+   asked to stop or IDLE has to be re-issued, returns TRUE if something
+   changed */
+static gboolean
+push_idle (struct _CamelImapPushConn *conn, CamelException *ex)
+{
+	CamelImapStore *store = conn->store;
+	gboolean changed = FALSE, tagged;
+	time_t since = time (NULL);
+	char *tag, *resp = NULL;
+	int sockfd = -1, timeout;
+	size_t taglen;
+
+	tag = g_strdup_printf ("%c%.5u", store->tag_prefix, store->command++);
+	taglen = strlen (tag);
+
+	if (camel_lite_stream_printf (store->ostream, "%s IDLE\r\n", tag) == -1) {
+		camel_lite_exception_setv (ex, CAMEL_EXCEPTION_SERVICE_LOST_CONNECTION,
+			_("Server unexpectedly disconnected: %s"), g_strerror (errno));
+		g_free (tag);
+		return FALSE;
+	}
+
+	while (camel_lite_imap_store_readline (store, &resp, ex) > 0) {
+		if (resp[0] == '+')
+			break;
+		if (!strncmp (resp, tag, taglen)) {
+			camel_lite_exception_setv (ex, CAMEL_EXCEPTION_SERVICE_PROTOCOL,
+				_("IMAP command failed: %s"), resp);
+			break;
+		}
+		changed |= push_idle_line (conn, resp);
+		g_free (resp);
+		resp = NULL;
+	}
+	g_free (resp);
+	resp = NULL;
+
+	if (camel_lite_exception_is_set (ex)) {
+		g_free (tag);
+		return FALSE;
+	}
+
+	if (CAMEL_IS_TCP_STREAM (store->ostream))
+		sockfd = camel_lite_tcp_stream_get_fd (CAMEL_TCP_STREAM (store->ostream));
+
+	while (!conn->stop && !changed) {
+		while (camel_lite_imap_store_readline_nb (store, &resp, ex) > 0) {
+			changed |= push_idle_line (conn, resp);
+			g_free (resp);
+			resp = NULL;
+		}
+		if (camel_lite_exception_is_set (ex)) {
+			g_free (tag);
+			return FALSE;
+		}
+
+		if (changed || (timeout = push_time_left (conn, since)) == 0)
+			break;
+
+		_camel_lite_imap_store_wait (store, sockfd, sockfd == -1 ?
+			MIN (timeout, IDLE_TICK_TIME / 1000) : timeout);
+	}
+
+	if (camel_lite_stream_printf (store->ostream, "DONE\r\n") == -1) {
+		camel_lite_exception_setv (ex, CAMEL_EXCEPTION_SERVICE_LOST_CONNECTION,
+			_("Server unexpectedly disconnected: %s"), g_strerror (errno));
+	} else {
+		while (camel_lite_imap_store_readline (store, &resp, ex) > 0) {
+			tagged = !strncmp (resp, tag, taglen);
+			changed |= push_idle_line (conn, resp);
+			g_free (resp);
+			resp = NULL;
+			if (tagged)
+				break;
+		}
+		g_free (resp);
+	}
+
+	g_free (tag);
+
+	return changed;
+}
+
+static gpointer
+push_thread (gpointer data)
+{
+	struct _CamelImapPushConn *conn = data;
+	CamelException ex = CAMEL_EXCEPTION_INITIALISER;
+	int unseen;
+
+	camel_lite_operation_register (conn->op);
+
+	while (!conn->stop) {
+		if (push_setup (conn, &ex)) {
+			if (conn->notify)
+				push_notify_loop (conn, &ex);
+			else while (!conn->stop && !camel_lite_exception_is_set (&ex)) {
+				gboolean changed = push_poll (conn, &ex);
+
+				if (!camel_lite_exception_is_set (&ex))
+					changed |= push_idle (conn, &ex);
+				if (changed && !camel_lite_exception_is_set (&ex)) {
+					unseen = push_count_unseen (conn, &ex);
+					if (!camel_lite_exception_is_set (&ex))
+						push_report (conn, conn->folders->pdata[0], unseen, conn->messages, -1);
+				}
+			}
+		}
+
+		if (conn->stop)
+			break;
+
+		imap_debug ("Push connection failed: %s\n", camel_lite_exception_get_description (&ex));
+		camel_lite_exception_clear (&ex);
+		camel_lite_service_disconnect (CAMEL_SERVICE (conn->store), FALSE, NULL);
+		_camel_lite_imap_store_wait (conn->store, -1, PUSH_RETRY_TIME * 1000);
+	}
+
+	camel_lite_exception_clear (&ex);
+	camel_lite_service_disconnect (CAMEL_SERVICE (conn->store), FALSE, NULL);
+	camel_lite_operation_unregister (conn->op);
+
+	return NULL;
+}
+
+static struct _CamelImapPushConn *
+push_conn_new (CamelImapStore *store, gboolean notify)
+{
+	struct _CamelImapPushConn *conn;
+	CamelException ex = CAMEL_EXCEPTION_INITIALISER;
+
+	conn = g_new0 (struct _CamelImapPushConn, 1);
+	conn->parent = store;
+	conn->notify = notify;
+	conn->messages = -1;
+	conn->folders = g_ptr_array_new ();
+	conn->mailboxes = g_ptr_array_new ();
+
+	conn->store = CAMEL_IMAP_STORE (camel_lite_object_new (CAMEL_IMAP_STORE_TYPE));
+	camel_lite_service_construct (CAMEL_SERVICE (conn->store),
+		camel_lite_service_get_session (CAMEL_SERVICE (store)),
+		camel_lite_service_get_provider (CAMEL_SERVICE (store)),
+		CAMEL_SERVICE (store)->url, &ex);
+	CAMEL_SERVICE (conn->store)->data = CAMEL_SERVICE (store)->data;
+
+	if (camel_lite_exception_is_set (&ex)) {
+		g_critical ("Severe interal error while trying to construct a new connection\n");
+		camel_lite_exception_clear (&ex);
+		camel_lite_object_unref (conn->store);
+		push_free_names (conn->folders);
+		push_free_names (conn->mailboxes);
+		g_free (conn);
+		return NULL;
+	}
+
+	conn->op = camel_lite_operation_new (NULL, NULL);
+
+	return conn;
+}
+
+static void
+push_conn_add (struct _CamelImapPushConn *conn, const char *folder_name)
+{
+	char *full;
+
+	full = camel_lite_imap_store_summary_full_from_path (conn->parent->summary, folder_name);
+	g_ptr_array_add (conn->mailboxes, camel_lite_utf8_utf7 (full ? full : folder_name));
+	g_ptr_array_add (conn->folders, g_strdup (folder_name));
+	g_free (full);
+}
+
+/* must be called with push_lock held */
+static void
+push_start (CamelImapStore *store)
+{
+	struct _CamelImapPushConn *conn = NULL;
+	gboolean notify;
+	GList *l;
+	guint i;
+
+	if (store->push_conns || store->push_folders == NULL || store->push_folders->len == 0)
+		return;
+
+	notify = (store->capabilities & IMAP_CAPABILITY_NOTIFY) && !store->push_notify_broken;
+	if (!notify && !(store->capabilities & IMAP_CAPABILITY_IDLE))
+		return;
+
+	/* like the get-message connections, leave the summary to us */
+	camel_lite_url_set_param (CAMEL_SERVICE (store)->url, "dont_touch_summary", "yes");
+
+	for (i = 0; i < store->push_folders->len; i++) {
+		if (!notify || conn == NULL) {
+			if (!notify && i >= store->push_size)
+				break;
+			if (!(conn = push_conn_new (store, notify)))
+				break;
+			store->push_conns = g_list_append (store->push_conns, conn);
+		}
+		push_conn_add (conn, store->push_folders->pdata[i]);
+	}
+
+	/* no connection left to IDLE on the others, poll them instead */
+	if (store->push_conns && i < store->push_folders->len) {
+		imap_debug ("No push connection left for %d folders, polling them\n",
+			store->push_folders->len - i);
+		for (l = store->push_conns; i < store->push_folders->len; i++) {
+			push_conn_add (l->data, store->push_folders->pdata[i]);
+			if (!(l = l->next))
+				l = store->push_conns;
+		}
+	}
+
+	for (l = store->push_conns; l; l = l->next) {
+		conn = l->data;
+		conn->thread = g_thread_create (push_thread, conn, TRUE, NULL);
+	}
+}
+
+/* must be called with push_lock held */
+static void
+push_stop (CamelImapStore *store)
+{
+	struct _CamelImapPushConn *conn;
+	GList *l;
+
+	for (l = store->push_conns; l; l = l->next) {
+		conn = l->data;
+		conn->stop = TRUE;
+		camel_lite_operation_cancel (conn->op);
+		_camel_lite_imap_store_wake_idle (conn->store);
+	}
+
+	while (store->push_conns) {
+		conn = store->push_conns->data;
+		if (conn->thread)
+			g_thread_join (conn->thread);
+		camel_lite_operation_unref (conn->op);
+		camel_lite_object_unref (conn->store);
+		push_free_names (conn->folders);
+		push_free_names (conn->mailboxes);
+		g_free (conn);
+		store->push_conns = g_list_delete_link (store->push_conns, store->push_conns);
+	}
+}
+
+static void
+imap_set_push_folders (CamelStore *store, GPtrArray *folder_names)
+{
+	CamelImapStore *imap_store = CAMEL_IMAP_STORE (store);
+	guint i;
+
+	g_mutex_lock (imap_store->push_lock);
+
+	push_stop (imap_store);
+	push_free_names (imap_store->push_folders);
+	imap_store->push_folders = NULL;
+
+	if (folder_names && folder_names->len > 0) {
+		imap_store->push_folders = g_ptr_array_new ();
+		for (i = 0; i < folder_names->len; i++)
+			g_ptr_array_add (imap_store->push_folders, g_strdup (folder_names->pdata[i]));
+	}
+
+	if (imap_store->connected && camel_lite_disco_store_status (CAMEL_DISCO_STORE (store)) == CAMEL_DISCO_STORE_ONLINE)
+		push_start (imap_store);
+
+	g_mutex_unlock (imap_store->push_lock);
+}
+
 void
 _camel_lite_imap_store_connect_unlock_no_start_idle (CamelImapStore *store)
 {
@@ -543,7 +1662,9 @@ camel_lite_imap_store_class_init (CamelImapStoreClass *camel_lite_imap_store_cla
 	camel_lite_store_class->get_trash = imap_get_trash;
 	camel_lite_store_class->get_junk = imap_get_junk;
 	camel_lite_store_class->get_folder_status = imap_get_folder_status;
+	camel_lite_store_class->get_folder_status_many = imap_get_folder_status_many;
 	camel_lite_store_class->restore = imap_restore;
+	camel_lite_store_class->set_push_folders = imap_set_push_folders;
 
 	camel_lite_disco_store_class->can_work_offline = can_work_offline;
 	camel_lite_disco_store_class->connect_online = imap_connect_online;
@@ -572,6 +1693,10 @@ camel_lite_imap_store_finalize (CamelObject *object)
 	CamelDiscoStore *disco = CAMEL_DISCO_STORE (object);
 	CamelException nex = CAMEL_EXCEPTION_INITIALISER;
 
+	g_mutex_lock (imap_store->push_lock);
+	push_stop (imap_store);
+	g_mutex_unlock (imap_store->push_lock);
+
 	let_idle_die (imap_store, TRUE);
 
 	CAMEL_SERVICE_REC_LOCK (imap_store, connect_lock);
@@ -638,9 +1763,29 @@ camel_lite_imap_store_finalize (CamelObject *object)
 	g_free (imap_store->sum_lock);
 	imap_store->sum_lock = NULL;
 
+	while (imap_store->gmsg_conns) {
+		struct _CamelImapGmsgConn *conn = imap_store->gmsg_conns->data;
+
+		if (conn->store) {
+			camel_lite_service_disconnect (CAMEL_SERVICE (conn->store), FALSE, NULL);
+			camel_lite_object_unref (conn->store);
+		}
+		g_free (conn);
+		imap_store->gmsg_conns = g_list_delete_link (imap_store->gmsg_conns, imap_store->gmsg_conns);
+	}
+	g_cond_free (imap_store->gmsg_cond);
+	g_mutex_free (imap_store->gmsg_lock);
+
+	push_free_names (imap_store->push_folders);
+	g_mutex_free (imap_store->push_lock);
+
 	g_free (imap_store->idle_wait_reasons_lock);
 	imap_store->idle_wait_reasons_lock = NULL;
 
+	if (imap_store->idle_wake[0] != -1) {
+		close (imap_store->idle_wake[0]);
+		close (imap_store->idle_wake[1]);
+	}
 }
 
 static void
@@ -676,6 +1821,21 @@ camel_lite_imap_store_init (gpointer object, gpointer klass)
 	imap_store->idle_sleep = IDLE_DEFAULT_SLEEP_TIME * (1000000/IDLE_TICK_TIME);
 	imap_store->getsrv_sleep = 100; /* default of 100s */
 
+	imap_store->gmsg_lock = g_mutex_new ();
+	imap_store->gmsg_cond = g_cond_new ();
+	imap_store->gmsg_conns = NULL;
+	imap_store->gmsg_size = CAMEL_IMAP_GMSG_POOL_SIZE;
+	imap_store->gmsg_reaper = 0;
+	imap_store->gmsg_acquired = 0;
+	imap_store->gmsg_waited = 0;
+	imap_store->gmsg_created = 0;
+
+	imap_store->push_lock = g_mutex_new ();
+	imap_store->push_folders = NULL;
+	imap_store->push_conns = NULL;
+	imap_store->push_size = CAMEL_IMAP_PUSH_POOL_SIZE;
+	imap_store->push_notify_broken = FALSE;
+
 	imap_store->in_idle = FALSE;
 	imap_store->idle_cont = FALSE;
 	imap_store->idle_send_done_happened = FALSE;
@@ -688,6 +1848,18 @@ camel_lite_imap_store_init (gpointer object, gpointer klass)
 
 	imap_store->idle_blocked = TRUE;
 
+	imap_store->idle_wakeups = 0;
+	imap_store->idle_wakeups_io = 0;
+	imap_store->idle_wakeups_stop = 0;
+	imap_store->idle_wakeups_timeout = 0;
+	if (pipe (imap_store->idle_wake) == -1) {
+		g_warning ("Could not create IDLE wake up pipe: %s", g_strerror (errno));
+		imap_store->idle_wake[0] = imap_store->idle_wake[1] = -1;
+	} else {
+		fcntl (imap_store->idle_wake[0], F_SETFL, O_NONBLOCK);
+		fcntl (imap_store->idle_wake[1], F_SETFL, O_NONBLOCK);
+	}
+
 	imap_store->istream = NULL;
 	imap_store->ostream = NULL;
 	imap_store->has_login = FALSE;
@@ -1046,6 +2218,10 @@ static struct {
 	{ "LIST-EXTENDED",	IMAP_CAPABILITY_LISTEXT },
 	{ "COMPRESS=DEFLATE",	IMAP_CAPABILITY_COMPRESS },
 	{ "XAOL-NETMAIL",       IMAP_CAPABILITY_XAOLNETMAIL },
+	{ "SORT",		IMAP_CAPABILITY_SORT },
+	{ "THREAD=REFERENCES",	IMAP_CAPABILITY_THREAD_REFERENCES },
+	{ "NOTIFY",		IMAP_CAPABILITY_NOTIFY },
+	{ "LIST-STATUS",	IMAP_CAPABILITY_LISTSTATUS },
 	{ NULL, 0 }
 };
 
@@ -1602,7 +2778,7 @@ static struct {
 static gboolean
 connect_to_server_wrapper (CamelService *service, CamelException *ex)
 {
-	const char *ssl_mode, *idle_sleep, *getsrv_sleep;
+	const char *ssl_mode, *idle_sleep, *getsrv_sleep, *getsrv_connections, *push_connections;
 	struct addrinfo hints;
 	int mode = -1, ret, i, must_tls = 0;
 	char *serv;
@@ -1637,6 +2813,20 @@ connect_to_server_wrapper (CamelService *service, CamelException *ex)
 			CAMEL_IMAP_STORE (service)->getsrv_sleep = tmp;
 	}
 
+	if ((push_connections = camel_lite_url_get_param (service->url, "push_connections")))
+	{
+		int tmp = atoi (push_connections);
+		if (tmp >= 0)
+			CAMEL_IMAP_STORE (service)->push_size = tmp;
+	}
+
+	if ((getsrv_connections = camel_lite_url_get_param (service->url, "getsrv_connections")))
+	{
+		int tmp = atoi (getsrv_connections);
+		if (tmp > 0)
+			camel_lite_imap_store_set_gmsg_pool (CAMEL_IMAP_STORE (service), tmp, 0);
+	}
+
 	if ((ssl_mode = camel_lite_url_get_param (service->url, "use_ssl"))) {
 		for (i = 0; ssl_options[i].value; i++)
 			if (!strcmp (ssl_options[i].value, ssl_mode))
@@ -2385,6 +3575,12 @@ done:
 
 	store->not_recon = FALSE;
 
+	if (store->got_online) {
+		g_mutex_lock (store->push_lock);
+		push_start (store);
+		g_mutex_unlock (store->push_lock);
+	}
+
 	return store->got_online;
 }
 
@@ -2493,6 +3689,10 @@ imap_disconnect_online (CamelService *service, gboolean clean, CamelException *e
 	}
 
 	if (do_disconnect) {
+		g_mutex_lock (store->push_lock);
+		push_stop (store);
+		g_mutex_unlock (store->push_lock);
+
 		if (clean)
 			let_idle_die (store, TRUE);
 
@@ -2514,20 +3714,7 @@ imap_disconnect_online (CamelService *service, gboolean clean, CamelException *e
 static gboolean
 imap_summary_is_dirty (CamelFolderSummary *summary)
 {
-	CamelImapMessageInfo *info;
-	int max, i;
-	int found = FALSE;
-
-	max = camel_lite_folder_summary_count (summary);
-	for (i = 0; i < max && !found; i++) {
-		info = (CamelImapMessageInfo *)camel_lite_folder_summary_index (summary, i);
-		if (info) {
-			found = info->info.flags & CAMEL_MESSAGE_FOLDER_FLAGGED;
-			camel_lite_message_info_free(info);
-		}
-	}
-
-	return FALSE;
+	return camel_lite_imap_summary_journal_count (summary) > 0;
 }
 
 static void
@@ -2890,12 +4077,11 @@ parse_message_header (char *response)
 
 #endif
 
-static void
-imap_get_folder_status (CamelStore *store, const char *folder_name, int *unseen, int *messages, int *uidnext)
+/* The counts in the folder's summary file, returns FALSE if the
+   unread count wasn't there */
+static gboolean
+get_folder_status_cached (CamelImapStore *imap_store, const char *folder_name, int *unseen, int *messages, int *uidnext)
 {
-	CamelImapStore *imap_store = CAMEL_IMAP_STORE (store);
-	struct imap_status_item *items, *item;
-	CamelException ex = CAMEL_EXCEPTION_INITIALISER;
 	char *storage_path = g_strdup_printf("%s/folders", imap_store->storage_path);
 	char *folder_dir = imap_path_to_physical (storage_path, folder_name);
 	gchar *spath = g_strdup_printf ("%s/summary.mmap", folder_dir);
@@ -2919,6 +4105,19 @@ imap_get_folder_status (CamelStore *store, const char *folder_name, int *unseen,
 	g_free (storage_path);
 	g_free (folder_dir);
 
+	return munread_count != -1;
+}
+
+static void
+imap_get_folder_status (CamelStore *store, const char *folder_name, int *unseen, int *messages, int *uidnext)
+{
+	CamelImapStore *imap_store = CAMEL_IMAP_STORE (store);
+	struct imap_status_item *items, *item;
+	CamelException ex = CAMEL_EXCEPTION_INITIALISER;
+	gboolean cached;
+
+	cached = get_folder_status_cached (imap_store, folder_name, unseen, messages, uidnext);
+
 	if (!camel_lite_disco_store_check_online (CAMEL_DISCO_STORE (imap_store), &ex))
 		return;
 
@@ -2933,10 +4132,10 @@ imap_get_folder_status (CamelStore *store, const char *folder_name, int *unseen,
 
 	if (item == NULL) /* Fallback situation for bizare servers */ {
 		item = items = get_folder_status (imap_store, folder_name, "MESSAGES", FALSE);
-		if (munread_count == -1)
+		if (!cached) {
 			*unseen = 0;
-		if (mnextuid == -1)
 			*uidnext = 0;
+		}
 	}
 
 	while (item != NULL) {
@@ -2956,6 +4155,182 @@ imap_get_folder_status (CamelStore *store, const char *folder_name, int *unseen,
 	return;
 }
 
+/* Mailbox names are case sensitive apart from INBOX */
+static char *
+status_mailbox_key (const char *mailbox)
+{
+	if (!g_ascii_strcasecmp (mailbox, "INBOX"))
+		return g_strdup ("INBOX");
+
+	return g_strdup (mailbox);
+}
+
+/* Folders are asked about in pipelined batches of this many commands,
+   with LIST-STATUS each command asks about LIST_STATUS_BATCH folders */
+#define STATUS_PIPELINE_DEPTH 32
+#define LIST_STATUS_BATCH 64
+
+static void
+imap_get_folder_status_many (CamelStore *store, CamelStoreFolderStatus *statuses, int count)
+{
+	CamelImapStore *imap_store = CAMEL_IMAP_STORE (store);
+	CamelStoreSummary *s = (CamelStoreSummary *) imap_store->summary;
+	CamelException ex = CAMEL_EXCEPTION_INITIALISER;
+	GPtrArray *cmds, *responses;
+	GHashTable *wanted;
+	GString *list = NULL;
+	gboolean list_status, touched = FALSE;
+	int i, j, k, queued = 0, done;
+
+	for (i = 0; i < count; i++)
+		get_folder_status_cached (imap_store, statuses[i].folder_name,
+			&statuses[i].unseen, &statuses[i].messages, &statuses[i].uidnext);
+
+	if (!camel_lite_disco_store_check_online (CAMEL_DISCO_STORE (imap_store), &ex)) {
+		camel_lite_exception_clear (&ex);
+		return;
+	}
+
+	if (!(imap_store->capabilities & (IMAP_CAPABILITY_STATUS | IMAP_CAPABILITY_LISTSTATUS)))
+		return;
+
+	/* RFC 5819, the counts come as STATUS responses to the LIST */
+	list_status = (imap_store->capabilities & IMAP_CAPABILITY_LISTSTATUS) != 0;
+
+	camel_lite_imap_store_stop_idle_connect_lock (imap_store);
+
+	wanted = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	cmds = g_ptr_array_new ();
+
+	for (i = 0; i < count; i++) {
+		char *full, *mailbox, *quoted;
+		gboolean noselect = FALSE;
+
+		if (s) {
+			CamelStoreInfo *si = camel_lite_store_summary_path (s, statuses[i].folder_name);
+			if (si) {
+				if (si->flags & CAMEL_FOLDER_NOSELECT)
+					noselect = TRUE;
+				camel_lite_store_summary_info_free (s, si);
+			}
+		}
+		if (noselect)
+			continue;
+
+		full = camel_lite_imap_store_summary_full_from_path (imap_store->summary, statuses[i].folder_name);
+		mailbox = camel_lite_utf8_utf7 (full ? full : statuses[i].folder_name);
+		g_free (full);
+
+		g_hash_table_insert (wanted, status_mailbox_key (mailbox), &statuses[i]);
+		quoted = imap_quote_string (mailbox);
+		g_free (mailbox);
+
+		if (list_status) {
+			if (list == NULL)
+				list = g_string_new ("LIST \"\" (");
+			else
+				g_string_append_c (list, ' ');
+			g_string_append (list, quoted);
+			if (++queued == LIST_STATUS_BATCH) {
+				g_string_append (list, ") RETURN (STATUS (MESSAGES UNSEEN UIDNEXT))");
+				g_ptr_array_add (cmds, g_string_free (list, FALSE));
+				list = NULL;
+				queued = 0;
+			}
+		} else
+			g_ptr_array_add (cmds, g_strdup_printf ("STATUS %s (MESSAGES UNSEEN UIDNEXT)", quoted));
+
+		g_free (quoted);
+	}
+
+	if (list) {
+		g_string_append (list, ") RETURN (STATUS (MESSAGES UNSEEN UIDNEXT))");
+		g_ptr_array_add (cmds, g_string_free (list, FALSE));
+	}
+
+	done = 0;
+	while (done < cmds->len && !camel_lite_exception_is_set (&ex)) {
+		GPtrArray *batch = g_ptr_array_new ();
+
+		for (k = 0; k < STATUS_PIPELINE_DEPTH && done + k < cmds->len; k++)
+			g_ptr_array_add (batch, cmds->pdata[done + k]);
+
+		responses = camel_lite_imap_command_pipeline (imap_store, NULL, batch, &ex);
+
+		for (k = 0; k < batch->len; k++) {
+			CamelImapResponse *response = responses->pdata[k];
+
+			if (!response)
+				continue;
+
+			for (j = 0; j < response->untagged->len; j++) {
+				int unseen = -1, messages = -1, uidnext = -1;
+				CamelStoreFolderStatus *status;
+				char *mailbox, *key;
+
+				mailbox = parse_status_response (response->untagged->pdata[j], &unseen, &messages, &uidnext);
+				if (!mailbox)
+					continue;
+
+				key = status_mailbox_key (mailbox);
+				if ((status = g_hash_table_lookup (wanted, key))) {
+					if (unseen != -1)
+						status->unseen = unseen;
+					if (messages != -1)
+						status->messages = messages;
+					if (uidnext != -1)
+						status->uidnext = uidnext;
+				}
+				g_free (key);
+				g_free (mailbox);
+			}
+
+			camel_lite_imap_response_free (imap_store, response);
+		}
+
+		done += batch->len;
+		g_ptr_array_free (responses, TRUE);
+		g_ptr_array_free (batch, TRUE);
+
+		/* A folder the server refused keeps its cached counts, the
+		 * others are still asked about */
+		if (camel_lite_exception_get_id (&ex) == CAMEL_EXCEPTION_SERVICE_PROTOCOL)
+			camel_lite_exception_clear (&ex);
+	}
+	camel_lite_exception_clear (&ex);
+
+	/* Remember the counts for when we're offline, saving once */
+	if (s) {
+		for (i = 0; i < count; i++) {
+			CamelStoreInfo *si;
+
+			if (statuses[i].messages == -1 || statuses[i].unseen == -1)
+				continue;
+			si = camel_lite_store_summary_path (s, statuses[i].folder_name);
+			if (si) {
+				if (si->unread != (guint32) statuses[i].unseen || si->total != (guint32) statuses[i].messages) {
+					si->unread = statuses[i].unseen;
+					si->total = statuses[i].messages;
+					touched = TRUE;
+				}
+				camel_lite_store_summary_info_free (s, si);
+			}
+		}
+		if (touched) {
+			camel_lite_store_summary_touch (s);
+			camel_lite_store_summary_save (s, &ex);
+			camel_lite_exception_clear (&ex);
+		}
+	}
+
+	for (i = 0; i < cmds->len; i++)
+		g_free (cmds->pdata[i]);
+	g_ptr_array_free (cmds, TRUE);
+	g_hash_table_destroy (wanted);
+
+	camel_lite_imap_store_connect_unlock_start_idle (imap_store);
+}
+
 static CamelFolder *
 get_folder_online (CamelStore *store, const char *folder_name, guint32 flags, CamelException *ex)
 {
@@ -128,6 +128,10 @@ typedef enum {
 #define IMAP_CAPABILITY_LISTEXT			(1 << 19)
 #define IMAP_CAPABILITY_COMPRESS		(1 << 20)
 #define IMAP_CAPABILITY_XAOLNETMAIL             (1 << 21)
+#define IMAP_CAPABILITY_SORT			(1 << 22)
+#define IMAP_CAPABILITY_THREAD_REFERENCES	(1 << 23)
+#define IMAP_CAPABILITY_NOTIFY			(1 << 24)
+#define IMAP_CAPABILITY_LISTSTATUS		(1 << 25)
 
 #define IMAP_PARAM_OVERRIDE_NAMESPACE		(1 << 0)
 #define IMAP_PARAM_CHECK_ALL			(1 << 1)
@@ -185,9 +189,45 @@ struct _CamelImapStore {
 
 	gboolean idle_blocked;
 
+	/* the IDLE thread waits in poll() on the socket and this pipe,
+	 * other threads write to it to make it stop */
+	int idle_wake[2];
+	guint idle_wakeups, idle_wakeups_io, idle_wakeups_stop, idle_wakeups_timeout;
+
 	struct addrinfo *addrinfo;
+
+	/* pool of secondary connections for fetching messages and parts */
+	GMutex *gmsg_lock;
+	GCond *gmsg_cond;
+	GList *gmsg_conns;
+	guint gmsg_size, gmsg_reaper;
+	guint gmsg_acquired, gmsg_waited, gmsg_created;
+
+	/* connections pushing changes in folders other than the selected one */
+	GMutex *push_lock;
+	GPtrArray *push_folders;
+	GList *push_conns;
+	guint push_size;
+	gboolean push_notify_broken;
 };
 
+typedef struct {
+	guint size;		/* most connections the pool opens */
+	guint idle_timeout;	/* seconds an unused connection is kept */
+	guint connections;	/* connections open or being opened */
+	guint busy;		/* connections in use */
+	guint acquired;		/* times a connection was handed out */
+	guint waited;		/* times a request had to wait for one */
+	guint created;		/* connections opened */
+} CamelImapGmsgStats;
+
+typedef struct {
+	guint wakeups;		/* times the IDLE thread woke up */
+	guint io;		/* of which because the server sent something */
+	guint stop;		/* of which because it was asked to stop */
+	guint timeout;		/* of which to re-issue IDLE, or to retry a busy connection */
+} CamelImapIdleStats;
+
 typedef struct {
 	CamelDiscoStoreClass parent_class;
 
@@ -215,6 +255,10 @@ void _camel_lite_imap_store_start_idle_if_unlocked (CamelImapStore *store);
 void _camel_lite_imap_store_connect_unlock_no_start_idle (CamelImapStore *store);
 void camel_lite_imap_recon (CamelImapStore *store, CamelException *mex, gboolean was_cancel);
 
+void camel_lite_imap_store_set_gmsg_pool (CamelImapStore *store, guint size, guint idle_timeout);
+void camel_lite_imap_store_get_gmsg_stats (CamelImapStore *store, CamelImapGmsgStats *stats);
+void camel_lite_imap_store_get_idle_stats (CamelImapStore *store, CamelImapIdleStats *stats);
+
 #define camel_lite_imap_store_stop_idle_connect_lock(store) {idle_debug ("Thread %d StopIdle-ConnectLock(%x) %s:%d\n", (gint) g_thread_self (), (gint) store, __FUNCTION__, (gint) __LINE__);  _camel_lite_imap_store_stop_idle_connect_lock((store));}
 #define camel_lite_imap_store_connect_unlock_start_idle(store) {idle_debug ("Thread %d ConnectUnlock-StartIdle(%x) %s:%d\n", (gint) g_thread_self (), (gint) store, __FUNCTION__, (gint) __LINE__);  _camel_lite_imap_store_connect_unlock_start_idle((store));}
 #define camel_lite_imap_store_start_idle_if_unlocked(store) {idle_debug ("Thread %d StartIdle-IfUnlocked(%x) %s:%d\n", (gint) g_thread_self (), (gint) store, __FUNCTION__, (gint) __LINE__);  _camel_lite_imap_store_start_idle_if_unlocked((store));}
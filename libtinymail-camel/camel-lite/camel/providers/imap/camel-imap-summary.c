@@ -47,12 +47,14 @@ static CamelMessageInfo *message_info_load (CamelFolderSummary *s, gboolean *mus
 static int message_info_save (CamelFolderSummary *s, FILE *out,
 			      CamelMessageInfo *info);
 static gboolean info_set_user_tag(CamelMessageInfo *info, const char *name, const char  *value);
+static gboolean info_set_flags(CamelMessageInfo *info, guint32 flags, guint32 set);
 static CamelMessageContentInfo *content_info_load (CamelFolderSummary *s);
 static int content_info_save (CamelFolderSummary *s, FILE *out,
 			      CamelMessageContentInfo *info);
 
 static void camel_lite_imap_summary_class_init (CamelImapSummaryClass *klass);
 static void camel_lite_imap_summary_init       (CamelImapSummary *obj);
+static void camel_lite_imap_summary_finalize   (CamelObject *obj);
 
 static CamelFolderSummaryClass *camel_lite_imap_summary_parent;
 
@@ -69,7 +71,7 @@ camel_lite_imap_summary_get_type (void)
 			(CamelObjectClassInitFunc) camel_lite_imap_summary_class_init,
 			NULL,
 			(CamelObjectInitFunc) camel_lite_imap_summary_init,
-			NULL);
+			(CamelObjectFinalizeFunc) camel_lite_imap_summary_finalize);
 	}
 
 	return type;
@@ -107,6 +109,7 @@ camel_lite_imap_summary_class_init (CamelImapSummaryClass *klass)
 	cfs_class->content_info_save = content_info_save;
 
 	cfs_class->info_set_user_tag = info_set_user_tag;
+	cfs_class->info_set_flags = info_set_flags;
 }
 
 static void
@@ -119,6 +122,12 @@ camel_lite_imap_summary_set_extra_flags (CamelFolder *folder, CamelMessageInfoBa
 	}
 }
 
+static void
+journal_delta_free (gpointer data)
+{
+	g_slice_free (CamelImapFlagDelta, data);
+}
+
 static void
 camel_lite_imap_summary_init (CamelImapSummary *obj)
 {
@@ -128,6 +137,18 @@ camel_lite_imap_summary_init (CamelImapSummary *obj)
 	/* subclasses need to set the right instance data sizes */
 	s->message_info_size = sizeof(CamelImapMessageInfo);
 	s->content_info_size = sizeof(CamelImapMessageContentInfo);
+
+	obj->journal = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, journal_delta_free);
+	obj->journal_lock = g_mutex_new ();
+}
+
+static void
+camel_lite_imap_summary_finalize (CamelObject *obj)
+{
+	CamelImapSummary *ims = (CamelImapSummary *)obj;
+
+	g_hash_table_destroy (ims->journal);
+	g_mutex_free (ims->journal_lock);
 }
 
 /**
@@ -233,6 +254,13 @@ message_info_load (CamelFolderSummary *s, gboolean *must_add)
 		ptrchr = camel_lite_file_util_mmap_decode_uint32 (ptrchr, &iinfo->server_flags, FALSE);
 		s->filepos = ptrchr;
 		label_to_flags(iinfo);
+
+		/* The journal isn't saved, rebuild it from the messages
+		 * which still had changes to store */
+		if (iinfo->info.flags & CAMEL_MESSAGE_FOLDER_FLAGGED)
+			camel_lite_imap_summary_journal_record (s, camel_lite_message_info_uid (info),
+				iinfo->info.flags & ~(iinfo->server_flags | CAMEL_MESSAGE_FOLDER_FLAGGED),
+				iinfo->server_flags & ~iinfo->info.flags);
 	}
 
 	return info;
@@ -252,12 +280,39 @@ message_info_save (CamelFolderSummary *s, FILE *out, CamelMessageInfo *info)
 static gboolean
 info_set_user_tag(CamelMessageInfo *info, const char *name, const char  *value)
 {
+	CamelMessageInfoBase *mi = (CamelMessageInfoBase *)info;
+	guint32 old;
 	int res;
 
 	res = camel_lite_imap_summary_parent->info_set_user_tag(info, name, value);
 
-	if (!strcmp(name, "label"))
+	if (!strcmp(name, "label")) {
+		old = mi->flags;
 		label_to_flags((CamelImapMessageInfo *)info);
+		if (old != mi->flags && mi->summary && mi->uid)
+			camel_lite_imap_summary_journal_record (mi->summary, mi->uid,
+				mi->flags & ~old & CAMEL_IMAP_MESSAGE_LABEL_MASK,
+				old & ~mi->flags & CAMEL_IMAP_MESSAGE_LABEL_MASK);
+	}
+
+	return res;
+}
+
+static gboolean
+info_set_flags(CamelMessageInfo *info, guint32 flags, guint32 set)
+{
+	CamelMessageInfoBase *mi = (CamelMessageInfoBase *)info;
+	guint32 old = mi->flags, changed;
+	gboolean res;
+
+	res = camel_lite_imap_summary_parent->info_set_flags(info, flags, set);
+
+	/* only what the server keeps goes in the journal, local flags
+	   such as ATTACHMENTS or SECURE never have to be replayed */
+	changed = (old ^ mi->flags) & (CAMEL_IMAP_SERVER_FLAGS | CAMEL_IMAP_MESSAGE_LABEL_MASK);
+	if (changed && mi->summary && mi->uid)
+		camel_lite_imap_summary_journal_record (mi->summary, mi->uid,
+			mi->flags & changed, old & changed);
 
 	return res;
 }
@@ -341,3 +396,128 @@ camel_lite_imap_summary_add_offline_uncached (CamelFolderSummary *summary, const
 
 	camel_lite_folder_summary_add (summary, (CamelMessageInfo *)mi);
 }
+
+
+/* The journal keeps the flag changes made locally per uid, so that a
+   sync only has to look at the messages which changed, rather than
+   at the whole summary.  The CAMEL_MESSAGE_FOLDER_FLAGGED flag of the
+   messages is still kept, as that's what is saved. */
+
+/**
+ * camel_lite_imap_summary_journal_record:
+ * @summary: a #CamelImapSummary
+ * @uid: uid of the message that changed
+ * @added: flags that got set
+ * @removed: flags that got unset
+ *
+ * Record a local flag change, merging it with what is recorded for
+ * @uid already.
+ **/
+void
+camel_lite_imap_summary_journal_record (CamelFolderSummary *summary, const char *uid,
+				   guint32 added, guint32 removed)
+{
+	CamelImapSummary *ims = (CamelImapSummary *)summary;
+	CamelImapFlagDelta *delta;
+
+	g_mutex_lock (ims->journal_lock);
+	if (!(delta = g_hash_table_lookup (ims->journal, uid))) {
+		delta = g_slice_new0 (CamelImapFlagDelta);
+		g_hash_table_insert (ims->journal, g_strdup (uid), delta);
+	}
+	delta->added = (delta->added & ~removed) | added;
+	delta->removed = (delta->removed & ~added) | removed;
+	g_mutex_unlock (ims->journal_lock);
+}
+
+/**
+ * camel_lite_imap_summary_journal_restore:
+ * @summary: a #CamelImapSummary
+ * @uid: uid of the message
+ * @delta: changes taken with camel_lite_imap_summary_journal_steal()
+ *
+ * Put back changes which couldn't be stored on the server. Changes
+ * recorded for @uid in the mean time take precedence.
+ **/
+void
+camel_lite_imap_summary_journal_restore (CamelFolderSummary *summary, const char *uid,
+				    const CamelImapFlagDelta *delta)
+{
+	CamelImapSummary *ims = (CamelImapSummary *)summary;
+	CamelImapFlagDelta *newer;
+
+	g_mutex_lock (ims->journal_lock);
+	if ((newer = g_hash_table_lookup (ims->journal, uid))) {
+		guint32 added = newer->added, removed = newer->removed;
+
+		newer->added = (delta->added & ~removed) | added;
+		newer->removed = (delta->removed & ~added) | removed;
+	} else {
+		newer = g_slice_new (CamelImapFlagDelta);
+		*newer = *delta;
+		g_hash_table_insert (ims->journal, g_strdup (uid), newer);
+	}
+	g_mutex_unlock (ims->journal_lock);
+}
+
+/**
+ * camel_lite_imap_summary_journal_steal:
+ * @summary: a #CamelImapSummary
+ *
+ * Take all recorded changes, leaving the journal empty.
+ *
+ * Return value: A #GHashTable of uid -> #CamelImapFlagDelta, free it
+ * with g_hash_table_destroy().
+ **/
+GHashTable *
+camel_lite_imap_summary_journal_steal (CamelFolderSummary *summary)
+{
+	CamelImapSummary *ims = (CamelImapSummary *)summary;
+	GHashTable *journal;
+
+	g_mutex_lock (ims->journal_lock);
+	journal = ims->journal;
+	ims->journal = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, journal_delta_free);
+	g_mutex_unlock (ims->journal_lock);
+
+	return journal;
+}
+
+/**
+ * camel_lite_imap_summary_journal_has:
+ * @summary: a #CamelImapSummary
+ * @uid: a message uid
+ *
+ * Return value: Whether changes to @uid are recorded.
+ **/
+gboolean
+camel_lite_imap_summary_journal_has (CamelFolderSummary *summary, const char *uid)
+{
+	CamelImapSummary *ims = (CamelImapSummary *)summary;
+	gboolean retval;
+
+	g_mutex_lock (ims->journal_lock);
+	retval = g_hash_table_lookup (ims->journal, uid) != NULL;
+	g_mutex_unlock (ims->journal_lock);
+
+	return retval;
+}
+
+/**
+ * camel_lite_imap_summary_journal_count:
+ * @summary: a #CamelImapSummary
+ *
+ * Return value: The number of messages with changes recorded.
+ **/
+guint
+camel_lite_imap_summary_journal_count (CamelFolderSummary *summary)
+{
+	CamelImapSummary *ims = (CamelImapSummary *)summary;
+	guint retval;
+
+	g_mutex_lock (ims->journal_lock);
+	retval = g_hash_table_size (ims->journal);
+	g_mutex_unlock (ims->journal_lock);
+
+	return retval;
+}
@@ -67,11 +67,21 @@ typedef struct _CamelImapMessageInfo {
 	guint32 server_flags;
 } CamelImapMessageInfo;
 
+/* A flag change made locally and not yet stored on the server */
+typedef struct _CamelImapFlagDelta {
+	guint32 added;
+	guint32 removed;
+} CamelImapFlagDelta;
+
 struct _CamelImapSummary {
 	CamelFolderSummary parent;
 
 	guint32 version;
 	guint32 validity;
+
+	/* uid -> CamelImapFlagDelta, see camel_lite_imap_summary_journal_record() */
+	GHashTable *journal;
+	GMutex *journal_lock;
 };
 
 struct _CamelImapSummaryClass {
@@ -91,6 +101,14 @@ void camel_lite_imap_summary_add_offline_uncached (CamelFolderSummary *summary,
 					      const char *uid,
 					      const CamelMessageInfo *info);
 
+void camel_lite_imap_summary_journal_record (CamelFolderSummary *summary, const char *uid,
+					guint32 added, guint32 removed);
+void camel_lite_imap_summary_journal_restore (CamelFolderSummary *summary, const char *uid,
+					 const CamelImapFlagDelta *delta);
+GHashTable *camel_lite_imap_summary_journal_steal (CamelFolderSummary *summary);
+gboolean camel_lite_imap_summary_journal_has (CamelFolderSummary *summary, const char *uid);
+guint camel_lite_imap_summary_journal_count (CamelFolderSummary *summary);
+
 G_END_DECLS
 
 #endif /* ! _CAMEL_IMAP_SUMMARY_H */
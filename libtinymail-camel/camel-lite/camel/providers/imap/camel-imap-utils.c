@@ -41,6 +41,7 @@
 #include "camel-string-utils.h"
 #include "camel-utf8.h"
 
+#include "camel-imap-folder.h"
 #include "camel-imap-store.h"
 #include "camel-imap-summary.h"
 #include "camel-imap-utils.h"
@@ -539,6 +540,46 @@ imap_label_to_flags(CamelMessageInfo *info)
 	return flags;
 }
 
+/**
+ * imap_parse_flag:
+ * @flag: a flag from a FLAGS list, not necessarily NUL terminated
+ * @len: its length
+ *
+ * Return value: the Camel flag bits @flag stands for, 0 if it isn't
+ * one we know of.
+ **/
+guint32
+imap_parse_flag (const char *flag, int len)
+{
+	if (!g_ascii_strncasecmp (flag, "\\Answered", len))
+		return CAMEL_MESSAGE_ANSWERED;
+	else if (!g_ascii_strncasecmp (flag, "\\Deleted", len))
+		return CAMEL_MESSAGE_DELETED;
+	else if (!g_ascii_strncasecmp (flag, "\\Draft", len))
+		return CAMEL_MESSAGE_DRAFT;
+	else if (!g_ascii_strncasecmp (flag, "\\Flagged", len))
+		return CAMEL_MESSAGE_FLAGGED;
+	else if (!g_ascii_strncasecmp (flag, "\\Seen", len))
+		return CAMEL_MESSAGE_SEEN;
+	else if (!g_ascii_strncasecmp (flag, "\\Recent", len))
+		return CAMEL_IMAP_MESSAGE_RECENT;
+	else if (!g_ascii_strncasecmp(flag, "\\*", len))
+		return CAMEL_MESSAGE_USER|CAMEL_IMAP_MESSAGE_LABEL_MASK;
+
+	else if (!g_ascii_strncasecmp(flag, "$Label1", len))
+		return CAMEL_IMAP_MESSAGE_LABEL1;
+	else if (!g_ascii_strncasecmp(flag, "$Label2", len))
+		return CAMEL_IMAP_MESSAGE_LABEL2;
+	else if (!g_ascii_strncasecmp(flag, "$Label3", len))
+		return CAMEL_IMAP_MESSAGE_LABEL3;
+	else if (!g_ascii_strncasecmp(flag, "$Label4", len))
+		return CAMEL_IMAP_MESSAGE_LABEL4;
+	else if (!g_ascii_strncasecmp(flag, "$Label5", len))
+		return CAMEL_IMAP_MESSAGE_LABEL5;
+
+	return 0;
+}
+
 guint32
 imap_parse_flag_list (char **flag_list_p)
 {
@@ -553,32 +594,7 @@ imap_parse_flag_list (char **flag_list_p)
 
 	while (*flag_list && *flag_list != ')') {
 		len = strcspn (flag_list, " )");
-		if (!g_ascii_strncasecmp (flag_list, "\\Answered", len))
-			flags |= CAMEL_MESSAGE_ANSWERED;
-		else if (!g_ascii_strncasecmp (flag_list, "\\Deleted", len))
-			flags |= CAMEL_MESSAGE_DELETED;
-		else if (!g_ascii_strncasecmp (flag_list, "\\Draft", len))
-			flags |= CAMEL_MESSAGE_DRAFT;
-		else if (!g_ascii_strncasecmp (flag_list, "\\Flagged", len))
-			flags |= CAMEL_MESSAGE_FLAGGED;
-		else if (!g_ascii_strncasecmp (flag_list, "\\Seen", len))
-			flags |= CAMEL_MESSAGE_SEEN;
-		else if (!g_ascii_strncasecmp (flag_list, "\\Recent", len))
-			flags |= CAMEL_IMAP_MESSAGE_RECENT;
-		else if (!g_ascii_strncasecmp(flag_list, "\\*", len))
-			flags |= CAMEL_MESSAGE_USER|CAMEL_IMAP_MESSAGE_LABEL_MASK;
-
-		else if (!g_ascii_strncasecmp(flag_list, "$Label1", len))
-			flags |= CAMEL_IMAP_MESSAGE_LABEL1;
-		else if (!g_ascii_strncasecmp(flag_list, "$Label2", len))
-			flags |= CAMEL_IMAP_MESSAGE_LABEL2;
-		else if (!g_ascii_strncasecmp(flag_list, "$Label3", len))
-			flags |= CAMEL_IMAP_MESSAGE_LABEL3;
-		else if (!g_ascii_strncasecmp(flag_list, "$Label4", len))
-			flags |= CAMEL_IMAP_MESSAGE_LABEL4;
-		else if (!g_ascii_strncasecmp(flag_list, "$Label5", len))
-			flags |= CAMEL_IMAP_MESSAGE_LABEL5;
-
+		flags |= imap_parse_flag (flag_list, len);
 
 		flag_list += len;
 		if (*flag_list == ' ')
@@ -1313,6 +1329,173 @@ imap_uid_array_free (GPtrArray *arr)
 	g_ptr_array_free (arr, TRUE);
 }
 
+/**
+ * imap_parse_esearch_response:
+ * @response: an untagged ESEARCH response
+ * @min: return location for the MIN result
+ * @max: return location for the MAX result
+ * @count: return location for the COUNT result
+ * @all: return location for the ALL result
+ *
+ * Parses the return data of an RFC 4731 ESEARCH response.  Items the
+ * server didn't return are left alone, so the caller should set them
+ * to something sensible first.  @all is set to a copy of the uid set
+ * exactly as the server sent it, which the caller must free.
+ *
+ * Return value: %FALSE if @response isn't an ESEARCH response
+ **/
+gboolean
+imap_parse_esearch_response (const char *response, guint32 *min, guint32 *max, guint32 *count, char **all)
+{
+	const char *p = response, *end;
+
+	if (*p == '*')
+		p = imap_next_word (p);
+	if (g_ascii_strncasecmp (p, "ESEARCH", 7) != 0 || (p[7] != ' ' && p[7] != '\0'))
+		return FALSE;
+	p = imap_next_word (p);
+
+	/* the search correlator, we only ever have one search running */
+	if (*p == '(') {
+		imap_skip_list (&p);
+		if (!p)
+			return FALSE;
+		while (*p == ' ')
+			p++;
+	}
+
+	if (!g_ascii_strncasecmp (p, "UID", 3) && (p[3] == ' ' || p[3] == '\0'))
+		p = imap_next_word (p);
+
+	while (*p) {
+		end = imap_next_word (p);
+		if (!g_ascii_strncasecmp (p, "MIN ", 4))
+			*min = strtoul (end, NULL, 10);
+		else if (!g_ascii_strncasecmp (p, "MAX ", 4))
+			*max = strtoul (end, NULL, 10);
+		else if (!g_ascii_strncasecmp (p, "COUNT ", 6))
+			*count = strtoul (end, NULL, 10);
+		else if (!g_ascii_strncasecmp (p, "ALL ", 4)) {
+			p = end;
+			while (*end && *end != ' ')
+				end++;
+			g_free (*all);
+			*all = g_strndup (p, end - p);
+		}
+		p = imap_next_word (end);
+	}
+
+	return TRUE;
+}
+
+/* the server nests a list for each branch of a thread, don't let a
+   bogus response run us out of stack */
+#define THREAD_MAX_DEPTH 512
+
+static gboolean
+thread_parse_list (const char **in, CamelImapThreadNode **tree, int depth)
+{
+	CamelImapThreadNode *head = NULL, *last = NULL, *node, **tail = NULL;
+	const char *p = *in;
+	char *end;
+
+	if (depth > THREAD_MAX_DEPTH)
+		goto lose;
+
+	/* called just past the opening parenthesis.  A run of numbers
+	   is a chain of replies, the lists after it are the branches
+	   hanging off its last message */
+	while (*p && *p != ')') {
+		if (*p == ' ') {
+			p++;
+		} else if (*p == '(') {
+			p++;
+			if (!thread_parse_list (&p, &node, depth + 1))
+				goto lose;
+			if (!node)
+				continue;
+			if (last == NULL) {
+				/* siblings whose parent the server doesn't have */
+				head = last = g_new0 (CamelImapThreadNode, 1);
+				tail = &last->child;
+			}
+			*tail = node;
+			tail = &node->next;
+		} else if (isdigit ((unsigned char) *p)) {
+			if (last && last->child)
+				goto lose;
+			node = g_new0 (CamelImapThreadNode, 1);
+			node->uid = strtoul (p, &end, 10);
+			p = end;
+			if (last)
+				last->child = node;
+			else
+				head = node;
+			last = node;
+			tail = &node->child;
+		} else
+			goto lose;
+	}
+
+	if (*p != ')')
+		goto lose;
+
+	*in = p + 1;
+	*tree = head;
+
+	return TRUE;
+
+ lose:
+	camel_lite_imap_thread_free (head);
+	*tree = NULL;
+
+	return FALSE;
+}
+
+/**
+ * imap_parse_thread_response:
+ * @response: an untagged THREAD response
+ * @tree: return location for the threads
+ *
+ * Parses an RFC 5256 THREAD response into a tree of uids, as described
+ * for camel_lite_imap_folder_thread().
+ *
+ * Return value: %FALSE if @response is not a valid THREAD response, in
+ * which case @tree is set to %NULL
+ **/
+gboolean
+imap_parse_thread_response (const char *response, CamelImapThreadNode **tree)
+{
+	CamelImapThreadNode *node, **tail = tree;
+	const char *p = response;
+
+	*tree = NULL;
+
+	if (*p == '*')
+		p = imap_next_word (p);
+	if (g_ascii_strncasecmp (p, "THREAD", 6) != 0 || (p[6] != ' ' && p[6] != '\0'))
+		return FALSE;
+	p += 6;
+	while (*p == ' ')
+		p++;
+	while (*p == '(') {
+		p++;
+		if (!thread_parse_list (&p, &node, 0)) {
+			camel_lite_imap_thread_free (*tree);
+			*tree = NULL;
+			return FALSE;
+		}
+		if (node) {
+			*tail = node;
+			tail = &node->next;
+		}
+		while (*p == ' ')
+			p++;
+	}
+
+	return *p == '\0';
+}
+
 char *
 imap_concat (CamelImapStore *imap_store, const char *prefix, const char *suffix)
 {
@@ -55,6 +55,7 @@ char   **imap_parse_folder_name    (CamelImapStore *store, const char *folder_na
 guint32 imap_label_to_flags(CamelMessageInfo *info);
 char    *imap_create_flag_list     (guint32 flags);
 guint32  imap_parse_flag_list      (char **flag_list);
+guint32  imap_parse_flag           (const char *flag, int len);
 
 
 enum { IMAP_STRING, IMAP_NSTRING, IMAP_ASTRING };
@@ -80,6 +81,10 @@ char    *imap_uid_array_to_set     (CamelFolderSummary *summary, GPtrArray *uids
 GPtrArray *imap_uid_set_to_array   (CamelFolderSummary *summary, const char *uids);
 void     imap_uid_array_free       (GPtrArray *arr);
 
+gboolean imap_parse_esearch_response (const char *response, guint32 *min, guint32 *max,
+				      guint32 *count, char **all);
+gboolean imap_parse_thread_response  (const char *response, struct _CamelImapThreadNode **tree);
+
 char *imap_concat (CamelImapStore *imap_store, const char *prefix, const char *suffix);
 char *imap_namespace_concat (CamelImapStore *store, const char *name);
 
@@ -0,0 +1,194 @@
+/* Checks the THREAD and ESEARCH response parsers against the examples
+   of RFC 5256 and RFC 4731, and the response tokenizer */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include "camel-stream-buffer.h"
+#include "camel-stream-mem.h"
+
+#include "camel-imap-command.h"
+#include "camel-imap-folder.h"
+#include "camel-imap-utils.h"
+
+static int failed = 0;
+
+#define check(expr) \
+	do { if (!(expr)) { printf ("%s:%d: %s failed\n", __FILE__, __LINE__, #expr); failed++; } } while (0)
+
+/* prints a tree the way the server sent it, minus the outer lists */
+static void
+thread_to_string (CamelImapThreadNode *node, GString *out)
+{
+	for (; node; node = node->next) {
+		g_string_append_c (out, '(');
+		g_string_append_printf (out, "%u", node->uid);
+		if (node->child) {
+			g_string_append_c (out, ' ');
+			thread_to_string (node->child, out);
+		}
+		g_string_append_c (out, ')');
+	}
+}
+
+static char *
+parse_thread (const char *response)
+{
+	CamelImapThreadNode *tree;
+	GString *out;
+
+	if (!imap_parse_thread_response (response, &tree))
+		return NULL;
+
+	out = g_string_new ("");
+	thread_to_string (tree, out);
+	camel_lite_imap_thread_free (tree);
+
+	return g_string_free (out, FALSE);
+}
+
+static void
+test_thread (void)
+{
+	char *str;
+
+	/* RFC 5256 section 4 */
+	str = parse_thread ("* THREAD (2)(3 6 (4 23)(44 7 96))");
+	check (str && !strcmp (str, "(2)(3 (6 (4 (23))(44 (7 (96)))))"));
+	g_free (str);
+
+	/* siblings without a parent the server knows about */
+	str = parse_thread ("* THREAD ((3)(5))");
+	check (str && !strcmp (str, "(0 (3)(5))"));
+	g_free (str);
+
+	str = parse_thread ("* THREAD");
+	check (str && !strcmp (str, ""));
+	g_free (str);
+
+	check (parse_thread ("* THREAD (2 (3)") == NULL);
+	check (parse_thread ("* THREAD (2 (3) 4)") == NULL);
+	check (parse_thread ("* THREAD (x)") == NULL);
+	check (parse_thread ("* SEARCH 1 2") == NULL);
+}
+
+static void
+test_esearch (void)
+{
+	guint32 min, max, count;
+	char *all;
+
+	/* RFC 4731 section 3.1 */
+	min = max = count = 0; all = NULL;
+	check (imap_parse_esearch_response ("* ESEARCH (TAG \"A282\") MIN 2 COUNT 3", &min, &max, &count, &all));
+	check (min == 2 && max == 0 && count == 3 && all == NULL);
+
+	min = max = count = 0; all = NULL;
+	check (imap_parse_esearch_response ("* ESEARCH (TAG \"A283\") ALL 2,10:11", &min, &max, &count, &all));
+	check (all && !strcmp (all, "2,10:11"));
+	g_free (all);
+
+	min = max = count = 0; all = NULL;
+	check (imap_parse_esearch_response ("* ESEARCH (TAG \"A285\") UID MIN 7 MAX 3800", &min, &max, &count, &all));
+	check (min == 7 && max == 3800 && count == 0 && all == NULL);
+
+	/* nothing matched */
+	min = max = count = 0; all = NULL;
+	check (imap_parse_esearch_response ("* ESEARCH (TAG \"A286\") UID", &min, &max, &count, &all));
+	check (min == 0 && max == 0 && count == 0 && all == NULL);
+
+	check (!imap_parse_esearch_response ("* SEARCH 2 10 11", &min, &max, &count, &all));
+}
+
+/* Reads a response with @tok and gives the tokens back separated by
+   spaces, literals as their data between braces, up to the end of the
+   line. An error shows up as "ERROR". */
+static char *
+tokenize (CamelImapTokenizer *tok)
+{
+	CamelException ex = CAMEL_EXCEPTION_INITIALISER;
+	GString *out = g_string_new ("");
+	GByteArray *literal;
+	const char *token;
+	guint32 len;
+	int type;
+
+	while ((type = camel_lite_imap_tokenizer_next (tok, &token, &len, &ex)) != CAMEL_IMAP_TOKEN_EOL) {
+		if (out->len)
+			g_string_append_c (out, ' ');
+
+		if (type == CAMEL_IMAP_TOKEN_LITERAL) {
+			literal = g_byte_array_new ();
+			if (camel_lite_imap_tokenizer_literal (tok, literal, &ex) == 0) {
+				g_string_append_c (out, '{');
+				g_string_append_len (out, (const char *) literal->data, literal->len);
+				g_string_append_c (out, '}');
+			} else
+				type = CAMEL_IMAP_TOKEN_ERROR;
+			g_byte_array_free (literal, TRUE);
+		} else if (type > CAMEL_IMAP_TOKEN_EOL)
+			g_string_append_len (out, token, len);
+		else if (type != CAMEL_IMAP_TOKEN_ERROR)
+			g_string_append_c (out, type);
+
+		if (type == CAMEL_IMAP_TOKEN_ERROR) {
+			g_string_append (out, "ERROR");
+			camel_lite_exception_clear (&ex);
+			break;
+		}
+	}
+
+	return g_string_free (out, FALSE);
+}
+
+static void
+test_tokenizer (void)
+{
+	const char *trace =
+		"12 FETCH (UID 1005 FLAGS (\\Seen \\Answered) BODY[HEADER] {17}\r\n"
+		"Subject: x\r\nTo: y)\r\n"
+		"13 FETCH (INTERNALDATE \"17-Jul-1996 02:44:25 -0700\" BODY[] \"q\\\"uo\\\\te\")\n"
+		"14 FETCH (BODY[] {2}\r\n";
+	CamelImapTokenizer *tok;
+	CamelStream *mem, *stream;
+	char *str;
+
+	mem = camel_lite_stream_mem_new_with_buffer (trace, strlen (trace));
+	stream = camel_lite_stream_buffer_new (mem, CAMEL_STREAM_BUFFER_READ);
+	camel_lite_object_unref (mem);
+	tok = camel_lite_imap_tokenizer_new_for_stream (CAMEL_STREAM_BUFFER (stream));
+
+	/* literals lose their CRs, like imap_read_untagged() does */
+	str = tokenize (tok);
+	check (!strcmp (str, "12 FETCH ( UID 1005 FLAGS ( \\Seen \\Answered ) BODY [ HEADER ] {Subject: x\nTo: y} )"));
+	g_free (str);
+
+	/* a bare LF ends a line as well, escapes are undone */
+	str = tokenize (tok);
+	check (!strcmp (str, "13 FETCH ( INTERNALDATE 17-Jul-1996 02:44:25 -0700 BODY [ ] q\"uo\\te )"));
+	g_free (str);
+
+	/* the trace ends inside the literal */
+	str = tokenize (tok);
+	check (!strcmp (str, "14 FETCH ( BODY [ ] ERROR"));
+	g_free (str);
+
+	camel_lite_imap_tokenizer_free (tok);
+	camel_lite_object_unref (stream);
+}
+
+int
+main (int argc, char *argv[])
+{
+	g_thread_init (NULL);
+
+	test_thread ();
+	test_esearch ();
+	test_tokenizer ();
+
+	if (failed)
+		printf ("%d checks failed\n", failed);
+
+	return failed ? 1 : 0;
+}
@@ -15,6 +15,7 @@
 #include "camel-store.h"
 #include "camel-stream-mem.h"
 #include "camel-stream-null.h"
+#include "camel-string-utils.h"
 
 #include "camel-imapp-driver.h"
 #include "camel-imapp-engine.h"
@@ -736,10 +737,10 @@ driver_resp_fetch(CamelIMAPPEngine *ie, guint32 id, CamelIMAPPDriver *sdata)
 	if (info) {
 		if (finfo->got & FETCH_MINFO) {
 			/* if we only use ENVELOPE? */
-			info->info.subject = g_strdup(camel_lite_message_info_subject(finfo->minfo));
-			info->info.from = g_strdup(camel_lite_message_info_from(finfo->minfo));
-			info->info.to = g_strdup(camel_lite_message_info_to(finfo->minfo));
-			info->info.cc = g_strdup(camel_lite_message_info_cc(finfo->minfo));
+			camel_lite_message_info_set_string((CamelMessageInfo *)info, CAMEL_MESSAGE_INFO_SUBJECT, camel_lite_pstring_strdup(camel_lite_message_info_subject(finfo->minfo)));
+			camel_lite_message_info_set_string((CamelMessageInfo *)info, CAMEL_MESSAGE_INFO_FROM, camel_lite_pstring_strdup(camel_lite_message_info_from(finfo->minfo)));
+			camel_lite_message_info_set_string((CamelMessageInfo *)info, CAMEL_MESSAGE_INFO_TO, camel_lite_pstring_strdup(camel_lite_message_info_to(finfo->minfo)));
+			camel_lite_message_info_set_string((CamelMessageInfo *)info, CAMEL_MESSAGE_INFO_CC, camel_lite_pstring_strdup(camel_lite_message_info_cc(finfo->minfo)));
 			info->info.date_sent = camel_lite_message_info_date_sent(finfo->minfo);
 			camel_lite_folder_change_info_add_uid(sdata->folder->changes, camel_lite_message_info_uid(info));
 			printf("adding change info uid '%s'\n", camel_lite_message_info_uid(info));
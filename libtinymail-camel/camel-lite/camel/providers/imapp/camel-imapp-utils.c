@@ -609,7 +609,7 @@ imap_parse_envelope(CamelIMAPPStream *is)
 
 		/* env_subject     ::= nstring */
 		tok = camel_lite_imapp_stream_nstring(is, &token);
-		minfo->subject = camel_lite_pstring_strdup(token);
+		camel_lite_message_info_set_string((CamelMessageInfo *)minfo, CAMEL_MESSAGE_INFO_SUBJECT, camel_lite_pstring_strdup(token));
 
 		/* we merge from/sender into from, append should probably merge more smartly? */
 
@@ -631,7 +631,7 @@ imap_parse_envelope(CamelIMAPPStream *is)
 
 		if (addr_from) {
 			addrstr = camel_lite_header_address_list_format(addr_from);
-			minfo->from = camel_lite_pstring_strdup(addrstr);
+			camel_lite_message_info_set_string((CamelMessageInfo *)minfo, CAMEL_MESSAGE_INFO_FROM, camel_lite_pstring_strdup(addrstr));
 			g_free(addrstr);
 			camel_lite_header_address_list_clear(&addr_from);
 		}
@@ -646,7 +646,7 @@ imap_parse_envelope(CamelIMAPPStream *is)
 		addr = imap_parse_address_list(is);
 		if (addr) {
 			addrstr = camel_lite_header_address_list_format(addr);
-			minfo->to = camel_lite_pstring_strdup(addrstr);
+			camel_lite_message_info_set_string((CamelMessageInfo *)minfo, CAMEL_MESSAGE_INFO_TO, camel_lite_pstring_strdup(addrstr));
 			g_free(addrstr);
 			camel_lite_header_address_list_clear(&addr);
 		}
@@ -655,7 +655,7 @@ imap_parse_envelope(CamelIMAPPStream *is)
 		addr = imap_parse_address_list(is);
 		if (addr) {
 			addrstr = camel_lite_header_address_list_format(addr);
-			minfo->cc = camel_lite_pstring_strdup(addrstr);
+			camel_lite_message_info_set_string((CamelMessageInfo *)minfo, CAMEL_MESSAGE_INFO_CC, camel_lite_pstring_strdup(addrstr));
 			g_free(addrstr);
 			camel_lite_header_address_list_clear(&addr);
 		}
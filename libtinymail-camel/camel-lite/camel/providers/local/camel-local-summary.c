@@ -236,14 +236,14 @@ do_stat_mi(CamelLocalSummary *cls, struct _stat_info *info, CamelMessageInfo *mi
 	info->micount++;
 	info->mitotal += ((CamelFolderSummary *)cls)->content_info_size /*+ 4*/;
 
-	if (mi->subject)
-		info->mitotal += strlen(mi->subject) + 4;
-	if (mi->to)
-		info->mitotal += strlen(mi->to) + 4;
-	if (mi->from)
-		info->mitotal += strlen(mi->from) + 4;
-	if (mi->cc)
-		info->mitotal += strlen(mi->cc) + 4;
+	if (camel_lite_message_info_subject(mi))
+		info->mitotal += strlen(camel_lite_message_info_subject(mi)) + 4;
+	if (camel_lite_message_info_to(mi))
+		info->mitotal += strlen(camel_lite_message_info_to(mi)) + 4;
+	if (camel_lite_message_info_from(mi))
+		info->mitotal += strlen(camel_lite_message_info_from(mi)) + 4;
+	if (camel_lite_message_info_cc(mi))
+		info->mitotal += strlen(camel_lite_message_info_cc(mi)) + 4;
 	if (mi->uid)
 		info->mitotal += strlen(mi->uid) + 4;
 
@@ -52,6 +52,7 @@
 #include "camel/camel-stream-mem.h"
 
 #include "camel-nntp-folder.h"
+#include "camel-nntp-newsrc.h"
 #include "camel-nntp-private.h"
 #include "camel-nntp-store.h"
 #include "camel-nntp-store.h"
@@ -101,11 +102,46 @@ nntp_folder_refresh_info_online (CamelFolder *folder, CamelException *ex)
 	}
 }
 
+/* Store the articles read in the newsrc, in one merge with the ranges
+   already there */
+static void
+nntp_folder_sync_newsrc (CamelFolder *folder)
+{
+	CamelNNTPStore *nntp_store = (CamelNNTPStore *) folder->parent_store;
+	CamelMessageInfoBase *mi;
+	GArray *read;
+	guint n;
+	int i, count;
+
+	if (nntp_store->newsrc == NULL)
+		return;
+
+	count = camel_lite_folder_summary_count (folder->summary);
+	read = g_array_sized_new (FALSE, FALSE, sizeof (guint), count);
+	for (i = 0; i < count; i++) {
+		mi = (CamelMessageInfoBase *) camel_lite_folder_summary_index (folder->summary, i);
+		if (mi) {
+			if (mi->flags & CAMEL_MESSAGE_SEEN) {
+				n = strtoul (camel_lite_message_info_uid (mi), NULL, 10);
+				g_array_append_val (read, n);
+			}
+			camel_lite_message_info_free (mi);
+		}
+	}
+
+	camel_lite_nntp_newsrc_mark_articles_read (nntp_store->newsrc, folder->full_name,
+		(guint *) read->data, read->len);
+	g_array_free (read, TRUE);
+
+	camel_lite_nntp_newsrc_write (nntp_store->newsrc);
+}
+
 static void
 nntp_folder_sync_online (CamelFolder *folder, CamelException *ex)
 {
 	CAMEL_SERVICE_REC_LOCK(folder->parent_store, connect_lock);
 	camel_lite_folder_summary_save (folder->summary, ex);
+	nntp_folder_sync_newsrc (folder);
 	CAMEL_SERVICE_REC_UNLOCK(folder->parent_store, connect_lock);
 }
 
@@ -114,6 +150,7 @@ nntp_folder_sync_offline (CamelFolder *folder, CamelException *ex)
 {
 	CAMEL_SERVICE_REC_LOCK(folder->parent_store, connect_lock);
 	camel_lite_folder_summary_save (folder->summary, ex);
+	nntp_folder_sync_newsrc (folder);
 	CAMEL_SERVICE_REC_UNLOCK(folder->parent_store, connect_lock);
 }
 
@@ -546,6 +583,12 @@ camel_lite_nntp_folder_new (CamelStore *parent, const char *folder_name, CamelEx
 		camel_lite_store_summary_info_free ((CamelStoreSummary *) ((CamelNNTPStore*) parent)->summary, si);
 	}
 
+	/* groups subscribed before the newsrc existed get their entry now,
+	   marking articles read in an unknown group is a no-op */
+	if (subscribed && ((CamelNNTPStore *) parent)->newsrc
+	    && !camel_lite_nntp_newsrc_group_is_subscribed (((CamelNNTPStore *) parent)->newsrc, folder->full_name))
+		camel_lite_nntp_newsrc_subscribe_group (((CamelNNTPStore *) parent)->newsrc, folder->full_name);
+
 	if (subscribed) {
 		camel_lite_folder_refresh_info(folder, ex);
 		if (camel_lite_exception_is_set(ex)) {
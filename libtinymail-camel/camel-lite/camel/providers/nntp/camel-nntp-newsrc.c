@@ -31,6 +31,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include <glib.h>
 #include <glib/gstdio.h>
@@ -103,10 +104,31 @@ camel_lite_nntp_newsrc_group_get_num_articles_read(CamelNNTPNewsrc *newsrc, News
 }
 
 
+/* The ranges of a group are kept sorted, and neither overlap nor touch
+   each other, so they can be binary searched.  Returns the index of the
+   first range which ends at or after num, or ranges->len if there is
+   none. */
+static guint
+camel_lite_nntp_newsrc_group_find_range (NewsrcGroup *group, guint num)
+{
+	guint lo = 0, hi = group->ranges->len, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (g_array_index (group->ranges, ArticleRange, mid).high < num)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
 static void
 camel_lite_nntp_newsrc_group_mark_range_read(CamelNNTPNewsrc *newsrc, NewsrcGroup *group, long low, long high)
 {
-	int i;
+	ArticleRange *range, tmp_range;
+	guint i, j;
 
 	if (group->ranges->len == 1
 	    && g_array_index (group->ranges, ArticleRange, 0).low == 0
@@ -115,77 +137,92 @@ camel_lite_nntp_newsrc_group_mark_range_read(CamelNNTPNewsrc *newsrc, NewsrcGrou
 		g_array_index (group->ranges, ArticleRange, 0).high = high;
 
 		newsrc->dirty = TRUE;
+		return;
 	}
-	else  {
-		ArticleRange tmp_range;
-
-		for (i = 0; i < group->ranges->len; i ++) {
-			guint range_low = g_array_index (group->ranges, ArticleRange, i).low;
-			guint range_high = g_array_index (group->ranges, ArticleRange, i).high;
-
-			/* if it's already part of a range, return immediately. */
-			if (low >= range_low &&
-			    low <= range_high &&
-			    high >= range_low &&
-			    high <= range_high) {
-				return;
-			}
-			/* if we have a new lower bound for this range, set it. */
-			else if (low <= range_low
-				 && high >= range_low
-				 && high <= range_high) {
-				g_array_index (group->ranges, ArticleRange, i).low = low;
-				newsrc->dirty = TRUE;
-				return;
-			}
-			/* if we have a new upper bound for this range, set it. */
-			else if (high >= range_high
-				 && low >= range_low
-				 && low <= range_high) {
-				g_array_index (group->ranges, ArticleRange, i).high = high;
-				newsrc->dirty = TRUE;
-				return;
-			}
-			/* if we would be inserting another range that
-                           starts one index higher than an existing
-                           one, make the upper value of the existing
-                           range the upper value of the new one. */
-			else if (low == range_high + 1) {
-				g_array_index (group->ranges, ArticleRange, i).high = high;
-				newsrc->dirty = TRUE;
-				return;
-			}
-			/* if we would be inserting another range that
-                           ends one index lower than an existing one,
-                           group the existing range by setting its low
-                           to the new low */
-			else if (high == range_low - 1) {
-				g_array_index (group->ranges, ArticleRange, i).low = low;
-				newsrc->dirty = TRUE;
-				return;
-			}
-			/* if the range lies entirely outside another
-                           range, doesn't coincide with it's
-                           endpoints, and has lower values, insert it
-                           into the middle of the list. */
-			else if (low < range_low
-				 && high < range_low) {
-				tmp_range.low = low;
-				tmp_range.high = high;
-
-				group->ranges = g_array_insert_val (group->ranges, i, tmp_range);
-				newsrc->dirty = TRUE;
-
-				return;
-			}
-		}
 
-		/* if we made it here, the range needs to go at the end */
+	/* the first range that overlaps or touches the new one */
+	i = camel_lite_nntp_newsrc_group_find_range (group, low > 0 ? low - 1 : 0);
+
+	if (i == group->ranges->len
+	    || g_array_index (group->ranges, ArticleRange, i).low > (guint) high + 1) {
 		tmp_range.low = low;
 		tmp_range.high = high;
-		group->ranges = g_array_append_val (group->ranges, tmp_range);
+		g_array_insert_val (group->ranges, i, tmp_range);
 		newsrc->dirty = TRUE;
+		return;
 	}
+
+	range = &g_array_index (group->ranges, ArticleRange, i);
+
+	/* if it's already part of a range, return immediately. */
+	if (low >= range->low && high <= range->high)
+		return;
+
+	if (low < range->low)
+		range->low = low;
+
+	/* swallow the following ranges the new one reaches */
+	for (j = i + 1; j < group->ranges->len; j++) {
+		if (g_array_index (group->ranges, ArticleRange, j).low > (guint) high + 1)
+			break;
+	}
+
+	if (g_array_index (group->ranges, ArticleRange, j - 1).high > (guint) high)
+		high = g_array_index (group->ranges, ArticleRange, j - 1).high;
+	range->high = high;
+
+	if (j > i + 1)
+		g_array_remove_range (group->ranges, i + 1, j - i - 1);
+
+	newsrc->dirty = TRUE;
+}
+
+static int
+camel_lite_nntp_newsrc_compare_num (gconstpointer a, gconstpointer b)
+{
+	guint na = *(const guint *) a, nb = *(const guint *) b;
+
+	return na < nb ? -1 : na > nb ? 1 : 0;
+}
+
+/* Merge the sorted, coalesced ranges in add into the group's ranges in
+   one pass over both */
+static void
+camel_lite_nntp_newsrc_group_merge_ranges (CamelNNTPNewsrc *newsrc, NewsrcGroup *group, GArray *add)
+{
+	GArray *old = group->ranges, *merged;
+	ArticleRange *next, *last = NULL;
+	guint i = 0, j = 0;
+
+	if (add->len == 0)
+		return;
+
+	if (old->len == 1
+	    && g_array_index (old, ArticleRange, 0).low == 0
+	    && g_array_index (old, ArticleRange, 0).high == 0)
+		g_array_set_size (old, 0);
+
+	merged = g_array_sized_new (FALSE, FALSE, sizeof (ArticleRange), old->len + add->len);
+
+	while (i < old->len || j < add->len) {
+		if (j == add->len || (i < old->len
+		    && g_array_index (old, ArticleRange, i).low <= g_array_index (add, ArticleRange, j).low))
+			next = &g_array_index (old, ArticleRange, i++);
+		else
+			next = &g_array_index (add, ArticleRange, j++);
+
+		if (last && next->low <= last->high + 1) {
+			if (next->high > last->high)
+				last->high = next->high;
+		} else {
+			g_array_append_val (merged, *next);
+			last = &g_array_index (merged, ArticleRange, merged->len - 1);
+		}
+	}
+
+	g_array_free (old, TRUE);
+	group->ranges = merged;
+	newsrc->dirty = TRUE;
 }
 
 int
@@ -256,29 +293,77 @@ camel_lite_nntp_newsrc_mark_range_read(CamelNNTPNewsrc *newsrc, const char *grou
 	NEWSRC_UNLOCK(newsrc, lock);
 }
 
+/**
+ * camel_lite_nntp_newsrc_mark_articles_read:
+ * @newsrc: a #CamelNNTPNewsrc
+ * @group_name: the group
+ * @nums: article numbers, in any order
+ * @count: the number of articles in @nums
+ *
+ * Mark many articles of @group_name read at once, in a single merge with
+ * the ranges already read rather than one per article.
+ **/
+void
+camel_lite_nntp_newsrc_mark_articles_read (CamelNNTPNewsrc *newsrc, const char *group_name, const guint *nums, int count)
+{
+	NewsrcGroup *group;
+	ArticleRange range;
+	GArray *add;
+	guint *sorted;
+	int i;
+
+	if (count <= 0)
+		return;
+
+	sorted = g_memdup (nums, count * sizeof (guint));
+	qsort (sorted, count, sizeof (guint), camel_lite_nntp_newsrc_compare_num);
+
+	add = g_array_new (FALSE, FALSE, sizeof (ArticleRange));
+	range.low = range.high = sorted[0];
+	for (i = 1; i < count; i++) {
+		if (sorted[i] <= range.high + 1) {
+			range.high = MAX (range.high, sorted[i]);
+		} else {
+			g_array_append_val (add, range);
+			range.low = range.high = sorted[i];
+		}
+	}
+	g_array_append_val (add, range);
+	g_free (sorted);
+
+	NEWSRC_LOCK(newsrc, lock);
+	group = g_hash_table_lookup (newsrc->groups, group_name);
+
+	if (group)
+		camel_lite_nntp_newsrc_group_merge_ranges (newsrc, group, add);
+	NEWSRC_UNLOCK(newsrc, lock);
+
+	g_array_free (add, TRUE);
+}
+
 gboolean
 camel_lite_nntp_newsrc_article_is_read (CamelNNTPNewsrc *newsrc, const char *group_name, long num)
 {
-	int i;
 	NewsrcGroup *group;
 	int ret = FALSE;
+	guint i;
+
+	if (num < 0)
+		return FALSE;
 
 	NEWSRC_LOCK(newsrc, lock);
 	group = g_hash_table_lookup (newsrc->groups, group_name);
 
 	if (group) {
-		for (i = 0; i < group->ranges->len; i++) {
-			if (num >= g_array_index (group->ranges, ArticleRange, i).low &&
-			    num <= g_array_index (group->ranges, ArticleRange, i).high) {
-				ret = TRUE;
-				break;
-			}
-		}
+		i = camel_lite_nntp_newsrc_group_find_range (group, num);
+		if (i < group->ranges->len
+		    && num >= g_array_index (group->ranges, ArticleRange, i).low)
+			ret = TRUE;
 	}
 
 	NEWSRC_UNLOCK(newsrc, lock);
 
-	return FALSE;
+	return ret;
 }
 
 gboolean
@@ -596,32 +681,38 @@ get_line (char *buf, char **p)
 	return line;
 }
 
+/**
+ * camel_lite_nntp_newsrc_read:
+ * @filename: the newsrc file
+ *
+ * Read the groups and the articles read in them from @filename.  A
+ * missing file gives an empty newsrc, which camel_lite_nntp_newsrc_write()
+ * creates.
+ *
+ * Return value: a #CamelNNTPNewsrc, free it with camel_lite_nntp_newsrc_free()
+ **/
 CamelNNTPNewsrc *
-camel_lite_nntp_newsrc_read_for_server (const char *server)
+camel_lite_nntp_newsrc_read (const char *filename)
 {
 	int fd;
 	char buf[1024];
 	char *file_contents, *line, *p;
-	char *filename;
 	CamelNNTPNewsrc *newsrc;
 	int newsrc_len;
 	int len_read = 0;
 	struct stat sb;
 
-	filename = g_strdup_printf ("%s/.newsrc-%s", g_get_home_dir(), server);
-
 	newsrc = g_new0(CamelNNTPNewsrc, 1);
-	newsrc->filename = filename;
+	newsrc->filename = g_strdup (filename);
 	newsrc->groups = g_hash_table_new (g_str_hash, g_str_equal);
 	newsrc->lock = g_mutex_new();
 
-	if ((fd = g_open(filename, O_RDONLY, 0)) == -1) {
-		g_warning ("~/.newsrc-%s not present.\n", server);
+	if ((fd = g_open(filename, O_RDONLY, 0)) == -1)
 		return newsrc;
-	}
 
 	if (fstat (fd, &sb) == -1) {
-		g_warning ("failed fstat on ~/.newsrc-%s: %s\n", server, strerror(errno));
+		g_warning ("failed fstat on %s: %s\n", filename, strerror(errno));
+		close (fd);
 		return newsrc;
 	}
 	newsrc_len = sb.st_size;
@@ -629,9 +720,9 @@ camel_lite_nntp_newsrc_read_for_server (const char *server)
 	file_contents = g_malloc (newsrc_len + 1);
 
 	while (len_read < newsrc_len) {
-		int c = read (fd, buf, sizeof (buf));
+		int c = read (fd, buf, MIN (sizeof (buf), newsrc_len - len_read));
 
-		if (c == -1)
+		if (c <= 0)
 			break;
 
 		memcpy (&file_contents[len_read], buf, c);
@@ -650,3 +741,36 @@ camel_lite_nntp_newsrc_read_for_server (const char *server)
 
 	return newsrc;
 }
+
+CamelNNTPNewsrc *
+camel_lite_nntp_newsrc_read_for_server (const char *server)
+{
+	CamelNNTPNewsrc *newsrc;
+	char *filename;
+
+	filename = g_strdup_printf ("%s/.newsrc-%s", g_get_home_dir(), server);
+	if (!g_file_test (filename, G_FILE_TEST_EXISTS))
+		g_warning ("~/.newsrc-%s not present.\n", server);
+	newsrc = camel_lite_nntp_newsrc_read (filename);
+	g_free (filename);
+
+	return newsrc;
+}
+
+static void
+camel_lite_nntp_newsrc_group_free (gpointer key, NewsrcGroup *group, gpointer data)
+{
+	g_array_free (group->ranges, TRUE);
+	g_free (group->name);
+	g_free (group);
+}
+
+void
+camel_lite_nntp_newsrc_free (CamelNNTPNewsrc *newsrc)
+{
+	g_hash_table_foreach (newsrc->groups, (GHFunc) camel_lite_nntp_newsrc_group_free, NULL);
+	g_hash_table_destroy (newsrc->groups);
+	g_mutex_free (newsrc->lock);
+	g_free (newsrc->filename);
+	g_free (newsrc);
+}
@@ -15,6 +15,8 @@ void             camel_lite_nntp_newsrc_mark_article_read          (CamelNNTPNew
 							       const char *group_name, int num);
 void             camel_lite_nntp_newsrc_mark_range_read            (CamelNNTPNewsrc *newsrc,
 							       const char *group_name, long low, long high);
+void             camel_lite_nntp_newsrc_mark_articles_read         (CamelNNTPNewsrc *newsrc,
+							       const char *group_name, const guint *nums, int count);
 
 gboolean         camel_lite_nntp_newsrc_article_is_read            (CamelNNTPNewsrc *newsrc,
 							       const char *group_name, long num);
@@ -29,7 +31,9 @@ void             camel_lite_nntp_newsrc_free_group_names           (CamelNNTPNew
 
 void             camel_lite_nntp_newsrc_write_to_file              (CamelNNTPNewsrc *newsrc, FILE *fp);
 void             camel_lite_nntp_newsrc_write                      (CamelNNTPNewsrc *newsrc);
+CamelNNTPNewsrc *camel_lite_nntp_newsrc_read                       (const char *filename);
 CamelNNTPNewsrc *camel_lite_nntp_newsrc_read_for_server            (const char *server);
+void             camel_lite_nntp_newsrc_free                       (CamelNNTPNewsrc *newsrc);
 
 G_END_DECLS
 
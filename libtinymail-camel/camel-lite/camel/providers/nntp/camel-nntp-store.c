@@ -52,6 +52,7 @@
 #include "camel-nntp-store.h"
 #include "camel-nntp-store-summary.h"
 #include "camel-nntp-folder.h"
+#include "camel-nntp-newsrc.h"
 #include "camel-nntp-private.h"
 #include "camel-nntp-resp-codes.h"
 
@@ -645,6 +646,31 @@ nntp_store_get_subscribed_folder_info (CamelNNTPStore *store, const char *top, g
 	return first;
 }
 
+/* The summary is kept sorted by group name, find the first group at or
+ * after prefix */
+static int
+nntp_store_summary_lower_bound (CamelNNTPStore *store, const char *prefix)
+{
+	CamelStoreSummary *summ = (CamelStoreSummary *) store->summary;
+	CamelStoreInfo *si;
+	int lo = 0, hi = camel_lite_store_summary_count (summ), mid, cmp;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		si = camel_lite_store_summary_index (summ, mid);
+		if (si == NULL)
+			break;
+		cmp = strcmp (si->path, prefix);
+		camel_lite_store_summary_info_free (summ, si);
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
 /*
  * get folder info, using the information in our StoreSummary
  */
@@ -661,7 +687,10 @@ nntp_store_get_cached_folder_info (CamelNNTPStore *store, const char *orig_top,
 	char *top = g_strconcat(orig_top?orig_top:"", ".", NULL);
 	int toplen = strlen(top);
 
-	for (i = 0; (si = camel_lite_store_summary_index ((CamelStoreSummary *) store->summary, i)); i++) {
+	/* below the root only the groups starting with top are looked at */
+	i = root_or_flag ? 0 : nntp_store_summary_lower_bound (store, top);
+
+	for (; (si = camel_lite_store_summary_index ((CamelStoreSummary *) store->summary, i)); i++) {
 		if ((subscribed_or_flag || (si->flags & CAMEL_STORE_INFO_FOLDER_SUBSCRIBED))
 		    && (root_or_flag || strncmp (si->path, top, toplen) == 0)) {
 			if (recursive_flag || strchr (si->path + toplen, '.') == NULL) {
@@ -698,6 +727,10 @@ nntp_store_get_cached_folder_info (CamelNNTPStore *store, const char *orig_top,
 			else
 				first = fi;
 			last = fi;
+		} else if (!root_or_flag && strncmp (si->path, top, toplen) != 0) {
+			/* past the groups under top */
+			camel_lite_store_summary_info_free((CamelStoreSummary *)store->summary, si);
+			break;
 		} else if (subscribed_or_flag && first) {
 			/* we have already added subitems, but this item is no longer a subitem */
 			camel_lite_store_summary_info_free((CamelStoreSummary *)store->summary, si);
@@ -824,6 +857,48 @@ nntp_store_get_folder_info_all(CamelNNTPStore *nntp_store, const char *top, guin
 			goto error;
 
 		camel_lite_store_summary_save ((CamelStoreSummary *) nntp_store->summary, ex);
+	} else if (online) {
+		GHashTable *all;
+		char *prefix = g_strdup_printf ("%s.", top);
+		int i;
+
+		/* only the groups below top, the rest of the list is left
+		   alone.  Servers without LIST ACTIVE get the cached groups */
+		ret = camel_lite_nntp_command (nntp_store, ex, NULL, (char **)&line, "list active %s*", prefix);
+		if (ret == -1) {
+			g_free (prefix);
+			goto error;
+		}
+
+		if (ret == 215) {
+			all = g_hash_table_new(g_str_hash, g_str_equal);
+			for (i = nntp_store_summary_lower_bound (nntp_store, prefix);
+			     (si = (CamelNNTPStoreInfo *)camel_lite_store_summary_index ((CamelStoreSummary *)nntp_store->summary, i)); i++) {
+				if (strncmp (si->info.path, prefix, strlen (prefix)) != 0) {
+					camel_lite_store_summary_info_free ((CamelStoreSummary *)nntp_store->summary, &si->info);
+					break;
+				}
+				g_hash_table_insert(all, si->info.path, si);
+			}
+
+			while ((ret = camel_lite_nntp_stream_line(nntp_store->stream, &line, &len)) > 0) {
+				si = nntp_store_info_update(nntp_store, (char *) line);
+				g_hash_table_remove(all, si->info.path);
+			}
+
+			if (ret == 0)
+				g_hash_table_foreach(all, store_info_remove, nntp_store->summary);
+			g_hash_table_destroy(all);
+
+			g_ptr_array_sort (CAMEL_STORE_SUMMARY (nntp_store->summary)->folders, store_info_sort);
+			if (ret < 0) {
+				g_free (prefix);
+				goto error;
+			}
+
+			camel_lite_store_summary_save ((CamelStoreSummary *) nntp_store->summary, ex);
+		}
+		g_free (prefix);
 	}
 
 	fi = nntp_store_get_cached_folder_info (nntp_store, top, flags, ex);
@@ -900,6 +975,8 @@ nntp_store_subscribe_folder (CamelStore *store, const char *folder_name,
 	} else {
 		if (!(si->flags & CAMEL_STORE_INFO_FOLDER_SUBSCRIBED)) {
 			si->flags |= CAMEL_STORE_INFO_FOLDER_SUBSCRIBED;
+			if (nntp_store->newsrc)
+				camel_lite_nntp_newsrc_subscribe_group (nntp_store->newsrc, folder_name);
 			fi = nntp_folder_info_from_store_info(nntp_store, nntp_store->do_short_folder_notation, si);
 			fi->flags |= CAMEL_FOLDER_NOINFERIORS | CAMEL_FOLDER_NOCHILDREN;
 			camel_lite_store_summary_touch ((CamelStoreSummary *) nntp_store->summary);
@@ -932,6 +1009,8 @@ nntp_store_unsubscribe_folder (CamelStore *store, const char *folder_name,
 	} else {
 		if (fitem->flags & CAMEL_STORE_INFO_FOLDER_SUBSCRIBED) {
 			fitem->flags &= ~CAMEL_STORE_INFO_FOLDER_SUBSCRIBED;
+			if (nntp_store->newsrc)
+				camel_lite_nntp_newsrc_unsubscribe_group (nntp_store->newsrc, folder_name);
 			fi = nntp_folder_info_from_store_info (nntp_store, nntp_store->do_short_folder_notation, fitem);
 			camel_lite_store_summary_touch ((CamelStoreSummary *) nntp_store->summary);
 			camel_lite_store_summary_save ((CamelStoreSummary *) nntp_store->summary, ex);
@@ -988,6 +1067,11 @@ nntp_store_finalize (CamelObject *object)
 		camel_lite_object_unref (nntp_store->summary);
 	}
 
+	if (nntp_store->newsrc) {
+		camel_lite_nntp_newsrc_write (nntp_store->newsrc);
+		camel_lite_nntp_newsrc_free (nntp_store->newsrc);
+	}
+
 	camel_lite_object_unref (nntp_store->mem);
 	nntp_store->mem = NULL;
 	if (nntp_store->stream)
@@ -1087,6 +1171,12 @@ nntp_construct (CamelService *service, CamelSession *session,
 	if (camel_lite_store_summary_load ((CamelStoreSummary *)nntp_store->summary) == 0)
 		;
 
+	/* what was read, so articles the summary lost or hasn't seen yet
+	   come in read */
+	tmp = g_build_filename (nntp_store->storage_path, ".newsrc", NULL);
+	nntp_store->newsrc = camel_lite_nntp_newsrc_read (tmp);
+	g_free (tmp);
+
 	/* get options */
 	if (camel_lite_url_get_param (url, "show_short_notation"))
 		nntp_store->do_short_folder_notation = TRUE;
@@ -1200,8 +1290,8 @@ camel_lite_nntp_try_authenticate (CamelNNTPStore *store, CamelException *ex)
 }
 
 /* Enter owning lock */
-int
-camel_lite_nntp_raw_commandv (CamelNNTPStore *store, CamelException *ex, char **line, const char *fmt, va_list ap)
+static int
+nntp_raw_command_sendv (CamelNNTPStore *store, CamelException *ex, const char *fmt, va_list ap)
 {
 	const unsigned char *p, *ps;
 	unsigned char c;
@@ -1265,6 +1355,61 @@ camel_lite_nntp_raw_commandv (CamelNNTPStore *store, CamelException *ex, char **
 	camel_lite_stream_reset ((CamelStream *) store->mem);
 	g_byte_array_set_size (store->mem->buffer, 0);
 
+	return 0;
+
+ioerror:
+	if (errno == EINTR)
+		camel_lite_exception_setv(ex, CAMEL_EXCEPTION_USER_CANCEL, _("Canceled."));
+	else
+		camel_lite_exception_setv(ex, CAMEL_EXCEPTION_SYSTEM, _("NNTP Command failed: %s"), g_strerror(errno));
+	return -1;
+}
+
+/**
+ * camel_lite_nntp_raw_command_send:
+ * @store: a #CamelNNTPStore
+ * @ex: a #CamelException
+ * @fmt: the command, formatted like for camel_lite_nntp_raw_command()
+ *
+ * Send a command without waiting for its response, so that several
+ * commands can be outstanding at once.  Each response has to be read
+ * with camel_lite_nntp_raw_command_response(), in order, together with
+ * its data.
+ *
+ * Return value: 0 on success, -1 on error.
+ **/
+int
+camel_lite_nntp_raw_command_send (CamelNNTPStore *store, CamelException *ex, const char *fmt, ...)
+{
+	int ret;
+	va_list ap;
+
+	va_start(ap, fmt);
+	ret = nntp_raw_command_sendv(store, ex, fmt, ap);
+	va_end(ap);
+
+	return ret;
+}
+
+/**
+ * camel_lite_nntp_raw_command_response:
+ * @store: a #CamelNNTPStore
+ * @ex: a #CamelException
+ * @line: the response line
+ *
+ * Read the response of the oldest command sent with
+ * camel_lite_nntp_raw_command_send().  The data of any earlier response
+ * must have been read already.
+ *
+ * Return value: the response code, or -1 on error.
+ **/
+int
+camel_lite_nntp_raw_command_response (CamelNNTPStore *store, CamelException *ex, char **line)
+{
+	unsigned int u;
+
+	camel_lite_nntp_stream_set_mode(store->stream, CAMEL_NNTP_STREAM_LINE);
+
 	if (camel_lite_nntp_stream_line (store->stream, (unsigned char **) line, &u) == -1)
 		goto ioerror;
 
@@ -1284,6 +1429,16 @@ ioerror:
 	return -1;
 }
 
+/* Enter owning lock */
+int
+camel_lite_nntp_raw_commandv (CamelNNTPStore *store, CamelException *ex, char **line, const char *fmt, va_list ap)
+{
+	if (nntp_raw_command_sendv(store, ex, fmt, ap) == -1)
+		return -1;
+
+	return camel_lite_nntp_raw_command_response(store, ex, line);
+}
+
 int
 camel_lite_nntp_raw_command(CamelNNTPStore *store, CamelException *ex, char **line, const char *fmt, ...)
 {
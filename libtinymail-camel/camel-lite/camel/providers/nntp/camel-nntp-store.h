@@ -82,6 +82,7 @@ struct _CamelNNTPStore {
 	struct _CamelStreamMem *mem;
 
 	struct _CamelDataCache *cache;
+	struct CamelNNTPNewsrc *newsrc;	/* articles read, by group */
 
 	char *current_folder, *storage_path, *base_url;
 
@@ -99,6 +100,8 @@ CamelType camel_lite_nntp_store_get_type (void);
 int camel_lite_nntp_raw_commandv (CamelNNTPStore *store, struct _CamelException *ex, char **line, const char *fmt, va_list ap);
 int camel_lite_nntp_raw_command(CamelNNTPStore *store, struct _CamelException *ex, char **line, const char *fmt, ...);
 int camel_lite_nntp_raw_command_auth(CamelNNTPStore *store, struct _CamelException *ex, char **line, const char *fmt, ...);
+int camel_lite_nntp_raw_command_send(CamelNNTPStore *store, struct _CamelException *ex, const char *fmt, ...);
+int camel_lite_nntp_raw_command_response(CamelNNTPStore *store, struct _CamelException *ex, char **line);
 int camel_lite_nntp_command (CamelNNTPStore *store, struct _CamelException *ex, struct _CamelNNTPFolder *folder, char **line, const char *fmt, ...);
 
 G_END_DECLS
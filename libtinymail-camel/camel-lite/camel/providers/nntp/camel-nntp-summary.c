@@ -40,6 +40,7 @@
 #include "camel/camel-stream-null.h"
 
 #include "camel-nntp-folder.h"
+#include "camel-nntp-newsrc.h"
 #include "camel-nntp-store.h"
 #include "camel-nntp-stream.h"
 #include "camel-nntp-summary.h"
@@ -210,39 +211,70 @@ summary_header_save(CamelFolderSummary *s, FILE *out)
 
 /* ********************************************************************** */
 
-/* Note: This will be called from camel_lite_nntp_command, so only use camel_lite_nntp_raw_command */
+/* Big ranges are asked for in windows of NNTP_XOVER_WINDOW articles,
+   with up to NNTP_XOVER_DEPTH xover commands (NNTP_HEAD_DEPTH head
+   commands) on their way while the oldest response is read */
+#define NNTP_XOVER_WINDOW (1000)
+#define NNTP_XOVER_DEPTH (4)
+#define NNTP_HEAD_DEPTH (16)
+
+/* Read and drop the responses of the commands still outstanding, so the
+   connection stays usable after an error */
+static void
+drain_responses(CamelNNTPStore *store, int outstanding)
+{
+	CamelException ex = CAMEL_EXCEPTION_INITIALISER;
+	unsigned char *data;
+	unsigned int len;
+	char *line;
+
+	while (outstanding-- > 0) {
+		if (camel_lite_nntp_raw_command_response(store, &ex, &line) == -1)
+			break;
+		if (store->stream->mode == CAMEL_NNTP_STREAM_DATA)
+			while (camel_lite_nntp_stream_line(store->stream, &data, &len) > 0)
+				;
+	}
+
+	camel_lite_exception_clear(&ex);
+}
+
+/* After an error with responses still on their way, or one read only
+   halfway, the next command would take them for its own answer, so the
+   connection is dropped instead */
+static void
+abandon_responses(CamelNNTPStore *store, int outstanding)
+{
+	if (outstanding > 0 || store->stream->mode == CAMEL_NNTP_STREAM_DATA)
+		camel_lite_service_disconnect((CamelService *)store, FALSE, NULL);
+}
+
+/* An article the newsrc has as read comes in read */
+static void
+newsrc_flags(CamelNNTPSummary *cns, CamelNNTPStore *store, CamelMessageInfoBase *mi, unsigned int n)
+{
+	CamelFolder *folder = ((CamelFolderSummary *)cns)->folder;
+
+	if (store->newsrc && folder
+	    && camel_lite_nntp_newsrc_article_is_read(store->newsrc, folder->full_name, n))
+		mi->flags |= CAMEL_MESSAGE_SEEN;
+}
+
+/* Add the messages of one xover response to the summary */
 static int
-add_range_xover(CamelNNTPSummary *cns, CamelNNTPStore *store, unsigned int high, unsigned int low, CamelFolderChangeInfo *changes, CamelException *ex)
+xover_read(CamelNNTPSummary *cns, CamelNNTPStore *store, CamelFolderChangeInfo *changes, unsigned int *count, unsigned int total, unsigned int *acnt, CamelException *ex)
 {
-	CamelFolderSummary *s;
+	CamelFolderSummary *s = (CamelFolderSummary *)cns;
 	CamelMessageInfoBase *mi;
 	struct _camel_lite_header_raw *headers = NULL;
 	char *line, *tab;
 	int len, ret;
-	unsigned int n, count, total, size, acnt=0;
+	unsigned int n, size;
 	struct _xover_header *xover;
 
-	s = (CamelFolderSummary *)cns;
-
-	camel_lite_operation_start(NULL, _("%s: Scanning new messages"), ((CamelService *)store)->url->host);
-
-	ret = camel_lite_nntp_raw_command_auth(store, ex, &line, "xover %r", low, high);
-	if (ret != 224) {
-		camel_lite_operation_end(NULL);
-		if (ret != -1)
-			camel_lite_exception_setv(ex, CAMEL_EXCEPTION_SYSTEM,
-					     _("Unexpected server response from xover: %s"), line);
-		return -1;
-	}
-
-	count = 0;
-	total = high-low+1;
-
-	camel_lite_folder_summary_prepare_hash (s);
-
 	while ((ret = camel_lite_nntp_stream_line(store->stream, (unsigned char **)&line, (unsigned int *) &len)) > 0) {
-		camel_lite_operation_progress(NULL, (count) , total);
-		count++;
+		camel_lite_operation_progress(NULL, (*count) , total);
+		(*count)++;
 		n = strtoul(line, &tab, 10);
 		if (*tab != '\t')
 			continue;
@@ -286,16 +318,17 @@ add_range_xover(CamelNNTPSummary *cns, CamelNNTPStore *store, unsigned int high,
 			if (mi == NULL) {
 				gchar *nuid;
 
-				if (acnt > 1000) {
+				if (*acnt > 1000) {
 					camel_lite_folder_summary_save (s, ex);
-					acnt = 0;
+					*acnt = 0;
 				}
-				acnt++;
+				(*acnt)++;
 				nuid = camel_lite_folder_summary_next_uid_string (s);
 				mi = (CamelMessageInfoBase *)camel_lite_folder_summary_add_from_header(s, headers, nuid);
 				g_free (nuid);
 				if (mi) {
 					mi->size = (size);
+					newsrc_flags(cns, store, mi, n);
 					cns->high = n;
 					camel_lite_folder_change_info_add_uid(changes, camel_lite_message_info_uid(mi));
 				}
@@ -312,6 +345,81 @@ add_range_xover(CamelNNTPSummary *cns, CamelNNTPStore *store, unsigned int high,
 		camel_lite_header_raw_clear(&headers);
 	}
 
+	return ret;
+}
+
+/* Note: This will be called from camel_lite_nntp_command, so only use camel_lite_nntp_raw_command */
+static int
+add_range_xover(CamelNNTPSummary *cns, CamelNNTPStore *store, unsigned int high, unsigned int low, CamelFolderChangeInfo *changes, CamelException *ex)
+{
+	CamelFolderSummary *s;
+	char *line;
+	int ret, outstanding = 0;
+	unsigned int count, total, acnt=0, next, last;
+
+	s = (CamelFolderSummary *)cns;
+
+	camel_lite_operation_start(NULL, _("%s: Scanning new messages"), ((CamelService *)store)->url->host);
+
+	/* the first window goes alone, the server may want us to authenticate */
+	last = MIN(high, low + NNTP_XOVER_WINDOW - 1);
+	ret = camel_lite_nntp_raw_command_auth(store, ex, &line, "xover %r", low, last);
+	/* 420/423: no articles in that window */
+	if (ret != 224 && ret != 420 && ret != 423) {
+		camel_lite_operation_end(NULL);
+		if (ret != -1)
+			camel_lite_exception_setv(ex, CAMEL_EXCEPTION_SYSTEM,
+					     _("Unexpected server response from xover: %s"), line);
+		return -1;
+	}
+	next = last + 1;
+
+	count = 0;
+	total = high-low+1;
+
+	camel_lite_folder_summary_prepare_hash (s);
+
+	for (;;) {
+		if (ret == 224) {
+			ret = xover_read(cns, store, changes, &count, total, &acnt, ex);
+			if (ret < 0)
+				break;
+		}
+
+		/* keep the next windows coming while this one is parsed */
+		while (outstanding < NNTP_XOVER_DEPTH && next <= high && next > last) {
+			last = MIN(high, next + NNTP_XOVER_WINDOW - 1);
+			if (camel_lite_nntp_raw_command_send(store, ex, "xover %r", next, last) == -1) {
+				ret = -1;
+				goto ioerror;
+			}
+			outstanding++;
+			next = last + 1;
+		}
+
+		if (outstanding == 0) {
+			ret = 0;
+			break;
+		}
+
+		ret = camel_lite_nntp_raw_command_response(store, ex, &line);
+		outstanding--;
+		if (ret == -1)
+			break;
+		if (ret != 224 && ret != 420 && ret != 423) {
+			camel_lite_exception_setv(ex, CAMEL_EXCEPTION_SYSTEM,
+					     _("Unexpected server response from xover: %s"), line);
+			drain_responses(store, outstanding);
+			outstanding = 0;
+			ret = -1;
+			break;
+		}
+	}
+
+ioerror:
+	if (ret == -1)
+		abandon_responses(store, outstanding);
+
 	camel_lite_folder_summary_kill_hash (s);
 
 	camel_lite_operation_end(NULL);
@@ -324,9 +432,10 @@ static int
 add_range_head(CamelNNTPSummary *cns, CamelNNTPStore *store, unsigned int high, unsigned int low, CamelFolderChangeInfo *changes, CamelException *ex)
 {
 	CamelFolderSummary *s;
-	int ret = -1;
+	int ret = -1, outstanding = 0;
 	char *line, *msgid;
-	unsigned int i, n, count, total, acnt=0;
+	unsigned char *data;
+	unsigned int i, n, count, total, acnt=0, next, len;
 	CamelMessageInfo *mi;
 	CamelMimeParser *mp;
 
@@ -341,17 +450,24 @@ add_range_head(CamelNNTPSummary *cns, CamelNNTPStore *store, unsigned int high,
 
 	camel_lite_folder_summary_prepare_hash (s);
 
-	for (i=low;i<high+1;i++) {
+	/* the first article goes alone, the server may want us to
+	   authenticate, the others are pipelined */
+	ret = camel_lite_nntp_raw_command_auth(store, ex, &line, "head %u", low);
+	next = low + 1;
+
+	for (i = low;; i++) {
 		camel_lite_operation_progress(NULL, (count) , total);
 		count++;
-		ret = camel_lite_nntp_raw_command_auth(store, ex, &line, "head %u", i);
 		/* unknown article, ignore */
 		if (ret == 423)
-			continue;
+			goto more;
 		else if (ret == -1)
 			goto ioerror;
 		else if (ret != 221) {
 			camel_lite_exception_setv(ex, CAMEL_EXCEPTION_SYSTEM, _("Unexpected server response from head: %s"), line);
+			drain_responses(store, outstanding);
+			outstanding = 0;
+			ret = -1;
 			goto ioerror;
 		}
 		line += 3;
@@ -366,8 +482,10 @@ add_range_head(CamelNNTPSummary *cns, CamelNNTPStore *store, unsigned int high,
 
 			mi = camel_lite_folder_summary_uid(s, cns->priv->uid);
 			if (mi == NULL) {
-				if (camel_lite_mime_parser_init_with_stream(mp, (CamelStream *)store->stream) == -1)
+				if (camel_lite_mime_parser_init_with_stream(mp, (CamelStream *)store->stream) == -1) {
+					ret = -1;
 					goto error;
+				}
 				if (acnt > 1000) {
 					camel_lite_folder_summary_save (s, ex);
 					acnt = 0;
@@ -377,8 +495,10 @@ add_range_head(CamelNNTPSummary *cns, CamelNNTPStore *store, unsigned int high,
 				while (camel_lite_mime_parser_step(mp, NULL, NULL) != CAMEL_MIME_PARSER_STATE_EOF)
 					;
 				if (mi == NULL) {
+					ret = -1;
 					goto error;
 				}
+				newsrc_flags(cns, store, (CamelMessageInfoBase *)mi, n);
 				cns->high = i;
 				camel_lite_folder_change_info_add_uid(changes, camel_lite_message_info_uid(mi));
 			} else {
@@ -390,6 +510,30 @@ add_range_head(CamelNNTPSummary *cns, CamelNNTPStore *store, unsigned int high,
 				cns->priv->uid = NULL;
 			}
 		}
+
+		/* the headers weren't wanted, skip them */
+		if (store->stream->mode == CAMEL_NNTP_STREAM_DATA) {
+			while ((ret = camel_lite_nntp_stream_line(store->stream, &data, &len)) > 0)
+				;
+			if (ret == -1)
+				goto error;
+		}
+
+	more:
+		while (outstanding < NNTP_HEAD_DEPTH && next <= high && next > low) {
+			if (camel_lite_nntp_raw_command_send(store, ex, "head %u", next) == -1) {
+				ret = -1;
+				goto ioerror;
+			}
+			outstanding++;
+			next++;
+		}
+
+		if (outstanding == 0)
+			break;
+
+		ret = camel_lite_nntp_raw_command_response(store, ex, &line);
+		outstanding--;
 	}
 
 	ret = 0;
@@ -402,6 +546,8 @@ error:
 			camel_lite_exception_setv(ex, CAMEL_EXCEPTION_SYSTEM, _("Operation failed: %s"), strerror(errno));
 	}
 ioerror:
+	if (ret == -1)
+		abandon_responses(store, outstanding);
 
 	camel_lite_folder_summary_kill_hash (s);
 
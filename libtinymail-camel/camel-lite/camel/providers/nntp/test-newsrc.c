@@ -1,10 +1,55 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <glib.h>
 #include "camel-nntp-newsrc.h"
 
+#define BENCH_GROUP "camel.bench"
+
+/* test-newsrc SERVER bench [ARTICLES]: time marking and checking read
+   articles in a busy group, nothing is written back */
+static void
+bench (CamelNNTPNewsrc *newsrc, int articles)
+{
+  GTimer *timer = g_timer_new ();
+  guint *nums;
+  int i, read = 0;
+
+  camel_lite_nntp_newsrc_subscribe_group (newsrc, BENCH_GROUP);
+
+  /* every other article, the worst case for the number of ranges */
+  g_timer_start (timer);
+  for (i = 1; i <= articles; i += 2)
+    camel_lite_nntp_newsrc_mark_article_read (newsrc, BENCH_GROUP, i);
+  printf ("mark %d single articles: %.3fs\n", articles / 2, g_timer_elapsed (timer, NULL));
+
+  g_timer_start (timer);
+  for (i = 1; i <= articles; i++)
+    read += camel_lite_nntp_newsrc_article_is_read (newsrc, BENCH_GROUP, i);
+  printf ("check %d articles (%d read): %.3fs\n", articles, read, g_timer_elapsed (timer, NULL));
+
+  nums = g_new (guint, articles / 2);
+  for (i = 0; i < articles / 2; i++)
+    nums[i] = articles - 2 * i;
+  g_timer_start (timer);
+  camel_lite_nntp_newsrc_mark_articles_read (newsrc, BENCH_GROUP, nums, articles / 2);
+  printf ("mark the other %d at once: %.3fs (%d read)\n", articles / 2,
+	  g_timer_elapsed (timer, NULL),
+	  camel_lite_nntp_newsrc_get_num_articles_read (newsrc, BENCH_GROUP));
+  g_free (nums);
+
+  g_timer_destroy (timer);
+}
+
 int
 main(int argc, char *argv[])
 {
   CamelNNTPNewsrc *newsrc = camel_lite_nntp_newsrc_read_for_server (argv[1]);
+
+  if (argc > 2 && !strcmp (argv[2], "bench")) {
+    bench (newsrc, argc > 3 ? atoi (argv[3]) : 100000);
+    return 0;
+  }
+
   camel_lite_nntp_newsrc_write_to_file (newsrc, stdout);
 }
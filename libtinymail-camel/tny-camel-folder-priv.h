@@ -22,6 +22,7 @@
 #include <glib.h>
 #include <camel/camel-folder.h>
 #include <camel/camel-store.h>
+#include <camel/camel-folder-thread.h>
 #include <tny-account.h>
 #include <tny-folder.h>
 
@@ -57,6 +58,8 @@ struct _TnyCamelFolderPriv
 	GList *obs, *sobs;
 	gboolean cant_reuse_iter;
 	gboolean ongoing_poke_status;
+	CamelFolderThread *threads;
+	gboolean threads_dirty;
 };
 
 CamelFolder* _tny_camel_folder_get_camel_folder (TnyCamelFolder *self);
@@ -88,9 +91,14 @@ void _tny_camel_folder_remove_folder_actual (TnyFolderStore *self, TnyFolder *fo
 
 void _tny_camel_folder_freeup_observers (TnyCamelFolder *self, TnyCamelFolderPriv *priv);
 void _tny_camel_folder_track_folder_changed (TnyCamelFolder *self, CamelFolder *folder);
+void _tny_camel_folder_set_status (TnyCamelFolder *self, gint unread, gint total);
+gboolean _tny_camel_folder_poke_status_done (TnyCamelFolder *self, gint unread, gint total);
 
 CamelFolder* _tny_camel_folder_get_folder (TnyCamelFolder *self);
 
+typedef void (*TnyCamelPrefetchCallback) (TnyCamelFolder *self, TnyHeader *header, gboolean cancelled, gsize bytes, GError *err, gpointer user_data);
+void _tny_camel_folder_prefetch_msg_async (TnyCamelFolder *self, TnyHeader *header, gboolean text_only, TnyCamelPrefetchCallback callback, gpointer user_data);
+
 #define TNY_CAMEL_FOLDER_GET_PRIVATE(o)	\
 	(G_TYPE_INSTANCE_GET_PRIVATE ((o), TNY_TYPE_CAMEL_FOLDER, TnyCamelFolderPriv))
 
@@ -70,6 +70,8 @@
 #include <tny-camel-msg-remove-strategy.h>
 #include <tny-camel-full-msg-receive-strategy.h>
 #include <tny-camel-partial-msg-receive-strategy.h>
+#include <tny-camel-bs-msg-receive-strategy.h>
+#include <tny-camel-stream.h>
 #include <tny-session-camel.h>
 
 #include "tny-camel-account-priv.h"
@@ -91,6 +93,8 @@ static GObjectClass *parent_class = NULL;
 static void tny_camel_folder_transfer_msgs_shared (TnyFolder *self, TnyList *headers, TnyFolder *folder_dst, gboolean delete_originals, TnyList *new_headers, GError **err);
 static gboolean load_folder_no_lock (TnyCamelFolderPriv *priv);
 static void folder_changed (CamelFolder *camel_folder, CamelFolderChangeInfo *info, gpointer user_data);
+static void threads_save_no_lock (TnyCamelFolderPriv *priv, gboolean destroy);
+static void threads_update_no_lock (TnyCamelFolderPriv *priv, CamelFolderChangeInfo *info);
 
 
 
@@ -389,6 +393,42 @@ _tny_camel_folder_check_unread_count (TnyCamelFolder *self)
 	g_object_unref (change);
 }
 
+/* Counts pushed by the server for a folder which isn't selected, a
+   count of -1 means the server didn't tell so we ask for it. This runs
+   in the push connection's thread, hence the folder_lock */
+void 
+_tny_camel_folder_set_status (TnyCamelFolder *self, gint unread, gint total)
+{
+	TnyFolderChange *change;
+	TnyCamelFolderPriv *priv = TNY_CAMEL_FOLDER_GET_PRIVATE (self);
+
+	if (unread < 0 || total < 0) {
+		tny_folder_poke_status (TNY_FOLDER (self));
+		return;
+	}
+
+	g_static_rec_mutex_lock (priv->folder_lock);
+
+	if (priv->unread_length == (guint) unread && priv->cached_length == (guint) total) {
+		g_static_rec_mutex_unlock (priv->folder_lock);
+		return;
+	}
+
+	priv->unread_length = unread;
+	priv->cached_length = total;
+	priv->unread_read = TRUE;
+	update_iter_counts (priv);
+
+	g_static_rec_mutex_unlock (priv->folder_lock);
+
+	change = tny_folder_change_new (TNY_FOLDER (self));
+	tny_folder_change_set_new_unread_count (change, unread);
+	tny_folder_change_set_new_all_count (change, total);
+	notify_folder_observers_about_in_idle (TNY_FOLDER (self), change, 
+		TNY_FOLDER_PRIV_GET_SESSION (priv));
+	g_object_unref (change);
+}
+
 static void 
 folder_tracking_changed (CamelFolder *camel_folder, CamelFolderChangeInfo *info, gpointer user_data)
 {
@@ -515,6 +555,9 @@ folder_changed (CamelFolder *camel_folder, CamelFolderChangeInfo *info, gpointer
 			}
 		}
 
+		if (priv->threads)
+			threads_update_no_lock (priv, info);
+
 		update_iter_counts (priv);
 
 		g_static_rec_mutex_unlock (priv->folder_lock);
@@ -561,6 +604,9 @@ unload_folder_no_lock (TnyCamelFolderPriv *priv, gboolean destroy)
 
 		camel_lite_folder_set_push_email (priv->folder, FALSE);
 
+		/* the threads hold a reference on the folder */
+		threads_save_no_lock (priv, TRUE);
+
 		/* printf ("UNLOAD (%s): %d\n",
 				priv->folder_name?priv->folder_name:"NUL",
 				(((CamelObject*)priv->folder)->ref_count));  */
@@ -1703,6 +1749,7 @@ tny_camel_folder_sync_default (TnyFolder *self, gboolean expunge, GError **err)
 		}
 
 	camel_lite_folder_sync (priv->folder, expunge, &ex);
+	threads_save_no_lock (priv, FALSE);
 	_tny_camel_folder_reason (priv);
 	_tny_camel_folder_check_unread_count (TNY_CAMEL_FOLDER (self));
 	reset_local_size (priv);
@@ -1838,6 +1885,7 @@ tny_camel_folder_sync_async_thread (gpointer thr_user_data)
 		priv->want_changes = FALSE;
 		camel_lite_folder_sync (priv->folder, info->expunge, &ex);
 		priv->want_changes = TRUE;
+		threads_save_no_lock (priv, FALSE);
 
 		if (apriv)
 			info->cancelled = camel_lite_operation_cancel_check (apriv->cancel);
@@ -2019,6 +2067,22 @@ tny_camel_folder_refresh_async_callback (gpointer thr_user_data)
 	return FALSE;
 }
 
+/* A refresh can report its new headers in many small changes, observers
+   get them merged into one per REFRESH_CHANGE_WINDOW milliseconds */
+#define REFRESH_CHANGE_WINDOW 250
+
+static void
+refresh_info_batched (CamelFolder *folder, CamelException *ex)
+{
+	guint window = camel_lite_folder_get_change_window (folder);
+
+	if (window == 0)
+		camel_lite_folder_set_change_window (folder, REFRESH_CHANGE_WINDOW);
+	camel_lite_folder_refresh_info (folder, ex);
+	if (window == 0)
+		camel_lite_folder_set_change_window (folder, 0);
+}
+
 
 static void
 tny_camel_folder_refresh_async_status (struct _CamelOperation *op, const char *what, int sofar, int oftotal, void *thr_user_data)
@@ -2066,7 +2130,7 @@ tny_camel_folder_refresh_async_thread (gpointer thr_user_data)
 	if (load_folder_no_lock (priv))
 	{
 		priv->want_changes = FALSE;
-		camel_lite_folder_refresh_info (priv->folder, &ex);
+		refresh_info_batched (priv->folder, &ex);
 		priv->want_changes = TRUE;
 
 		info->cancelled = camel_lite_operation_cancel_check (apriv->cancel);
@@ -2237,7 +2301,7 @@ tny_camel_folder_refresh_default (TnyFolder *self, GError **err)
 	oldurlen = priv->unread_length;
 
 	priv->want_changes = FALSE;
-	camel_lite_folder_refresh_info (priv->folder, &ex);
+	refresh_info_batched (priv->folder, &ex);
 	priv->want_changes = TRUE;
 
 	priv->cached_length = camel_lite_folder_get_message_count (priv->folder);    
@@ -2583,6 +2647,362 @@ tny_camel_folder_get_headers_default (TnyFolder *self, TnyList *headers, gboolea
 }
 
 
+static gchar *
+threads_path (TnyCamelFolderPriv *priv)
+{
+	CamelFolderSummary *summary = priv->folder ? priv->folder->summary : NULL;
+
+	if (summary && summary->summary_path)
+		return g_strdup_printf ("%s.threads", summary->summary_path);
+
+	return NULL;
+}
+
+/* must hold folder_lock, with the folder loaded */
+static void
+threads_load_no_lock (TnyCamelFolderPriv *priv)
+{
+	gchar *path;
+
+	if (priv->threads)
+		return;
+
+	path = threads_path (priv);
+	if (path)
+		priv->threads = camel_lite_folder_thread_messages_load (priv->folder, path, TRUE);
+	else
+		priv->threads = camel_lite_folder_thread_messages_new (priv->folder, NULL, TRUE);
+	g_free (path);
+
+	/* store whatever got added to or rebuilt from the file */
+	priv->threads_dirty = TRUE;
+}
+
+/* must hold folder_lock */
+static void
+threads_save_no_lock (TnyCamelFolderPriv *priv, gboolean destroy)
+{
+	gchar *path;
+
+	if (!priv->threads)
+		return;
+
+	if (priv->threads_dirty && (path = threads_path (priv))) {
+		if (camel_lite_folder_thread_messages_save (priv->threads, path) == 0)
+			priv->threads_dirty = FALSE;
+		g_free (path);
+	}
+
+	if (destroy) {
+		camel_lite_folder_thread_messages_unref (priv->threads);
+		priv->threads = NULL;
+	}
+}
+
+/* must hold folder_lock */
+static void
+threads_update_no_lock (TnyCamelFolderPriv *priv, CamelFolderChangeInfo *info)
+{
+	CamelMessageInfo *minfo;
+	GPtrArray *added;
+	guint i;
+
+	if (info->uid_removed && info->uid_removed->len > 0) {
+		camel_lite_folder_thread_messages_remove (priv->threads, info->uid_removed);
+		priv->threads_dirty = TRUE;
+	}
+
+	if (info->uid_added && info->uid_added->len > 0) {
+		added = g_ptr_array_sized_new (info->uid_added->len);
+		for (i = 0; i < info->uid_added->len; i++) {
+			minfo = camel_lite_folder_summary_uid (priv->folder->summary, 
+				info->uid_added->pdata[i]);
+			if (minfo)
+				g_ptr_array_add (added, minfo);
+		}
+
+		camel_lite_folder_thread_messages_add (priv->threads, added);
+
+		for (i = 0; i < added->len; i++)
+			camel_lite_message_info_free (added->pdata[i]);
+		g_ptr_array_free (added, TRUE);
+		priv->threads_dirty = TRUE;
+	}
+}
+
+static void
+add_thread_nodes (TnyCamelFolder *self, TnyCamelFolderPriv *priv, CamelFolderThreadNode *node, TnyList *list)
+{
+	TnyHeader *header;
+
+	for (; node; node = node->next) {
+		/* an empty container groups replies to a message which isn't
+		   there, those replies take its place */
+		if (!node->message) {
+			add_thread_nodes (self, priv, node->child, list);
+			continue;
+		}
+		header = _tny_camel_header_new ();
+		_tny_camel_header_set_folder ((TnyCamelHeader *) header, self, priv);
+		_tny_camel_header_set_camel_message_info ((TnyCamelHeader *) header, 
+			(CamelMessageInfo *) node->message, FALSE);
+		tny_list_append (list, (GObject *) header);
+		g_object_unref (header);
+	}
+}
+
+/**
+ * tny_camel_folder_get_threads:
+ * @self: A #TnyCamelFolder object
+ * @threads: A #TnyList to which the threads will be added
+ * @err: A #GError or NULL
+ *
+ * Get the conversations of @self, oldest first.  Each one is added to
+ * @threads as the header of the message it starts with, use
+ * tny_camel_folder_get_thread_replies() to walk down it.
+ *
+ * The threads are kept up to date as messages get added and removed,
+ * and are stored next to the summary of the folder, so the folder is
+ * only threaded from scratch the first time.
+ **/
+void
+tny_camel_folder_get_threads (TnyCamelFolder *self, TnyList *threads, GError **err)
+{
+	TnyCamelFolderPriv *priv = TNY_CAMEL_FOLDER_GET_PRIVATE (self);
+
+	g_assert (TNY_IS_LIST (threads));
+
+	g_static_rec_mutex_lock (priv->folder_lock);
+
+	if (!load_folder_no_lock (priv))
+	{
+		_tny_camel_exception_to_tny_error (&priv->load_ex, err);
+		camel_lite_exception_clear (&priv->load_ex);
+		g_static_rec_mutex_unlock (priv->folder_lock);
+		return;
+	}
+
+	_tny_camel_folder_reason (priv);
+	threads_load_no_lock (priv);
+	add_thread_nodes (self, priv, priv->threads->tree, threads);
+	_tny_camel_folder_unreason (priv);
+
+	g_static_rec_mutex_unlock (priv->folder_lock);
+
+	return;
+}
+
+/**
+ * tny_camel_folder_get_thread_replies:
+ * @self: A #TnyCamelFolder object
+ * @header: A header from tny_camel_folder_get_threads() or from this function
+ * @replies: A #TnyList to which the replies will be added
+ *
+ * Get the direct replies to @header in its conversation, oldest first.
+ * Replies to a message which isn't in @self are listed along with
+ * the message they reply to.
+ **/
+void
+tny_camel_folder_get_thread_replies (TnyCamelFolder *self, TnyHeader *header, TnyList *replies)
+{
+	TnyCamelFolderPriv *priv = TNY_CAMEL_FOLDER_GET_PRIVATE (self);
+	CamelFolderThreadNode *node;
+	gchar *uid;
+
+	g_assert (TNY_IS_HEADER (header));
+	g_assert (TNY_IS_LIST (replies));
+
+	uid = tny_header_dup_uid (header);
+	if (!uid)
+		return;
+
+	g_static_rec_mutex_lock (priv->folder_lock);
+
+	if (!load_folder_no_lock (priv)) {
+		camel_lite_exception_clear (&priv->load_ex);
+		g_static_rec_mutex_unlock (priv->folder_lock);
+		g_free (uid);
+		return;
+	}
+
+	_tny_camel_folder_reason (priv);
+	threads_load_no_lock (priv);
+	if ((node = camel_lite_folder_thread_messages_find (priv->threads, uid)))
+		add_thread_nodes (self, priv, node->child, replies);
+	_tny_camel_folder_unreason (priv);
+
+	g_static_rec_mutex_unlock (priv->folder_lock);
+	g_free (uid);
+
+	return;
+}
+
+/**
+ * tny_camel_folder_get_sorted_uids:
+ * @self: A #TnyCamelFolder object
+ * @criteria: RFC 5256 sort criteria, like "REVERSE DATE" or "SUBJECT"
+ * @err: A #GError or NULL
+ *
+ * Get the uids of the messages in @self in the order of @criteria, as
+ * sorted by the server.  Unlike sorting the headers of the folder this
+ * also covers the messages of which no header has been fetched yet, so
+ * the order is right for a folder that is only partly synchronized.
+ *
+ * Return value: A NULL terminated array of uids to free with g_strfreev(),
+ * or NULL.  If the server can't sort NULL is returned without setting
+ * @err, the caller should then sort the headers itself.
+ **/
+gchar**
+tny_camel_folder_get_sorted_uids (TnyCamelFolder *self, const gchar *criteria, GError **err)
+{
+	TnyCamelFolderPriv *priv = TNY_CAMEL_FOLDER_GET_PRIVATE (self);
+	CamelException ex = CAMEL_EXCEPTION_INITIALISER;
+	GPtrArray *sorted;
+	gchar **uids = NULL;
+	guint i;
+
+	if (!_tny_session_check_operation (TNY_FOLDER_PRIV_GET_SESSION(priv), 
+			priv->account, err, TNY_ERROR_DOMAIN,
+			TNY_SERVICE_ERROR_UNKNOWN))
+		return NULL;
+
+	g_static_rec_mutex_lock (priv->folder_lock);
+
+	if (!load_folder_no_lock (priv))
+	{
+		_tny_camel_exception_to_tny_error (&priv->load_ex, err);
+		camel_lite_exception_clear (&priv->load_ex);
+		g_static_rec_mutex_unlock (priv->folder_lock);
+		_tny_session_stop_operation (TNY_FOLDER_PRIV_GET_SESSION (priv));
+		return NULL;
+	}
+
+	_tny_camel_folder_reason (priv);
+	sorted = camel_lite_folder_sort_uids (priv->folder, criteria, &ex);
+	_tny_camel_folder_unreason (priv);
+
+	g_static_rec_mutex_unlock (priv->folder_lock);
+
+	if (sorted) {
+		uids = g_new (gchar *, sorted->len + 1);
+		for (i = 0; i < sorted->len; i++)
+			uids[i] = sorted->pdata[i];
+		uids[i] = NULL;
+		g_ptr_array_free (sorted, TRUE);
+	}
+
+	if (camel_lite_exception_is_set (&ex)) {
+		_tny_camel_exception_to_tny_error (&ex, err);
+		camel_lite_exception_clear (&ex);
+	}
+
+	_tny_session_stop_operation (TNY_FOLDER_PRIV_GET_SESSION (priv));
+
+	return uids;
+}
+
+/**
+ * tny_camel_folder_run_filters:
+ * @self: A #TnyCamelFolder object
+ * @headers: the headers of the messages to filter, or NULL for all of them
+ * @rules: a NULL terminated array of match and action expression pairs
+ * @err: A #GError or NULL
+ *
+ * Run filter rules over messages in @self.  Each rule is a match
+ * expression, like (match-all (header-contains "subject" "spam")),
+ * followed by an action expression, like (move-to "imap://user@host/Junk").
+ * Folders in actions are named by their url strings, as returned by
+ * tny_folder_get_url_string().
+ *
+ * All messages are matched before anything is done to them.  Messages
+ * going to the same folder are then transferred together, in one
+ * operation per destination, and flag changes are applied in one go.
+ **/
+void
+tny_camel_folder_run_filters (TnyCamelFolder *self, TnyList *headers, const gchar **rules, GError **err)
+{
+	TnyCamelFolderPriv *priv = TNY_CAMEL_FOLDER_GET_PRIVATE (self);
+	CamelException ex = CAMEL_EXCEPTION_INITIALISER;
+	CamelFilterDriver *driver;
+	GPtrArray *uids = NULL;
+	guint i;
+
+	g_assert (rules != NULL);
+
+	if (!_tny_session_check_operation (TNY_FOLDER_PRIV_GET_SESSION(priv), 
+			priv->account, err, TNY_ERROR_DOMAIN,
+			TNY_SERVICE_ERROR_UNKNOWN))
+		return;
+
+	driver = camel_lite_session_get_filter_driver (
+		(CamelSession *) TNY_FOLDER_PRIV_GET_SESSION (priv), "incoming", &ex);
+	if (!driver) {
+		_tny_camel_exception_to_tny_error (&ex, err);
+		camel_lite_exception_clear (&ex);
+		_tny_session_stop_operation (TNY_FOLDER_PRIV_GET_SESSION (priv));
+		return;
+	}
+
+	for (i = 0; rules[i] && rules[i + 1]; i += 2) {
+		gchar *name = g_strdup_printf ("rule %d", i / 2 + 1);
+		camel_lite_filter_driver_add_rule (driver, name, rules[i], rules[i + 1]);
+		g_free (name);
+	}
+	camel_lite_filter_driver_set_batch (driver, TRUE);
+
+	if (headers) {
+		TnyIterator *iter = tny_list_create_iterator (headers);
+
+		uids = g_ptr_array_new ();
+		while (!tny_iterator_is_done (iter)) {
+			TnyHeader *header = TNY_HEADER (tny_iterator_get_current (iter));
+			gchar *uid = tny_header_dup_uid (header);
+
+			if (uid)
+				g_ptr_array_add (uids, uid);
+			g_object_unref (header);
+			tny_iterator_next (iter);
+		}
+		g_object_unref (iter);
+	}
+
+	g_static_rec_mutex_lock (priv->folder_lock);
+
+	if (!load_folder_no_lock (priv))
+	{
+		_tny_camel_exception_to_tny_error (&priv->load_ex, err);
+		camel_lite_exception_clear (&priv->load_ex);
+	} else {
+		_tny_camel_folder_reason (priv);
+		camel_lite_filter_driver_filter_folder (driver, priv->folder, NULL, uids, FALSE, &ex);
+		camel_lite_filter_driver_flush (driver, &ex);
+		_tny_camel_folder_unreason (priv);
+
+		_tny_camel_folder_check_unread_count (self);
+		reset_local_size (priv);
+	}
+
+	g_static_rec_mutex_unlock (priv->folder_lock);
+
+	/* closes the folders the rules opened */
+	camel_lite_object_unref (driver);
+
+	if (uids) {
+		for (i = 0; i < uids->len; i++)
+			g_free (uids->pdata[i]);
+		g_ptr_array_free (uids, TRUE);
+	}
+
+	if (camel_lite_exception_is_set (&ex)) {
+		_tny_camel_exception_to_tny_error (&ex, err);
+		camel_lite_exception_clear (&ex);
+	}
+
+	_tny_session_stop_operation (TNY_FOLDER_PRIV_GET_SESSION (priv));
+
+	return;
+}
+
 
 typedef struct 
 {
@@ -2832,6 +3252,216 @@ tny_camel_folder_get_msg_async_default (TnyFolder *self, TnyHeader *header, TnyG
 }
 
 
+typedef struct 
+{
+	TnyCamelQueueable parent;
+
+	TnyFolder *self;
+	TnyHeader *header;
+	gboolean text_only;
+	gsize bytes;
+	GError *err;
+	TnyCamelPrefetchCallback callback;
+	gpointer user_data;
+	gboolean cancelled;
+
+} PrefetchInfo;
+
+/* Write the leaf parts of a bodystructure message to a null stream,
+ * which makes the strategy fetch them into the part cache. Returns the
+ * amount of decoded bytes that went through. */
+static gsize
+prefetch_parts (TnyMimePart *part, gboolean text_only, GError **err)
+{
+	TnyList *parts = tny_simple_list_new ();
+	TnyIterator *iter;
+	gsize bytes = 0;
+
+	tny_mime_part_get_parts (part, parts);
+
+	if (tny_list_get_length (parts) == 0) {
+		if (!text_only || (tny_mime_part_content_type_is (part, "text/*") &&
+		                   !tny_mime_part_is_attachment (part))) 
+		{
+			CamelStream *null_stream = camel_lite_stream_null_new ();
+			TnyStream *tny_null_stream = tny_camel_stream_new (null_stream);
+
+			tny_mime_part_write_to_stream (part, tny_null_stream, err);
+			bytes = CAMEL_STREAM_NULL (null_stream)->written;
+
+			g_object_unref (tny_null_stream);
+			camel_lite_object_unref (null_stream);
+		}
+	}
+
+	iter = tny_list_create_iterator (parts);
+	while (!tny_iterator_is_done (iter) && (err == NULL || *err == NULL))
+	{
+		TnyMimePart *child = TNY_MIME_PART (tny_iterator_get_current (iter));
+		bytes += prefetch_parts (child, text_only, err);
+		g_object_unref (child);
+		tny_iterator_next (iter);
+	}
+	g_object_unref (iter);
+	g_object_unref (parts);
+
+	return bytes;
+}
+
+static gpointer 
+tny_camel_folder_prefetch_msg_async_thread (gpointer thr_user_data)
+{
+	PrefetchInfo *info = (PrefetchInfo *) thr_user_data;
+	TnyCamelFolderPriv *priv = TNY_CAMEL_FOLDER_GET_PRIVATE (info->self);
+	CamelOperation *cancel;
+	TnyMsg *msg;
+
+	/* Unlike get_msg this isn't registered as the account's getmsg_cancel,
+	 * cancelling a message the user asked for mustn't hit a prefetch */
+
+	cancel = camel_lite_operation_new (NULL, NULL);
+	camel_lite_operation_register (cancel);
+	camel_lite_operation_start (cancel, (char *) "Prefetching message");
+
+	info->bytes = 0;
+
+	if (TNY_IS_CAMEL_BS_MSG_RECEIVE_STRATEGY (priv->receive_strat)) {
+		msg = tny_msg_receive_strategy_perform_get_msg (priv->receive_strat, 
+			info->self, info->header, &info->err);
+		if (msg) {
+			info->bytes = prefetch_parts (TNY_MIME_PART (msg), 
+				info->text_only, &info->err);
+			g_object_unref (msg);
+		}
+	} else if (!info->text_only) {
+		msg = tny_msg_receive_strategy_perform_get_msg (priv->receive_strat, 
+			info->self, info->header, &info->err);
+		if (msg) {
+			info->bytes = tny_header_get_message_size (info->header);
+			g_object_unref (msg);
+		}
+	}
+
+	reset_local_size (priv);
+
+	info->cancelled = camel_lite_operation_cancel_check (cancel);
+
+	camel_lite_operation_unregister (cancel);
+	camel_lite_operation_end (cancel);
+	camel_lite_operation_unref (cancel);
+
+	if (info->err != NULL) {
+		if (camel_lite_strstrcase (info->err->message, "cancel") != NULL)
+			info->cancelled = TRUE;
+	}
+
+	return NULL;
+}
+
+static gboolean
+tny_camel_folder_prefetch_msg_async_callback (gpointer thr_user_data)
+{
+	PrefetchInfo *info = (PrefetchInfo *) thr_user_data;
+
+	if (info->callback)
+		info->callback (TNY_CAMEL_FOLDER (info->self), info->header, 
+			info->cancelled, info->bytes, info->err, info->user_data);
+
+	return FALSE;
+}
+
+static gboolean
+tny_camel_folder_prefetch_msg_async_cancelled_callback (gpointer thr_user_data)
+{
+	PrefetchInfo *info = (PrefetchInfo *) thr_user_data;
+
+	if (info->callback)
+		info->callback (TNY_CAMEL_FOLDER (info->self), info->header, 
+			TRUE, 0, info->err, info->user_data);
+
+	return FALSE;
+}
+
+static void
+tny_camel_folder_prefetch_msg_async_destroyer (gpointer thr_user_data)
+{
+	PrefetchInfo *info = (PrefetchInfo *) thr_user_data;
+	TnyCamelFolderPriv *priv = TNY_CAMEL_FOLDER_GET_PRIVATE (info->self);
+
+	/* thread reference */
+	_tny_camel_folder_unreason (priv);
+	g_object_unref (info->self);
+	g_object_unref (info->header);
+
+	if (info->err)
+		g_error_free (info->err);
+
+	return;
+}
+
+/**
+ * _tny_camel_folder_prefetch_msg_async:
+ * @self: a #TnyCamelFolder
+ * @header: the header of the message to prefetch
+ * @text_only: only fetch the text parts
+ * @callback: called in the GMainLoop when done, cancelled or failed
+ * @user_data: user data for @callback
+ *
+ * Internal, non-public API documentation of Tinymail
+ *
+ * Get the message of @header into the cache without handing it out and
+ * without notifying the folder's observers. With a bodystructure receive
+ * strategy all leaf parts get fetched into the part cache, or only the 
+ * text parts that aren't attachments if @text_only is set. With other
+ * strategies the strategy fetches the message, unless @text_only is set
+ * in which case nothing happens.
+ *
+ * The item goes on the message queue as an idle item: items launched 
+ * while it is waiting are performed before it.
+ **/
+void
+_tny_camel_folder_prefetch_msg_async (TnyCamelFolder *self, TnyHeader *header, gboolean text_only, TnyCamelPrefetchCallback callback, gpointer user_data)
+{
+	PrefetchInfo *info;
+	TnyCamelFolderPriv *priv = TNY_CAMEL_FOLDER_GET_PRIVATE (self);
+	TnyCamelQueue *queue;
+
+	info = g_slice_new0 (PrefetchInfo);
+	info->self = TNY_FOLDER (self);
+	info->header = header;
+	info->text_only = text_only;
+	info->callback = callback;
+	info->user_data = user_data;
+	info->err = NULL;
+	info->cancelled = FALSE;
+
+	/* thread reference */
+	_tny_camel_folder_reason (priv);
+	g_object_ref (info->self);
+	g_object_ref (info->header);
+
+	if (!TNY_IS_CAMEL_POP_FOLDER (self) && 
+	    !_tny_camel_queue_has_items (TNY_FOLDER_PRIV_GET_QUEUE (priv), 
+					 TNY_CAMEL_QUEUE_RECONNECT_ITEM | TNY_CAMEL_QUEUE_CONNECT_ITEM))
+		queue = TNY_FOLDER_PRIV_GET_MSG_QUEUE (priv);
+	else
+		queue = TNY_FOLDER_PRIV_GET_QUEUE (priv);
+
+	_tny_camel_queue_launch_wflags (queue, 
+		tny_camel_folder_prefetch_msg_async_thread, 
+		tny_camel_folder_prefetch_msg_async_callback,
+		tny_camel_folder_prefetch_msg_async_destroyer, 
+		tny_camel_folder_prefetch_msg_async_cancelled_callback,
+		tny_camel_folder_prefetch_msg_async_destroyer, 
+		&info->cancelled,
+		info, sizeof (PrefetchInfo), 
+		TNY_CAMEL_QUEUE_IDLE_ITEM | TNY_CAMEL_QUEUE_CANCELLABLE_ITEM,
+		__FUNCTION__);
+
+	return;
+}
+
+
 typedef struct 
 {
 	TnyCamelQueueable parent;
@@ -6179,6 +6809,19 @@ tny_camel_folder_poke_status_default (TnyFolder *self)
 		return;
 
 	store = priv->store;
+
+	/* Folders of the same account poked together are asked about
+	 * together, see _tny_camel_store_account_queue_poke_status */
+	if (!priv->folder && store && CAMEL_IS_DISCO_STORE (store) && priv->folder_name 
+		&& TNY_IS_CAMEL_STORE_ACCOUNT (priv->account)
+		&& camel_lite_disco_store_status (CAMEL_DISCO_STORE (store)) == CAMEL_DISCO_STORE_ONLINE)
+	{
+		priv->ongoing_poke_status = TRUE;
+		_tny_camel_store_account_queue_poke_status (TNY_CAMEL_STORE_ACCOUNT (priv->account), 
+			TNY_CAMEL_FOLDER (self));
+		return;
+	}
+
 	info = g_slice_new (PokeStatusInfo);
 
 	priv->ongoing_poke_status = TRUE;
@@ -6223,6 +6866,46 @@ tny_camel_folder_poke_status_default (TnyFolder *self)
 	return;
 }
 
+/* Finishes a poke_status which was queued with the account. A count of
+   -1 means the server couldn't tell, the cached one is used then. Returns
+   whether the counts changed, the folder's observers are told if so. */
+gboolean
+_tny_camel_folder_poke_status_done (TnyCamelFolder *self, gint unread, gint total)
+{
+	TnyCamelFolderPriv *priv = TNY_CAMEL_FOLDER_GET_PRIVATE (self);
+	TnySessionCamel *session = TNY_FOLDER_PRIV_GET_SESSION (priv);
+	TnyFolderChange *change;
+
+	priv->ongoing_poke_status = FALSE;
+
+	if (unread == -1 || total == -1) {
+		if (priv->iter) {
+			unread = priv->iter->unread;
+			total = priv->iter->total;
+		} else {
+			unread = priv->unread_length;
+			total = priv->cached_length;
+		}
+	}
+
+	if ((guint) unread == priv->unread_length && (guint) total == priv->cached_length)
+		return FALSE;
+
+	priv->unread_length = (guint) unread;
+	priv->cached_length = (guint) total;
+	update_iter_counts (priv);
+
+	if (session) {
+		change = tny_folder_change_new (TNY_FOLDER (self));
+		tny_folder_change_set_new_all_count (change, priv->cached_length);
+		tny_folder_change_set_new_unread_count (change, priv->unread_length);
+		notify_folder_observers_about (TNY_FOLDER (self), change, session);
+		g_object_unref (change);
+	}
+
+	return TRUE;
+}
+
 static TnyFolderStore*  
 tny_camel_folder_get_folder_store (TnyFolder *self)
 {
@@ -6604,6 +7287,7 @@ tny_camel_folder_finalize (GObject *object)
 
 	if (G_LIKELY (priv->folder))
 	{
+		threads_save_no_lock (priv, TRUE);
 		camel_lite_object_unref (priv->folder);
 		priv->folder = NULL;
 	}
@@ -105,6 +105,10 @@ GType tny_camel_folder_get_type (void);
 
 
 const gchar* tny_camel_folder_get_full_name (TnyCamelFolder *self);
+void tny_camel_folder_get_threads (TnyCamelFolder *self, TnyList *threads, GError **err);
+void tny_camel_folder_get_thread_replies (TnyCamelFolder *self, TnyHeader *header, TnyList *replies);
+gchar** tny_camel_folder_get_sorted_uids (TnyCamelFolder *self, const gchar *criteria, GError **err);
+void tny_camel_folder_run_filters (TnyCamelFolder *self, TnyList *headers, const gchar **rules, GError **err);
 
 G_END_DECLS
 
@@ -0,0 +1,446 @@
+/* libtinymail-camel - The Tiny Mail base library for Camel
+ * Copyright (C) 2006-2007 Philip Van Hoof <pvanhoof@gnome.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with self library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <config.h>
+#include <glib.h>
+#include <glib/gi18n-lib.h>
+
+#include <tny-camel-prefetcher.h>
+
+#include <tny-header.h>
+#include <tny-camel-folder.h>
+#include <tny-camel-bs-msg-receive-strategy.h>
+#include <tny-camel-partial-msg-receive-strategy.h>
+
+#include "tny-camel-folder-priv.h"
+
+#define TNY_CAMEL_PREFETCHER_DEFAULT_MAX_MSGS 50
+#define TNY_CAMEL_PREFETCHER_DEFAULT_MAX_BYTES (2 * 1024 * 1024)
+#define TNY_CAMEL_PREFETCHER_DEFAULT_MAX_MSG_SIZE (32 * 1024)
+
+static GObjectClass *parent_class = NULL;
+
+typedef struct _TnyCamelPrefetcherPriv TnyCamelPrefetcherPriv;
+
+struct _TnyCamelPrefetcherPriv
+{
+	TnyDevice *device;
+	guint connchanged_signal;
+	gboolean online, paused, busy;
+	TnyFolder *folder;
+	GList *pending;
+	guint max_msgs, msgs;
+	gsize max_bytes, max_msg_size, bytes;
+};
+
+#define TNY_CAMEL_PREFETCHER_GET_PRIVATE(o) \
+	(G_TYPE_INSTANCE_GET_PRIVATE ((o), TNY_TYPE_CAMEL_PREFETCHER, TnyCamelPrefetcherPriv))
+
+static void prefetch_next (TnyCamelPrefetcher *self);
+
+static void
+clear_pending (TnyCamelPrefetcherPriv *priv)
+{
+	g_list_foreach (priv->pending, (GFunc) g_object_unref, NULL);
+	g_list_free (priv->pending);
+	priv->pending = NULL;
+}
+
+static void
+on_prefetched (TnyCamelFolder *folder, TnyHeader *header, gboolean cancelled, gsize bytes, GError *err, gpointer user_data)
+{
+	TnyCamelPrefetcher *self = user_data;
+	TnyCamelPrefetcherPriv *priv = TNY_CAMEL_PREFETCHER_GET_PRIVATE (self);
+
+	priv->busy = FALSE;
+
+	if (cancelled || err) {
+		/* Don't hammer a server that's failing us, or go against a
+		 * cancellation of the account's operations. The next hint 
+		 * starts over */
+		tny_debug ("TnyCamelPrefetcher: backing off (%s)\n", 
+			err ? err->message : "cancelled");
+		clear_pending (priv);
+	} else if (bytes > 0) {
+		priv->msgs++;
+		priv->bytes += bytes;
+	}
+
+	prefetch_next (self);
+
+	/* launch reference */
+	g_object_unref (self);
+}
+
+static void
+prefetch_next (TnyCamelPrefetcher *self)
+{
+	TnyCamelPrefetcherPriv *priv = TNY_CAMEL_PREFETCHER_GET_PRIVATE (self);
+	TnyMsgReceiveStrategy *strat;
+	gboolean bs, partial;
+
+	/* One item at a time, so that a message the user asks for never 
+	 * waits for more than one prefetch on the queue */
+	if (priv->busy || priv->paused || !priv->online || !priv->folder)
+		return;
+
+	strat = tny_folder_get_msg_receive_strategy (priv->folder);
+	bs = TNY_IS_CAMEL_BS_MSG_RECEIVE_STRATEGY (strat);
+	partial = TNY_IS_CAMEL_PARTIAL_MSG_RECEIVE_STRATEGY (strat);
+	g_object_unref (strat);
+
+	while (priv->pending)
+	{
+		TnyHeader *header = priv->pending->data;
+		TnyHeaderFlags flags;
+		gsize size;
+		gboolean text_only;
+
+		priv->pending = g_list_delete_link (priv->pending, priv->pending);
+
+		if (priv->msgs >= priv->max_msgs || priv->bytes >= priv->max_bytes) {
+			g_object_unref (header);
+			clear_pending (priv);
+			break;
+		}
+
+		flags = tny_header_get_flags (header);
+		if (flags & (TNY_HEADER_FLAG_CACHED | TNY_HEADER_FLAG_DELETED | TNY_HEADER_FLAG_EXPUNGED)) {
+			g_object_unref (header);
+			continue;
+		}
+
+		/* The partial strategy only gets the text anyway */
+		size = tny_header_get_message_size (header);
+		text_only = !partial && (size > priv->max_msg_size || 
+			priv->bytes + size > priv->max_bytes);
+
+		if (text_only && !bs) {
+			g_object_unref (header);
+			continue;
+		}
+
+		priv->busy = TRUE;
+
+		/* launch reference */
+		g_object_ref (self);
+		_tny_camel_folder_prefetch_msg_async (TNY_CAMEL_FOLDER (priv->folder), 
+			header, text_only, on_prefetched, self);
+
+		g_object_unref (header);
+		break;
+	}
+
+	return;
+}
+
+static void
+connection_changed (TnyDevice *device, gboolean online, gpointer user_data)
+{
+	TnyCamelPrefetcher *self = user_data;
+	TnyCamelPrefetcherPriv *priv = TNY_CAMEL_PREFETCHER_GET_PRIVATE (self);
+
+	priv->online = online;
+	if (online)
+		prefetch_next (self);
+}
+
+/**
+ * tny_camel_prefetcher_hint:
+ * @self: a #TnyCamelPrefetcher
+ * @folder: a #TnyCamelFolder
+ * @headers: a #TnyList with the #TnyHeader instances that are visible
+ *
+ * Tell @self which headers of @folder are being shown, typically the rows 
+ * of a header view's visible area in display order. This replaces the
+ * previous hint. Messages that aren't cached yet are fetched into the 
+ * cache one by one in the background, the unread ones first.
+ *
+ * Messages up to the maximum message size of the budget are fetched 
+ * with @folder's receive strategy. Of larger messages only the text parts
+ * are fetched if @folder uses a #TnyCamelBsMsgReceiveStrategy, otherwise 
+ * they are skipped.
+ *
+ * The work is queued on @folder's account behind everything else that is
+ * waiting, so that it doesn't delay what the user asked for.
+ **/
+void
+tny_camel_prefetcher_hint (TnyCamelPrefetcher *self, TnyFolder *folder, TnyList *headers)
+{
+	TnyCamelPrefetcherPriv *priv = TNY_CAMEL_PREFETCHER_GET_PRIVATE (self);
+	GList *unread = NULL, *read = NULL;
+	TnyIterator *iter;
+
+	g_return_if_fail (TNY_IS_CAMEL_FOLDER (folder));
+
+	clear_pending (priv);
+
+	if (priv->folder != folder) {
+		if (priv->folder)
+			g_object_unref (priv->folder);
+		priv->folder = TNY_FOLDER (g_object_ref (folder));
+	}
+
+	iter = tny_list_create_iterator (headers);
+	while (!tny_iterator_is_done (iter))
+	{
+		TnyHeader *header = TNY_HEADER (tny_iterator_get_current (iter));
+		TnyHeaderFlags flags = tny_header_get_flags (header);
+
+		if (flags & TNY_HEADER_FLAG_CACHED)
+			g_object_unref (header);
+		else if (flags & TNY_HEADER_FLAG_SEEN)
+			read = g_list_prepend (read, header);
+		else
+			unread = g_list_prepend (unread, header);
+
+		tny_iterator_next (iter);
+	}
+	g_object_unref (iter);
+
+	priv->pending = g_list_concat (g_list_reverse (unread), 
+		g_list_reverse (read));
+
+	prefetch_next (self);
+
+	return;
+}
+
+/**
+ * tny_camel_prefetcher_cancel:
+ * @self: a #TnyCamelPrefetcher
+ *
+ * Forget about the current hint. A message that is already being fetched
+ * will still be completed.
+ **/
+void
+tny_camel_prefetcher_cancel (TnyCamelPrefetcher *self)
+{
+	TnyCamelPrefetcherPriv *priv = TNY_CAMEL_PREFETCHER_GET_PRIVATE (self);
+
+	clear_pending (priv);
+	if (priv->folder)
+		g_object_unref (priv->folder);
+	priv->folder = NULL;
+
+	return;
+}
+
+/**
+ * tny_camel_prefetcher_set_budget:
+ * @self: a #TnyCamelPrefetcher
+ * @max_msgs: the maximum amount of messages to prefetch
+ * @max_bytes: the maximum amount of bytes to prefetch
+ * @max_msg_size: the size above which only the text parts are prefetched
+ *
+ * Set how much @self is allowed to fetch. The amounts are counted since
+ * @self got created or since tny_camel_prefetcher_reset_budget() was last
+ * called, whichever came last. Once the budget is spent hints are ignored.
+ **/
+void
+tny_camel_prefetcher_set_budget (TnyCamelPrefetcher *self, guint max_msgs, gsize max_bytes, gsize max_msg_size)
+{
+	TnyCamelPrefetcherPriv *priv = TNY_CAMEL_PREFETCHER_GET_PRIVATE (self);
+
+	priv->max_msgs = max_msgs;
+	priv->max_bytes = max_bytes;
+	priv->max_msg_size = max_msg_size;
+
+	prefetch_next (self);
+
+	return;
+}
+
+/**
+ * tny_camel_prefetcher_reset_budget:
+ * @self: a #TnyCamelPrefetcher
+ *
+ * Start counting the budget over again, for example after the user went
+ * to another folder or at a regular interval.
+ **/
+void
+tny_camel_prefetcher_reset_budget (TnyCamelPrefetcher *self)
+{
+	TnyCamelPrefetcherPriv *priv = TNY_CAMEL_PREFETCHER_GET_PRIVATE (self);
+
+	priv->msgs = 0;
+	priv->bytes = 0;
+
+	return;
+}
+
+/**
+ * tny_camel_prefetcher_set_paused:
+ * @self: a #TnyCamelPrefetcher
+ * @paused: whether to pause
+ *
+ * Pause or resume prefetching. Next to going offline, which @self detects 
+ * using its #TnyDevice, this is how an application tells @self to back off,
+ * for example while on a metered connection or on battery power.
+ **/
+void
+tny_camel_prefetcher_set_paused (TnyCamelPrefetcher *self, gboolean paused)
+{
+	TnyCamelPrefetcherPriv *priv = TNY_CAMEL_PREFETCHER_GET_PRIVATE (self);
+
+	priv->paused = paused;
+	if (!paused)
+		prefetch_next (self);
+
+	return;
+}
+
+/**
+ * tny_camel_prefetcher_get_stats:
+ * @self: a #TnyCamelPrefetcher
+ * @msgs: byref location for the amount of prefetched messages, or NULL
+ * @bytes: byref location for the amount of prefetched bytes, or NULL
+ *
+ * Get how much of the budget has been spent.
+ **/
+void
+tny_camel_prefetcher_get_stats (TnyCamelPrefetcher *self, guint *msgs, gsize *bytes)
+{
+	TnyCamelPrefetcherPriv *priv = TNY_CAMEL_PREFETCHER_GET_PRIVATE (self);
+
+	if (msgs)
+		*msgs = priv->msgs;
+	if (bytes)
+		*bytes = priv->bytes;
+
+	return;
+}
+
+static void
+tny_camel_prefetcher_finalize (GObject *object)
+{
+	TnyCamelPrefetcherPriv *priv = TNY_CAMEL_PREFETCHER_GET_PRIVATE (object);
+
+	if (priv->device) {
+		if (g_signal_handler_is_connected (G_OBJECT (priv->device), priv->connchanged_signal))
+			g_signal_handler_disconnect (G_OBJECT (priv->device), priv->connchanged_signal);
+		g_object_unref (priv->device);
+	}
+
+	clear_pending (priv);
+	if (priv->folder)
+		g_object_unref (priv->folder);
+
+	parent_class->finalize (object);
+}
+
+static void
+tny_camel_prefetcher_instance_init (GTypeInstance *instance, gpointer g_class)
+{
+	TnyCamelPrefetcherPriv *priv = TNY_CAMEL_PREFETCHER_GET_PRIVATE (instance);
+
+	priv->device = NULL;
+	priv->connchanged_signal = 0;
+	priv->online = TRUE;
+	priv->paused = FALSE;
+	priv->busy = FALSE;
+	priv->folder = NULL;
+	priv->pending = NULL;
+	priv->max_msgs = TNY_CAMEL_PREFETCHER_DEFAULT_MAX_MSGS;
+	priv->max_bytes = TNY_CAMEL_PREFETCHER_DEFAULT_MAX_BYTES;
+	priv->max_msg_size = TNY_CAMEL_PREFETCHER_DEFAULT_MAX_MSG_SIZE;
+	priv->msgs = 0;
+	priv->bytes = 0;
+
+	return;
+}
+
+static void
+tny_camel_prefetcher_class_init (TnyCamelPrefetcherClass *klass)
+{
+	GObjectClass *object_class;
+
+	parent_class = g_type_class_peek_parent (klass);
+	object_class = (GObjectClass*) klass;
+	object_class->finalize = tny_camel_prefetcher_finalize;
+
+	g_type_class_add_private (object_class, sizeof (TnyCamelPrefetcherPriv));
+}
+
+/**
+ * tny_camel_prefetcher_new:
+ * @device: a #TnyDevice
+ *
+ * Create a prefetcher that fills the message cache with the messages that
+ * the user is likely to open next, as hinted by tny_camel_prefetcher_hint().
+ * Nothing is fetched while @device is offline.
+ *
+ * Return value: A new #TnyCamelPrefetcher instance
+ **/
+TnyCamelPrefetcher*
+tny_camel_prefetcher_new (TnyDevice *device)
+{
+	TnyCamelPrefetcher *self = g_object_new (TNY_TYPE_CAMEL_PREFETCHER, NULL);
+	TnyCamelPrefetcherPriv *priv = TNY_CAMEL_PREFETCHER_GET_PRIVATE (self);
+
+	g_assert (TNY_IS_DEVICE (device));
+
+	priv->device = TNY_DEVICE (g_object_ref (device));
+	priv->online = tny_device_is_online (device);
+	priv->connchanged_signal = g_signal_connect (
+		G_OBJECT (device), "connection_changed",
+		G_CALLBACK (connection_changed), self);
+
+	return self;
+}
+
+static gpointer
+tny_camel_prefetcher_register_type (gpointer notused)
+{
+	GType type = 0;
+	static const GTypeInfo info = 
+		{
+			sizeof (TnyCamelPrefetcherClass),
+			NULL,   /* base_init */
+			NULL,   /* base_finalize */
+			(GClassInitFunc) tny_camel_prefetcher_class_init,   /* class_init */
+			NULL,   /* class_finalize */
+			NULL,   /* class_data */
+			sizeof (TnyCamelPrefetcher),
+			0,      /* n_preallocs */
+			tny_camel_prefetcher_instance_init,    /* instance_init */
+			NULL
+		};
+	
+	type = g_type_register_static (G_TYPE_OBJECT,
+				       "TnyCamelPrefetcher",
+				       &info, 0);
+	
+	return GSIZE_TO_POINTER (type);
+}
+
+/**
+ * tny_camel_prefetcher_get_type:
+ *
+ * GType system helper function
+ *
+ * Return value: a GType
+ **/
+GType
+tny_camel_prefetcher_get_type (void)
+{
+	static GOnce once = G_ONCE_INIT;
+	g_once (&once, tny_camel_prefetcher_register_type, NULL);
+	return GPOINTER_TO_SIZE (once.retval);
+}
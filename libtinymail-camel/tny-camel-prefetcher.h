@@ -0,0 +1,64 @@
+#ifndef TNY_CAMEL_PREFETCHER_H
+#define TNY_CAMEL_PREFETCHER_H
+
+/* libtinymail-camel - The Tiny Mail base library for Camel
+ * Copyright (C) 2006-2007 Philip Van Hoof <pvanhoof@gnome.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with self library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <glib-object.h>
+
+#include <tny-device.h>
+#include <tny-folder.h>
+#include <tny-list.h>
+
+G_BEGIN_DECLS
+
+#define TNY_TYPE_CAMEL_PREFETCHER             (tny_camel_prefetcher_get_type ())
+#define TNY_CAMEL_PREFETCHER(obj)             (G_TYPE_CHECK_INSTANCE_CAST ((obj), TNY_TYPE_CAMEL_PREFETCHER, TnyCamelPrefetcher))
+#define TNY_CAMEL_PREFETCHER_CLASS(vtable)    (G_TYPE_CHECK_CLASS_CAST ((vtable), TNY_TYPE_CAMEL_PREFETCHER, TnyCamelPrefetcherClass))
+#define TNY_IS_CAMEL_PREFETCHER(obj)          (G_TYPE_CHECK_INSTANCE_TYPE ((obj), TNY_TYPE_CAMEL_PREFETCHER))
+#define TNY_IS_CAMEL_PREFETCHER_CLASS(vtable) (G_TYPE_CHECK_CLASS_TYPE ((vtable), TNY_TYPE_CAMEL_PREFETCHER))
+#define TNY_CAMEL_PREFETCHER_GET_CLASS(inst)  (G_TYPE_INSTANCE_GET_CLASS ((inst), TNY_TYPE_CAMEL_PREFETCHER, TnyCamelPrefetcherClass))
+
+typedef struct _TnyCamelPrefetcher TnyCamelPrefetcher;
+typedef struct _TnyCamelPrefetcherClass TnyCamelPrefetcherClass;
+
+struct _TnyCamelPrefetcher
+{
+	GObject parent;
+
+};
+
+struct _TnyCamelPrefetcherClass
+{
+	GObjectClass parent_class;
+};
+
+GType tny_camel_prefetcher_get_type (void);
+TnyCamelPrefetcher* tny_camel_prefetcher_new (TnyDevice *device);
+
+void tny_camel_prefetcher_hint (TnyCamelPrefetcher *self, TnyFolder *folder, TnyList *headers);
+void tny_camel_prefetcher_cancel (TnyCamelPrefetcher *self);
+void tny_camel_prefetcher_set_budget (TnyCamelPrefetcher *self, guint max_msgs, gsize max_bytes, gsize max_msg_size);
+void tny_camel_prefetcher_reset_budget (TnyCamelPrefetcher *self);
+void tny_camel_prefetcher_set_paused (TnyCamelPrefetcher *self, gboolean paused);
+void tny_camel_prefetcher_get_stats (TnyCamelPrefetcher *self, guint *msgs, gsize *bytes);
+
+G_END_DECLS
+
+#endif
@@ -75,6 +75,7 @@ typedef enum {
 	TNY_CAMEL_QUEUE_REFRESH_ITEM = 1<<6,
 	TNY_CAMEL_QUEUE_AUTO_CANCELLABLE_ITEM = 1<<7,
 	TNY_CAMEL_QUEUE_CONNECT_ITEM = 1<<8,
+	TNY_CAMEL_QUEUE_IDLE_ITEM = 1<<9,
 } TnyCamelQueueItemFlags;
 
 GType tny_camel_queue_get_type (void);
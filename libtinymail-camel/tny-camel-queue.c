@@ -399,6 +399,9 @@ _tny_camel_queue_cancel_remove_items (TnyCamelQueue *queue, TnyCamelQueueItemFla
  * it doesn't get cancelled. If it does get cancelled and @callback is not NULL,
  * @callback will be called in the GMainLoop with @destroyer as GDestroyNotify.
  * A cancelled item's @cancel_field will also be set to TRUE.
+ *
+ * Items with TNY_CAMEL_QUEUE_PRIORITY_ITEM in @flags are performed before the
+ * others, items with TNY_CAMEL_QUEUE_IDLE_ITEM only after all the others.
  **/
 void 
 _tny_camel_queue_launch_wflags (TnyCamelQueue *queue, GThreadFunc func, GSourceFunc callback, GDestroyNotify destroyer, GSourceFunc cancel_callback, GDestroyNotify cancel_destroyer, gboolean *cancel_field, gpointer data, gsize data_size, TnyCamelQueueItemFlags flags, const gchar *name)
@@ -442,7 +445,21 @@ _tny_camel_queue_launch_wflags (TnyCamelQueue *queue, GThreadFunc func, GSourceF
 			first = g_list_next (first);
 		}
 		queue->list = g_list_insert (queue->list, item, cnt);
-	} else /* Normal items simply get appended */
+	} else if (!(flags & TNY_CAMEL_QUEUE_IDLE_ITEM)) 
+	{
+		/* Normal items go before the idle items, the current item is
+		 * left where it is as it's already being performed */
+		gint cnt = 0;
+		GList *first = g_list_first (queue->list);
+		while (first) {
+			QueueItem *item = first->data;
+			if (item && (item->flags & TNY_CAMEL_QUEUE_IDLE_ITEM) && item != queue->current)
+				break;
+			cnt++;
+			first = g_list_next (first);
+		}
+		queue->list = g_list_insert (queue->list, item, cnt);
+	} else /* Idle items simply get appended */
 		queue->list = g_list_append (queue->list, item);
 
 	/* If no next item is scheduled then we can go idle after finishing operation */
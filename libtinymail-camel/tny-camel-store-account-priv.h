@@ -30,14 +30,18 @@ typedef struct _TnyCamelStoreAccountPriv TnyCamelStoreAccountPriv;
 
 struct _TnyCamelStoreAccountPriv
 {
-	CamelStore *iter_store;
-	CamelFolderInfo *iter;
+	CamelStore *iter_store, *cached_iter_store;
+	CamelFolderInfo *iter, *cached_iter;
 	GList *managed_folders;
 	GList *sobs;
 	gboolean cant_reuse_iter;
 	GStaticRecMutex *factory_lock, *obs_lock;
 	TnyCamelQueue *queue, *msg_queue;
 	gboolean deleted;
+	GPtrArray *push_folders;
+	GList *poke_pending;
+	guint poke_idle;
+	gboolean cache_answered;
 };
 
 #define TNY_CAMEL_STORE_ACCOUNT_GET_PRIVATE(o)	\
@@ -48,5 +52,6 @@ void _tny_camel_store_account_queue_going_online (TnyCamelStoreAccount *self, Tn
 
 void _tny_camel_store_account_add_to_managed_folders (TnyCamelStoreAccount *self, TnyCamelFolder *folder);
 void _tny_camel_store_account_remove_from_managed_folders (TnyCamelStoreAccount *self, TnyCamelFolder *folder);
+void _tny_camel_store_account_queue_poke_status (TnyCamelStoreAccount *self, TnyCamelFolder *folder);
 
 #endif
@@ -96,6 +96,37 @@ folder_opened (CamelStore *camel_store, CamelFolder *camel_folder, TnyCamelStore
 	
 }
 
+/* Called from the store's push thread with counts for a folder which
+   isn't selected */
+static void 
+folder_status (CamelStore *camel_store, CamelStoreFolderStatus *status, TnyCamelStoreAccount *self)
+{
+	GList *node;
+	TnyCamelFolder *found = NULL;
+	TnyCamelStoreAccountPriv *priv = TNY_CAMEL_STORE_ACCOUNT_GET_PRIVATE (self);
+
+	if (status == NULL || status->folder_name == NULL)
+		return;
+
+	g_static_rec_mutex_lock (priv->factory_lock);
+	for (node = priv->managed_folders; node != NULL; node = g_list_next (node)) {
+		TnyCamelFolder *folder = (TnyCamelFolder *) node->data;
+
+		if (TNY_IS_CAMEL_FOLDER (folder)) {
+			if (g_strcmp0 (tny_folder_get_id (TNY_FOLDER (folder)), status->folder_name)==0) {
+				found = g_object_ref (folder);
+				break;
+			}
+		}
+	}
+	g_static_rec_mutex_unlock (priv->factory_lock);
+
+	if (found) {
+		_tny_camel_folder_set_status (found, status->unseen, status->messages);
+		g_object_unref (found);
+	}
+}
+
 static void 
 do_notify_in_idle_destroy (gpointer user_data)
 {
@@ -512,6 +543,7 @@ tny_camel_store_account_prepare (TnyCamelAccount *self, gboolean recon_if, gbool
 		if (apriv->service && CAMEL_IS_SERVICE (apriv->service) && 
 		  new_service && !camel_lite_exception_is_set (apriv->ex)) {
 			camel_lite_object_unhook_event (apriv->service, "folder_opened", folder_opened, self);
+			camel_lite_object_unhook_event (apriv->service, "folder_status", folder_status, self);
 			camel_lite_object_unref (apriv->service);
 			apriv->service = NULL;
 		}
@@ -546,6 +578,7 @@ tny_camel_store_account_prepare (TnyCamelAccount *self, gboolean recon_if, gbool
 
 			if (apriv->service && CAMEL_IS_SERVICE (apriv->service)) {
 				camel_lite_object_unhook_event (new_service, "folder_opened", folder_opened, self);
+				camel_lite_object_unhook_event (new_service, "folder_status", folder_status, self);
 				camel_lite_object_unref (apriv->service);
 			}
 
@@ -556,12 +589,17 @@ tny_camel_store_account_prepare (TnyCamelAccount *self, gboolean recon_if, gbool
 			apriv->service->reconnecter = (con_op) reconnecting;
 			apriv->service->reconnection = (con_op) reconnection;
 
-			if (new_service)
+			if (new_service) {
 				camel_lite_object_hook_event (new_service, "folder_opened", folder_opened, self);
+				camel_lite_object_hook_event (new_service, "folder_status", folder_status, self);
+				if (priv->push_folders)
+					camel_lite_store_set_push_folders (CAMEL_STORE (new_service), priv->push_folders);
+			}
 
 		} else if (camel_lite_exception_is_set (apriv->ex) && new_service) {
 			if (CAMEL_IS_OBJECT (new_service)) {
 				camel_lite_object_unhook_event (new_service, "folder_opened", folder_opened, self);
+				camel_lite_object_unhook_event (new_service, "folder_status", folder_status, self);
 				camel_lite_object_unref (new_service);
 			}
 		}
@@ -806,6 +844,12 @@ tny_camel_store_account_instance_init (GTypeInstance *instance, gpointer g_class
 	priv->obs_lock = g_new0 (GStaticRecMutex, 1);
 	g_static_rec_mutex_init (priv->obs_lock);
 	priv->iter_store = NULL;
+	priv->push_folders = NULL;
+	priv->poke_pending = NULL;
+	priv->poke_idle = 0;
+	priv->cache_answered = FALSE;
+	priv->cached_iter = NULL;
+	priv->cached_iter_store = NULL;
 
 	return;
 }
@@ -917,6 +961,14 @@ tny_camel_store_account_dispose (GObject *object)
 		camel_lite_object_unref (CAMEL_OBJECT (priv->iter_store));
 	}
 
+	if (priv->cached_iter_store)
+	{
+		camel_lite_store_free_folder_info (priv->cached_iter_store, priv->cached_iter);
+		camel_lite_object_unref (CAMEL_OBJECT (priv->cached_iter_store));
+		priv->cached_iter_store = NULL;
+		priv->cached_iter = NULL;
+	}
+
 	g_object_unref (priv->msg_queue);
 
 	return;
@@ -933,6 +985,13 @@ tny_camel_store_account_finalize (GObject *object)
 
 	if (apriv->service) {
 		camel_lite_object_unhook_event (apriv->service, "folder_opened", folder_opened, self);
+		camel_lite_object_unhook_event (apriv->service, "folder_status", folder_status, self);
+	}
+
+	if (priv->push_folders) {
+		g_ptr_array_foreach (priv->push_folders, (GFunc) g_free, NULL);
+		g_ptr_array_free (priv->push_folders, TRUE);
+		priv->push_folders = NULL;
 	}
 
 	/* g_static_rec_mutex_free (priv->factory_lock); */
@@ -1384,6 +1443,259 @@ tny_camel_store_account_factor_folder (TnyCamelStoreAccount *self, const gchar *
 	return TNY_CAMEL_STORE_ACCOUNT_GET_CLASS (self)->factor_folder(self, full_name, was_new);
 }
 
+typedef struct {
+	TnyCamelQueueable parent;
+
+	TnyCamelStoreAccount *self;
+	GList *folders;
+	CamelStoreFolderStatus *statuses;
+	gint count;
+	gboolean cancelled;
+	TnySessionCamel *session;
+} PokeStatusManyInfo;
+
+static gpointer
+poke_status_many_thread (gpointer user_data)
+{
+	PokeStatusManyInfo *info = (PokeStatusManyInfo *) user_data;
+	TnyCamelAccountPriv *apriv = TNY_CAMEL_ACCOUNT_GET_PRIVATE (info->self);
+	CamelService *service = apriv->service;
+
+	if (service && CAMEL_IS_STORE (service) && service->status == CAMEL_SERVICE_CONNECTED)
+		camel_lite_store_get_folder_status_many (CAMEL_STORE (service), 
+			info->statuses, info->count);
+
+	return NULL;
+}
+
+static gboolean
+poke_status_many_callback (gpointer user_data)
+{
+	PokeStatusManyInfo *info = (PokeStatusManyInfo *) user_data;
+	TnyFolderStoreChange *change = NULL;
+	GList *node;
+	gint i = 0;
+
+	/* The folders whose counts changed are told one by one, the
+	 * store's observers get them all in one change */
+	for (node = info->folders; node != NULL; node = g_list_next (node), i++) {
+		TnyCamelFolder *folder = (TnyCamelFolder *) node->data;
+		gint unread = -1, total = -1;
+
+		if (!info->cancelled) {
+			unread = info->statuses[i].unseen;
+			total = info->statuses[i].messages;
+		}
+
+		if (_tny_camel_folder_poke_status_done (folder, unread, total)) {
+			if (!change)
+				change = tny_folder_store_change_new (TNY_FOLDER_STORE (info->self));
+			tny_folder_store_change_add_status_folder (change, TNY_FOLDER (folder));
+		}
+	}
+
+	if (change) {
+		notify_folder_store_observers_about (TNY_FOLDER_STORE (info->self), change);
+		g_object_unref (change);
+	}
+
+	return FALSE;
+}
+
+static void
+poke_status_many_destroyer (gpointer user_data)
+{
+	PokeStatusManyInfo *info = (PokeStatusManyInfo *) user_data;
+	gint i;
+
+	g_list_foreach (info->folders, (GFunc) g_object_unref, NULL);
+	g_list_free (info->folders);
+	for (i = 0; i < info->count; i++)
+		g_free ((gchar *) info->statuses[i].folder_name);
+	g_free (info->statuses);
+
+	/* Thread reference */
+	g_object_unref (info->self);
+	camel_lite_object_unref (info->session);
+
+	return;
+}
+
+static gboolean
+poke_status_many_idle (gpointer user_data)
+{
+	TnyCamelStoreAccount *self = (TnyCamelStoreAccount *) user_data;
+	TnyCamelStoreAccountPriv *priv = TNY_CAMEL_STORE_ACCOUNT_GET_PRIVATE (self);
+	TnyCamelAccountPriv *apriv = TNY_CAMEL_ACCOUNT_GET_PRIVATE (self);
+	PokeStatusManyInfo *info;
+	GList *folders, *node;
+	gint i;
+
+	g_static_rec_mutex_lock (priv->factory_lock);
+	folders = g_list_reverse (priv->poke_pending);
+	priv->poke_pending = NULL;
+	priv->poke_idle = 0;
+	g_static_rec_mutex_unlock (priv->factory_lock);
+
+	if (!folders || !apriv->session) {
+		for (node = folders; node != NULL; node = g_list_next (node)) {
+			_tny_camel_folder_poke_status_done (node->data, -1, -1);
+			g_object_unref (node->data);
+		}
+		g_list_free (folders);
+		g_object_unref (self);
+		return FALSE;
+	}
+
+	info = g_slice_new0 (PokeStatusManyInfo);
+	info->folders = folders;
+	info->count = g_list_length (folders);
+	info->statuses = g_new (CamelStoreFolderStatus, info->count);
+	for (node = folders, i = 0; node != NULL; node = g_list_next (node), i++) {
+		TnyCamelFolderPriv *fpriv = TNY_CAMEL_FOLDER_GET_PRIVATE (node->data);
+
+		/* the folder can be renamed while the thread runs */
+		info->statuses[i].folder_name = g_strdup (fpriv->folder_name);
+		info->statuses[i].unseen = -1;
+		info->statuses[i].messages = -1;
+		info->statuses[i].uidnext = -1;
+	}
+	info->cancelled = FALSE;
+	info->session = apriv->session;
+	camel_lite_object_ref (info->session);
+
+	/* Thread reference, taken over from the idle */
+	info->self = self;
+
+	_tny_camel_queue_launch_wflags (priv->queue, 
+		poke_status_many_thread, 
+		poke_status_many_callback, 
+		poke_status_many_destroyer, 
+		poke_status_many_callback, 
+		poke_status_many_destroyer, 
+		&info->cancelled,
+		info, sizeof (PokeStatusManyInfo),
+		TNY_CAMEL_QUEUE_CANCELLABLE_ITEM,
+		__FUNCTION__);
+
+	return FALSE;
+}
+
+/* Asking the server about the status of a folder, done for every folder
+   in a folder tree when it gets shown, costs a round trip. The folders
+   poked during one main loop iteration are collected here and asked
+   about at once, see camel_lite_store_get_folder_status_many */
+void
+_tny_camel_store_account_queue_poke_status (TnyCamelStoreAccount *self, TnyCamelFolder *folder)
+{
+	TnyCamelStoreAccountPriv *priv = TNY_CAMEL_STORE_ACCOUNT_GET_PRIVATE (self);
+
+	g_static_rec_mutex_lock (priv->factory_lock);
+	priv->poke_pending = g_list_prepend (priv->poke_pending, g_object_ref (folder));
+	if (priv->poke_idle == 0)
+		priv->poke_idle = g_idle_add (poke_status_many_idle, g_object_ref (self));
+	g_static_rec_mutex_unlock (priv->factory_lock);
+}
+
+/**
+ * tny_camel_store_account_poke_status:
+ * @self: a valid #TnyCamelStoreAccount instance
+ * @folders: the #TnyFolder instances of @self to poke, or NULL for all of them
+ * 
+ * Like tny_folder_poke_status for each of @folders, but while online they
+ * are asked about together: with one LIST-STATUS or a pipeline of STATUS
+ * commands for IMAP. The folders whose counts changed get their observers
+ * notified, the observers of @self get one #TnyFolderStoreChange with all of
+ * them as status folders.
+ *
+ * If @folders is NULL all folders of @self that are in use are poked.
+ **/
+void 
+tny_camel_store_account_poke_status (TnyCamelStoreAccount *self, TnyList *folders)
+{
+	TnyCamelStoreAccountPriv *priv = TNY_CAMEL_STORE_ACCOUNT_GET_PRIVATE (self);
+	GList *copy = NULL, *node;
+
+	g_return_if_fail (TNY_IS_CAMEL_STORE_ACCOUNT (self));
+
+	if (folders) {
+		TnyIterator *iter = tny_list_create_iterator (folders);
+
+		while (!tny_iterator_is_done (iter)) {
+			copy = g_list_prepend (copy, tny_iterator_get_current (iter));
+			tny_iterator_next (iter);
+		}
+		g_object_unref (iter);
+	} else {
+		g_static_rec_mutex_lock (priv->factory_lock);
+		for (node = priv->managed_folders; node != NULL; node = g_list_next (node))
+			copy = g_list_prepend (copy, g_object_ref (node->data));
+		g_static_rec_mutex_unlock (priv->factory_lock);
+	}
+
+	for (node = copy; node != NULL; node = g_list_next (node)) {
+		tny_folder_poke_status (TNY_FOLDER (node->data));
+		g_object_unref (node->data);
+	}
+	g_list_free (copy);
+}
+
+
+/**
+ * tny_camel_store_account_set_push_folders:
+ * @self: a valid #TnyCamelStoreAccount instance
+ * @folders: the #TnyFolder instances of @self to watch, or NULL
+ * 
+ * Ask the server to push changes in @folders even though they aren't the
+ * folder being looked at. Their unread and total counts are then kept up to
+ * date and their observers told about it, without polling. This replaces the
+ * folders set by an earlier call, NULL or an empty list stops watching.
+ *
+ * IMAP servers that support NOTIFY watch all folders over one connection,
+ * others get a connection per folder, no more than the push_connections url
+ * parameter (2 by default). The folders left over are polled by those
+ * connections each time they keep themselves alive, so their counts still
+ * follow, only later.
+ **/
+void 
+tny_camel_store_account_set_push_folders (TnyCamelStoreAccount *self, TnyList *folders)
+{
+	TnyCamelStoreAccountPriv *priv = TNY_CAMEL_STORE_ACCOUNT_GET_PRIVATE (self);
+	TnyCamelAccountPriv *apriv = TNY_CAMEL_ACCOUNT_GET_PRIVATE (self);
+	GPtrArray *names = NULL;
+
+	g_return_if_fail (TNY_IS_CAMEL_STORE_ACCOUNT (self));
+
+	if (folders && tny_list_get_length (folders) > 0) {
+		TnyIterator *iter = tny_list_create_iterator (folders);
+
+		names = g_ptr_array_new ();
+		while (!tny_iterator_is_done (iter)) {
+			TnyFolder *folder = TNY_FOLDER (tny_iterator_get_current (iter));
+			const gchar *id = tny_folder_get_id (folder);
+
+			if (id)
+				g_ptr_array_add (names, g_strdup (id));
+			g_object_unref (folder);
+			tny_iterator_next (iter);
+		}
+		g_object_unref (iter);
+	}
+
+	g_static_rec_mutex_lock (apriv->service_lock);
+
+	if (priv->push_folders) {
+		g_ptr_array_foreach (priv->push_folders, (GFunc) g_free, NULL);
+		g_ptr_array_free (priv->push_folders, TRUE);
+	}
+	priv->push_folders = names;
+
+	if (apriv->service && CAMEL_IS_STORE (apriv->service))
+		camel_lite_store_set_push_folders (CAMEL_STORE (apriv->service), names);
+
+	g_static_rec_mutex_unlock (apriv->service_lock);
+}
+
 
 static TnyFolder * 
 tny_camel_store_account_factor_folder_default (TnyCamelStoreAccount *self, const gchar *full_name, gboolean *was_new)
@@ -1471,6 +1783,39 @@ _tny_camel_store_account_refresh_children (TnyFolderStore *self, TnyFolder *fold
 }
 
 
+/* Add the folders for @iter and its siblings to @list */
+static void
+list_folder_infos (TnyFolderStore *self, TnyList *list, TnyFolderStoreQuery *query, CamelFolderInfo *iter)
+{
+	while (iter)
+	{
+		/* Also take a look at camel-maildir-store.c:525 */
+		if (!(iter->flags & CAMEL_FOLDER_VIRTUAL) && _tny_folder_store_query_passes (query, iter))
+		{
+			gboolean was_new = FALSE;
+
+			TnyCamelFolder *folder = (TnyCamelFolder *) tny_camel_store_account_factor_folder (
+				TNY_CAMEL_STORE_ACCOUNT (self), 
+				iter->full_name, &was_new);
+
+			if (folder != NULL)
+			{
+				if (was_new)
+					_tny_camel_folder_set_folder_info (self, folder, iter);
+				else
+					_tny_camel_store_account_refresh_children (self, folder, iter);
+			
+				const gchar *name = tny_folder_get_name (TNY_FOLDER(folder));
+				/* TNY TODO: Temporary fix for empty root folders */
+				if (name && strlen(name) > 0)
+					tny_list_prepend (list, G_OBJECT (folder));
+				g_object_unref (G_OBJECT (folder));
+			}
+		}
+		iter = iter->next;
+	}
+}
+
 static void 
 tny_camel_store_account_get_folders_default (TnyFolderStore *self, TnyList *list, TnyFolderStoreQuery *query, gboolean refresh, GError **err)
 {
@@ -1553,36 +1898,7 @@ tny_camel_store_account_get_folders_default (TnyFolderStore *self, TnyList *list
 
 	priv->iter_store = store;
 
-	if (iter)
-	{
-	  while (iter)
-	  {
-		/* Also take a look at camel-maildir-store.c:525 */
-		if (!(iter->flags & CAMEL_FOLDER_VIRTUAL) && _tny_folder_store_query_passes (query, iter))
-		{
-			gboolean was_new = FALSE;
-
-			TnyCamelFolder *folder = (TnyCamelFolder *) tny_camel_store_account_factor_folder (
-				TNY_CAMEL_STORE_ACCOUNT (self), 
-				iter->full_name, &was_new);
-
-			if (folder != NULL)
-			{
-				if (was_new)
-					_tny_camel_folder_set_folder_info (self, folder, iter);
-				else
-					_tny_camel_store_account_refresh_children (self, folder, iter);
-			
-				const gchar *name = tny_folder_get_name (TNY_FOLDER(folder));
-				/* TNY TODO: Temporary fix for empty root folders */
-				if (name && strlen(name) > 0)
-					tny_list_prepend (list, G_OBJECT (folder));
-				g_object_unref (G_OBJECT (folder));
-			}
-		}
-		iter = iter->next;
-	  }
-	}
+	list_folder_infos (self, list, query, iter);
 
 	_tny_session_stop_operation (apriv->session);
 
@@ -1603,6 +1919,8 @@ typedef struct
 	gpointer user_data;
 	TnySessionCamel *session;
 	gboolean cancelled;
+	CamelStore *store;
+	CamelFolderInfo *cached;
 
 } GetFoldersInfo;
 
@@ -1692,6 +2010,326 @@ tny_camel_store_account_get_folders_async (TnyFolderStore *self, TnyList *list,
 	TNY_CAMEL_STORE_ACCOUNT_GET_CLASS (self)->get_folders_async(self, list, query, refresh, callback, status_callback, user_data);
 }
 
+typedef struct
+{
+	TnyCamelQueueable parent;
+
+	TnyCamelStoreAccount *self;
+	TnyFolderStoreQuery *query;
+	CamelFolderInfo *cached;
+	GList *changes;
+	gboolean cancelled;
+	TnySessionCamel *session;
+} FolderListDeltaInfo;
+
+static void
+index_folder_infos (GHashTable *table, CamelFolderInfo *iter)
+{
+	for (; iter != NULL; iter = iter->next) {
+		if (iter->full_name && !(iter->flags & CAMEL_FOLDER_VIRTUAL))
+			g_hash_table_insert (table, iter->full_name, iter);
+		index_folder_infos (table, iter->child);
+	}
+}
+
+static TnyFolderStoreChange *
+change_for_store (GList **changes, TnyFolderStore *store)
+{
+	TnyFolderStoreChange *change;
+	GList *node;
+
+	for (node = *changes; node != NULL; node = g_list_next (node)) {
+		TnyFolderStore *fnd;
+
+		change = node->data;
+		fnd = tny_folder_store_change_get_folder_store (change);
+		g_object_unref (fnd);
+		if (fnd == store)
+			return change;
+	}
+
+	change = tny_folder_store_change_new (store);
+	*changes = g_list_append (*changes, change);
+
+	return change;
+}
+
+static TnyFolder *
+find_managed_folder (TnyCamelStoreAccount *self, const gchar *full_name)
+{
+	TnyCamelStoreAccountPriv *priv = TNY_CAMEL_STORE_ACCOUNT_GET_PRIVATE (self);
+	TnyFolder *found = NULL;
+	GList *copy;
+
+	g_static_rec_mutex_lock (priv->factory_lock);
+	for (copy = priv->managed_folders; copy != NULL; copy = g_list_next (copy)) {
+		TnyFolder *fnd = (TnyFolder*) copy->data;
+		const gchar *name = tny_folder_get_id (fnd);
+
+		if (name && !strcmp (name, full_name)) {
+			found = g_object_ref (fnd);
+			break;
+		}
+	}
+	g_static_rec_mutex_unlock (priv->factory_lock);
+
+	return found;
+}
+
+/* The store that holds @iter, its parent folders are factored when
+ * nobody asked for them yet */
+static TnyFolderStore *
+folder_info_parent_store (TnyCamelStoreAccount *self, CamelFolderInfo *iter)
+{
+	TnyFolderStore *store;
+	TnyFolder *parent;
+	gboolean was_new = FALSE;
+
+	if (iter->parent == NULL || iter->parent->full_name == NULL)
+		return TNY_FOLDER_STORE (g_object_ref (self));
+
+	parent = tny_camel_store_account_factor_folder (self, 
+		iter->parent->full_name, &was_new);
+
+	if (was_new) {
+		store = folder_info_parent_store (self, iter->parent);
+		_tny_camel_folder_set_folder_info (store, TNY_CAMEL_FOLDER (parent), iter->parent);
+		g_object_unref (store);
+	}
+
+	return TNY_FOLDER_STORE (parent);
+}
+
+static void
+folder_list_delta_created (TnyCamelStoreAccount *self, TnyFolderStoreQuery *query, CamelFolderInfo *iter, GHashTable *cached, GList **changes)
+{
+	for (; iter != NULL; iter = iter->next) {
+		if (iter->full_name && !(iter->flags & CAMEL_FOLDER_VIRTUAL) &&
+		    _tny_folder_store_query_passes (query, iter) &&
+		    !g_hash_table_lookup (cached, iter->full_name))
+		{
+			TnyFolderStore *store = folder_info_parent_store (self, iter);
+			gboolean was_new = FALSE;
+			TnyFolder *folder;
+
+			folder = tny_camel_store_account_factor_folder (self, 
+				iter->full_name, &was_new);
+			if (was_new)
+				_tny_camel_folder_set_folder_info (store, TNY_CAMEL_FOLDER (folder), iter);
+
+			tny_folder_store_change_add_created_folder (
+				change_for_store (changes, store), folder);
+
+			g_object_unref (folder);
+			g_object_unref (store);
+		}
+		folder_list_delta_created (self, query, iter->child, cached, changes);
+	}
+}
+
+static void
+folder_list_delta_removed (TnyCamelStoreAccount *self, CamelFolderInfo *iter, GHashTable *fresh, GList **changes)
+{
+	for (; iter != NULL; iter = iter->next) {
+		if (iter->full_name && !(iter->flags & CAMEL_FOLDER_VIRTUAL) &&
+		    !g_hash_table_lookup (fresh, iter->full_name))
+		{
+			TnyFolder *folder = find_managed_folder (self, iter->full_name);
+
+			if (folder) {
+				TnyFolderStore *store = tny_folder_get_folder_store (folder);
+
+				if (store) {
+					tny_folder_store_change_add_removed_folder (
+						change_for_store (changes, store), folder);
+
+					/* Its iter still has the folder as a child */
+					if (TNY_IS_CAMEL_FOLDER (store))
+						TNY_CAMEL_FOLDER_GET_PRIVATE (store)->cant_reuse_iter = TRUE;
+
+					g_object_unref (store);
+				}
+				g_object_unref (folder);
+			}
+
+			/* Its subfolders go away with it */
+			continue;
+		}
+		folder_list_delta_removed (self, iter->child, fresh, changes);
+	}
+}
+
+static gpointer
+folder_list_delta_thread (gpointer thr_user_data)
+{
+	FolderListDeltaInfo *info = thr_user_data;
+	TnyCamelStoreAccountPriv *priv = TNY_CAMEL_STORE_ACCOUNT_GET_PRIVATE (info->self);
+	TnyList *list = tny_simple_list_new ();
+	GHashTable *cached, *fresh;
+	GError *err = NULL;
+
+	tny_folder_store_get_folders (TNY_FOLDER_STORE (info->self), 
+		list, NULL, TRUE, &err);
+	g_object_unref (list);
+
+	if (err != NULL) {
+		g_error_free (err);
+		return NULL;
+	}
+
+	cached = g_hash_table_new (g_str_hash, g_str_equal);
+	fresh = g_hash_table_new (g_str_hash, g_str_equal);
+	index_folder_infos (cached, info->cached);
+	index_folder_infos (fresh, priv->iter);
+
+	/* LIST doesn't tell renames apart, a renamed folder is removed
+	 * from its old place and created in its new one */
+	folder_list_delta_removed (info->self, info->cached, fresh, &info->changes);
+	folder_list_delta_created (info->self, info->query, priv->iter, cached, &info->changes);
+
+	g_hash_table_destroy (cached);
+	g_hash_table_destroy (fresh);
+
+	return NULL;
+}
+
+static gboolean
+folder_list_delta_callback (gpointer thr_user_data)
+{
+	FolderListDeltaInfo *info = thr_user_data;
+	GList *node;
+
+	for (node = info->changes; node != NULL; node = g_list_next (node)) {
+		TnyFolderStoreChange *change = node->data;
+		TnyFolderStore *store = tny_folder_store_change_get_folder_store (change);
+
+		if (!info->cancelled)
+			notify_folder_store_observers_about (store, change);
+		g_object_unref (store);
+	}
+
+	return FALSE;
+}
+
+static void
+folder_list_delta_destroyer (gpointer thr_user_data)
+{
+	FolderListDeltaInfo *info = thr_user_data;
+
+	g_list_foreach (info->changes, (GFunc) g_object_unref, NULL);
+	g_list_free (info->changes);
+
+	/* Thread reference */
+	g_object_unref (info->self);
+	if (info->query)
+		g_object_unref (info->query);
+	camel_lite_object_unref (info->session);
+
+	return;
+}
+
+/* Ask the server for the folder list and tell the observers how it
+ * differs from @cached, the list the caller got answered with. Only
+ * created folders that pass @query are reported, like the listing */
+static void
+queue_folder_list_delta (TnyCamelStoreAccount *self, TnyFolderStoreQuery *query, CamelFolderInfo *cached)
+{
+	TnyCamelAccountPriv *apriv = TNY_CAMEL_ACCOUNT_GET_PRIVATE (self);
+	TnyCamelStoreAccountPriv *priv = TNY_CAMEL_STORE_ACCOUNT_GET_PRIVATE (self);
+	FolderListDeltaInfo *info;
+
+	info = g_slice_new0 (FolderListDeltaInfo);
+	info->self = TNY_CAMEL_STORE_ACCOUNT (g_object_ref (self));
+	info->query = query ? g_object_ref (query) : NULL;
+	info->cached = cached;
+	info->changes = NULL;
+	info->cancelled = FALSE;
+	info->session = apriv->session;
+	camel_lite_object_ref (info->session);
+
+	_tny_camel_queue_launch_wflags (priv->queue, 
+		folder_list_delta_thread, 
+		folder_list_delta_callback, 
+		folder_list_delta_destroyer, 
+		folder_list_delta_callback, 
+		folder_list_delta_destroyer, 
+		&info->cancelled, info, sizeof (FolderListDeltaInfo),
+		TNY_CAMEL_QUEUE_NORMAL_ITEM, 
+		__FUNCTION__);
+}
+
+static void
+launch_get_folders (TnyCamelStoreAccount *self, GetFoldersInfo *info)
+{
+	TnyCamelStoreAccountPriv *priv = TNY_CAMEL_STORE_ACCOUNT_GET_PRIVATE (self);
+
+	_tny_camel_queue_launch_wflags (priv->queue, 
+		tny_camel_store_account_get_folders_async_thread,
+		tny_camel_store_account_get_folders_async_callback,
+		tny_camel_store_account_get_folders_async_destroyer, 
+		tny_camel_store_account_get_folders_async_cancelled_callback,
+		tny_camel_store_account_get_folders_async_cancelled_destroyer, 
+		&info->cancelled, info, sizeof (GetFoldersInfo),
+		TNY_CAMEL_QUEUE_NORMAL_ITEM|TNY_CAMEL_QUEUE_PRIORITY_ITEM, 
+		__FUNCTION__);
+}
+
+static gboolean
+get_folders_cached_idle (gpointer thr_user_data)
+{
+	GetFoldersInfo *info = thr_user_data;
+	TnyCamelStoreAccount *self = TNY_CAMEL_STORE_ACCOUNT (info->self);
+	TnyCamelStoreAccountPriv *priv = TNY_CAMEL_STORE_ACCOUNT_GET_PRIVATE (self);
+
+	if (info->cached == NULL) {
+		/* Nothing was stored yet, wait for the server after all */
+		camel_lite_object_unref (info->store);
+		info->store = NULL;
+		launch_get_folders (self, info);
+		return FALSE;
+	}
+
+	/* The folders are factored here and not in the thread that read
+	 * the store summary, the account's queue factors them too */
+	priv->cached_iter = info->cached;
+	priv->cached_iter_store = info->store;
+	info->store = NULL;
+	list_folder_infos (info->self, info->list, info->query, info->cached);
+
+	info->cancelled = FALSE;
+	tny_camel_store_account_get_folders_async_callback (info);
+	queue_folder_list_delta (self, info->query, info->cached);
+
+	tny_camel_store_account_get_folders_async_destroyer (info);
+	g_slice_free (GetFoldersInfo, info);
+
+	return FALSE;
+}
+
+static gpointer
+get_folders_cached_thread (gpointer thr_user_data)
+{
+	GetFoldersInfo *info = thr_user_data;
+	CamelException ex = CAMEL_EXCEPTION_INITIALISER;
+	CamelStore *store = info->store;
+	guint32 flags;
+
+	flags = CAMEL_STORE_FOLDER_INFO_FAST | CAMEL_STORE_FOLDER_INFO_NO_VIRTUAL |
+		CAMEL_STORE_FOLDER_INFO_RECURSIVE;
+
+	if (!camel_lite_session_is_online ((CamelSession*) info->session))
+		flags |= CAMEL_STORE_FOLDER_INFO_SUBSCRIBED;
+
+	/* This only reads the store summary, it doesn't have to wait for
+	 * the account's queue which is probably still connecting */
+	info->cached = CAMEL_DISCO_STORE_CLASS(CAMEL_OBJECT_GET_CLASS(store))->get_folder_info_offline(store,  "", flags, &ex);
+	camel_lite_exception_clear (&ex);
+
+	g_idle_add (get_folders_cached_idle, info);
+
+	return NULL;
+}
+
 static void 
 tny_camel_store_account_get_folders_async_default (TnyFolderStore *self, TnyList *list, TnyFolderStoreQuery *query, gboolean refresh, TnyGetFoldersCallback callback, TnyStatusCallback status_callback, gpointer user_data)
 {
@@ -1720,15 +2358,23 @@ tny_camel_store_account_get_folders_async_default (TnyFolderStore *self, TnyList
 	if (info->query)
 		g_object_ref (info->query);
 
-	_tny_camel_queue_launch_wflags (priv->queue, 
-		tny_camel_store_account_get_folders_async_thread,
-		tny_camel_store_account_get_folders_async_callback,
-		tny_camel_store_account_get_folders_async_destroyer, 
-		tny_camel_store_account_get_folders_async_cancelled_callback,
-		tny_camel_store_account_get_folders_async_cancelled_destroyer, 
-		&info->cancelled, info, sizeof (GetFoldersInfo),
-		TNY_CAMEL_QUEUE_NORMAL_ITEM|TNY_CAMEL_QUEUE_PRIORITY_ITEM, 
-		__FUNCTION__);
+	/* The first listing is answered from the store summary of the 
+	 * last session right away, the server's list follows as changes */
+	if (refresh && !priv->cache_answered && apriv->service && 
+	    CAMEL_IS_DISCO_STORE (apriv->service))
+	{
+		priv->cache_answered = TRUE;
+		info->store = CAMEL_STORE (apriv->service);
+		camel_lite_object_ref (info->store);
+
+		if (g_thread_create (get_folders_cached_thread, info, FALSE, NULL))
+			return;
+
+		camel_lite_object_unref (info->store);
+		info->store = NULL;
+	}
+
+	launch_get_folders (TNY_CAMEL_STORE_ACCOUNT (self), info);
 
 	return;
 }
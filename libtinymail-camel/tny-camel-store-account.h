@@ -68,6 +68,8 @@ GType tny_camel_store_account_get_type (void);
 TnyStoreAccount* tny_camel_store_account_new (void);
 
 TnyFolder* tny_camel_store_account_factor_folder (TnyCamelStoreAccount *self, const gchar *full_name, gboolean *was_new);
+void tny_camel_store_account_set_push_folders (TnyCamelStoreAccount *self, TnyList *folders);
+void tny_camel_store_account_poke_status (TnyCamelStoreAccount *self, TnyList *folders);
 
 G_END_DECLS
 
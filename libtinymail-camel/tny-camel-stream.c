@@ -25,6 +25,8 @@
 
 #include <tny-stream.h>
 #include <tny-camel-stream.h>
+#include <tny-stream-camel.h>
+#include <tny-fs-stream.h>
 #include <tny-folder.h>
 #include <tny-camel-folder.h>
 
@@ -44,12 +46,40 @@
 static GObjectClass *parent_class = NULL;
 
 
+#define TNY_CAMEL_STREAM_BUFFER_MIN 4096
+#define TNY_CAMEL_STREAM_BUFFER_MAX (64 * 1024)
+
+/* A CamelStreamFs going into a TnyFsStream is copied by the kernel. Returns
+ * what got copied, the rest is left for the buffered copy */
+static gssize
+copy_fs_to_fs (CamelStreamFs *stream, TnyFsStream *output)
+{
+	CamelSeekableStream *seekable = CAMEL_SEEKABLE_STREAM (stream);
+	gsize n = G_MAXSSIZE;
+	gssize copied;
+
+	if (CAMEL_STREAM (stream)->eos)
+		return 0;
+
+	if (seekable->bound_end != CAMEL_STREAM_UNBOUND)
+		n = seekable->bound_end - seekable->position;
+
+	copied = tny_fs_stream_copy_from_fd (output, stream->fd, n);
+	if (copied <= 0)
+		return 0;
+
+	seekable->position += copied;
+
+	return copied;
+}
+
 static gssize
 tny_camel_stream_write_to_stream (TnyStream *self, TnyStream *output)
 {
 	TnyCamelStreamPriv *priv = TNY_CAMEL_STREAM_GET_PRIVATE (self);
 	CamelStream *stream = priv->stream;
-	char tmp_buf[4096];
+	gsize size = TNY_CAMEL_STREAM_BUFFER_MIN;
+	char *tmp_buf;
 	gssize total = 0;
 	gssize nb_read;
 	gssize nb_written;
@@ -57,12 +87,22 @@ tny_camel_stream_write_to_stream (TnyStream *self, TnyStream *output)
 	g_return_val_if_fail (CAMEL_IS_STREAM (stream), -1);
 	g_return_val_if_fail (TNY_IS_STREAM (output), -1);
 
+	/* Wrapping a TnyStream, let that one do it */
+	if (CAMEL_CHECK_TYPE (stream, tny_stream_camel_get_type ()))
+		return tny_stream_write_to_stream (TNY_STREAM_CAMEL (stream)->stream, output);
+
+	if (CAMEL_IS_STREAM_FS (stream) && TNY_IS_FS_STREAM (output))
+		total = copy_fs_to_fs (CAMEL_STREAM_FS (stream), TNY_FS_STREAM (output));
+
+	tmp_buf = g_malloc (size);
+
 	while (G_LIKELY (!camel_lite_stream_eos (stream))) 
 	{
-		nb_read = camel_lite_stream_read (stream, tmp_buf, sizeof (tmp_buf));
-		if (G_UNLIKELY (nb_read < 0))
-			return -1;
-		else if (G_LIKELY (nb_read > 0)) 
+		nb_read = camel_lite_stream_read (stream, tmp_buf, size);
+		if (G_UNLIKELY (nb_read < 0)) {
+			total = -1;
+			break;
+		} else if (G_LIKELY (nb_read > 0)) 
 		{
 			nb_written = 0;
 	
@@ -70,13 +110,24 @@ tny_camel_stream_write_to_stream (TnyStream *self, TnyStream *output)
 			{
 				gssize len = tny_stream_write (output, tmp_buf + nb_written,
 								  nb_read - nb_written);
-				if (G_UNLIKELY (len < 0))
+				if (G_UNLIKELY (len < 0)) {
+					g_free (tmp_buf);
 					return -1;
+				}
 				nb_written += len;
 			}
 			total += nb_written;
+
+			if (nb_read == size && size < TNY_CAMEL_STREAM_BUFFER_MAX) {
+				size *= 2;
+				g_free (tmp_buf);
+				tmp_buf = g_malloc (size);
+			}
 		}
 	}
+
+	g_free (tmp_buf);
+
 	return total;
 }
 
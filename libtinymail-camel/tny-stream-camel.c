@@ -38,35 +38,12 @@ static CamelStreamClass *parent_class = NULL;
 gssize 
 tny_stream_camel_write_to_stream (TnyStreamCamel *self, TnyStream *output)
 {
-	CamelStream *stream = CAMEL_STREAM (self);
-	char tmp_buf[4096];
-	gssize total = 0;
-	gssize nb_read;
-	gssize nb_written;
-	g_return_val_if_fail (CAMEL_IS_STREAM (stream), -1);
+	g_return_val_if_fail (TNY_IS_STREAM (self->stream), -1);
 	g_return_val_if_fail (TNY_IS_STREAM (output), -1);
 
-	while (G_LIKELY (!camel_lite_stream_eos (stream)))
-	{
-		nb_read = camel_lite_stream_read (stream, tmp_buf, sizeof (tmp_buf));
-		if (G_UNLIKELY (nb_read < 0))
-			return -1;
-		else if (G_LIKELY (nb_read > 0))
-		{
-			nb_written = 0;
-	
-			while (G_LIKELY (nb_written < nb_read))
-			{
-				gssize len = tny_stream_write (output, tmp_buf + nb_written,
-								  nb_read - nb_written);
-				if (G_UNLIKELY (len < 0))
-					return -1;
-				nb_written += len;
-			}
-			total += nb_written;
-		}
-	}
-	return total;
+	/* Reading self is reading self->stream, which might know a faster way
+	 * to copy itself, like a TnyFsStream into another one */
+	return tny_stream_write_to_stream (self->stream, output);
 }
 
 
@@ -48,7 +48,8 @@ typedef enum {
 
 typedef enum {
 	TNY_FOLDER_STORE_CHANGE_CHANGED_CREATED_FOLDERS = 1<<0,
-	TNY_FOLDER_STORE_CHANGE_CHANGED_REMOVED_FOLDERS = 1<<1
+	TNY_FOLDER_STORE_CHANGE_CHANGED_REMOVED_FOLDERS = 1<<1,
+	TNY_FOLDER_STORE_CHANGE_CHANGED_STATUS_FOLDERS = 1<<2
 } TnyFolderStoreChangeChanged;
 
 typedef enum {
@@ -36,7 +36,7 @@ typedef struct _TnyFolderStoreChangePriv TnyFolderStoreChangePriv;
 
 struct _TnyFolderStoreChangePriv
 {
-	TnyList *created, *removed;
+	TnyList *created, *removed, *status;
 	GMutex *lock;
 	TnyFolderStore *folderstore;
 	TnyFolderStoreChangeChanged changed;
@@ -213,6 +213,80 @@ tny_folder_store_change_get_removed_folders (TnyFolderStoreChange *self, TnyList
 	return;
 }
 
+/**
+ * tny_folder_store_change_add_status_folder:
+ * @self: a #TnyFolderStoreChange
+ * @folder: a #TnyFolder to add to the changeset
+ *
+ * Add @folder to the changeset of folders whose unread or total count got
+ * refreshed. This is an internal function not intended for application
+ * developers to alter.
+ *
+ * since: 1.0
+ * audience: tinymail-developer
+ **/
+void 
+tny_folder_store_change_add_status_folder (TnyFolderStoreChange *self, TnyFolder *folder)
+{
+	TnyFolderStoreChangePriv *priv = TNY_FOLDER_STORE_CHANGE_GET_PRIVATE (self);
+
+	g_mutex_lock (priv->lock);
+
+	if (!priv->status)
+		priv->status = tny_simple_list_new ();
+	tny_list_prepend (priv->status, G_OBJECT (folder));
+	priv->changed |= TNY_FOLDER_STORE_CHANGE_CHANGED_STATUS_FOLDERS;
+
+	g_mutex_unlock (priv->lock);
+
+	return;
+}
+
+/**
+ * tny_folder_store_change_get_status_folders:
+ * @self: a #TnyFolderStoreChange
+ * @folders: a #TnyList where the folders will be prepended to
+ *
+ * Get the folders in this changeset whose unread or total count got
+ * refreshed. Their new counts are the ones tny_folder_get_unread_count and
+ * tny_folder_get_all_count return.
+ *
+ * since: 1.0
+ * audience: application-developer
+ **/
+void 
+tny_folder_store_change_get_status_folders (TnyFolderStoreChange *self, TnyList *folders)
+{
+	TnyFolderStoreChangePriv *priv = TNY_FOLDER_STORE_CHANGE_GET_PRIVATE (self);
+	TnyIterator *iter;
+
+	g_assert (TNY_IS_LIST (folders));
+
+	g_mutex_lock (priv->lock);
+
+	if (!priv->status)
+	{
+		g_mutex_unlock (priv->lock);
+		return;
+	}
+
+	iter = tny_list_create_iterator (priv->status);
+
+	while (!tny_iterator_is_done (iter))
+	{
+		GObject *folder = tny_iterator_get_current (iter);
+		tny_list_prepend (folders, folder);
+		g_object_unref (folder);
+		tny_iterator_next (iter);
+	}
+
+	g_object_unref (iter);
+
+	g_mutex_unlock (priv->lock);
+
+	return;
+}
+
 /**
  * tny_folder_store_change_reset:
  * @self: a #TnyFolderStoreChange
@@ -235,8 +309,11 @@ tny_folder_store_change_reset (TnyFolderStoreChange *self)
 		g_object_unref (G_OBJECT (priv->created));
 	if (priv->removed)
 		g_object_unref (G_OBJECT (priv->removed));
+	if (priv->status)
+		g_object_unref (G_OBJECT (priv->status));
 	priv->created = NULL;
 	priv->removed = NULL;
+	priv->status = NULL;
 
 	g_mutex_unlock (priv->lock);
 }
@@ -302,6 +379,7 @@ tny_folder_store_change_instance_init (GTypeInstance *instance, gpointer g_class
 	priv->changed = 0;
 	priv->created = NULL;
 	priv->removed = NULL;
+	priv->status = NULL;
 	priv->folderstore = NULL;
 
 	g_mutex_unlock (priv->lock);
@@ -321,8 +399,11 @@ tny_folder_store_change_finalize (GObject *object)
 		g_object_unref (G_OBJECT (priv->created));
 	if (priv->removed)
 		g_object_unref (G_OBJECT (priv->removed));
+	if (priv->status)
+		g_object_unref (G_OBJECT (priv->status));
 	priv->created = NULL;
 	priv->removed = NULL;
+	priv->status = NULL;
 
 	if (priv->folderstore)
 		g_object_unref (G_OBJECT (priv->folderstore));
@@ -397,6 +478,7 @@ tny_folder_store_change_changed_register_type (gpointer notused)
   static const GFlagsValue values[] = {
     { TNY_FOLDER_STORE_CHANGE_CHANGED_CREATED_FOLDERS, "TNY_FOLDER_STORE_CHANGE_CHANGED_CREATED_FOLDERS", "created-folders" },
     { TNY_FOLDER_STORE_CHANGE_CHANGED_REMOVED_FOLDERS, "TNY_FOLDER_STORE_CHANGE_CHANGED_REMOVED_FOLDERS", "removed-folders" },
+    { TNY_FOLDER_STORE_CHANGE_CHANGED_STATUS_FOLDERS, "TNY_FOLDER_STORE_CHANGE_CHANGED_STATUS_FOLDERS", "status-folders" },
     { 0, NULL, NULL }
   };
   etype = g_flags_register_static ("TnyFolderStoreChangeChanged", values);
@@ -52,9 +52,16 @@
 
 #include <config.h>
 
+#define _GNU_SOURCE
+
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
 
 #include <tny-fs-stream.h>
 
@@ -75,32 +82,125 @@ struct _TnyFsStreamPriv
 	(G_TYPE_INSTANCE_GET_PRIVATE ((o), TNY_TYPE_FS_STREAM, TnyFsStreamPriv))
 
 
+#define TNY_FS_STREAM_BUFFER_MIN 4096
+#define TNY_FS_STREAM_BUFFER_MAX (64 * 1024)
+#define TNY_FS_STREAM_COPY_CHUNK (1 << 30)
+
+typedef enum {
+	FD_COPY_FILE_RANGE,
+	FD_COPY_SENDFILE,
+	FD_COPY_SPLICE,
+	FD_COPY_NONE
+} FdCopyMethod;
+
+static gboolean
+fd_copy_unsupported (int err)
+{
+	return (err == EINVAL || err == ENOSYS || err == EXDEV || 
+		err == EOPNOTSUPP || err == ENOTSUP || err == EBADF || 
+		err == ESPIPE);
+}
+
+/* Copy from in_fd to out_fd in the kernel, starting at and advancing both
+ * file offsets. Falls through to the next method when the kernel says it
+ * can't do the current one for these two descriptors */
+static gssize
+fd_copy (int in_fd, int out_fd, gsize n, FdCopyMethod *method)
+{
+	gssize len;
+
+	switch (*method) {
+	case FD_COPY_FILE_RANGE:
+#ifdef HAVE_COPY_FILE_RANGE
+		len = copy_file_range (in_fd, NULL, out_fd, NULL, n, 0);
+		if (len >= 0 || !fd_copy_unsupported (errno))
+			return len;
+#endif
+		*method = FD_COPY_SENDFILE;
+		/* fall through */
+	case FD_COPY_SENDFILE:
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+		len = sendfile (out_fd, in_fd, NULL, n);
+		if (len >= 0 || !fd_copy_unsupported (errno))
+			return len;
+#endif
+		*method = FD_COPY_SPLICE;
+		/* fall through */
+	case FD_COPY_SPLICE:
+#ifdef HAVE_SPLICE
+		/* Only when one of them is a pipe */
+		len = splice (in_fd, NULL, out_fd, NULL, n, SPLICE_F_MOVE);
+		if (len >= 0 || !fd_copy_unsupported (errno))
+			return len;
+#endif
+		*method = FD_COPY_NONE;
+		/* fall through */
+	default:
+		break;
+	}
+
+	errno = ENOTSUP;
+	return -1;
+}
+
 static gssize
 tny_fs_stream_write_to_stream (TnyStream *self, TnyStream *output)
 {
-	char tmp_buf[4096];
+	TnyFsStreamPriv *priv = TNY_FS_STREAM_GET_PRIVATE (self);
+	gsize size = TNY_FS_STREAM_BUFFER_MIN;
+	char *tmp_buf;
 	gssize total = 0;
 	gssize nb_read;
 	gssize nb_written;
-	
+
+	if (TNY_IS_FS_STREAM (output) && !priv->eos) {
+		gsize n = G_MAXSSIZE;
+
+		if (priv->bound_end != (~0))
+			n = priv->bound_end - priv->position;
+
+		/* What the kernel couldn't copy, if anything, goes through 
+		 * the buffer below. A real error will happen again there */
+		total = tny_fs_stream_copy_from_fd (TNY_FS_STREAM (output), priv->fd, n);
+		if (total > 0)
+			priv->position += total;
+		else
+			total = 0;
+	}
+
+	tmp_buf = g_malloc (size);
+
 	while (G_UNLIKELY (!tny_stream_is_eos (self))) {
-		nb_read = tny_stream_read (self, tmp_buf, sizeof (tmp_buf));
-		if (G_UNLIKELY (nb_read < 0))
-			return -1;
-		else if (G_LIKELY (nb_read > 0)) {
+		nb_read = tny_stream_read (self, tmp_buf, size);
+		if (G_UNLIKELY (nb_read < 0)) {
+			total = -1;
+			break;
+		} else if (G_LIKELY (nb_read > 0)) {
 			nb_written = 0;
 	
 			while (G_LIKELY (nb_written < nb_read))
 			{
 				gssize len = tny_stream_write (output, tmp_buf + nb_written,
 					  nb_read - nb_written);
-				if (G_UNLIKELY (len < 0))
+				if (G_UNLIKELY (len < 0)) {
+					g_free (tmp_buf);
 					return -1;
+				}
 				nb_written += len;
 			}
 			total += nb_written;
+
+			/* A full buffer means there's more to come */
+			if (nb_read == size && size < TNY_FS_STREAM_BUFFER_MAX) {
+				size *= 2;
+				g_free (tmp_buf);
+				tmp_buf = g_malloc (size);
+			}
 		}
 	}
+
+	g_free (tmp_buf);
+
 	return total;
 }
 
@@ -174,6 +274,82 @@ tny_fs_stream_set_fd (TnyFsStream *self, int fd)
 	return;
 }
 
+/**
+ * tny_fs_stream_get_fd:
+ * @self: A #TnyFsStream instance
+ *
+ * Get the file descriptor @self adapts. It stays owned by @self, and reading
+ * or writing it directly will confuse @self's idea of its position.
+ *
+ * returns: the file descriptor or -1
+ * since: 1.0
+ * audience: tinymail-developer
+ **/
+int
+tny_fs_stream_get_fd (TnyFsStream *self)
+{
+	TnyFsStreamPriv *priv = TNY_FS_STREAM_GET_PRIVATE (self);
+	return priv->fd;
+}
+
+/**
+ * tny_fs_stream_copy_from_fd:
+ * @self: A #TnyFsStream instance
+ * @fd: The file descriptor to copy from
+ * @n: The maximum amount of bytes to copy
+ *
+ * Copy from @fd, starting at its current offset, to @self without passing
+ * the data through user space, using copy_file_range(), sendfile() or 
+ * splice(), whichever the kernel supports for the two descriptors. The 
+ * offset of @fd advances with the amount of bytes copied. The bounds of 
+ * @self are respected.
+ *
+ * This is what tny_stream_write_to_stream() uses between two #TnyFsStream
+ * instances. Other stream implementations that are backed by a file 
+ * descriptor can use it when writing to a #TnyFsStream.
+ *
+ * returns: the amount of bytes copied, which is less than @n if the end of
+ * @fd was reached, or -1 with errno set. If errno is ENOTSUP nothing was 
+ * copied and the caller has to copy through a buffer instead.
+ * since: 1.0
+ * audience: tinymail-developer
+ **/
+gssize
+tny_fs_stream_copy_from_fd (TnyFsStream *self, int fd, gsize n)
+{
+	TnyFsStreamPriv *priv = TNY_FS_STREAM_GET_PRIVATE (self);
+	FdCopyMethod method = FD_COPY_FILE_RANGE;
+	gssize total = 0, len;
+
+	if (priv->fd == -1 || fd == -1) {
+		errno = EBADF;
+		return -1;
+	}
+
+	if (priv->bound_end != (~0))
+		n = MIN (priv->bound_end - priv->position, n);
+
+	while ((gsize) total < n)
+	{
+		len = fd_copy (fd, priv->fd, MIN (n - total, TNY_FS_STREAM_COPY_CHUNK), &method);
+
+		if (len > 0)
+			total += len;
+		else if (len == 0)
+			break;
+		else if (errno == EINTR)
+			continue;
+		else if (total > 0)
+			break;
+		else
+			return -1;
+	}
+
+	priv->position += total;
+
+	return total;
+}
+
 /**
  * tny_fs_stream_new:
  * @fd: The file descriptor to write to or read from
@@ -57,6 +57,8 @@ struct _TnyFsStreamClass
 GType  tny_fs_stream_get_type (void);
 TnyStream* tny_fs_stream_new (int fd);
 void tny_fs_stream_set_fd (TnyFsStream *self, int fd);
+int tny_fs_stream_get_fd (TnyFsStream *self);
+gssize tny_fs_stream_copy_from_fd (TnyFsStream *self, int fd, gsize n);
 
 G_END_DECLS
 
@@ -23,6 +23,10 @@
  * A #TnyMimePartView that can render a #TnyMimePart that is an image. It's
  * recommended to use this type together with a #TnyGtkExpanderMimePartView.
  *
+ * Images can be decoded straight to a maximum size, and what was shown can be
+ * kept in a thumbnail cache on disk so that showing the same part again
+ * doesn't need decoding it anymore.
+ *
  * free-function: g_object_unref
  **/
 
@@ -38,6 +42,7 @@
 #include <sys/types.h>
 
 #include <string.h>
+#include <glib/gstdio.h>
 #include <gtk/gtk.h>
 
 #include <tny-gtk-image-mime-part-view.h>
@@ -61,8 +66,16 @@ struct _TnyGtkImageMimePartViewPriv
 	TnyMimePart *part;
 	TnyStatusCallback status_callback;
 	gpointer status_user_data;
+	gint max_width, max_height;
+	gchar *thumbnail_dir, *thumbnail_key;
 };
 
+typedef struct
+{
+	TnyMimePartView *self;
+	gchar *thumbnail;
+} DecodeInfo;
+
 #define TNY_GTK_IMAGE_MIME_PART_VIEW_GET_PRIVATE(o) \
 	(G_TYPE_INSTANCE_GET_PRIVATE ((o), TNY_TYPE_GTK_IMAGE_MIME_PART_VIEW, TnyGtkImageMimePartViewPriv))
 
@@ -87,21 +100,78 @@ tny_gtk_image_mime_part_view_set_part (TnyMimePartView *self, TnyMimePart *part)
 	return;
 }
 
+/* The key is escaped into a file name, together with the size the image
+ * got decoded to as a thumbnail only fits one size */
+static gchar *
+thumbnail_path (TnyGtkImageMimePartViewPriv *priv)
+{
+	GString *name;
+	const gchar *ptr;
+	gchar *retval;
+
+	if (!priv->thumbnail_dir || !priv->thumbnail_key)
+		return NULL;
+
+	name = g_string_new ("");
+	for (ptr = priv->thumbnail_key; *ptr && name->len < 200; ptr++) {
+		if (g_ascii_isalnum (*ptr) || *ptr == '-' || *ptr == '_' || *ptr == '.')
+			g_string_append_c (name, *ptr);
+		else
+			g_string_append_printf (name, "%%%02X", (guchar) *ptr);
+	}
+	if (*ptr)
+		g_string_append_printf (name, "-%08x", g_str_hash (priv->thumbnail_key));
+	g_string_append_printf (name, "-%dx%d.png", priv->max_width, priv->max_height);
+
+	retval = g_build_filename (priv->thumbnail_dir, name->str, NULL);
+	g_string_free (name, TRUE);
+
+	return retval;
+}
+
+static void
+thumbnail_save (GdkPixbuf *pixbuf, const gchar *path)
+{
+	gchar *dir, *tmp;
+
+	dir = g_path_get_dirname (path);
+	g_mkdir_with_parents (dir, S_IRWXU);
+	g_free (dir);
+
+	/* Written aside and renamed so that a half written file is never
+	 * picked up as a thumbnail */
+	tmp = g_strdup_printf ("%s~", path);
+	if (gdk_pixbuf_save (pixbuf, tmp, "png", NULL, NULL))
+		g_rename (tmp, path);
+	else
+		g_unlink (tmp);
+	g_free (tmp);
+}
+
 static void 
 on_mime_part_decoded (TnyMimePart *part, gboolean canceled, TnyStream *dest, GError *err, gpointer user_data)
 {
-	TnyMimePartView *self = (TnyMimePartView *) user_data;
+	DecodeInfo *info = user_data;
 	GdkPixbuf *pixbuf;
+	gboolean complete;
 	tny_stream_reset (dest);
+	/* Closing finishes the image, before that the last rows can
+	 * still be missing */
+	complete = (tny_stream_close (dest) == 0);
 	pixbuf = tny_gtk_pixbuf_stream_get_pixbuf (TNY_GTK_PIXBUF_STREAM (dest));
-	gtk_image_set_from_pixbuf (GTK_IMAGE (self), pixbuf);
-	g_object_unref (self);
+	gtk_image_set_from_pixbuf (GTK_IMAGE (info->self), pixbuf);
+	if (pixbuf && info->thumbnail && complete && !canceled && !err)
+		thumbnail_save (pixbuf, info->thumbnail);
+	g_object_unref (info->self);
+	g_free (info->thumbnail);
+	g_slice_free (DecodeInfo, info);
 }
 
 static void 
 on_status (GObject *part, TnyStatus *status, gpointer user_data)
 {
-	TnyMimePartView *self = (TnyMimePartView *) user_data;
+	DecodeInfo *info = user_data;
+	TnyMimePartView *self = info->self;
 	TnyGtkImageMimePartViewPriv *priv = TNY_GTK_IMAGE_MIME_PART_VIEW_GET_PRIVATE (self);
 	if (priv->status_callback)
 		priv->status_callback ((GObject *) self, status, priv->status_user_data);
@@ -119,11 +189,30 @@ tny_gtk_image_mime_part_view_set_part_default (TnyMimePartView *self, TnyMimePar
 		g_object_unref (priv->part);
 
 	if (part) {
-		TnyStream *dest = tny_gtk_pixbuf_stream_new (tny_mime_part_get_content_type (part));
-		tny_stream_reset (dest);
-		tny_mime_part_decode_to_stream_async (part, dest, on_mime_part_decoded, 
-				on_status, g_object_ref (self));
-		g_object_unref (dest);
+		gchar *thumbnail = thumbnail_path (priv);
+		GdkPixbuf *pixbuf = NULL;
+
+		if (thumbnail && g_file_test (thumbnail, G_FILE_TEST_EXISTS))
+			pixbuf = gdk_pixbuf_new_from_file (thumbnail, NULL);
+
+		if (pixbuf) {
+			gtk_image_set_from_pixbuf (GTK_IMAGE (self), pixbuf);
+			g_object_unref (pixbuf);
+			g_free (thumbnail);
+		} else {
+			TnyStream *dest = tny_gtk_pixbuf_stream_new (tny_mime_part_get_content_type (part));
+			DecodeInfo *info = g_slice_new (DecodeInfo);
+
+			tny_gtk_pixbuf_stream_set_max_size (TNY_GTK_PIXBUF_STREAM (dest), 
+				priv->max_width, priv->max_height);
+			info->self = g_object_ref (self);
+			info->thumbnail = thumbnail;
+
+			tny_stream_reset (dest);
+			tny_mime_part_decode_to_stream_async (part, dest, on_mime_part_decoded, 
+					on_status, info);
+			g_object_unref (dest);
+		}
 		priv->part = g_object_ref (part);
 	}
 
@@ -143,6 +232,61 @@ tny_gtk_image_mime_part_view_clear_default (TnyMimePartView *self)
 	return;
 }
 
+/**
+ * tny_gtk_image_mime_part_view_set_max_size:
+ * @self: a #TnyGtkImageMimePartView
+ * @max_width: the largest width to show images at, or -1 for no limit
+ * @max_height: the largest height to show images at, or -1 for no limit
+ *
+ * Make @self decode images that are larger straight to a size that fits
+ * @max_width x @max_height. Only affects parts set after this call.
+ *
+ * since: 1.0
+ * audience: application-developer
+ **/
+void
+tny_gtk_image_mime_part_view_set_max_size (TnyGtkImageMimePartView *self, gint max_width, gint max_height)
+{
+	TnyGtkImageMimePartViewPriv *priv = TNY_GTK_IMAGE_MIME_PART_VIEW_GET_PRIVATE (self);
+
+	priv->max_width = max_width;
+	priv->max_height = max_height;
+
+	return;
+}
+
+/**
+ * tny_gtk_image_mime_part_view_set_thumbnail:
+ * @self: a #TnyGtkImageMimePartView
+ * @cache_dir: (null-ok): directory to keep thumbnails in or NULL
+ * @key: (null-ok): a key unique for the part that will be set, or NULL
+ *
+ * Set where the next part set on @self is cached. Once a part got decoded,
+ * the image as shown is saved in @cache_dir under @key. When a part is set
+ * while a thumbnail for @key and the current maximum size exists, the
+ * thumbnail is shown instead of decoding the part.
+ *
+ * The key should identify both the message and the part within it, and
+ * must not be used again for another message. #TnyGtkMsgView uses the
+ * message's URL string, size and received date followed by the part's
+ * position.
+ *
+ * since: 1.0
+ * audience: application-developer
+ **/
+void
+tny_gtk_image_mime_part_view_set_thumbnail (TnyGtkImageMimePartView *self, const gchar *cache_dir, const gchar *key)
+{
+	TnyGtkImageMimePartViewPriv *priv = TNY_GTK_IMAGE_MIME_PART_VIEW_GET_PRIVATE (self);
+
+	g_free (priv->thumbnail_dir);
+	g_free (priv->thumbnail_key);
+	priv->thumbnail_dir = g_strdup (cache_dir);
+	priv->thumbnail_key = g_strdup (key);
+
+	return;
+}
+
 /**
  * tny_gtk_image_mime_part_view_new:
  * @status_callback: (null-ok): a #TnyStatusCallback or NULL
@@ -179,6 +323,10 @@ tny_gtk_image_mime_part_view_instance_init (GTypeInstance *instance, gpointer g_
 
 	priv->status_callback = NULL;
 	priv->status_user_data = NULL;
+	priv->max_width = -1;
+	priv->max_height = -1;
+	priv->thumbnail_dir = NULL;
+	priv->thumbnail_key = NULL;
 
 	return;
 }
@@ -192,6 +340,9 @@ tny_gtk_image_mime_part_view_finalize (GObject *object)
 	if (priv->part)
 		g_object_unref (priv->part);
 
+	g_free (priv->thumbnail_dir);
+	g_free (priv->thumbnail_key);
+
 	(*parent_class->finalize) (object);
 
 	return;
@@ -59,6 +59,8 @@ struct _TnyGtkImageMimePartViewClass
 
 GType tny_gtk_image_mime_part_view_get_type (void);
 TnyMimePartView* tny_gtk_image_mime_part_view_new (TnyStatusCallback status_callback, gpointer status_user_data);
+void tny_gtk_image_mime_part_view_set_max_size (TnyGtkImageMimePartView *self, gint max_width, gint max_height);
+void tny_gtk_image_mime_part_view_set_thumbnail (TnyGtkImageMimePartView *self, const gchar *cache_dir, const gchar *key);
 
 G_END_DECLS
 
@@ -85,6 +85,9 @@ struct _TnyGtkMsgViewPriv
 	GtkBox *kid; gboolean in_expander, parented;
 	TnyStatusCallback status_callback;
 	gpointer status_user_data;
+	gint image_max_width, image_max_height;
+	gchar *thumbnail_dir, *thumbnail_key;
+	gint part_index;
 };
 
 typedef struct
@@ -389,6 +392,36 @@ tny_gtk_msg_view_get_status_callback (TnyGtkMsgView *self, TnyStatusCallback *st
 	*status_user_data = priv->status_user_data;
 }
 
+/**
+ * tny_gtk_msg_view_set_image_options:
+ * @self: a #TnyGtkMsgView
+ * @max_width: the largest width to show images at, 0 for the screen's width or -1 for no limit
+ * @max_height: the largest height to show images at, 0 for the screen's height or -1 for no limit
+ * @thumbnail_dir: (null-ok): directory to cache shown images in, or NULL
+ *
+ * Set how images in messages are shown. Images that are larger than
+ * @max_width x @max_height are decoded straight to a size that fits, so that
+ * big photos don't need their full resolution in memory. By default images
+ * are limited to the size of the screen.
+ *
+ * If @thumbnail_dir is set, the images as shown are saved there per message
+ * and part. Showing the same message again will show them from there, without
+ * decoding the parts again. The cache isn't cleaned up by @self.
+ *
+ * since: 1.0
+ * audience: application-developer
+ **/
+void 
+tny_gtk_msg_view_set_image_options (TnyGtkMsgView *self, gint max_width, gint max_height, const gchar *thumbnail_dir)
+{
+	TnyGtkMsgViewPriv *priv = TNY_GTK_MSG_VIEW_GET_PRIVATE (self);
+	priv->image_max_width = max_width;
+	priv->image_max_height = max_height;
+	g_free (priv->thumbnail_dir);
+	priv->thumbnail_dir = g_strdup (thumbnail_dir);
+	return;
+}
+
 static TnyMsgView*
 tny_gtk_msg_view_create_new_inline_viewer_default (TnyMsgView *self)
 {
@@ -398,6 +431,8 @@ tny_gtk_msg_view_create_new_inline_viewer_default (TnyMsgView *self)
 	tny_gtk_msg_view_set_parented (TNY_GTK_MSG_VIEW (retval), TRUE);
 	tny_gtk_msg_view_set_status_callback (TNY_GTK_MSG_VIEW (retval), 
 		priv->status_callback, priv->status_user_data);
+	tny_gtk_msg_view_set_image_options (TNY_GTK_MSG_VIEW (retval), 
+		priv->image_max_width, priv->image_max_height, priv->thumbnail_dir);
 
 	return retval;
 }
@@ -437,9 +472,16 @@ tny_gtk_msg_view_create_mime_part_view_for_default (TnyMsgView *self, TnyMimePar
 {
 	TnyGtkMsgViewPriv *priv = TNY_GTK_MSG_VIEW_GET_PRIVATE (self);
 	TnyMimePartView *retval = NULL;
+	gchar *key = NULL;
 
 	g_assert (TNY_IS_MIME_PART (part));
 
+	/* Parts are keyed by their position, which is the same each time
+	 * the same message is shown */
+	if (priv->thumbnail_key)
+		key = g_strdup_printf ("%s/%d", priv->thumbnail_key, priv->part_index);
+	priv->part_index++;
+
 	/* PLAIN mime part */
 	if (priv->display_plain && tny_mime_part_content_type_is (part, "text/plain"))
 	{
@@ -457,6 +499,17 @@ tny_gtk_msg_view_create_mime_part_view_for_default (TnyMsgView *self, TnyMimePar
 		gboolean nf = FALSE;
 		TnyMimePartView *image_view = tny_gtk_image_mime_part_view_new (priv->status_callback, priv->status_user_data);
 		gchar *desc = (gchar *) tny_mime_part_get_description (part);
+		gint max_width = priv->image_max_width, max_height = priv->image_max_height;
+
+		if (max_width == 0)
+			max_width = gdk_screen_get_width (gdk_screen_get_default ());
+		if (max_height == 0)
+			max_height = gdk_screen_get_height (gdk_screen_get_default ());
+
+		tny_gtk_image_mime_part_view_set_max_size (TNY_GTK_IMAGE_MIME_PART_VIEW (image_view), 
+			max_width, max_height);
+		tny_gtk_image_mime_part_view_set_thumbnail (TNY_GTK_IMAGE_MIME_PART_VIEW (image_view), 
+			priv->thumbnail_dir, key);
 
 		retval = tny_gtk_expander_mime_part_view_new (image_view);
 		if (!desc) {
@@ -474,6 +527,12 @@ tny_gtk_msg_view_create_mime_part_view_for_default (TnyMsgView *self, TnyMimePar
 	{
 		retval = TNY_MIME_PART_VIEW (tny_msg_view_create_new_inline_viewer (self));
 
+		if (TNY_IS_GTK_MSG_VIEW (retval)) {
+			TnyGtkMsgViewPriv *kpriv = TNY_GTK_MSG_VIEW_GET_PRIVATE (retval);
+			g_free (kpriv->thumbnail_key);
+			kpriv->thumbnail_key = g_strdup (key);
+		}
+
 	/* Attachments */
 	} else if ((priv->display_attachments && tny_mime_part_is_attachment (part)) || 
 		(priv->display_rfc822 && (tny_mime_part_content_type_is (part, "message/rfc822"))))
@@ -501,6 +560,8 @@ tny_gtk_msg_view_create_mime_part_view_for_default (TnyMsgView *self, TnyMimePar
 		retval = tny_gtk_attachment_mime_part_view_new (TNY_GTK_ATTACH_LIST_MODEL (model));
 	}
 
+	g_free (key);
+
 	return retval;
 }
 
@@ -732,15 +793,36 @@ tny_gtk_msg_view_mp_set_part_default (TnyMimePartView *self, TnyMimePart *part)
 	{
 		g_assert (TNY_IS_MIME_PART (part));
 
+		priv->part_index = 0;
+
 		if (TNY_IS_MSG (part))
 		{
 			TnyHeader *header = (TnyHeader*) tny_msg_get_header (TNY_MSG (part));
 			if (header && TNY_IS_HEADER (header))
 			{
 				tny_header_view_set_header (priv->headerview, header);
-				g_object_unref (G_OBJECT (header));
 				gtk_widget_show (GTK_WIDGET (priv->headerview));
 			}
+
+			/* Inline viewers got the key from their parent. The URL
+			 * string only holds the folder and the uid, which the
+			 * server can hand out again after a UIDVALIDITY change,
+			 * so the size and date of the message go in the key too */
+			if (priv->thumbnail_dir && !priv->parented)
+			{
+				gchar *url = tny_msg_get_url_string (TNY_MSG (part));
+
+				g_free (priv->thumbnail_key);
+				priv->thumbnail_key = NULL;
+				if (url && header && TNY_IS_HEADER (header))
+					priv->thumbnail_key = g_strdup_printf ("%s-%u-%ld", url,
+						tny_header_get_message_size (header),
+						(long) tny_header_get_date_received (header));
+				g_free (url);
+			}
+
+			if (header)
+				g_object_unref (G_OBJECT (header));
 		}
 
 		priv->part = (TnyMimePart*)g_object_ref (G_OBJECT (part));
@@ -830,6 +912,11 @@ tny_gtk_msg_view_instance_init (GTypeInstance *instance, gpointer g_class)
 	priv->first_attachment = TRUE;
 	priv->unattached_views = NULL;
 	priv->part = NULL;
+	priv->image_max_width = 0;
+	priv->image_max_height = 0;
+	priv->thumbnail_dir = NULL;
+	priv->thumbnail_key = NULL;
+	priv->part_index = 0;
 
 
 	priv->headerview = TNY_GTK_MSG_VIEW_GET_CLASS (self)->create_header_view(self);
@@ -897,6 +984,9 @@ tny_gtk_msg_view_finalize (GObject *object)
 	if (G_LIKELY (priv->part))
 		g_object_unref (G_OBJECT (priv->part));
 
+	g_free (priv->thumbnail_dir);
+	g_free (priv->thumbnail_key);
+
 	(*parent_class->finalize) (object);
 
 	return;
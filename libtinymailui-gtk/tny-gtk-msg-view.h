@@ -85,6 +85,8 @@ void tny_gtk_msg_view_get_status_callback (TnyGtkMsgView *self, TnyStatusCallbac
 
 void tny_gtk_msg_view_set_parented (TnyGtkMsgView *self, gboolean parented);
 
+void tny_gtk_msg_view_set_image_options (TnyGtkMsgView *self, gint max_width, gint max_height, const gchar *thumbnail_dir);
+
 G_END_DECLS
 
 #endif
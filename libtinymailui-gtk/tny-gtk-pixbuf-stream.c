@@ -25,6 +25,10 @@
  * streaming a #TnyMimePart that is an image to a #GdkPixbuf that will be used
  * by a #GtkImage.
  *
+ * With tny_gtk_pixbuf_stream_set_max_size() the image is decoded straight to
+ * a smaller size, which for formats like JPEG means that the full resolution
+ * image is never kept in memory.
+ *
  * free-function: g_object_unref
  **/
 
@@ -47,6 +51,8 @@ typedef struct _TnyGtkPixbufStreamPriv TnyGtkPixbufStreamPriv;
 struct _TnyGtkPixbufStreamPriv
 {
 	GdkPixbufLoader *loader;
+	gint max_width, max_height;
+	gboolean closed;
 };
 
 #define TNY_GTK_PIXBUF_STREAM_GET_PRIVATE(o)	\
@@ -147,7 +153,17 @@ tny_gtk_pixbuf_stream_close (TnyStream *self)
 static gint
 tny_gtk_pixbuf_stream_close_default (TnyStream *self)
 {
-	return 0;
+	TnyGtkPixbufStreamPriv *priv = TNY_GTK_PIXBUF_STREAM_GET_PRIVATE (self);
+	gint retval = 0;
+
+	/* Tells the loader that all data is there */
+	if (priv->loader && !priv->closed) {
+		if (!gdk_pixbuf_loader_close (priv->loader, NULL))
+			retval = -1;
+		priv->closed = TRUE;
+	}
+
+	return retval;
 }
 
 static gboolean
@@ -175,6 +191,49 @@ tny_gtk_pixbuf_stream_reset_default (TnyStream *self)
 }
 
 
+static void
+on_size_prepared (GdkPixbufLoader *loader, gint width, gint height, gpointer user_data)
+{
+	TnyGtkPixbufStreamPriv *priv = user_data;
+	gdouble scale = 1.0;
+
+	if (priv->max_width > 0 && width > priv->max_width)
+		scale = (gdouble) priv->max_width / width;
+	if (priv->max_height > 0 && height * scale > priv->max_height)
+		scale = (gdouble) priv->max_height / height;
+
+	if (scale < 1.0)
+		gdk_pixbuf_loader_set_size (loader, 
+			MAX (1, (gint) (width * scale)), 
+			MAX (1, (gint) (height * scale)));
+
+	return;
+}
+
+/**
+ * tny_gtk_pixbuf_stream_set_max_size:
+ * @self: a #TnyGtkPixbufStream
+ * @max_width: the largest width to decode to, or -1 for no limit
+ * @max_height: the largest height to decode to, or -1 for no limit
+ *
+ * Make the decoder scale images that are larger than @max_width x @max_height
+ * down while decoding, keeping their aspect ratio. Must be called before any
+ * data is written to @self.
+ *
+ * since: 1.0
+ * audience: application-developer
+ **/
+void
+tny_gtk_pixbuf_stream_set_max_size (TnyGtkPixbufStream *self, gint max_width, gint max_height)
+{
+	TnyGtkPixbufStreamPriv *priv = TNY_GTK_PIXBUF_STREAM_GET_PRIVATE (self);
+
+	priv->max_width = max_width;
+	priv->max_height = max_height;
+
+	return;
+}
+
 /**
  * tny_gtk_pixbuf_stream_new:
  * @mime_type: the MIME type, for example image/jpeg
@@ -193,6 +252,9 @@ tny_gtk_pixbuf_stream_new (const gchar *mime_type)
 
 	/* TODO: Handle errors */
 	priv->loader = gdk_pixbuf_loader_new_with_mime_type (mime_type, NULL);
+	if (priv->loader)
+		g_signal_connect (priv->loader, "size-prepared",
+			G_CALLBACK (on_size_prepared), priv);
 
 	return TNY_STREAM (self);
 }
@@ -221,6 +283,9 @@ tny_gtk_pixbuf_stream_instance_init (GTypeInstance *instance, gpointer g_class)
 	TnyGtkPixbufStreamPriv *priv = TNY_GTK_PIXBUF_STREAM_GET_PRIVATE (self);
 
 	priv->loader = NULL;
+	priv->max_width = -1;
+	priv->max_height = -1;
+	priv->closed = FALSE;
 
 	return;
 }
@@ -232,7 +297,8 @@ tny_gtk_pixbuf_stream_finalize (GObject *object)
 	TnyGtkPixbufStreamPriv *priv = TNY_GTK_PIXBUF_STREAM_GET_PRIVATE (self);
 
 	if (priv->loader) {
-		gdk_pixbuf_loader_close (priv->loader, NULL);
+		if (!priv->closed)
+			gdk_pixbuf_loader_close (priv->loader, NULL);
 		g_object_unref (priv->loader);
 	}
 
@@ -61,6 +61,7 @@ GType tny_gtk_pixbuf_stream_get_type (void);
 TnyStream* tny_gtk_pixbuf_stream_new (const gchar *mime_type);
 
 GdkPixbuf *tny_gtk_pixbuf_stream_get_pixbuf (TnyGtkPixbufStream *self);
+void tny_gtk_pixbuf_stream_set_max_size (TnyGtkPixbufStream *self, gint max_width, gint max_height);
 
 G_END_DECLS
 
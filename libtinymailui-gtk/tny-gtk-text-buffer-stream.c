@@ -24,6 +24,11 @@
  * streaming a #TnyMimePart that is a plain text to a #GtkTextBuffer that will be
  * used by a #GtkTextView.
  *
+ * In progressive mode, see tny_gtk_text_buffer_stream_set_progressive(), the
+ * stream can be written to from another thread, like the one decoding a
+ * #TnyMimePart while it is being downloaded. The text is then added to the
+ * #GtkTextBuffer in chunks from the main loop.
+ *
  * free-function: g_object_unref
  **/
 
@@ -39,6 +44,9 @@
 
 static GObjectClass *parent_class = NULL;
 
+/* Most bytes inserted per main loop dispatch in progressive mode */
+#define TNY_GTK_TEXT_BUFFER_STREAM_CHUNK (8 * 1024)
+
 
 typedef struct _TnyGtkTextBufferStreamPriv TnyGtkTextBufferStreamPriv;
 
@@ -47,6 +55,16 @@ struct _TnyGtkTextBufferStreamPriv
 	GtkTextBuffer *buffer;
 	GtkTextIter cur;
 	GByteArray *pending_bytes;
+
+	/* progressive mode: the queue is filled by the writing thread
+	 * and drained from the main loop, both under queue_lock */
+	gboolean progressive, cancelled, flush_queued;
+	GMutex *queue_lock;
+	GByteArray *queue;
+	guint idle_id;
+
+	GTimer *timer;
+	gdouble first_paint;
 };
 
 #define TNY_GTK_TEXT_BUFFER_STREAM_GET_PRIVATE(o)	\
@@ -131,14 +149,13 @@ tny_gtk_text_buffer_stream_write (TnyStream *self, const char *buffer, gsize n)
 	return TNY_GTK_TEXT_BUFFER_STREAM_GET_CLASS (self)->write(self, buffer, n);
 }
 
-static gssize
-tny_gtk_text_buffer_stream_write_default (TnyStream *self, const char *buffer, gsize n)
+static void
+insert_bytes (TnyGtkTextBufferStreamPriv *priv, const char *buffer, gsize n)
 {
-	TnyGtkTextBufferStreamPriv *priv = TNY_GTK_TEXT_BUFFER_STREAM_GET_PRIVATE (self);
 	const gchar *end;
 	gint nb_written;
 
-	g_byte_array_append (priv->pending_bytes, buffer, n);
+	g_byte_array_append (priv->pending_bytes, (const guint8 *) buffer, n);
 
 	/* GtkTextBuffer only accepts full UTF-8 chars, but we might
 	 * receive a single UTF-8 char split into two different
@@ -162,6 +179,85 @@ tny_gtk_text_buffer_stream_write_default (TnyStream *self, const char *buffer, g
 	/* Leave the unwritten chars in priv->pending_bytes for later */
 	g_byte_array_remove_range (priv->pending_bytes, 0, nb_written);
 
+	if (nb_written > 0 && priv->first_paint < 0 && priv->timer)
+		priv->first_paint = g_timer_elapsed (priv->timer, NULL);
+}
+
+static void
+flush_pending (TnyGtkTextBufferStreamPriv *priv)
+{
+	if (priv->pending_bytes->len > 0) {
+		gtk_text_buffer_insert (priv->buffer, &(priv->cur),
+					priv->pending_bytes->data, priv->pending_bytes->len);
+		g_byte_array_set_size (priv->pending_bytes, 0);
+	}
+}
+
+/* Runs in the main loop, holds a reference on the stream */
+static gboolean
+progressive_drain (gpointer user_data)
+{
+	TnyGtkTextBufferStreamPriv *priv = TNY_GTK_TEXT_BUFFER_STREAM_GET_PRIVATE (user_data);
+	gboolean more, flush = FALSE;
+	guint8 *chunk = NULL;
+	guint len = 0;
+
+	g_mutex_lock (priv->queue_lock);
+	if (!priv->cancelled) {
+		len = MIN (priv->queue->len, TNY_GTK_TEXT_BUFFER_STREAM_CHUNK);
+		if (len > 0) {
+			chunk = g_memdup (priv->queue->data, len);
+			g_byte_array_remove_range (priv->queue, 0, len);
+		}
+		more = (priv->queue->len > 0);
+		if (!more && priv->flush_queued) {
+			flush = TRUE;
+			priv->flush_queued = FALSE;
+		}
+	} else
+		more = FALSE;
+	if (!more)
+		priv->idle_id = 0;
+	g_mutex_unlock (priv->queue_lock);
+
+	if (len > 0 || flush) {
+		gdk_threads_enter ();
+		if (len > 0)
+			insert_bytes (priv, (const char *) chunk, len);
+		if (flush)
+			flush_pending (priv);
+		gdk_threads_leave ();
+	}
+
+	g_free (chunk);
+
+	return more;
+}
+
+/* must be called with queue_lock held */
+static void
+progressive_schedule (TnyGtkTextBufferStream *self, TnyGtkTextBufferStreamPriv *priv)
+{
+	if (priv->idle_id == 0)
+		priv->idle_id = g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
+			progressive_drain, g_object_ref (self), g_object_unref);
+}
+
+static gssize
+tny_gtk_text_buffer_stream_write_default (TnyStream *self, const char *buffer, gsize n)
+{
+	TnyGtkTextBufferStreamPriv *priv = TNY_GTK_TEXT_BUFFER_STREAM_GET_PRIVATE (self);
+
+	if (priv->progressive) {
+		g_mutex_lock (priv->queue_lock);
+		if (!priv->cancelled && n > 0) {
+			g_byte_array_append (priv->queue, (const guint8 *) buffer, n);
+			progressive_schedule ((TnyGtkTextBufferStream *) self, priv);
+		}
+		g_mutex_unlock (priv->queue_lock);
+	} else
+		insert_bytes (priv, buffer, n);
+
 	return (gssize) n;
 }
 
@@ -175,11 +271,19 @@ static gint
 tny_gtk_text_buffer_stream_flush_default (TnyStream *self)
 {
 	TnyGtkTextBufferStreamPriv *priv = TNY_GTK_TEXT_BUFFER_STREAM_GET_PRIVATE (self);
-	if (priv->pending_bytes->len > 0) {
-		gtk_text_buffer_insert (priv->buffer, &(priv->cur),
-					priv->pending_bytes->data, priv->pending_bytes->len);
-		g_byte_array_set_size (priv->pending_bytes, 0);
-	}
+
+	/* In progressive mode this is likely called by the writing
+	 * thread, the main loop flushes once the queue is drained */
+	if (priv->progressive) {
+		g_mutex_lock (priv->queue_lock);
+		if (!priv->cancelled) {
+			priv->flush_queued = TRUE;
+			progressive_schedule ((TnyGtkTextBufferStream *) self, priv);
+		}
+		g_mutex_unlock (priv->queue_lock);
+	} else
+		flush_pending (priv);
+
 	return 0;
 }
 
@@ -223,6 +327,10 @@ tny_gtk_text_buffer_stream_reset_priv (TnyGtkTextBufferStreamPriv *priv)
 {
 	gtk_text_buffer_get_start_iter (priv->buffer, &(priv->cur));
 
+	priv->first_paint = -1;
+	if (priv->timer)
+		g_timer_start (priv->timer);
+
 	return 0;
 }
 
@@ -273,6 +381,84 @@ tny_gtk_text_buffer_stream_set_text_buffer (TnyGtkTextBufferStream *self, GtkTex
 	return;
 }
 
+/**
+ * tny_gtk_text_buffer_stream_set_progressive:
+ * @self: a #TnyGtkTextBufferStream
+ * @progressive: whether to write to the #GtkTextBuffer from the main loop
+ *
+ * In progressive mode writing to @self only queues the bytes, which can
+ * therefore be done from any thread. The queued text is added to the
+ * #GtkTextBuffer from the main loop, at most 8 KB per iteration so that
+ * the first screen of a big message is shown while the rest of it is still
+ * being downloaded and decoded. The main loop callback takes the gdk lock.
+ *
+ * Should be set before anything is written to @self.
+ *
+ * since: 1.0
+ * audience: application-developer
+ **/
+void
+tny_gtk_text_buffer_stream_set_progressive (TnyGtkTextBufferStream *self, gboolean progressive)
+{
+	TnyGtkTextBufferStreamPriv *priv = TNY_GTK_TEXT_BUFFER_STREAM_GET_PRIVATE (self);
+
+	priv->progressive = progressive;
+
+	return;
+}
+
+/**
+ * tny_gtk_text_buffer_stream_cancel:
+ * @self: a #TnyGtkTextBufferStream
+ *
+ * Drop whatever text is still queued in progressive mode and ignore
+ * further writes, like when the #GtkTextBuffer is about to show something
+ * else while the old part is still being decoded. Must be called from the
+ * main loop.
+ *
+ * since: 1.0
+ * audience: application-developer
+ **/
+void
+tny_gtk_text_buffer_stream_cancel (TnyGtkTextBufferStream *self)
+{
+	TnyGtkTextBufferStreamPriv *priv = TNY_GTK_TEXT_BUFFER_STREAM_GET_PRIVATE (self);
+	guint idle_id;
+
+	g_mutex_lock (priv->queue_lock);
+	priv->cancelled = TRUE;
+	priv->flush_queued = FALSE;
+	g_byte_array_set_size (priv->queue, 0);
+	idle_id = priv->idle_id;
+	priv->idle_id = 0;
+	g_mutex_unlock (priv->queue_lock);
+
+	/* this drops the reference the idle holds, so do it unlocked */
+	if (idle_id)
+		g_source_remove (idle_id);
+
+	return;
+}
+
+/**
+ * tny_gtk_text_buffer_stream_get_first_paint:
+ * @self: a #TnyGtkTextBufferStream
+ *
+ * Get the time between the last reset of @self, or setting its
+ * #GtkTextBuffer, and the first text being added to the #GtkTextBuffer.
+ *
+ * returns: the time in seconds or -1 if nothing was added yet
+ * since: 1.0
+ * audience: application-developer
+ **/
+gdouble
+tny_gtk_text_buffer_stream_get_first_paint (TnyGtkTextBufferStream *self)
+{
+	TnyGtkTextBufferStreamPriv *priv = TNY_GTK_TEXT_BUFFER_STREAM_GET_PRIVATE (self);
+
+	return priv->first_paint;
+}
+
 /**
  * tny_gtk_text_buffer_stream_new:
  * @buffer: a #GtkTextBuffer to write to or read from
@@ -301,6 +487,14 @@ tny_gtk_text_buffer_stream_instance_init (GTypeInstance *instance, gpointer g_cl
 
 	priv->buffer = NULL;
 	priv->pending_bytes = NULL;
+	priv->progressive = FALSE;
+	priv->cancelled = FALSE;
+	priv->flush_queued = FALSE;
+	priv->queue_lock = g_mutex_new ();
+	priv->queue = g_byte_array_new ();
+	priv->idle_id = 0;
+	priv->timer = g_timer_new ();
+	priv->first_paint = -1;
 
 	return;
 }
@@ -311,14 +505,20 @@ tny_gtk_text_buffer_stream_finalize (GObject *object)
 	TnyGtkTextBufferStream *self = (TnyGtkTextBufferStream *)object;
 	TnyGtkTextBufferStreamPriv *priv = TNY_GTK_TEXT_BUFFER_STREAM_GET_PRIVATE (self);
 
-	if (priv->buffer && priv->pending_bytes)
-		tny_gtk_text_buffer_stream_flush ((TnyStream *) self);
+	/* A pending idle holds a reference, so whatever is left in the
+	 * queue here was cancelled */
+	if (priv->buffer && priv->pending_bytes && !priv->cancelled)
+		flush_pending (priv);
 
 	if (priv->buffer)
 		g_object_unref (priv->buffer);
 	if (priv->pending_bytes)
 		g_byte_array_free (priv->pending_bytes, TRUE);
 
+	g_byte_array_free (priv->queue, TRUE);
+	g_mutex_free (priv->queue_lock);
+	g_timer_destroy (priv->timer);
+
 	(*parent_class->finalize) (object);
 
 	return;
@@ -61,6 +61,9 @@ GType tny_gtk_text_buffer_stream_get_type (void);
 TnyStream* tny_gtk_text_buffer_stream_new (GtkTextBuffer *buffer);
 
 void tny_gtk_text_buffer_stream_set_text_buffer (TnyGtkTextBufferStream *self, GtkTextBuffer *buffer);
+void tny_gtk_text_buffer_stream_set_progressive (TnyGtkTextBufferStream *self, gboolean progressive);
+void tny_gtk_text_buffer_stream_cancel (TnyGtkTextBufferStream *self);
+gdouble tny_gtk_text_buffer_stream_get_first_paint (TnyGtkTextBufferStream *self);
 
 G_END_DECLS
 
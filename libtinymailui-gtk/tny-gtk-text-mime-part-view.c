@@ -22,6 +22,9 @@
  *
  * A #TnyMimePartView to show a plain text #TnyMimePart.
  *
+ * The text is shown progressively, while the part is still being retrieved
+ * and decoded.
+ *
  * free-function: g_object_unref
  **/
 
@@ -60,12 +63,23 @@ struct _TnyGtkTextMimePartViewPriv
 	TnyMimePart *part;
 	TnyStatusCallback status_callback;
 	gpointer status_user_data;
+	TnyGtkTextBufferStream *stream;
 };
 
 #define TNY_GTK_TEXT_MIME_PART_VIEW_GET_PRIVATE(o) \
 	(G_TYPE_INSTANCE_GET_PRIVATE ((o), TNY_TYPE_GTK_TEXT_MIME_PART_VIEW, TnyGtkTextMimePartViewPriv))
 
 
+static void
+stop_stream (TnyGtkTextMimePartViewPriv *priv)
+{
+	if (priv->stream) {
+		tny_gtk_text_buffer_stream_cancel (priv->stream);
+		g_object_unref (priv->stream);
+		priv->stream = NULL;
+	}
+}
+
 static TnyMimePart*
 tny_gtk_text_mime_part_view_get_part (TnyMimePartView *self)
 {
@@ -95,6 +109,10 @@ tny_gtk_text_mime_part_view_set_part_default (TnyMimePartView *self, TnyMimePart
 
 	if (priv->part)
 		g_object_unref (priv->part);
+	priv->part = NULL;
+
+	/* A previous part might still be decoding into the buffer */
+	stop_stream (priv);
 
 	if (part) {
 		GtkTextBuffer *buffer;
@@ -105,11 +123,12 @@ tny_gtk_text_mime_part_view_set_part_default (TnyMimePartView *self, TnyMimePart
 			gtk_text_buffer_set_text (buffer, "", 0);
 
 		dest = tny_gtk_text_buffer_stream_new (buffer);
+		tny_gtk_text_buffer_stream_set_progressive (TNY_GTK_TEXT_BUFFER_STREAM (dest), TRUE);
 
 		tny_stream_reset (dest);
 		tny_mime_part_decode_to_stream_async (part, dest, NULL, 
 			priv->status_callback, priv->status_user_data);
-		g_object_unref (dest);
+		priv->stream = TNY_GTK_TEXT_BUFFER_STREAM (dest);
 
 		priv->part = g_object_ref (part);
 	}
@@ -127,14 +146,37 @@ tny_gtk_text_mime_part_view_clear (TnyMimePartView *self)
 static void
 tny_gtk_text_mime_part_view_clear_default (TnyMimePartView *self)
 {
+	TnyGtkTextMimePartViewPriv *priv = TNY_GTK_TEXT_MIME_PART_VIEW_GET_PRIVATE (self);
 	GtkTextBuffer *buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (self));
 
+	stop_stream (priv);
+
 	if (buffer && GTK_IS_TEXT_BUFFER (buffer))
 		gtk_text_buffer_set_text (buffer, "", 0);
 
 	return;
 }
 
+/**
+ * tny_gtk_text_mime_part_view_get_first_paint:
+ * @self: a #TnyGtkTextMimePartView
+ *
+ * Get the time it took from setting the current part until its first
+ * text was shown, for measuring how fast a message starts rendering.
+ *
+ * returns: the time in seconds or -1 if nothing was shown yet
+ **/
+gdouble
+tny_gtk_text_mime_part_view_get_first_paint (TnyGtkTextMimePartView *self)
+{
+	TnyGtkTextMimePartViewPriv *priv = TNY_GTK_TEXT_MIME_PART_VIEW_GET_PRIVATE (self);
+
+	if (!priv->stream)
+		return -1;
+
+	return tny_gtk_text_buffer_stream_get_first_paint (priv->stream);
+}
+
 /**
  * tny_gtk_text_mime_part_view_new:
  * @status_callback: (null-ok): a #TnyStatusCallback for when status information happens or NULL
@@ -168,6 +210,7 @@ tny_gtk_text_mime_part_view_instance_init (GTypeInstance *instance, gpointer g_c
 	priv->part = NULL;
 	priv->status_callback = NULL;
 	priv->status_user_data = NULL;
+	priv->stream = NULL;
 
 	gtk_text_view_set_editable (GTK_TEXT_VIEW (self), FALSE);
 
@@ -180,6 +223,8 @@ tny_gtk_text_mime_part_view_finalize (GObject *object)
 	TnyGtkTextMimePartView *self = (TnyGtkTextMimePartView *)object;	
 	TnyGtkTextMimePartViewPriv *priv = TNY_GTK_TEXT_MIME_PART_VIEW_GET_PRIVATE (self);
 
+	stop_stream (priv);
+
 	if (G_LIKELY (priv->part))
 		g_object_unref (G_OBJECT (priv->part));
 
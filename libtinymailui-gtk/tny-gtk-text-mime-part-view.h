@@ -59,6 +59,7 @@ struct _TnyGtkTextMimePartViewClass
 
 GType tny_gtk_text_mime_part_view_get_type (void);
 TnyMimePartView* tny_gtk_text_mime_part_view_new (TnyStatusCallback status_callback, gpointer status_user_data);
+gdouble tny_gtk_text_mime_part_view_get_first_paint (TnyGtkTextMimePartView *self);
 
 G_END_DECLS
 
@@ -0,0 +1,190 @@
+/* tinymail - Tiny Mail
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with self library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Measures how long a TnyGtkTextMimePartView takes to show the first
+ * text of a long plain text part, and to show all of it */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <gtk/gtk.h>
+
+#include <tny-mime-part.h>
+#include <tny-mime-part-view.h>
+#include <tny-stream.h>
+
+#include <tny-camel-mime-part.h>
+#include <tny-camel-mem-stream.h>
+#include <tny-gtk-text-mime-part-view.h>
+
+/* a part that didn't show up completely by then is reported as such */
+#define ROUND_TIMEOUT 60.0
+
+static gint size=1024, rounds=5;
+
+static const GOptionEntry options[] =
+{
+	{ "size", 's', 0, G_OPTION_ARG_INT, &size,
+		"Size of the text in KB", NULL },
+	{ "rounds", 'r', 0, G_OPTION_ARG_INT, &rounds,
+		"Number of times to show the text", NULL },
+
+	{ NULL }
+};
+
+static TnyMimePartView *view;
+static TnyMimePart *part;
+static GTimer *timer;
+static gint current=0, length=0;
+static gdouble first_total=0, complete_total=0;
+
+static TnyMimePart*
+create_text_part (gint kb)
+{
+	TnyMimePart *retval = tny_camel_mime_part_new ();
+	TnyStream *stream = tny_camel_mem_stream_new ();
+	gchar line[128];
+	gint i;
+
+	/* ASCII only, so that the characters in the buffer can be
+	 * counted against the bytes written */
+	for (i = 0; length < kb * 1024; i++) {
+		gint n = g_snprintf (line, sizeof (line),
+			"Line %d of a long message that is read from the top while "
+			"the rest of it is still being decoded.\n", i);
+		tny_stream_write (stream, line, n);
+		length += n;
+	}
+	tny_stream_reset (stream);
+
+	tny_mime_part_construct (retval, stream, "text/plain; charset=utf-8", "7bit");
+	g_object_unref (G_OBJECT (stream));
+
+	return retval;
+}
+
+static gboolean start_round (gpointer data);
+
+/* Polled every few milliseconds, which is the resolution of the
+ * complete time */
+static gboolean
+check_round (gpointer data)
+{
+	GtkTextBuffer *buffer;
+	gdouble complete, first;
+	gint chars;
+
+	gdk_threads_enter ();
+
+	buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (view));
+	chars = gtk_text_buffer_get_char_count (buffer);
+	complete = g_timer_elapsed (timer, NULL);
+
+	if (chars < length && complete < ROUND_TIMEOUT) {
+		gdk_threads_leave ();
+		return TRUE;
+	}
+
+	first = tny_gtk_text_mime_part_view_get_first_paint (TNY_GTK_TEXT_MIME_PART_VIEW (view));
+
+	if (chars < length) {
+		g_print ("round %d: first paint %.3fs, only %d of %d characters after %.0fs\n",
+			current, first, chars, length, complete);
+		gtk_main_quit ();
+		gdk_threads_leave ();
+		return FALSE;
+	}
+
+	g_print ("round %d: first paint %.3fs, complete %.3fs\n", current, first, complete);
+	first_total += first;
+	complete_total += complete;
+
+	if (++current < rounds)
+		g_idle_add (start_round, NULL);
+	else {
+		g_print ("%d KB, %d rounds: first paint %.3fs, complete %.3fs on average\n",
+			size, rounds, first_total / rounds, complete_total / rounds);
+		gtk_main_quit ();
+	}
+
+	gdk_threads_leave ();
+
+	return FALSE;
+}
+
+static gboolean
+start_round (gpointer data)
+{
+	gdk_threads_enter ();
+	g_timer_start (timer);
+	tny_mime_part_view_set_part (view, part);
+	gdk_threads_leave ();
+
+	g_timeout_add (5, check_round, NULL);
+
+	return FALSE;
+}
+
+int
+main (int argc, char **argv)
+{
+	GOptionContext *context;
+	GtkWidget *window, *scrolled;
+
+	free (malloc (10));
+
+	g_thread_init (NULL);
+	gdk_threads_init ();
+	gdk_threads_enter ();
+
+	context = g_option_context_new ("- The tinymail functional tester");
+	g_option_context_add_main_entries (context, options, "tinymail");
+	g_option_context_add_group (context, gtk_get_option_group (TRUE));
+	g_option_context_parse (context, &argc, &argv, NULL);
+	g_option_context_free (context);
+
+	gtk_init (&argc, &argv);
+
+	if (size < 1)
+		size = 1;
+	if (rounds < 1)
+		rounds = 1;
+
+	part = create_text_part (size);
+	timer = g_timer_new ();
+
+	window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+	gtk_window_set_default_size (GTK_WINDOW (window), 640, 480);
+	scrolled = gtk_scrolled_window_new (NULL, NULL);
+	view = tny_gtk_text_mime_part_view_new (NULL, NULL);
+	gtk_container_add (GTK_CONTAINER (scrolled), GTK_WIDGET (view));
+	gtk_container_add (GTK_CONTAINER (window), scrolled);
+	gtk_widget_show_all (window);
+
+	g_idle_add (start_round, NULL);
+
+	gtk_main ();
+
+	gdk_threads_leave ();
+
+	g_timer_destroy (timer);
+	g_object_unref (G_OBJECT (part));
+
+	return 0;
+}